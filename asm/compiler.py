@@ -1,18 +1,39 @@
 
+import typing
 from dataclasses import dataclass, field
 
 import regex
 
-from memory import MemoryRegion, MemoryFragment, MemoryOffset, UnknownSourcePos, SourcePos
+from memory import MemoryRegion, MemoryFragment, MemoryOffset, UnknownSourcePos, SourcePos, find_frag
 from instruction import Instructions, InstructionDesc, BuilderDescImpl, ArgCathegory
 
 all_regex=regex.compile(r"^[ \t]*(?<label>\w+)\:$|^[ \t]*(?<op>\w+)(?:[ \t]+(?&arg)(?:[ \t]*,[ \t]*(?<arg>[0-9][0-9xA-Fa-f]*|\w+))*)?$|^[ \t]*\.(?<section>\w+)$", regex.M | regex.I)
 
 
+WIDTHS = (16, 32, 64)
+
+
+def parse_int(arg: str) -> int:
+    """ Numeric argument: decimal, 0x hex or 0b binary, leading zeros of decimals are allowed """
+    if arg[:2] in ('0x', '0X'):
+        return int(arg[2:], 16)
+    if arg[:2] in ('0b', '0B'):
+        return int(arg[2:], 2)
+    return int(arg, 10)
+
+
 @dataclass()
 class NanoVMMemoryObject:
     ram: MemoryRegion = field(default_factory=lambda: MemoryRegion('ram', 0, UnknownSourcePos, [], 128, 128))
     text: MemoryRegion = field(default_factory=lambda: MemoryRegion('text', 0,UnknownSourcePos, [], 256, 256))
+    # bits of a ram word, ram is 32 words and label positions are in bytes of this width
+    width: int = 32
+    # code labels execution may start at besides 0, listed in text as name=pos:0
+    entries: list[MemoryFragment] = field(default_factory=list)
+
+    @property
+    def word_bytes(self) -> int:
+        return self.width // 8
 
 
 class LazyInstruction(MemoryRegion):
@@ -35,16 +56,13 @@ class LazyInstruction(MemoryRegion):
             if arg == '.':
                 int_args[name] = self.position
             elif arg[0].isdigit():
-                if arg.startswith('0x') or arg.startswith('0X'):
-                    int_args[name] = int(arg[2:], 16)
-                else:
-                    int_args[name] = int(arg)
+                int_args[name] = parse_int(arg)
             else:
                 frag = self.compiler.resolve_label(arg)
                 if frag.position is None:
                     raise RuntimeError(f"Var {frag.name} not evaluated")
                 if self.inst.args_cathegories.get(name) == ArgCathegory.Register:
-                    int_args[name] = frag.position // 4
+                    int_args[name] = frag.position // self.compiler.word_bytes
                 else:
                     int_args[name] = frag.position
         reg = self.inst.encode(self.source_pos, int_args)
@@ -52,13 +70,55 @@ class LazyInstruction(MemoryRegion):
         return reg.get_data()
 
 
+class LazyData(MemoryRegion):
+    """ BYTE/HALF/WORD values of .rodata, a text label gives its address, a ram label - its word """
+    def __init__(self, compiler: "NanoVMAsmParser", position: SourcePos, item: int, args: list[str]):
+        super().__init__(f"Data[{item}]", None, position, [], item * len(args), None)
+        self.compiler = compiler
+        self.item = item
+        self.args = args
+
+    def eval_position(self, base: int) -> int:
+        self.position = base
+        return base + self.eval_size()
+
+    def eval_size(self) -> int:
+        return self.item * len(self.args)
+
+    def get_data(self) -> bytes:
+        data = bytearray()
+        for arg in self.args:
+            if arg[0].isdigit():
+                value = parse_int(arg)
+            else:
+                frag = self.compiler.resolve_label(arg)
+                if frag.position is None:
+                    raise RuntimeError(f"Var {frag.name} not evaluated")
+                value = frag.position if self.compiler.is_text_label(frag) else frag.position // self.compiler.word_bytes
+            if value >> (self.item * 8):
+                raise RuntimeError(f"Value {arg} does not fit {self.item} bytes", self.source_pos)
+            data.extend(value.to_bytes(self.item, 'little'))
+        return bytes(data)
+
+
+# BYTE/HALF/WORD - tables in .rodata for LOAD_ROMB/LOAD_ROMH/LOAD_ROMW
+DATA_ITEMS = {'BYTE': 1, 'HALF': 2, 'WORD': 4}
+
+
 class NanoVMAsmParser:
-    def __init__(self):
+    def __init__(self, optimize: bool = False, whole_program: bool = False):
         self._sections: dict[str, MemoryRegion] | None = None
         self._section: MemoryRegion | None = None
         self._memory: NanoVMMemoryObject | None = None
         self._labels: dict[str, MemoryFragment] | None = None
+        self._width_set = False
         self.last_error_line = None
+        self.optimize = optimize or whole_program
+        self.whole_program = whole_program
+        # EXPORT - labels visible to other objects (linker.py), entries - names of entry points
+        self.exports: list[str] = []
+        self.entries: list[str] = []
+        self.optimization_report = None
 
     def _make_section(self, region: MemoryRegion, mem: MemoryRegion):
         self._sections[region.name] = region
@@ -68,6 +128,7 @@ class NanoVMAsmParser:
     def init(self):
         self._sections = {}
         self._labels = {}
+        self._width_set = False
         self._memory = NanoVMMemoryObject()
         self._make_section(MemoryRegion('lr', 0, UnknownSourcePos, [MemoryOffset('LR', 0, UnknownSourcePos, 0), MemoryOffset('lr', 0, UnknownSourcePos, 4)], 4, 4), self._memory.ram)
         self._make_section(MemoryRegion('code', None, UnknownSourcePos, [], 256, 256), self._memory.text)
@@ -76,33 +137,88 @@ class NanoVMAsmParser:
         self._make_section(MemoryRegion('data', None, UnknownSourcePos, [], 256, 256), self._memory.ram)
         self._select_section(UnknownSourcePos, 'code')
 
+    @property
+    def word_bytes(self) -> int:
+        return self._memory.word_bytes
+
+    def _set_width(self, width: int):
+        if width not in WIDTHS:
+            raise RuntimeError(f"Width must be one of {', '.join(map(str, WIDTHS))}")
+        if self._width_set:
+            raise RuntimeError("Duplicate WIDTH")
+        self._width_set = True
+        self._memory.width = width
+        self._memory.ram.max_size = self._memory.ram.max_top = 32 * self.word_bytes
+        lr = self._sections['lr']
+        lr.max_size = lr.max_top = self.word_bytes
+        find_frag(lr, 'lr').size = self.word_bytes
+
     def _make_label(self, source_pos: SourcePos, name: str, size: int = 0):
         label = MemoryOffset(name, None, source_pos, size)
         self._labels[name] = label
         self._section.fragments.append(label)
 
     def _select_section(self, source_pos: SourcePos, name: str):
+        if name == 'rodata' and name not in self._sections:
+            # tables follow the code in text, the section appears only when it is used
+            self._make_section(MemoryRegion('rodata', None, source_pos, [], 256, 256), self._memory.text)
+        if name not in self._sections:
+            raise RuntimeError(f"Unknown section {name}")
         self._section = self._sections[name]
 
+    def fresh_label(self, base: str, size: int = 0) -> MemoryOffset:
+        """ Label with an unused name for code or variables made by the optimizer, the caller places it """
+        i = 1
+        while f"{base}_{i}" in self._labels:
+            i += 1
+        label = MemoryOffset(f"{base}_{i}", None, UnknownSourcePos, size)
+        self._labels[label.name] = label
+        return label
+
+    def is_text_label(self, frag: MemoryFragment) -> bool:
+        return any(frag is region or any(frag is f for f in region.fragments)
+                   for region in self._memory.text.fragments)
+
     def _add_instruction(self, instruction: MemoryFragment):
         self._section.fragments.append(instruction)
 
     def _process_instruction(self, source_pos: SourcePos, name: str, args: list[str]):
         name = name.upper()
         if name in ('MEMORY', ):
-            self._make_label(source_pos, args[1] if len(args) > 1 else '', int(args[0]))
+            # MEMORY size, name, count - array of count cells
+            if not 1 <= len(args) <= 3:
+                raise RuntimeError(f"Args of {name} length not match")
+            count = parse_int(args[2]) if len(args) > 2 else 1
+            self._make_label(source_pos, args[1] if len(args) > 1 else '', parse_int(args[0]) * count)
+        elif name in ('EXPORT', ):
+            if not args:
+                raise RuntimeError(f"Args of {name} length not match")
+            self.exports.extend(arg for arg in args if arg not in self.exports)
+        elif name in ('WIDTH', ):
+            if len(args) != 1:
+                raise RuntimeError(f"Args of {name} length not match")
+            self._set_width(parse_int(args[0]))
+        elif name in DATA_ITEMS:
+            if self._section.name != 'rodata':
+                raise RuntimeError(f"{name} is only allowed in .rodata")
+            if not args:
+                raise RuntimeError(f"Args of {name} length not match")
+            data = LazyData(self, source_pos, DATA_ITEMS[name], args)
+            if all(arg[0].isdigit() for arg in args):
+                data.get_data()
+            self._section.fragments.append(data)
+        elif self._section.name == 'rodata':
+            raise RuntimeError(f"Instruction {name} is not allowed in .rodata")
         else:
             if name not in Instructions.all_instructions:
                 raise RuntimeError(f"Instruction {name} not found")
             inst = Instructions.all_instructions[name]
             if len(args) != len(inst.args):
                 raise RuntimeError(f"Args of {name} length not match")
-            if any(not arg[0].isdigit() for arg in args):
-                lazy_inst = LazyInstruction(self, source_pos, inst, args)
-                self._section.fragments.append(lazy_inst)
-            else:
-                int_args = {name: eval(arg) for name, arg in zip(inst.args, args)}
-                self._section.fragments.append(inst.encode(source_pos, int_args))
+            if all(arg[0].isdigit() for arg in args):
+                # constant arguments are checked right away
+                inst.encode(source_pos, {name: parse_int(arg) for name, arg in zip(inst.args, args)})
+            self._section.fragments.append(LazyInstruction(self, source_pos, inst, args))
 
     def _process_line(self, source_pos: SourcePos, line: str):
         m = all_regex.match(line)
@@ -136,5 +252,27 @@ class NanoVMAsmParser:
                 self.last_error_line = i
                 raise
 
+    def section(self, name: str) -> MemoryRegion | None:
+        return self._sections.get(name)
+
     def get_memory(self) -> NanoVMMemoryObject:
+        if self.optimize and self.optimization_report is None:
+            from optimizer import optimize
+            self.optimization_report = optimize(self, self._memory, self.whole_program)
+        self._memory.entries = [self.resolve_label(name) for name in self.entries]
         return self._memory
+
+
+def dump_region(region: MemoryRegion, extra: list[MemoryFragment] = ()) -> str:
+    data = ' '.join(f"{a:02X}" for a in region.get_data())
+    frags = ' '.join([f"{frag.name}={frag.position}:{len(frag.get_data())}" for frag in region.fragments]
+                     + [f"{frag.name}={frag.position}:0" for frag in extra])
+    return f"{region.name} {data}, {frags}"
+
+
+def dump_object(obj: NanoVMMemoryObject) -> str:
+    """ The object format of the compiler service (parse_nvma_object in runtime_compiler.hpp) """
+    lines = [f"width {obj.width}"] if obj.width != 32 else []
+    lines += [dump_region(obj.ram), dump_region(obj.text, obj.entries)]
+    lines += [dump_region(typing.cast(MemoryRegion, find_frag(obj.ram, name))) for name in ('input', 'output', 'data')]
+    return ''.join(f"{line}\n" for line in lines)
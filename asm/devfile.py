@@ -13,7 +13,7 @@ except ImportError:
 import regex
 
 from memory import find_frag, MemoryRegion, MemoryData, UnknownSourcePos, MemoryFragment, SourcePos
-from compiler import NanoVMAsmParser, NanoVMMemoryObject
+from compiler import NanoVMAsmParser, NanoVMMemoryObject, dump_object
 from disasm import Disassembler
 
 
@@ -38,35 +38,26 @@ class BaseTask:
 
 
 class NVMCompilerTask(BaseTask):
-    def __init__(self, _id: int):
+    def __init__(self, _id: int, optimize: bool = False, whole_program: bool = False):
         super().__init__(id)
         self._task_thread = None
         self._buffer = bytearray()
         self._output = None
-
-    @staticmethod
-    def _dump_region(region: MemoryRegion):
-        data = ' '.join(f"{a:02X}" for a in region.get_data())
-        frags = ' '.join(f"{frag.name}={frag.position}:{len(frag.get_data())}" for frag in region.fragments)
-        return f"{region.name} {data}, {frags}"
+        self._optimize = optimize
+        self._whole_program = whole_program
 
     def _task(self):
-        comp = NanoVMAsmParser()
+        comp = NanoVMAsmParser(optimize=self._optimize, whole_program=self._whole_program)
         try:
             buf = self._buffer.decode('utf-8')
             print(f"Compiling {buf[:64]}...")
             comp.init()
             comp.process_file(buf, '<input>')
             obj = comp.get_memory()
+            if comp.optimization_report is not None:
+                print(f"Optimized: {comp.optimization_report}")
 
-            json_obj = {
-                'ram': self._dump_region(obj.ram),
-                'text': self._dump_region(obj.text),
-                'input': self._dump_region(typing.cast(MemoryRegion, find_frag(obj.ram, 'input'))),
-                'output': self._dump_region(typing.cast(MemoryRegion, find_frag(obj.ram, 'output'))),
-                'data': self._dump_region(typing.cast(MemoryRegion, find_frag(obj.ram, 'data'))),
-            }
-            self._output = ''.join(f"{v}\n" for _, v in json_obj.items()).encode('utf-8')
+            self._output = dump_object(obj).encode('utf-8')
             print(f"Done")
 
         except RuntimeError as e:
@@ -129,10 +120,16 @@ class NVMDecompilerTask(BaseTask):
             print(f"Decompiling {buf[:64]}...")
             obj = NanoVMMemoryObject()
             for line in buf.strip().split('\n'):
+                if line.startswith('width '):
+                    obj.width = int(line.split()[1])
+                    continue
                 reg = self._load_region(line.strip())
                 if reg.name in ('input', 'output', 'data'):
                     obj.ram.fragments.append(reg)
                 if reg.name in ('text', ):
+                    # name=pos:0 are entry points of a linked program, not a part of the image
+                    obj.entries = [f for f in reg.fragments if not f.get_data()]
+                    reg.fragments = [f for f in reg.fragments if f.get_data()]
                     reg.position = 0
                     obj.text = reg
 
@@ -220,8 +217,13 @@ class BaseVirtualFile:
 
 
 class VirtualFileCompiler(BaseVirtualFile):
+    def __init__(self, path: str, optimize: bool = False, whole_program: bool = False):
+        super().__init__(path)
+        self._optimize = optimize
+        self._whole_program = whole_program
+
     def new_task(self, _id: int):
-        return NVMCompilerTask(_id)
+        return NVMCompilerTask(_id, self._optimize, self._whole_program)
 
 
 class VirtualFileDecompiler(BaseVirtualFile):
@@ -230,9 +232,9 @@ class VirtualFileDecompiler(BaseVirtualFile):
 
 
 class VirtualDir(Operations):
-    def __init__(self):
+    def __init__(self, optimize: bool = False, whole_program: bool = False):
         self._files: dict[str, BaseVirtualFile] = {
-            '/compiler': VirtualFileCompiler('/compiler'),
+            '/compiler': VirtualFileCompiler('/compiler', optimize, whole_program),
             '/decompiler': VirtualFileDecompiler('/decompiler'),
         }
         self._seq_ids: dict[str, int] = {
@@ -262,10 +264,18 @@ class VirtualDir(Operations):
         return self._files[path].truncate(length, **kwargs)
 
 
-def main(mount_point):
-    FUSE(VirtualDir(), mount_point, foreground=True, nothreads=True)
+def main(mount_point, optimize: bool = False, whole_program: bool = False):
+    FUSE(VirtualDir(optimize, whole_program), mount_point, foreground=True, nothreads=True)
 
 
 if __name__ == "__main__":
+    from argparse import ArgumentParser
+
+    args_parser = ArgumentParser()
+    args_parser.add_argument('-O', '--optimize', action='store_true', help="run peephole optimizer on compiled code")
+    args_parser.add_argument('-G', '--global', dest='whole_program', action='store_true',
+                             help="also inline subroutines, unroll loops and rewrite multiply loops")
+    args = args_parser.parse_args()
+
     mount_dir = "/local/nvmc-jabus"
-    main(mount_dir)
+    main(mount_dir, args.optimize, args.whole_program)
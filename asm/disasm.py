@@ -1,48 +1,63 @@
 import typing
 
-from instruction import Instructions, BuilderDescImpl, ArgCathegory
+from instruction import Instructions, InstructionDesc, BuilderDescImpl, ArgCathegory
 from compiler import NanoVMMemoryObject
 from memory import MemoryRegion, find_frag, MemoryFragment, MemoryData, MemoryOffset, UnknownSourcePos
 
 
+def decode_instruction(data: bytes, pos: int = 0) -> tuple[str, InstructionDesc, dict[str, int]]:
+    """ Name, description and arguments of the instruction at the start of data, pos is for the error """
+    opcode = data[0] >> 5
+    reasons = {}
+    for key, inst in Instructions.all_instructions.items():
+        c, r = inst.check(data)
+        if c:
+            return key, inst, inst.decode(data)
+        if opcode == inst.opcode:
+            reasons[key] = r
+    reason = f"Unknown opcode {opcode}" if not reasons else ', '.join(f"{k}: {v}" for k, v in reasons.items())
+    raise RuntimeError(f"Instruction not found at {pos} ({data[0]:02X}), reasons: {reason}")
+
+
 class Disassembler:
     def __init__(self, memory_object: NanoVMMemoryObject):
         self.memory = memory_object
         self.all_labels: dict[str, MemoryFragment] = {
-            'lr': MemoryOffset("lr", 0, UnknownSourcePos, 4),
+            'lr': MemoryOffset("lr", 0, UnknownSourcePos, self.memory.word_bytes),
             **{f.name: f for f in typing.cast(MemoryRegion, find_frag(self.memory.ram, 'input')).fragments},
             **{f.name: f for f in typing.cast(MemoryRegion, find_frag(self.memory.ram, 'data')).fragments},
             **{f.name: f for f in typing.cast(MemoryRegion, find_frag(self.memory.ram, 'output')).fragments},
         }
 
+    def code_size(self, size: int) -> int:
+        """ .rodata after the code holds tables for LOAD_ROMB/H/W, it is not decoded """
+        for frag in self.memory.text.fragments:
+            if frag.name == 'rodata' and frag.position is not None:
+                return frag.position
+        return size
+
     def disassemble(self) -> str:
-        data = bytes(self.memory.text.get_data())
-        orig = len(data)
+        text = bytes(self.memory.text.get_data())
+        orig = self.code_size(len(text))
+        data, rodata = text[:orig], text[orig:]
         instructions = []
+        entries = {frag.position: frag.name for frag in self.memory.entries}
         while data:
-            opcode = data[0] >> 5
-            reasons = {}
-
-            c = False
-            for key, inst in Instructions.all_instructions.items():
-                c, r = inst.check(data)
-                if c:
-                    args = inst.decode(data)
-                    formatted_args, sects = self.replace_labels(args, inst)
-                    str_data = ''.join(f"{a:02x}" for a in inst.encode(None, args).get_data())
-                    str_data = str_data + ' ' * (8 - len(str_data))
-                    instructions.append(f"{orig - len(data): >2x}:  {str_data}  {key} {', '.join(formatted_args)} $$; {', '.join(sects)}\n")
-                    data = data[len(inst.encode(None, args).get_data()):]
-                    break
-
-                if opcode == inst.opcode:
-                    reasons[key] = r
-
-            if c:
-                continue
-
-            reason = f"Unknown opcode {opcode}" if not reasons else ', '.join(f"{k}: {v}" for k, v in reasons.items())
-            raise RuntimeError(f"Instruction not found at {orig - len(data)} ({data[0]:02X}), reasons: {reason}")
+            pos = orig - len(data)
+            if pos in entries:
+                instructions.append(f"{entries[pos]}:\n")
+            key, inst, args = decode_instruction(data, pos)
+            formatted_args, sects = self.replace_labels(args, inst)
+            encoded = inst.encode(None, args).get_data()
+            str_data = ''.join(f"{a:02x}" for a in encoded)
+            str_data = str_data + ' ' * (8 - len(str_data))
+            instructions.append(f"{pos: >2x}:  {str_data}  {key} {', '.join(formatted_args)} $$; {', '.join(sects)}\n")
+            data = data[len(encoded):]
+
+        for pos in range(0, len(rodata), 4):
+            chunk = rodata[pos:pos + 4]
+            values = ', '.join(f"0x{b:X}" for b in chunk)
+            instructions.append(f"{orig + pos: >2x}:  {chunk.hex(): <8}  BYTE {values} $$; \n")
 
         max_l = max([ins.find('$$') for ins in instructions])
         for i, ins in enumerate(instructions):
@@ -64,7 +79,7 @@ class Disassembler:
 
     def find_label(self, address):
         for fragment in self.all_labels.values():
-            if fragment.position // 4 == address:
+            if fragment.position // self.memory.word_bytes == address:
                 return fragment
         return None
 
@@ -1,10 +1,23 @@
 import enum
+import sys
 from dataclasses import dataclass
+from pathlib import Path
 
 from bitstring import BitArray
 
 from memory import MemoryFragment, MemoryRegion, SourcePos
 
+try:
+    # generated/isa_tables.py of the build directory, when it is on PYTHONPATH
+    from isa_tables import INSTRUCTIONS
+except ImportError:
+    # the same table straight from the description
+    _ISA_DIR = Path(__file__).resolve().parent.parent / 'isa'
+    sys.path.insert(0, str(_ISA_DIR))
+    import generate
+    sys.path.remove(str(_ISA_DIR))
+    INSTRUCTIONS = generate.python_tables(generate.load(str(_ISA_DIR / 'nanovm.json'))[0])
+
 
 @dataclass()
 class BitFrag:
@@ -143,6 +156,11 @@ class InstructionDescBuilder:
     def build(self) -> InstructionDesc:
         handlers = {}
         partial = {}
+        order = []
+        for key in self._handlers:
+            base = key.split('@')[0]
+            if base not in order:
+                order.append(base)
         for key, value in self._handlers.items():
             if '@' in key:
                 key, part = key.split('@')
@@ -174,6 +192,7 @@ class InstructionDescBuilder:
         for key, seq in partial.items():
             seq = [val for part, val in sorted(seq.items(), key=lambda x: x[0])]
             handlers[key] = handler_builder(seq)
+        handlers = {key: handlers[key] for key in order}
 
         return BuilderDescImpl(self._opcode,
                                list(handlers.keys()),
@@ -201,118 +220,46 @@ class MovInstruction(InstructionDesc):
         return False, "Is composite instruction"
 
 
-class Instructions:
-    Builder = InstructionDescBuilder
+class RefInstruction(InstructionDesc):
+    """ LOAD_REF label - LOAD_LOW with the ram word of a label, a pointer for LOAD_IND/STORE_IND """
+    def __init__(self):
+        super().__init__(-1, ['ref'], 2, {'ref': ArgCathegory.Register})
 
-    LOAD_OP   = Builder(0, 1) \
-                .arg_bits('mem', 0, 5) \
-                .build()
+    def encode(self, position: SourcePos, args: dict[str, int | str]) -> MemoryFragment:
+        return Instructions.LOAD_LOW.encode(position, {'low': args['ref']})
+
+    def check(self, value: bytes) -> tuple[bool, str]:
+        return False, "Is alias of LOAD_LOW"
 
-    STORE_OP  = Builder(1, 1) \
-                .arg_bits('mem', 0, 5) \
-                .build()
 
-    MOV       = MovInstruction()
+def build_instruction(desc: dict) -> InstructionDesc:
+    builder = InstructionDescBuilder(desc['opcode'], desc['size'])
+    for name, start, end, value in desc['fixed']:
+        builder.const_bits(name, start, end, value)
+    for name, cathegory, bits in desc['operands']:
+        if len(bits) == 1:
+            builder.arg_bits(name, *bits[0], ArgCathegory(cathegory))
+        else:
+            for part, (start, end) in enumerate(bits):
+                builder.arg_bits(f'{name}@{part}', start, end)
+            builder.arg_cathegory(name, ArgCathegory(cathegory))
+    return builder.build()
 
-    JL        = Builder(2, 2) \
-                .const_bits('is_jl', 4, 5, 1) \
-                .arg_bits('rarg', 0, 4) \
-                .arg_bits('data', 8, 16, ArgCathegory.Code) \
-                .build()
-
-    JZ        = Builder(2, 2) \
-                .const_bits('is_jl', 4, 5, 0) \
-                .arg_bits('rarg', 0, 4) \
-                .arg_bits('data', 8, 16, ArgCathegory.Code) \
-                .build()
-
-    LOAD_LOW  = Builder(3, 2) \
-                .const_bits('is_high', 4, 5, 0) \
-                .arg_bits('low@1', 0, 4) \
-                .arg_bits('low@0', 8, 16) \
-                .arg_cathegory('low', ArgCathegory.Code) \
-                .build()
-
-    LOAD_HIGH = Builder(3, 3) \
-                .const_bits('is_high', 4, 5, 1) \
-                .arg_bits('low@2', 0, 4) \
-                .arg_bits('low@1', 8, 16) \
-                .arg_bits('low@0', 16, 24) \
-                .arg_cathegory('low', ArgCathegory.Const) \
-                .build()
-
-    ADD       = Builder(4, 2) \
-                .const_bits('is_sub', 4, 5, 0) \
-                .arg_bits('result', 0, 4) \
-                .arg_bits('mem1', 12, 16, ArgCathegory.Register) \
-                .arg_bits('mem2', 8, 12, ArgCathegory.Register) \
-                .build()
-
-    SUB       = Builder(4, 2) \
-                .const_bits('is_sub', 4, 5, 1) \
-                .arg_bits('result', 0, 4) \
-                .arg_bits('mem1', 12, 16) \
-                .arg_bits('mem2', 8, 12) \
-                .build()
-
-    AND       = Builder(5, 2) \
-                .const_bits('is_or', 4, 5, 0) \
-                .arg_bits('result', 0, 4) \
-                .arg_bits('mem1', 12, 16) \
-                .arg_bits('mem2', 8, 12) \
-                .build()
-
-    OR        = Builder(5, 2) \
-                .const_bits('is_or', 4, 5, 1) \
-                .arg_bits('result', 0, 4) \
-                .arg_bits('mem1', 12, 16) \
-                .arg_bits('mem2', 8, 12) \
-                .build()
-
-    LS        = Builder(6, 2) \
-                .const_bits('is_right', 4, 5, 0) \
-                .arg_bits('result', 0, 4) \
-                .arg_bits('mem', 12, 16) \
-                .arg_bits('count', 8, 12, ArgCathegory.Const) \
-                .build()
-
-    RS        = Builder(6, 2) \
-                .const_bits('is_right', 4, 5, 1) \
-                .arg_bits('result', 0, 4) \
-                .arg_bits('mem', 12, 16) \
-                .arg_bits('count', 8, 12, ArgCathegory.Const) \
-                .build()
-
-    CALL      = Builder(7, 2) \
-                .const_bits('extend', 4, 5, 0) \
-                .arg_bits('result', 0, 4) \
-                .arg_bits('callback', 12, 16) \
-                .arg_bits('arg', 8, 12) \
-                .build()
-
-    PC_SWP    = Builder(7, 2) \
-                .const_bits('extend3', 2, 5, 6) \
-                .arg_bits('mem@0', 13, 16) \
-                .arg_bits('mem@1', 0, 2) \
-                .arg_cathegory('mem', ArgCathegory.Register) \
-                .arg_bits('save', 8, 13) \
-                .build()
-
-    HALT      = Builder(7, 1) \
-                .const_bits('extend', 4, 5, 1) \
-                .const_bits('extend2', 4, 5, 1) \
-                .const_bits('halt', 0, 4, 0xF) \
-                .build()
-
-    LOAD3     = Builder(7, 1) \
-                .const_bits('extend', 4, 5, 1) \
-                .const_bits('extend2', 3, 4, 0) \
-                .arg_bits('value', 0, 3, ArgCathegory.Const) \
-                .build()
+
+class Instructions:
+    """Encodings come from isa/nanovm.json, through isa_tables.py when it is generated"""
+    Builder = InstructionDescBuilder
+
+    MOV       = MovInstruction()
+    LOAD_REF  = RefInstruction()
 
     all_instructions: dict[str, InstructionDesc] = {}
 
 
+for _desc in INSTRUCTIONS:
+    setattr(Instructions, _desc['name'], build_instruction(_desc))
+
+
 Instructions.all_instructions = {inst: getattr(Instructions, inst)
                                  for inst in dir(Instructions)
                                  if isinstance(getattr(Instructions, inst), InstructionDesc)
@@ -0,0 +1,440 @@
+"""
+Linker: sources are assembled to relocatable objects (.nvmo), objects are combined into one program
+in the object format of the compiler service.
+
+Code and .rodata labels are local to their module unless listed by EXPORT, ram variables are shared by
+name: modules declaring the same variable get one word, declarations must agree in section and size.
+Routines not reachable from pc 0 or from an entry point are dropped, .data variables nobody uses too.
+
+.nvmo is a text file, one record per line:
+    width 32                                - word width of the module
+    code 0A 43 ...                          - encoded .code, symbolic arguments are 0
+    rodata 03 0A ...                        - encoded .rodata
+    label code|rodata <offset> <size> <name>
+    var input|output|data <size> [<name>]   - in declaration order, no name for padding
+    export <name>                           - code or .rodata label visible to other modules
+    reloc code <offset> <argument> <symbol> - argument of the instruction at offset, '.' is the instruction
+    reloc rodata <offset> <bytes> <symbol>  - BYTE/HALF/WORD item at offset
+"""
+import sys
+from argparse import ArgumentParser
+from dataclasses import dataclass, field
+from pathlib import Path
+
+from memory import MemoryFragment, MemoryOffset, SourcePos, UnknownSourcePos
+from instruction import Instructions, ArgCathegory
+from compiler import NanoVMAsmParser, NanoVMMemoryObject, LazyInstruction, LazyData, dump_object, parse_int
+from disasm import decode_instruction
+
+
+instruction_names: dict[int, str] = {id(v): k for k, v in Instructions.all_instructions.items()}
+
+RAM_SECTIONS = ('input', 'output', 'data')
+TEXT_SECTIONS = ('code', 'rodata')
+
+
+def is_numeric(arg: str) -> bool:
+    return arg[0].isdigit()
+
+
+@dataclass()
+class Relocation:
+    section: str
+    offset: int
+    # argument name for code, item size in bytes for .rodata
+    field: str
+    symbol: str
+
+
+@dataclass()
+class RelocatableObject:
+    name: str
+    width: int = 32
+    text: dict[str, bytes] = field(default_factory=lambda: {section: b'' for section in TEXT_SECTIONS})
+    # (section, offset, size, name) of code and .rodata labels
+    labels: list[tuple[str, int, int, str]] = field(default_factory=list)
+    # (section, size, name) of ram declarations
+    variables: list[tuple[str, int, str]] = field(default_factory=list)
+    exports: list[str] = field(default_factory=list)
+    relocations: list[Relocation] = field(default_factory=list)
+
+    def dump(self) -> str:
+        lines = [f"width {self.width}"]
+        lines += [' '.join([section, *(f"{a:02X}" for a in self.text[section])]) for section in TEXT_SECTIONS]
+        lines += [f"label {section} {offset} {size} {name}" for section, offset, size, name in self.labels]
+        lines += [f"var {section} {size} {name}".rstrip() for section, size, name in self.variables]
+        lines += [f"export {name}" for name in self.exports]
+        lines += [f"reloc {r.section} {r.offset} {r.field} {r.symbol}" for r in self.relocations]
+        return ''.join(f"{line}\n" for line in lines)
+
+    @staticmethod
+    def parse(text: str, name: str) -> "RelocatableObject":
+        obj = RelocatableObject(name)
+        for i, line in enumerate(text.split('\n')):
+            words = line.split()
+            if not words:
+                continue
+            try:
+                if words[0] == 'width' and len(words) == 2:
+                    obj.width = int(words[1])
+                elif words[0] in TEXT_SECTIONS:
+                    obj.text[words[0]] = bytes(int(a, 16) for a in words[1:])
+                elif words[0] == 'label' and len(words) == 5 and words[1] in TEXT_SECTIONS:
+                    obj.labels.append((words[1], int(words[2]), int(words[3]), words[4]))
+                elif words[0] == 'var' and len(words) in (3, 4) and words[1] in RAM_SECTIONS:
+                    obj.variables.append((words[1], int(words[2]), words[3] if len(words) == 4 else ''))
+                elif words[0] == 'export' and len(words) == 2:
+                    obj.exports.append(words[1])
+                elif words[0] == 'reloc' and len(words) == 5 and words[1] in TEXT_SECTIONS:
+                    obj.relocations.append(Relocation(words[1], int(words[2]), words[3], words[4]))
+                else:
+                    raise ValueError()
+            except ValueError:
+                raise RuntimeError(f"{name}:{i + 1}: bad object record '{line}'")
+        return obj
+
+
+def assemble_object(source: str, filename: str) -> RelocatableObject:
+    """ Assemble without layout, every symbolic argument becomes a relocation """
+    comp = NanoVMAsmParser()
+    comp.init()
+    comp.process_file(source, filename)
+    obj = RelocatableObject(filename, comp.get_memory().width)
+
+    for section in RAM_SECTIONS:
+        for frag in comp.section(section).fragments:
+            obj.variables.append((section, frag.size, frag.name))
+
+    for section in TEXT_SECTIONS:
+        region = comp.section(section)
+        if region is None:
+            continue
+        data = bytearray()
+        for frag in region.fragments:
+            if isinstance(frag, LazyInstruction):
+                name = instruction_names[id(frag.inst)]
+                if name == 'MOV':
+                    parts = [('LOAD_OP', [frag.args[1]]), ('STORE_OP', [frag.args[0]])]
+                else:
+                    parts = [(name, frag.args)]
+                for name, args in parts:
+                    data += encode_instruction(obj, frag.source_pos, name, args, len(data))
+            elif isinstance(frag, LazyData):
+                for arg in frag.args:
+                    value = 0
+                    if is_numeric(arg):
+                        value = parse_int(arg)
+                    else:
+                        obj.relocations.append(Relocation(section, len(data), str(frag.item), arg))
+                    data += value.to_bytes(frag.item, 'little')
+            else:
+                obj.labels.append((section, len(data), frag.size, frag.name))
+                data += frag.get_data()
+        obj.text[section] = bytes(data)
+
+    labels = {name for _, _, _, name in obj.labels}
+    for name in comp.exports:
+        if name not in labels:
+            raise RuntimeError(f"Exported label {name} is not in .code or .rodata of {filename}")
+    obj.exports = list(comp.exports)
+    return obj
+
+
+def encode_instruction(obj: RelocatableObject, source_pos: SourcePos, name: str, args: list[str], offset: int) -> bytes:
+    inst = Instructions.all_instructions[name]
+    int_args = {}
+    for arg_name, arg in zip(inst.args, args):
+        if is_numeric(arg):
+            if inst.args_cathegories.get(arg_name) == ArgCathegory.Code and name != 'LOAD_LOW':
+                raise RuntimeError(f"Absolute text address {arg} in {name} can't be relocated", source_pos)
+            int_args[arg_name] = parse_int(arg)
+        else:
+            obj.relocations.append(Relocation('code', offset, arg_name, arg))
+            int_args[arg_name] = 0
+    reg = inst.encode(source_pos, int_args)
+    reg.eval_position(offset)
+    return reg.get_data()
+
+
+@dataclass()
+class Variable:
+    section: str
+    # zero-size labels in front of the variable
+    aliases: list[str]
+    # '' for padding or a group of aliases at the end of a section
+    name: str
+    size: int
+    module: str
+
+    @property
+    def names(self) -> list[str]:
+        return self.aliases + ([self.name] if self.name else [])
+
+
+class NanoVMLinker(NanoVMAsmParser):
+    def __init__(self, optimize: bool = False, whole_program: bool = False):
+        super().__init__(optimize=optimize, whole_program=whole_program)
+        self.variables: list[Variable] = []
+        # labels of dropped routines and tables, bytes of text and ram they took
+        self.stripped: list[str] = []
+        self.stripped_bytes = 0
+        self.stripped_ram = 0
+
+    def link(self, modules: list[RelocatableObject], entries: list[str]) -> NanoVMMemoryObject:
+        if not modules:
+            raise RuntimeError("Nothing to link")
+        if len({module.width for module in modules}) != 1:
+            raise RuntimeError("Modules have different widths: "
+                               + ', '.join(f"{module.name} {module.width}" for module in modules))
+        self.init()
+        if modules[0].width != 32:
+            self._set_width(modules[0].width)
+
+        owners = self.merge_variables(modules)
+        exports: dict[str, RelocatableObject] = {}
+        for module in modules:
+            for name in module.exports:
+                if name in exports:
+                    raise RuntimeError(f"{name} is exported by {exports[name].name} and {module.name}")
+                if name in owners:
+                    raise RuntimeError(f"Exported label {name} of {module.name} is also a variable")
+                exports[name] = module
+
+        code, rodata = [], []
+        for index, module in enumerate(modules):
+            code += self.load_text(index, module, 'code', exports, owners)
+            rodata += self.load_text(index, module, 'rodata', exports, owners)
+
+        for name in entries:
+            if name not in exports:
+                raise RuntimeError(f"Entry {name} is not exported")
+        code, rodata = self.strip(code, rodata, entries)
+        self.place_variables(code + rodata)
+
+        self.section('code').fragments = code
+        if rodata:
+            self._select_section(UnknownSourcePos, 'rodata')
+            self.section('rodata').fragments = rodata
+        for frag in code + rodata:
+            if isinstance(frag, MemoryOffset):
+                self._labels[frag.name] = frag
+        self.entries = list(entries)
+        return self.get_memory()
+
+    def merge_variables(self, modules: list[RelocatableObject]) -> dict[str, Variable]:
+        """ One variable per name, aliases stay in front of the variable they were declared with """
+        owners: dict[str, Variable] = {}
+        for module in modules:
+            aliases, section = [], None
+            for var_section, size, name in module.variables + [(None, 0, '')]:
+                if aliases and var_section != section:
+                    self.add_variable(owners, Variable(section, aliases, '', 0, module.name))
+                    aliases = []
+                section = var_section
+                if var_section is None:
+                    break
+                if size == 0 and name:
+                    aliases.append(name)
+                    continue
+                self.add_variable(owners, Variable(section, aliases, name, size, module.name))
+                aliases = []
+        return owners
+
+    def add_variable(self, owners: dict[str, Variable], var: Variable):
+        known = [owners[name] for name in var.names if name in owners]
+        if not known:
+            self.variables.append(var)
+            owners.update({name: var for name in var.names})
+            return
+        first = known[0]
+        if any(v is not first for v in known) or (first.section, first.name, first.size) != (var.section, var.name, var.size):
+            name = next(name for name in var.names if name in owners)
+            raise RuntimeError(f"Variable {name} of {var.module} does not match its declaration in {first.module}")
+        for name in var.aliases:
+            if name not in first.aliases:
+                first.aliases.append(name)
+                owners[name] = first
+
+    def load_text(self, index: int, module: RelocatableObject, section: str,
+                  exports: dict[str, RelocatableObject], owners: dict[str, Variable]) -> list[MemoryFragment]:
+        local = {name for _, _, _, name in module.labels}
+
+        def symbol(name: str) -> str:
+            if name == '.':
+                return name
+            if name in local:
+                return name if name in module.exports else f"{name}.{index}"
+            if name in exports or name in owners or name in ('lr', 'LR'):
+                return name
+            raise RuntimeError(f"Undefined symbol {name} in {module.name}")
+
+        relocations: dict[int, dict[str, str]] = {}
+        for r in module.relocations:
+            if r.section == section:
+                relocations.setdefault(r.offset, {})[r.field] = symbol(r.symbol)
+
+        source_pos = SourcePos(module.name, 0)
+        data = module.text[section]
+        labels = sorted((offset, i, size, name) for i, (label_section, offset, size, name) in enumerate(module.labels)
+                        if label_section == section)
+        fragments, offset = [], 0
+        for label_offset, _, size, name in labels + [(len(data), 0, 0, None)]:
+            if label_offset < offset:
+                raise RuntimeError(f"Label {name} of {module.name} is inside an instruction or a variable")
+            decode = self.decode_code if section == 'code' else self.decode_rodata
+            fragments += decode(source_pos, data, offset, label_offset, relocations)
+            offset = label_offset
+            if name is not None:
+                fragments.append(MemoryOffset(symbol(name), None, source_pos, size))
+                offset += size
+        if relocations:
+            raise RuntimeError(f"Relocation at {min(relocations)} of {module.name} {section} is not at an item")
+        return fragments
+
+    def decode_code(self, source_pos: SourcePos, data: bytes, start: int, end: int,
+                    relocations: dict[int, dict[str, str]]) -> list[MemoryFragment]:
+        fragments = []
+        while start < end:
+            name, inst, args = decode_instruction(data[start:end], start)
+            fields = relocations.pop(start, {})
+            if name == 'LOAD_LOW' and 'ref' in fields:
+                inst, args = Instructions.LOAD_REF, {'ref': 0}
+            if set(fields) - set(inst.args):
+                raise RuntimeError(f"Relocation of {', '.join(fields)} at {start} does not match {name}", source_pos)
+            fragments.append(LazyInstruction(self, source_pos, inst, [fields.get(arg, str(args[arg])) for arg in inst.args]))
+            start += inst.length
+        return fragments
+
+    def decode_rodata(self, source_pos: SourcePos, data: bytes, start: int, end: int,
+                      relocations: dict[int, dict[str, str]]) -> list[MemoryFragment]:
+        fragments, values = [], []
+        while start < end:
+            fields = relocations.pop(start, {})
+            if not fields:
+                values.append(str(data[start]))
+                start += 1
+                continue
+            if values:
+                fragments.append(LazyData(self, source_pos, 1, values))
+                values = []
+            (item, name), = fields.items()
+            fragments.append(LazyData(self, source_pos, int(item), [name]))
+            start += int(item)
+        if values:
+            fragments.append(LazyData(self, source_pos, 1, values))
+        return fragments
+
+    @staticmethod
+    def atoms(fragments: list[MemoryFragment]) -> list[list[MemoryFragment]]:
+        """ Pieces of text starting at labels, a routine is one or more pieces """
+        atoms = [[]]
+        for frag in fragments:
+            if isinstance(frag, MemoryOffset) and any(not isinstance(f, MemoryOffset) for f in atoms[-1]):
+                atoms.append([])
+            atoms[-1].append(frag)
+        return [atom for atom in atoms if atom]
+
+    @staticmethod
+    def falls_through(atom: list[MemoryFragment]) -> bool:
+        """ HALT, JZ lr and the return PC_SWP w, w never continue to the next piece """
+        instructions = [frag for frag in atom if isinstance(frag, LazyInstruction)]
+        if not instructions:
+            return True
+        last = instructions[-1]
+        name = instruction_names[id(last.inst)]
+        if name == 'HALT':
+            return False
+        if name == 'JZ':
+            return last.args[0] not in ('lr', 'LR') and not (is_numeric(last.args[0]) and parse_int(last.args[0]) == 0)
+        return not (name == 'PC_SWP' and last.args[0] == last.args[1])
+
+    def strip(self, code: list[MemoryFragment], rodata: list[MemoryFragment],
+              entries: list[str]) -> tuple[list[MemoryFragment], list[MemoryFragment]]:
+        code_atoms = self.atoms(code)
+        atoms = code_atoms + self.atoms(rodata)
+        labels = {frag.name: i for i, atom in enumerate(atoms) for frag in atom if isinstance(frag, MemoryOffset)}
+
+        work = [0] if code_atoms else []
+        for name in entries:
+            if labels[name] >= len(code_atoms):
+                raise RuntimeError(f"Entry {name} is not a code label")
+            work.append(labels[name])
+        kept = set()
+        while work:
+            i = work.pop()
+            if i in kept:
+                continue
+            kept.add(i)
+            for frag in atoms[i]:
+                if isinstance(frag, (LazyInstruction, LazyData)):
+                    work += [labels[arg] for arg in frag.args if arg in labels]
+            if i + 1 < len(code_atoms) and self.falls_through(atoms[i]):
+                work.append(i + 1)
+
+        for i, atom in enumerate(atoms):
+            if i not in kept:
+                self.stripped += [frag.name.split('.')[0] for frag in atom if isinstance(frag, MemoryOffset)][:1]
+                self.stripped_bytes += sum(frag.eval_size() for frag in atom)
+        pick = lambda first, last: [frag for i in range(first, last) if i in kept for frag in atoms[i]]
+        return pick(0, len(code_atoms)), pick(len(code_atoms), len(atoms))
+
+    def place_variables(self, text: list[MemoryFragment]):
+        """ .input/.output are the host ABI and stay, .data only when used, all of it with LOAD_IND/STORE_IND """
+        used = {arg for frag in text if isinstance(frag, (LazyInstruction, LazyData)) for arg in frag.args}
+        indirect = any(isinstance(frag, LazyInstruction) and instruction_names[id(frag.inst)] in ('LOAD_IND', 'STORE_IND')
+                       for frag in text)
+        for var in self.variables:
+            if var.section == 'data' and not indirect and not used.intersection(var.names):
+                self.stripped_ram += var.size
+                continue
+            self._select_section(UnknownSourcePos, var.section)
+            for name in var.aliases:
+                self._make_label(UnknownSourcePos, name)
+            if var.name or var.size:
+                self._make_label(UnknownSourcePos, var.name, var.size)
+
+
+def load_module(path: str) -> RelocatableObject:
+    text = open(path).read()
+    if path.endswith('.nvmo'):
+        return RelocatableObject.parse(text, path)
+    return assemble_object(text, path)
+
+
+def main():
+    args_parser = ArgumentParser(description="Assemble relocatable objects and link them into one program")
+    args_parser.add_argument('inputs', nargs='+', help=".nvma sources or .nvmo objects, the first one starts at pc 0")
+    args_parser.add_argument('-o', '--output')
+    args_parser.add_argument('-c', '--compile', action='store_true', help="only assemble sources to .nvmo")
+    args_parser.add_argument('-e', '--entry', action='append', default=[],
+                             help="exported code label the host may start at, repeatable")
+    args_parser.add_argument('-O', '--optimize', action='store_true')
+    args_parser.add_argument('-G', '--global', dest='whole_program', action='store_true')
+    args = args_parser.parse_args(sys.argv[1:])
+
+    if args.compile:
+        if args.output and len(args.inputs) > 1:
+            args_parser.error("-o with -c takes one source")
+        for path in args.inputs:
+            dump = load_module(path).dump()
+            with open(args.output or Path(path).with_suffix('.nvmo'), 'w') as w:
+                w.write(dump)
+        return
+
+    if not args.output:
+        args_parser.error("the linked program needs -o")
+    modules = [load_module(path) for path in args.inputs]
+    linker = NanoVMLinker(optimize=args.optimize, whole_program=args.whole_program)
+    obj = linker.link(modules, args.entry)
+    dump = dump_object(obj)
+    print(f"Linked {len(modules)} objects: text {len(obj.text.get_data())} bytes, "
+          f"stripped {linker.stripped_bytes} bytes of text ({', '.join(linker.stripped) or 'nothing'}) "
+          f"and {linker.stripped_ram // obj.word_bytes} .data words")
+    if linker.optimization_report is not None:
+        print(f"Optimized: {linker.optimization_report}")
+    with open(args.output, 'w') as w:
+        w.write(dump)
+
+
+if __name__ == '__main__':
+    main()
@@ -5,13 +5,16 @@ from argparse import ArgumentParser
 from compiler import NanoVMAsmParser
 
 
-def run(target: str, output: str):
+def run(target: str, output: str, optimize: bool = False, whole_program: bool = False):
     asm = open(target).read()
-    compiler = NanoVMAsmParser()
+    compiler = NanoVMAsmParser(optimize=optimize, whole_program=whole_program)
     compiler.init()
-    compiler.process_file(asm)
+    compiler.process_file(asm, target)
     obj = compiler.get_memory()
-    data = [
+    if compiler.optimization_report is not None:
+        print(f"Optimized: {compiler.optimization_report}")
+    data = [f"width {obj.width}"] if obj.width != 32 else []
+    data += [
         f"ram {' '.join(f'{a:02X}' for a in obj.ram.get_data())}",
         f"text {' '.join(f'{a:02X}' for a in obj.text.get_data())}",
     ]
@@ -24,9 +27,11 @@ def main():
     args_parser = ArgumentParser()
     args_parser.add_argument('target')
     args_parser.add_argument('output')
+    args_parser.add_argument('-O', '--optimize', action='store_true')
+    args_parser.add_argument('-G', '--global', dest='whole_program', action='store_true')
     args = args_parser.parse_args(sys.argv[1:])
 
-    run(target=args.target, output=args.output)
+    run(target=args.target, output=args.output, optimize=args.optimize, whole_program=args.whole_program)
 
 
 if __name__ == '__main__':
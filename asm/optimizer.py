@@ -0,0 +1,834 @@
+import itertools
+import typing
+from dataclasses import dataclass
+
+from memory import MemoryRegion, MemoryFragment, MemoryOffset, find_frag
+from instruction import Instructions, BuilderDescImpl, ArgCathegory
+from compiler import NanoVMAsmParser, NanoVMMemoryObject, LazyInstruction, LazyData, parse_int
+
+
+instruction_names: dict[int, str] = {id(v): k for k, v in Instructions.all_instructions.items()}
+
+# instructions which overwrite lr without reading it
+lr_overwrites = ('LOAD_OP', 'LOAD_LOW', 'LOAD3', 'LOAD_REF')
+
+# LOAD_IND/STORE_IND access ram[ram[ptr]], any word including lr
+indirect = ('LOAD_IND', 'STORE_IND')
+
+# lr = text[table + *idx * size], table is an address in text, not a word
+rom_loads = ('LOAD_ROMB', 'LOAD_ROMH', 'LOAD_ROMW')
+
+# instructions after which nothing is known about the state, PC_SWP returns to the next one
+barriers = ('HALT', 'PC_SWP')
+
+
+@dataclass()
+class OptimizationReport:
+    instructions_before: int = 0
+    instructions_after: int = 0
+    bytes_before: int = 0
+    bytes_after: int = 0
+    relocated: int = 0
+    # whole-program mode only
+    inlined: int = 0
+    unrolled: int = 0
+    multiplies: int = 0
+    executed_before: int | None = None
+    executed_after: int | None = None
+
+    def __str__(self):
+        text = (f"instructions {self.instructions_before} -> {self.instructions_after} "
+                f"({self.instructions_after - self.instructions_before:+d}), "
+                f"bytes {self.bytes_before} -> {self.bytes_after} "
+                f"({self.bytes_after - self.bytes_before:+d}), "
+                f"relocated variables {self.relocated}")
+        if self.executed_before is not None:
+            text += (f", inlined calls {self.inlined}, unrolled loops {self.unrolled}, "
+                     f"multiply loops {self.multiplies}, "
+                     f"estimated executed {self.executed_before} -> {self.executed_after} "
+                     f"({self.executed_after - self.executed_before:+d})")
+        return text
+
+
+def is_numeric(arg: str) -> bool:
+    return arg[0].isdigit()
+
+
+def const_load_size(sequence: list[tuple[str, int]]) -> int:
+    return sum(Instructions.all_instructions[name].length for name, _ in sequence)
+
+
+def const_load_sequence(prev: int | None, value: int) -> list[tuple[str, int]]:
+    """ Shortest sequence of LOAD3/LOAD_LOW/LOAD_HIGH which turns lr == prev into lr == value """
+    low, high = value & 0xFFF, value >> 12
+    if prev == value:
+        return []
+    if value < 8:
+        return [('LOAD3', value)]
+    if high == 0:
+        return [('LOAD_LOW', low)]
+    if prev is not None and prev & 0xFFF == low:
+        return [('LOAD_HIGH', high)]
+    if low < 8:
+        return [('LOAD3', low), ('LOAD_HIGH', high)]
+    return [('LOAD_LOW', low), ('LOAD_HIGH', high)]
+
+
+class RegisterPlacement:
+    """
+    3-operand instructions, JL/JZ and CALL address only words 0-15 (4-bit fields), LOAD_OP/STORE_OP reach all 32.
+    Variables are placed by their use in 4-bit fields, each use weighted by loop_weight ** loop depth.
+    Hosts find variables through the label table, so any order inside .input/.output/.data keeps the ABI,
+    the order of the sections themselves is chosen to minimize the cost.
+    Programs with LOAD_IND/STORE_IND or LOAD_REF keep their layout, pointers are absolute words.
+    """
+
+    sections = ('input', 'output', 'data')
+    loop_weight = 8
+    narrow_limit = 16
+    # a variable used in a 4-bit field beyond the limit can't be encoded at all
+    overflow_penalty = 1 << 40
+
+    def __init__(self, compiler: NanoVMAsmParser):
+        self.compiler = compiler
+
+    @staticmethod
+    def narrow_args(frag: LazyInstruction) -> list[str]:
+        if not isinstance(frag.inst, BuilderDescImpl):
+            return []
+        return [arg for name, arg in zip(frag.inst.args, frag.args)
+                if frag.inst.args_cathegories.get(name, ArgCathegory.Register) == ArgCathegory.Register
+                and frag.inst.handlers[name].end - frag.inst.handlers[name].start <= 4
+                and not is_numeric(arg)]
+
+    def loop_depths(self, code: list[MemoryFragment]) -> list[int]:
+        """ Backward JZ/JL to a label form a loop over the fragments between them """
+        labels = {frag.name: i for i, frag in enumerate(code) if isinstance(frag, MemoryOffset)}
+        depths = [0] * len(code)
+        for i, frag in enumerate(code):
+            if PeepholeOptimizer.name(frag) in ('JZ', 'JL'):
+                target = labels.get(dict(zip(frag.inst.args, frag.args))['data'])
+                if target is not None and target <= i:
+                    for j in range(target, i + 1):
+                        depths[j] += 1
+        return depths
+
+    def weights(self, code: list[MemoryFragment]) -> dict[str, int]:
+        weights: dict[str, int] = {}
+        for frag, depth in zip(code, self.loop_depths(code)):
+            if isinstance(frag, LazyInstruction):
+                for arg in self.narrow_args(frag):
+                    weights[arg] = weights.get(arg, 0) + self.loop_weight ** depth
+        return weights
+
+    @staticmethod
+    def units(region: MemoryRegion) -> list[list[MemoryFragment]]:
+        """ Zero sized labels are aliases of the next variable and move with it """
+        units, pending = [], []
+        for frag in region.fragments:
+            pending.append(frag)
+            if frag.eval_size():
+                units.append(pending)
+                pending = []
+        if pending:
+            units.append(pending)
+        return units
+
+    def cost(self, layout: list[list[MemoryFragment]], weights: dict[str, int]) -> int:
+        word_bytes = self.compiler.word_bytes
+        # word 0 is lr
+        cost, position = 0, word_bytes
+        for unit in layout:
+            for frag in unit:
+                weight = weights.get(frag.name, 0)
+                cost += weight * (position // word_bytes)
+                if weight and position // word_bytes >= self.narrow_limit:
+                    cost += self.overflow_penalty
+            position += sum(frag.eval_size() for frag in unit)
+        return cost
+
+    def run(self, memory: NanoVMMemoryObject) -> int:
+        code = typing.cast(MemoryRegion, find_frag(memory.text, 'code')).fragments
+        if any(PeepholeOptimizer.name(frag) in indirect + ('LOAD_REF', ) for frag in code):
+            # pointers are absolute words, a host supplied one must keep addressing the same variable
+            return 0
+        weights = self.weights(code)
+
+        regions = {name: typing.cast(MemoryRegion, find_frag(memory.ram, name)) for name in self.sections}
+        ordered = {}
+        for name, region in regions.items():
+            units = self.units(region)
+            ordered[name] = sorted(units, key=lambda unit: -sum(weights.get(f.name, 0) for f in unit))
+
+        best = min(itertools.permutations(self.sections),
+                   key=lambda order: self.cost([u for name in order for u in ordered[name]], weights))
+
+        memory.ram.eval_position(0)
+        before = {frag.name: frag.position for region in regions.values() for frag in region.fragments}
+
+        for name, region in regions.items():
+            region.fragments = [frag for unit in ordered[name] for frag in unit]
+        others = [frag for frag in memory.ram.fragments if frag.name not in self.sections]
+        memory.ram.fragments = others + [regions[name] for name in best]
+
+        memory.ram.eval_position(0)
+        return sum(1 for region in regions.values() for frag in region.fragments
+                   if before[frag.name] != frag.position)
+
+
+class PeepholeOptimizer:
+    """
+    Local optimizations over the fragment list of the code section, before layout.
+    Every label is treated as a possible entry point, so all facts are dropped on labels.
+    """
+
+    max_thread_depth = 16
+
+    def __init__(self, compiler: NanoVMAsmParser):
+        self.compiler = compiler
+        self.report = OptimizationReport()
+
+    @staticmethod
+    def name(frag: MemoryFragment) -> str | None:
+        if isinstance(frag, LazyInstruction):
+            return instruction_names.get(id(frag.inst))
+        return None
+
+    @staticmethod
+    def args(frag: LazyInstruction) -> dict[str, str]:
+        return dict(zip(frag.inst.args, frag.args))
+
+    @staticmethod
+    def is_label(frag: MemoryFragment) -> bool:
+        return not isinstance(frag, LazyInstruction)
+
+    def make(self, source: MemoryFragment, name: str, args: list[str]) -> LazyInstruction:
+        return LazyInstruction(self.compiler, source.source_pos, Instructions.all_instructions[name], args)
+
+    def register(self, arg: str) -> int:
+        if is_numeric(arg):
+            return parse_int(arg)
+        frag = self.compiler.resolve_label(arg)
+        if frag.position is None:
+            raise RuntimeError(f"Var {frag.name} not evaluated")
+        return frag.position // self.compiler.word_bytes
+
+    def is_jump_always(self, frag: MemoryFragment) -> bool:
+        """ JZ lr, label compares lr with itself """
+        return self.name(frag) == 'JZ' and self.register(self.args(frag)['rarg']) == 0
+
+    def is_jump_never(self, frag: MemoryFragment) -> bool:
+        return self.name(frag) == 'JL' and self.register(self.args(frag)['rarg']) == 0
+
+    def ends_flow(self, frag: MemoryFragment) -> bool:
+        return self.name(frag) == 'HALT' or self.is_jump_always(frag)
+
+    def writes_lr(self, frag: LazyInstruction) -> bool:
+        name = self.name(frag)
+        if name in ('LOAD_OP', 'LOAD_LOW', 'LOAD_HIGH', 'LOAD3', 'LOAD_REF', 'LOAD_IND') or name in rom_loads:
+            return True
+        written = self.written_register(frag)
+        return written is not None and written == 0
+
+    def reads_lr(self, frag: LazyInstruction) -> bool:
+        name = self.name(frag)
+        if name in ('STORE_OP', 'LOAD_HIGH', 'JZ', 'JL') or name in indirect:
+            return True
+        if name in lr_overwrites or name == 'HALT':
+            return False
+        return any(self.register(arg) == 0
+                   for key, arg in self.args(frag).items()
+                   if key not in ('result', 'save', 'count', 'table'))
+
+    def written_register(self, frag: LazyInstruction) -> int | None:
+        args = self.args(frag)
+        name = self.name(frag)
+        if name == 'STORE_OP':
+            return self.register(args['mem'])
+        if name == 'PC_SWP':
+            return self.register(args['save'])
+        if 'result' in args:
+            return self.register(args['result'])
+        return None
+
+    def lower_mov(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        lowered = []
+        for frag in code:
+            if self.name(frag) == 'MOV':
+                args = self.args(frag)
+                lowered.append(self.make(frag, 'LOAD_OP', [args['mem2']]))
+                lowered.append(self.make(frag, 'STORE_OP', [args['mem1']]))
+            else:
+                lowered.append(frag)
+        return lowered
+
+    def drop_redundant_loads(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        """ Remove LOAD_OP/STORE_OP whose value is already in place and select shortest constant loads """
+        result = []
+        copies: set[int] = set()
+        const: int | None = None
+        i = 0
+        while i < len(code):
+            frag = code[i]
+            name = self.name(frag)
+
+            if self.is_label(frag) or name in barriers:
+                copies, const = set(), None
+                result.append(frag)
+                i += 1
+                continue
+
+            if name in ('LOAD3', 'LOAD_LOW', 'LOAD_HIGH') and is_numeric(frag.args[0]):
+                # run of constant loads, replaced by the shortest sequence with the same final lr
+                end, value = i, const
+                while end < len(code) and self.name(code[end]) in ('LOAD3', 'LOAD_LOW', 'LOAD_HIGH') \
+                        and is_numeric(code[end].args[0]):
+                    arg = parse_int(code[end].args[0])
+                    if self.name(code[end]) == 'LOAD_HIGH':
+                        value = None if value is None else (value & 0xFFF) | ((arg << 12) & 0xFFFFFFFF)
+                    else:
+                        value = arg
+                    end += 1
+                if value is not None:
+                    sequence = const_load_sequence(const, value)
+                    run = [(self.name(f), parse_int(f.args[0])) for f in code[i:end]]
+                    if const_load_size(sequence) < const_load_size(run):
+                        result.extend(self.make(frag, n, [str(v)]) for n, v in sequence)
+                    else:
+                        result.extend(code[i:end])
+                    copies, const = set(), value
+                else:
+                    result.extend(code[i:end])
+                    copies, const = set(), None
+                i = end
+                continue
+
+            if name == 'LOAD_OP':
+                reg = self.register(frag.args[0])
+                if reg == 0 or reg in copies:
+                    i += 1
+                    continue
+                copies, const = {reg}, None
+
+            elif name == 'STORE_OP':
+                reg = self.register(frag.args[0])
+                if reg == 0 or reg in copies:
+                    i += 1
+                    continue
+                copies.add(reg)
+
+            elif self.writes_lr(frag):
+                copies, const = set(), None
+
+            else:
+                written = self.written_register(frag)
+                if written is not None:
+                    copies.discard(written)
+
+            result.append(frag)
+            i += 1
+        return result
+
+    def drop_dead_lr_writes(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        """ lr load immediately overwritten by the next instruction """
+        result = []
+        for i, frag in enumerate(code):
+            if self.name(frag) in lr_overwrites and i + 1 < len(code):
+                following = code[i + 1]
+                if not self.is_label(following) and self.name(following) in lr_overwrites \
+                        and not self.reads_lr(following):
+                    continue
+            result.append(frag)
+        return result
+
+    def find_label(self, code: list[MemoryFragment], label: str) -> int | None:
+        for i, frag in enumerate(code):
+            if isinstance(frag, MemoryOffset) and frag.name == label:
+                return i
+        return None
+
+    def next_instruction(self, code: list[MemoryFragment], index: int) -> int | None:
+        while index < len(code) and self.is_label(code[index]):
+            index += 1
+        return index if index < len(code) else None
+
+    def thread_jumps(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        """ Retarget jumps to unconditional jumps, drop jumps to the next instruction """
+        result = []
+        for i, frag in enumerate(code):
+            if self.name(frag) in ('JZ', 'JL') and not is_numeric(self.args(frag)['data']):
+                if self.is_jump_never(frag):
+                    continue
+
+                target = self.args(frag)['data']
+                for _ in range(self.max_thread_depth):
+                    index = self.find_label(code, target)
+                    landing = self.next_instruction(code, index) if index is not None else None
+                    if landing is None or not self.is_jump_always(code[landing]) \
+                            or is_numeric(self.args(code[landing])['data']) \
+                            or self.args(code[landing])['data'] == target:
+                        break
+                    target = self.args(code[landing])['data']
+
+                if target != self.args(frag)['data']:
+                    frag = self.make(frag, self.name(frag), [self.args(frag)['rarg'], target])
+
+                index = self.find_label(code, target)
+                if index is not None and index > i and all(self.is_label(f) for f in code[i + 1:index]):
+                    continue
+            result.append(frag)
+        return result
+
+    def drop_dead_code(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        """ Instructions after HALT or an unconditional jump until the next label """
+        result = []
+        dead = False
+        for frag in code:
+            if self.is_label(frag):
+                dead = False
+            elif dead:
+                continue
+            result.append(frag)
+            if not self.is_label(frag) and self.ends_flow(frag):
+                dead = True
+        return result
+
+    def measure(self, code: list[MemoryFragment]) -> tuple[int, int]:
+        instructions = [f for f in code if not self.is_label(f)]
+        return (sum(2 if self.name(f) == 'MOV' else 1 for f in instructions),
+                sum(f.eval_size() for f in instructions))
+
+    def run(self, memory: NanoVMMemoryObject) -> OptimizationReport:
+        memory.ram.eval_position(0)
+        region = typing.cast(MemoryRegion, find_frag(memory.text, 'code'))
+
+        code = region.fragments
+        self.report.instructions_before, self.report.bytes_before = self.measure(code)
+
+        code = self.lower_mov(code)
+        passes = (self.drop_dead_code,
+                  self.thread_jumps,
+                  self.drop_redundant_loads,
+                  self.drop_dead_lr_writes)
+        while True:
+            size = self.measure(code)
+            for optimization_pass in passes:
+                code = optimization_pass(code)
+            if self.measure(code) == size:
+                break
+
+        region.fragments = code
+        self.report.instructions_after, self.report.bytes_after = self.measure(code)
+        return self.report
+
+
+class GlobalOptimizer(PeepholeOptimizer):
+    """
+    Whole-program passes, run before register placement and the peephole pass:
+    - calls `LOAD_LOW sub; PC_SWP link, lr` are replaced by a copy of the subroutine up to its
+      `PC_SWP x, link`, the original is removed when nothing else reaches it;
+    - repeated-add loops `JZ zero, end; ADD acc, acc, b; SUB lr, lr, one; JZ lr, loop` become
+      shift-and-add loops, one iteration per bit of the count;
+    - innermost counted loops (exit test at the top, unconditional jump back) are unrolled.
+    Text is kept within 256 bytes. Executed instructions are estimated with assumed_trips
+    iterations of every loop, a subroutine is counted at each of its call sites.
+    """
+
+    max_inline_bytes = 32
+    max_unroll_bytes = 16
+    unroll_bytes = 32
+    max_unroll = 4
+    assumed_trips = RegisterPlacement.loop_weight
+    # words addressed by 3-operand instructions
+    narrow_words = 16
+
+    def __init__(self, compiler: NanoVMAsmParser, memory: NanoVMMemoryObject):
+        super().__init__(compiler)
+        self.memory = memory
+        # header label -> assumed iterations, for the loops made or changed by the passes
+        self.trips: dict[str, float] = {}
+        self.temps: list[str] = []
+
+    def rodata(self) -> MemoryRegion | None:
+        return next((typing.cast(MemoryRegion, frag) for frag in self.memory.text.fragments
+                     if frag.name == 'rodata'), None)
+
+    def text_size(self, code: list[MemoryFragment]) -> int:
+        rodata = self.rodata()
+        return (sum(frag.eval_size() for frag in code if not self.is_label(frag))
+                + (rodata.eval_size() if rodata is not None else 0))
+
+    def references(self, fragments: list[MemoryFragment]) -> dict[str, int]:
+        refs: dict[str, int] = {}
+        for frag in fragments:
+            if isinstance(frag, (LazyInstruction, LazyData)):
+                for arg in frag.args:
+                    if not is_numeric(arg):
+                        refs[arg] = refs.get(arg, 0) + 1
+        return refs
+
+    def all_references(self, code: list[MemoryFragment]) -> dict[str, int]:
+        rodata = self.rodata()
+        refs = self.references(code + (rodata.fragments if rodata is not None else []))
+        # entry points of a linked program are referenced by the host
+        for name in self.compiler.entries:
+            refs[name] = refs.get(name, 0) + 1
+        return refs
+
+    def registers(self, frag: LazyInstruction) -> list[int]:
+        return [self.register(arg) for key, arg in self.args(frag).items()
+                if frag.inst.args_cathegories.get(key) == ArgCathegory.Register]
+
+    def jump_target(self, frag: MemoryFragment) -> str | None:
+        if self.name(frag) in ('JZ', 'JL'):
+            return self.args(frag)['data']
+        return None
+
+    def has_indirect(self, code: list[MemoryFragment]) -> bool:
+        return any(self.name(frag) in indirect for frag in code)
+
+    def copy(self, fragments: list[MemoryFragment]) -> list[MemoryFragment]:
+        """ Labels get fresh names, jumps to them are redirected to the copies """
+        labels = {frag.name: self.compiler.fresh_label(frag.name) for frag in fragments if self.is_label(frag)}
+        return [labels[frag.name] if self.is_label(frag)
+                else self.make(frag, self.name(frag), [labels[arg].name if arg in labels else arg
+                                                       for arg in frag.args])
+                for frag in fragments]
+
+    # subroutines
+
+    def call_sites(self, code: list[MemoryFragment]) -> list[tuple[int, str, int]]:
+        """ (index of LOAD_LOW, subroutine label, link word) of every `LOAD_LOW sub; PC_SWP link, lr` """
+        sites = []
+        for i, frag in enumerate(code[:-1]):
+            call = code[i + 1]
+            if self.name(frag) == 'LOAD_LOW' and not is_numeric(frag.args[0]) \
+                    and self.find_label(code, frag.args[0]) is not None \
+                    and self.name(call) == 'PC_SWP' and self.register(self.args(call)['mem']) == 0:
+                sites.append((i, frag.args[0], self.register(self.args(call)['save'])))
+        return sites
+
+    def return_index(self, code: list[MemoryFragment], start: int) -> int | None:
+        """ The first PC_SWP after the subroutine label """
+        return next((j for j in range(start + 1, len(code)) if self.name(code[j]) == 'PC_SWP'), None)
+
+    def inlinable(self, code: list[MemoryFragment], start: int, link: int) -> int | None:
+        """ Index of the return PC_SWP x, link when the body can be copied to a call site """
+        end = self.return_index(code, start)
+        if end is None or self.register(self.args(code[end])['mem']) != link:
+            return None
+        body = code[start:end]
+        labels = {frag.name for frag in body if self.is_label(frag)}
+        for frag in body:
+            if self.is_label(frag):
+                continue
+            target = self.jump_target(frag)
+            if target is not None:
+                if target not in labels:
+                    return None
+            elif any(arg in labels or (not is_numeric(arg) and self.find_label(code, arg) is not None)
+                     for arg in frag.args):
+                # the address of code is taken
+                return None
+        # only the entry label may be reached from outside
+        inside, everywhere = self.references(body), self.all_references(code)
+        if any(everywhere.get(name, 0) != inside.get(name, 0) for name in labels if name != code[start].name):
+            return None
+        # lr holds the address of the subroutine at the entry, the copy must not read it
+        for frag in body[1:]:
+            if self.is_label(frag):
+                continue
+            if self.reads_lr(frag):
+                return None
+            if self.writes_lr(frag):
+                return end
+        return None
+
+    def private_link(self, code: list[MemoryFragment], words: set[int]) -> bool:
+        """ Return addresses depend on the layout, they may be used only by calls and returns """
+        if 0 in words or self.has_indirect(code):
+            return False
+        for name in ('input', 'output'):
+            region = typing.cast(MemoryRegion, find_frag(self.memory.ram, name))
+            if any(frag.eval_size() and frag.position // self.compiler.word_bytes in words
+                   for frag in region.fragments):
+                return False
+        return all(self.name(frag) == 'PC_SWP' or not words & set(self.registers(frag))
+                   for frag in code if not self.is_label(frag))
+
+    def removable(self, code: list[MemoryFragment], start: int, end: int) -> bool:
+        """ code[start:end + 1] is reached neither by a jump, nor by falling through """
+        first = start
+        while first > 0 and self.is_label(code[first - 1]):
+            first -= 1
+        if first == 0 or not self.ends_flow(code[first - 1]):
+            return False
+        refs = self.all_references(code[:first] + code[end + 1:])
+        return not any(refs.get(frag.name) for frag in code[first:end + 1] if self.is_label(frag))
+
+    def inline_call(self, code: list[MemoryFragment], site: int, label: str, link: int) -> list[MemoryFragment] | None:
+        start = self.find_label(code, label)
+        end = self.inlinable(code, start, link)
+        if end is None or not self.private_link(code, {link, self.register(self.args(code[end])['save'])}):
+            return None
+
+        body = code[start:end]
+        result = code[:site] + self.copy(body) + code[site + 2:]
+        start = self.find_label(result, label)
+        end = self.return_index(result, start)
+        removed = self.removable(result, start, end)
+        if removed:
+            result = result[:start] + result[end + 1:]
+
+        if self.text_size(result) > self.memory.text.max_size:
+            return None
+        if not removed and sum(frag.eval_size() for frag in body) > self.max_inline_bytes:
+            return None
+        return result
+
+    def inline_calls(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        """ The hottest call sites first, until nothing more fits """
+        while True:
+            weights = self.loop_weights(code)
+            sites = sorted(self.call_sites(code), key=lambda site: -weights[site[0]])
+            for site, label, link in sites:
+                result = self.inline_call(code, site, label, link)
+                if result is not None:
+                    code = result
+                    self.report.inlined += 1
+                    break
+            else:
+                return code
+
+    # multiply loops
+
+    def constant_words(self, code: list[MemoryFragment]) -> dict[int, int]:
+        """ Words stored by the straight-line start of the program and never written again """
+        if self.has_indirect(code) or self.compiler.entries:
+            return {}
+        refs = self.all_references(code)
+        stored: dict[int, set[int | None]] = {}
+        prologue = set()
+        lr = None
+        for i, frag in enumerate(code):
+            if self.is_label(frag):
+                if refs.get(frag.name):
+                    break
+                continue
+            name = self.name(frag)
+            if name in ('JZ', 'JL', 'PC_SWP', 'HALT'):
+                break
+            prologue.add(i)
+            if name in ('LOAD3', 'LOAD_LOW') and is_numeric(frag.args[0]):
+                lr = parse_int(frag.args[0])
+            elif name == 'LOAD_HIGH' and lr is not None and is_numeric(frag.args[0]):
+                lr = (lr & 0xFFF) | (parse_int(frag.args[0]) << 12)
+            elif name == 'STORE_OP':
+                stored.setdefault(self.register(frag.args[0]), set()).add(lr)
+            elif self.writes_lr(frag):
+                lr = None
+
+        written = set()
+        for i, frag in enumerate(code):
+            if not self.is_label(frag) and (i not in prologue or self.name(frag) != 'STORE_OP'):
+                register = self.written_register(frag)
+                if register is not None:
+                    written.add(register)
+        return {word: values.pop() for word, values in stored.items()
+                if word != 0 and word not in written and len(values) == 1 and None not in values}
+
+    def temp(self, index: int, base: str) -> str:
+        """ Words shared by all rewritten loops, placed in .data """
+        while len(self.temps) <= index:
+            label = self.compiler.fresh_label(base, self.compiler.word_bytes)
+            typing.cast(MemoryRegion, find_frag(self.memory.ram, 'data')).fragments.append(label)
+            self.memory.ram.eval_position(0)
+            self.temps.append(label.name)
+        return self.temps[index]
+
+    def multiply_loop(self, code: list[MemoryFragment], i: int, constants: dict[int, int]) -> list[str] | None:
+        """ Arguments acc, b, one of `loop: JZ zero, end; ADD acc, acc, b; SUB lr, lr, one; JZ lr, loop` at i """
+        if i + 5 > len(code) or any(self.is_label(frag) for frag in code[i + 1:i + 5]):
+            return None
+        test, add, sub, back = code[i + 1:i + 5]
+        if [self.name(f) for f in (test, add, sub, back)] != ['JZ', 'ADD', 'SUB', 'JZ'] \
+                or not self.is_jump_always(back) or self.jump_target(back) != code[i].name \
+                or is_numeric(self.jump_target(test)):
+            return None
+        zero, one = self.register(self.args(test)['rarg']), self.register(self.args(sub)['mem2'])
+        if self.registers(sub)[:2] != [0, 0] or constants.get(zero) != 0 or constants.get(one) != 1:
+            return None
+        args = self.args(add)
+        acc = args['result']
+        if self.register(args['mem1']) == self.register(acc):
+            b = args['mem2']
+        elif self.register(args['mem2']) == self.register(acc):
+            b = args['mem1']
+        else:
+            return None
+        if self.register(acc) == self.register(b) or {0, zero, one} & {self.register(acc), self.register(b)}:
+            return None
+        return [acc, b, self.args(sub)['mem2']]
+
+    def reduce_multiplies(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        """
+        lr counts down to zero adding b to acc, the rewrite adds b << k for every set bit k of lr:
+        STORE_OP n; MOV m, b; LOAD3 0
+        top: JZ n, end; AND bit, n, one; JZ bit, skip; ADD acc, acc, m
+        skip: LS m, m, 1; RS n, n, 1; JZ lr, top
+        lr is 0 at the end in both versions
+        """
+        constants = self.constant_words(code)
+        i = 0
+        while i < len(code):
+            operands = self.multiply_loop(code, i, constants) if self.is_label(code[i]) else None
+            refs = self.all_references(code)
+            if operands is None or refs.get(code[i].name) != 1:
+                i += 1
+                continue
+            words = self.memory.ram.eval_size() // self.compiler.word_bytes
+            if not self.temps and words + 3 > self.narrow_words:
+                return code
+            acc, b, one = operands
+            end = self.jump_target(code[i + 1])
+            source = code[i + 2]
+            n, m, bit = self.temp(0, 'mul_count'), self.temp(1, 'mul_shifted'), self.temp(2, 'mul_bit')
+            top, skip = self.compiler.fresh_label('mul_loop'), self.compiler.fresh_label('mul_skip')
+            loop = [self.make(source, 'STORE_OP', [n]),
+                    self.make(source, 'LOAD_OP', [b]),
+                    self.make(source, 'STORE_OP', [m]),
+                    self.make(source, 'LOAD3', ['0']),
+                    top,
+                    self.make(source, 'JZ', [n, end]),
+                    self.make(source, 'AND', [bit, n, one]),
+                    self.make(source, 'JZ', [bit, skip.name]),
+                    self.make(source, 'ADD', [acc, acc, m]),
+                    skip,
+                    self.make(source, 'LS', [m, m, '1']),
+                    self.make(source, 'RS', [n, n, '1']),
+                    self.make(source, 'JZ', ['lr', top.name])]
+            result = code[:i] + loop + code[i + 5:]
+            if self.text_size(result) > self.memory.text.max_size:
+                i += 1
+                continue
+            self.trips[top.name] = self.assumed_trips.bit_length()
+            self.report.multiplies += 1
+            code = result
+            i += len(loop)
+        return code
+
+    # loop unrolling
+
+    def counted_loop(self, code: list[MemoryFragment], start: int, end: int) -> bool:
+        """ code[start] is the header, code[end] jumps back; the exit test is at the top, the counter changes """
+        body = code[start + 1:end]
+        labels = {frag.name: i for i, frag in enumerate(code) if self.is_label(frag)}
+        for i, frag in enumerate(body, start + 1):
+            if self.name(frag) == 'PC_SWP':
+                return False
+            target = self.jump_target(frag)
+            if target is not None and (is_numeric(target) or labels.get(target, len(code)) <= i):
+                # not innermost
+                return False
+        test = next((frag for frag in body if not self.is_label(frag)
+                     and self.name(frag) not in ('LOAD3', 'LOAD_LOW', 'LOAD_HIGH')), None)
+        if test is None or self.jump_target(test) is None:
+            return False
+        exit_index = labels.get(self.jump_target(test))
+        if exit_index is None or start <= exit_index <= end:
+            return False
+        counter = self.register(self.args(test)['rarg'])
+        return counter != 0 and any(self.written_register(frag) == counter
+                                    for frag in body if not self.is_label(frag))
+
+    def unroll_loops(self, code: list[MemoryFragment]) -> list[MemoryFragment]:
+        """ L: body; JZ lr, L -> L: body; body'; ...; JZ lr, L, every copy keeps the exit test """
+        i = 0
+        while i < len(code):
+            target = self.jump_target(code[i]) if self.is_jump_always(code[i]) else None
+            start = self.find_label(code, target) if target is not None and not is_numeric(target) else None
+            if start is None or start >= i or not self.counted_loop(code, start, i):
+                i += 1
+                continue
+            body = code[start + 1:i]
+            size = sum(frag.eval_size() for frag in body if not self.is_label(frag))
+            factor = min(self.max_unroll, max(self.unroll_bytes // max(size, 1), 1))
+            while factor > 1 and self.text_size(code) + size * (factor - 1) > self.memory.text.max_size:
+                factor -= 1
+            if size > self.max_unroll_bytes or factor < 2:
+                i += 1
+                continue
+            copies = [frag for _ in range(factor - 1) for frag in self.copy(body)]
+            code = code[:i] + copies + code[i:]
+            self.trips[target] = self.trips.get(target, self.assumed_trips) / factor
+            self.report.unrolled += 1
+            i += len(copies) + 1
+        return code
+
+    # estimate
+
+    def loop_weights(self, code: list[MemoryFragment]) -> list[float]:
+        """ Executions of each fragment per entry, backward jumps to a label form a loop """
+        labels = {frag.name: i for i, frag in enumerate(code) if self.is_label(frag)}
+        ends: dict[int, int] = {}
+        for i, frag in enumerate(code):
+            target = labels.get(self.jump_target(frag))
+            if target is not None and target <= i:
+                ends[target] = max(ends.get(target, i), i)
+        weights = [1.0] * len(code)
+        for start, end in ends.items():
+            trips = self.trips.get(code[start].name, self.assumed_trips)
+            for j in range(start, end + 1):
+                weights[j] *= trips
+        return weights
+
+    def estimate(self, code: list[MemoryFragment]) -> int:
+        weights = self.loop_weights(code)
+        cost = [0 if self.is_label(frag) else 2 if self.name(frag) == 'MOV' else 1 for frag in code]
+        calls: dict[str, float] = {}
+        for site, label, _ in self.call_sites(code):
+            calls[label] = calls.get(label, 0) + weights[site + 1]
+        total, covered = 0.0, set()
+        for label, count in calls.items():
+            start = self.find_label(code, label)
+            end = self.return_index(code, start)
+            if end is None:
+                continue
+            body = range(start, end + 1)
+            total += count * sum(weights[j] * cost[j] for j in body)
+            covered.update(body)
+        total += sum(weights[j] * cost[j] for j in range(len(code)) if j not in covered)
+        return round(total)
+
+    def run(self, memory: NanoVMMemoryObject) -> OptimizationReport:
+        memory.ram.eval_position(0)
+        region = typing.cast(MemoryRegion, find_frag(memory.text, 'code'))
+
+        code = region.fragments
+        self.report.instructions_before, self.report.bytes_before = self.measure(code)
+        self.report.executed_before = self.estimate(code)
+
+        code = self.lower_mov(code)
+        code = self.inline_calls(code)
+        if self.report.inlined:
+            code = self.drop_dead_code(code)
+        code = self.reduce_multiplies(code)
+        code = self.unroll_loops(code)
+
+        region.fragments = code
+        return self.report
+
+
+def optimize(compiler: NanoVMAsmParser, memory: NanoVMMemoryObject, whole_program: bool = False) -> OptimizationReport:
+    global_optimizer = GlobalOptimizer(compiler, memory) if whole_program else None
+    if global_optimizer is not None:
+        global_optimizer.run(memory)
+    relocated = RegisterPlacement(compiler).run(memory)
+    report = PeepholeOptimizer(compiler).run(memory)
+    report.relocated = relocated
+    if global_optimizer is not None:
+        code = typing.cast(MemoryRegion, find_frag(memory.text, 'code')).fragments
+        for name in ('instructions_before', 'bytes_before', 'inlined', 'unrolled', 'multiplies', 'executed_before'):
+            setattr(report, name, getattr(global_optimizer.report, name))
+        report.executed_after = global_optimizer.estimate(code)
+    return report
@@ -0,0 +1,278 @@
+"""
+Optimizer passes keep the results of the programs: every fixture of nanovm/ is assembled without
+optimization and with the passes, the whole-program ones included, the objects run in the tests
+executable (`tests -b`) against the expected outputs of the unoptimized program.
+
+    python3 optimizer_test.py <tests executable> [unittest arguments]
+"""
+import subprocess
+import sys
+import tempfile
+import typing
+import unittest
+from pathlib import Path
+
+from memory import MemoryRegion, find_frag
+from compiler import NanoVMAsmParser, NanoVMMemoryObject, dump_object, parse_int
+from optimizer import GlobalOptimizer, PeepholeOptimizer, RegisterPlacement, optimize
+
+FIXTURES = Path(__file__).resolve().parent.parent / 'nanovm'
+TESTS: str = ''
+
+# fixture -> (input file, values), values in the -b form <section>.<label>=<value>
+PROGRAMS = {
+    'factorial': ('', ['input.n=5', 'output.result=120']),
+    'isatest': ('isatest_input.json', []),
+    'packedtest': ('packedtest_input.json', []),
+    'arraytest': ('arraytest_input.json', []),
+    'romtest': ('romtest_input.json', []),
+}
+
+
+def parse(name: str, source: str | None = None) -> tuple[NanoVMAsmParser, NanoVMMemoryObject]:
+    compiler = NanoVMAsmParser()
+    compiler.init()
+    compiler.process_file(source if source is not None else (FIXTURES / f"{name}.nvma").read_text(), name)
+    memory = compiler.get_memory()
+    memory.ram.eval_position(0)
+    return compiler, memory
+
+
+def code_of(memory: NanoVMMemoryObject) -> MemoryRegion:
+    return typing.cast(MemoryRegion, find_frag(memory.text, 'code'))
+
+
+class OptimizerTestCase(unittest.TestCase):
+    def run_program(self, name: str, memory: NanoVMMemoryObject, input_file: str = '', values: list[str] = ()):
+        with tempfile.TemporaryDirectory() as tmp:
+            binary = Path(tmp) / f"{name}.nvmb"
+            binary.write_text(dump_object(memory))
+            spec = ':'.join([str(binary), str(FIXTURES / input_file) if input_file else '', *values])
+            result = subprocess.run([TESTS, '-b', spec], capture_output=True, text=True)
+        self.assertEqual(result.returncode, 0, result.stdout)
+        self.assertIn('PASSED', result.stdout, f"{name}:\n{result.stdout}{result.stderr}")
+
+    def run_fixture(self, name: str, memory: NanoVMMemoryObject):
+        input_file, values = PROGRAMS[name]
+        self.run_program(name, memory, input_file, values)
+
+
+class PeepholeTest(OptimizerTestCase):
+    def test_unoptimized(self):
+        for name in PROGRAMS:
+            with self.subTest(name):
+                self.run_fixture(name, parse(name)[1])
+
+    def test_peephole(self):
+        saved = 0
+        for name in PROGRAMS:
+            with self.subTest(name):
+                compiler, memory = parse(name)
+                report = PeepholeOptimizer(compiler).run(memory)
+                self.assertLessEqual(report.bytes_after, report.bytes_before)
+                saved += report.bytes_before - report.bytes_after
+                self.run_fixture(name, memory)
+        self.assertGreater(saved, 0)
+
+    def test_constant_loads(self):
+        compiler, memory = parse('constants', """
+            .output
+            MEMORY 4, a
+            MEMORY 4, b
+            .code
+            LOAD_LOW 0x345
+            LOAD_HIGH 0x12
+            STORE_OP a
+            LOAD_LOW 0x345
+            LOAD_HIGH 0x12
+            LOAD_LOW 0x345
+            LOAD_HIGH 0x13
+            STORE_OP b
+            HALT
+        """)
+        report = PeepholeOptimizer(compiler).run(memory)
+        names = [PeepholeOptimizer.name(frag) for frag in code_of(memory).fragments]
+        self.assertEqual(names, ['LOAD_LOW', 'LOAD_HIGH', 'STORE_OP', 'LOAD_HIGH', 'STORE_OP', 'HALT'])
+        self.assertEqual(report.instructions_after, 6)
+        self.run_program('constants', memory, '', ['output.a=0x12345', 'output.b=0x13345'])
+
+    def test_dead_code(self):
+        compiler, memory = parse('dead', """
+            .output
+            MEMORY 4, a
+            .code
+            LOAD3 5
+            JZ lr, first
+            LOAD3 1
+            first:
+            JZ lr, second
+            second:
+            STORE_OP a
+            HALT
+            STORE_OP a
+        """)
+        PeepholeOptimizer(compiler).run(memory)
+        instructions = [(PeepholeOptimizer.name(frag), frag.args) for frag in code_of(memory).fragments
+                        if not PeepholeOptimizer.is_label(frag)]
+        self.assertEqual(instructions, [('LOAD3', ['5']), ('STORE_OP', ['a']), ('HALT', [])])
+        self.run_program('dead', memory, '', ['output.a=5'])
+
+
+class PlacementTest(OptimizerTestCase):
+    def test_optimize(self):
+        for name in PROGRAMS:
+            with self.subTest(name):
+                compiler, memory = parse(name)
+                optimize(compiler, memory)
+                self.run_fixture(name, memory)
+
+    def test_pointers_keep_layout(self):
+        # wrapped_ptr of the input file is an absolute word
+        compiler, memory = parse('arraytest')
+        before = memory.ram.get_data()
+        self.assertEqual(RegisterPlacement(compiler).run(memory), 0)
+        self.assertEqual(memory.ram.get_data(), before)
+
+    def test_width16(self):
+        # the cheapest order ignoring the limit puts .input first, then result lands beyond word 15
+        compiler, memory = parse('hot16', """
+            WIDTH 16
+            .input
+            MEMORY 2, n
+            MEMORY 2, padding, 17
+            .output
+            MEMORY 2, result
+            .data
+            MEMORY 2, count
+            MEMORY 2, one
+            .code
+            LOAD3 1
+            STORE_OP one
+            LOAD3 3
+            STORE_OP count
+            loop:
+            LOAD3 0
+            JZ count, end
+            ADD n, n, n
+            ADD n, n, n
+            ADD n, n, n
+            ADD n, n, n
+            SUB count, count, one
+            JZ lr, loop
+            end:
+            ADD result, n, n
+            HALT
+        """)
+        self.assertGreater(RegisterPlacement(compiler).run(memory), 0)
+        self.assertLess(compiler.resolve_label('result').position // 2, RegisterPlacement.narrow_limit)
+        self.run_program('hot16', memory, '', ['input.n=1', 'output.result=8192'])
+
+
+class GlobalOptimizerTest(OptimizerTestCase):
+    # factorial with n, n! fits 32 bits up to 12
+    FACTORIALS = [(1, 1), (5, 120), (12, 479001600)]
+
+    SUM_LOOP = """
+        .input
+        MEMORY 4, n
+        .output
+        MEMORY 4, sum
+        .data
+        MEMORY 4, one
+        .code
+        LOAD3 1
+        STORE_OP one
+        loop:
+        LOAD3 0
+        JZ n, end
+        ADD sum, sum, n
+        SUB n, n, one
+        JZ lr, loop
+        end:
+        HALT
+    """
+
+    def run_passes(self, name: str, passes: list[str], source: str | None = None):
+        compiler, memory = parse(name, source)
+        optimizer = GlobalOptimizer(compiler, memory)
+        region = code_of(memory)
+        region.fragments = optimizer.lower_mov(region.fragments)
+        for name in passes:
+            region.fragments = getattr(optimizer, name)(region.fragments)
+        return memory, optimizer.report
+
+    def run_factorials(self, memory: NanoVMMemoryObject):
+        for n, result in self.FACTORIALS:
+            with self.subTest(n=n):
+                self.run_program('factorial', memory, '', [f'input.n={n}', f'output.result={result}'])
+
+    def test_inline_calls(self):
+        memory, report = self.run_passes('factorial', ['inline_calls'])
+        self.assertEqual(report.inlined, 1)
+        self.run_factorials(memory)
+
+    def test_reduce_multiplies(self):
+        memory, report = self.run_passes('factorial', ['reduce_multiplies'])
+        self.assertEqual(report.multiplies, 1)
+        self.run_factorials(memory)
+
+    def test_unroll_loops(self):
+        # the shift-and-add loop of the reduced multiplication is counted by n
+        memory, report = self.run_passes('factorial', ['reduce_multiplies', 'unroll_loops'])
+        self.assertEqual(report.unrolled, 1)
+        self.run_factorials(memory)
+
+        # trip counts that are not a multiple of the unroll factor leave through a copy
+        memory, report = self.run_passes('sum', ['unroll_loops'], self.SUM_LOOP)
+        self.assertEqual(report.unrolled, 1)
+        for n in (0, 1, 5, 7):
+            with self.subTest(n=n):
+                self.run_program('sum', memory, '', [f'input.n={n}', f'output.sum={n * (n + 1) // 2}'])
+
+    def test_whole_program(self):
+        for name in PROGRAMS:
+            with self.subTest(name):
+                compiler, memory = parse(name)
+                optimize(compiler, memory, whole_program=True)
+                self.run_fixture(name, memory)
+        compiler, memory = parse('factorial')
+        report = optimize(compiler, memory, whole_program=True)
+        self.assertEqual((report.inlined, report.multiplies, report.unrolled), (1, 1, 1))
+        self.assertLess(report.executed_after, report.executed_before)
+        self.run_factorials(memory)
+
+
+class LiteralTest(unittest.TestCase):
+    def test_parse_int(self):
+        self.assertEqual(parse_int('07'), 7)
+        self.assertEqual(parse_int('010'), 10)
+        self.assertEqual(parse_int('0x1F'), 31)
+        self.assertEqual(parse_int('0X1f'), 31)
+        self.assertEqual(parse_int('0b101'), 5)
+        with self.assertRaises(ValueError):
+            parse_int('0o7')
+
+    def test_leading_zeros(self):
+        compiler, memory = parse('literals', """
+            .data
+            MEMORY 04, a
+            .code
+            LOAD3 07
+            LOAD_LOW 0x0A
+            HALT
+        """)
+        self.assertEqual(memory.text.get_data()[:5], parse('literals', """
+            .data
+            MEMORY 4, a
+            .code
+            LOAD3 7
+            LOAD_LOW 10
+            HALT
+        """)[1].text.get_data()[:5])
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        sys.exit(f"Usage: {sys.argv[0]} <tests executable> [unittest arguments]")
+    TESTS = sys.argv.pop(1)
+    unittest.main()
@@ -0,0 +1,416 @@
+#!/usr/bin/python3
+"""
+Generates instruction tables from the ISA description (nanovm.json):
+
+    generate.py <description.json> --cpp <isa_tables.hpp> --python <isa_tables.py>
+
+Bits are numbered from the first byte of an instruction, bit 0 is the lowest bit
+of byte 0, bit 8 the lowest bit of byte 1 (the numbering of asm/instruction.py).
+Operand bit ranges go from the least significant part of the value.
+"""
+
+import argparse
+import json
+import sys
+
+
+def fail(message: str):
+    print(f"{sys.argv[0]}: {message}", file=sys.stderr)
+    sys.exit(1)
+
+
+def camel(name: str) -> str:
+    return ''.join(part.capitalize() for part in name.split('_'))
+
+
+class Instruction:
+    def __init__(self, desc: dict, fields: list[str], categories: list[str]):
+        self.name: str = desc['name']
+        self.enum: str = desc['enum']
+        self.opcode: int = desc['opcode']
+        self.size: int = desc['size']
+        self.lr: str = desc.get('lr', '')
+        # access to ram[ram[ptr] & 31], the word is not known from the encoding
+        self.indirect: str = desc.get('indirect', '')
+        # opcode is a fixed field like the others
+        self.fixed = [('opcode', 5, 8, self.opcode)] + [(f['name'], *f['bits'], f['value']) for f in desc['fixed']]
+        self.operands: list[dict] = desc['operands']
+
+        if self.lr not in ('', 'read', 'write', 'read_write'):
+            fail(f"{self.name}: unknown lr side effect '{self.lr}'")
+        if self.indirect not in ('', 'read', 'write'):
+            fail(f"{self.name}: unknown indirect access '{self.indirect}'")
+        if len(self.operands) > 3:
+            fail(f"{self.name}: more than 3 operands")
+
+        used = [False] * (self.size * 8)
+
+        def take(start: int, end: int, what: str):
+            if not 0 <= start < end <= self.size * 8:
+                fail(f"{self.name}: {what} bits {start}..{end} out of instruction")
+            if start // 8 != (end - 1) // 8:
+                fail(f"{self.name}: {what} bits {start}..{end} cross a byte")
+            for bit in range(start, end):
+                if used[bit]:
+                    fail(f"{self.name}: {what} bit {bit} is used twice")
+                used[bit] = True
+
+        for name, start, end, value in self.fixed:
+            take(start, end, name)
+            if value >> (end - start):
+                fail(f"{self.name}: value {value} of {name} does not fit")
+        for operand in self.operands:
+            if operand['field'] not in fields:
+                fail(f"{self.name}: unknown field {operand['field']}")
+            if operand['category'] not in categories:
+                fail(f"{self.name}: unknown category {operand['category']}")
+            for start, end in operand['bits']:
+                take(start, end, operand['name'])
+
+    def width(self, operand: dict) -> int:
+        return sum(end - start for start, end in operand['bits'])
+
+    def matches_header(self, header: int) -> bool:
+        return all((header >> start) & ((1 << (end - start)) - 1) == value
+                   for _, start, end, value in self.fixed if end <= 8)
+
+    def selectors(self) -> list[tuple[int, int, int, int]]:
+        """Fixed fields after the first byte: (byte, shift, mask, value)."""
+        return [(start // 8, start % 8, (1 << (end - start)) - 1, value)
+                for _, start, end, value in self.fixed if start >= 8]
+
+
+def load(path: str) -> tuple[list[Instruction], dict]:
+    with open(path) as f:
+        doc = json.load(f)
+    instructions = [Instruction(desc, doc['fields'], doc['categories']) for desc in doc['instructions']]
+    names = [inst.name for inst in instructions]
+    if len(set(names)) != len(names):
+        fail("duplicate instruction names")
+    return instructions, doc
+
+
+def decode_tables(instructions: list[Instruction]):
+    """decode_table: header -> (enum or None, size, subtable index + 1), subtables: (byte, shift, mask, ops)."""
+    table = []
+    subtables = []
+    for header in range(256):
+        candidates = [inst for inst in instructions if inst.matches_header(header)]
+        if not candidates:
+            table.append((None, 1, 0))
+            continue
+
+        selected = [inst for inst in candidates if inst.selectors()]
+        if not selected:
+            if len(candidates) > 1:
+                fail(f"header {header:02X} is ambiguous: {', '.join(i.name for i in candidates)}")
+            table.append((candidates[0].enum, candidates[0].size, 0))
+            continue
+
+        # several instructions share the header and differ by one field of a later byte
+        keys = {inst.selectors()[0][:3] for inst in candidates if len(inst.selectors()) == 1}
+        sizes = {inst.size for inst in candidates}
+        if len(selected) != len(candidates) or len(keys) != 1 or len(sizes) != 1:
+            fail(f"header {header:02X}: {', '.join(i.name for i in candidates)} can't be told apart by one field")
+        byte, shift, mask = keys.pop()
+        ops: list[str | None] = [None] * (mask + 1)
+        for inst in candidates:
+            value = inst.selectors()[0][3]
+            if ops[value] is not None:
+                fail(f"header {header:02X}: {ops[value]} and {inst.name} have the same encoding")
+            ops[value] = inst.enum
+
+        subtable = (byte, shift, mask, tuple(ops))
+        if subtable not in subtables:
+            subtables.append(subtable)
+        table.append((None, sizes.pop(), subtables.index(subtable) + 1))
+    return table, subtables
+
+
+def byte_expr(index: int) -> str:
+    return "code[pc]" if index == 0 else f"code[(uint8_t)(pc + {index})]"
+
+
+def extract_expr(operand: dict) -> str:
+    parts = []
+    shift = 0
+    for start, end in operand['bits']:
+        mask = (1 << (end - start)) - 1
+        part = byte_expr(start // 8)
+        if start % 8:
+            part = f"({part} >> {start % 8})"
+        part = f"({part} & 0x{mask:X})"
+        if shift:
+            part = f"({part} << {shift})"
+        parts.append(part)
+        shift += end - start
+    return ' | '.join(parts)
+
+
+def encode_lines(inst: Instruction) -> list[str]:
+    constants = [0] * inst.size
+    terms: list[list[str]] = [[] for _ in range(inst.size)]
+    for _, start, end, value in inst.fixed:
+        constants[start // 8] |= value << (start % 8)
+    for operand in inst.operands:
+        shift = 0
+        for start, end in operand['bits']:
+            mask = (1 << (end - start)) - 1
+            term = operand['name']
+            if shift:
+                term = f"({term} >> {shift})"
+            term = f"({term} & 0x{mask:X})"
+            if start % 8:
+                term = f"({term} << {start % 8})"
+            terms[start // 8].append(term)
+            shift += end - start
+    return [f"out[{i}] = " + ' | '.join([f"0x{constants[i]:02X}"] + terms[i]) + ";" for i in range(inst.size)]
+
+
+def generate_cpp(instructions: list[Instruction], doc: dict, source: str) -> str:
+    table, subtables = decode_tables(instructions)
+    out = [
+        f"// Generated by isa/generate.py from {source}, do not edit.",
+        "",
+        "#pragma once",
+        "",
+        "#include <stdint.h>",
+        "",
+        "",
+        "",
+        "",
+        "enum class Mnemonic : uint8_t {",
+        *[f"    {inst.enum}," for inst in instructions],
+        "    Unknown,",
+        "};",
+        "",
+        "",
+        "enum class OperandField : uint8_t {",
+        *[f"    {camel(field)}," for field in doc['fields']],
+        "};",
+        "",
+        "",
+        "enum class OperandCategory : uint8_t {",
+        *[f"    {camel(category)}," for category in doc['categories']],
+        "};",
+        "",
+        "",
+        "struct OperandInfo",
+        "{",
+        "    const char* name;",
+        "    OperandField field;",
+        "    OperandCategory category;",
+        "    bool read;",
+        "    bool write;",
+        "    bool decimal; // printed in decimal by the disassembler",
+        "};",
+        "",
+        "",
+        "struct InstructionInfo",
+        "{",
+        "    const char* name;",
+        "    uint8_t size;",
+        "    bool lr_read;",
+        "    bool lr_write;",
+        "    bool indirect_read;  // ram[ram[ptr] & 31]",
+        "    bool indirect_write;",
+        "    uint8_t operand_count;",
+        "    OperandInfo operands[3];",
+        "};",
+        "",
+        "",
+        "// indexed by Mnemonic",
+        "constexpr InstructionInfo instruction_info[] = {",
+    ]
+    for inst in instructions:
+        operands = ', '.join(
+            "{"
+            f"\"{o['name']}\", OperandField::{camel(o['field'])}, OperandCategory::{camel(o['category'])}, "
+            f"{str('read' in o.get('access', '')).lower()}, {str('write' in o.get('access', '')).lower()}, "
+            f"{str(o.get('format') == 'dec').lower()}"
+            "}" for o in inst.operands)
+        out.append(f"    {{\"{inst.name}\", {inst.size}, {str('read' in inst.lr).lower()}, "
+                   f"{str('write' in inst.lr).lower()}, {str(inst.indirect == 'read').lower()}, "
+                   f"{str(inst.indirect == 'write').lower()}, {len(inst.operands)}, {{{operands}}}}},")
+    out += [
+        "    {\"UNKNOWN\", 1, false, false, false, false, 0, {}},",
+        "};",
+        "",
+        "",
+        "struct DecodeEntry",
+        "{",
+        "    Mnemonic op;",
+        "    uint8_t size;",
+        "    uint8_t subtable; // index in decode_subtables + 1, 0 - op is final",
+        "};",
+        "",
+        "",
+        "// by the first byte of an instruction",
+        "constexpr DecodeEntry decode_table[256] = {",
+    ]
+    for header, (enum, size, subtable) in enumerate(table):
+        out.append(f"    {{Mnemonic::{enum or 'Unknown'}, {size}, {subtable}}}, // {header:02X}")
+    out += [
+        "};",
+        "",
+        "",
+        "// instructions sharing the first byte, told apart by a field of a later byte",
+        "struct DecodeSubtable",
+        "{",
+        "    uint8_t offset;",
+        "    uint8_t shift;",
+        "    uint8_t mask;",
+        "    Mnemonic ops[16];",
+        "};",
+        "",
+        "",
+        "constexpr DecodeSubtable decode_subtables[] = {",
+    ]
+    for byte, shift, mask, ops in subtables:
+        if mask > 15:
+            fail("subtable selector is wider than 4 bits")
+        names = ', '.join(f"Mnemonic::{op or 'Unknown'}" for op in ops)
+        out.append(f"    {{{byte}, {shift}, 0x{mask:X}, {{{names}}}}},")
+    if not subtables:
+        out.append("    {0, 0, 0, {}},")
+    out += [
+        "};",
+        "",
+        "",
+        "// operand bytes are read modulo 256 like the pc",
+        "constexpr Mnemonic decode_mnemonic(const uint8_t* code, uint8_t pc)",
+        "{",
+        "    auto& entry = decode_table[code[pc]];",
+        "    if (not entry.subtable)",
+        "        return entry.op;",
+        "    auto& sub = decode_subtables[entry.subtable - 1];",
+        "    return sub.ops[(code[(uint8_t)(pc + sub.offset)] >> sub.shift) & sub.mask];",
+        "}",
+        "",
+        "",
+        "// Operands and encoding of every instruction: isa::Add::mem1(code, pc),",
+        "// isa::Add::encode(out, result, mem1, mem2).",
+        "namespace isa {",
+    ]
+    for inst in instructions:
+        out += ["", "", f"struct {inst.enum}", "{",
+                f"    static constexpr Mnemonic op = Mnemonic::{inst.enum};",
+                f"    static constexpr uint8_t size = {inst.size};"]
+        for operand in inst.operands:
+            out.append(f"    static constexpr uint32_t {operand['name']}(const uint8_t* code, uint8_t pc) "
+                       f"{{ return {extract_expr(operand)}; }}")
+        params = ''.join(f", uint32_t {o['name']}" for o in inst.operands)
+        out += [f"    static constexpr void encode(uint8_t* out{params})", "    {"]
+        out += [f"        {line}" for line in encode_lines(inst)]
+        out += ["    }", "};"]
+    out += [
+        "",
+        "",
+        "} // namespace isa",
+        "",
+        "",
+        "// operands in the order of instruction_info[op].operands",
+        "constexpr void decode_operands(Mnemonic op, const uint8_t* code, uint8_t pc, uint32_t* values)",
+        "{",
+        "    switch (op)",
+        "    {",
+    ]
+    for inst in instructions:
+        out.append(f"    case Mnemonic::{inst.enum}:")
+        for i, operand in enumerate(inst.operands):
+            out.append(f"        values[{i}] = isa::{inst.enum}::{operand['name']}(code, pc);")
+        out.append("        break;")
+    out += [
+        "    case Mnemonic::Unknown:",
+        "        break;",
+        "    }",
+        "}",
+        "",
+        "",
+        "// writes instruction_info[op].size bytes, UNKNOWN is encoded as HALT",
+        "constexpr void encode_operands(Mnemonic op, const uint32_t* values, uint8_t* out)",
+        "{",
+        "    switch (op)",
+        "    {",
+    ]
+    halt = None
+    for inst in instructions:
+        args = ''.join(f", values[{i}]" for i in range(len(inst.operands)))
+        out += [f"    case Mnemonic::{inst.enum}:",
+                f"        isa::{inst.enum}::encode(out{args});",
+                "        break;"]
+        if inst.name == 'HALT':
+            halt = inst
+    if halt is None:
+        fail("HALT is not described")
+    out += [
+        "    case Mnemonic::Unknown:",
+        f"        isa::{halt.enum}::encode(out);",
+        "        break;",
+        "    }",
+        "}",
+        "",
+    ]
+    return '\n'.join(out)
+
+
+def python_tables(instructions: list[Instruction]) -> list[dict]:
+    """INSTRUCTIONS of isa_tables.py, asm/instruction.py builds it this way when the file is not generated."""
+    return [{
+        'name': inst.name, 'opcode': inst.opcode, 'size': inst.size, 'lr': inst.lr,
+        'fixed': inst.fixed[1:],
+        'operands': [(o['name'], o['category'], [tuple(b) for b in o['bits']]) for o in inst.operands],
+    } for inst in instructions]
+
+
+def generate_python(instructions: list[Instruction], source: str) -> str:
+    out = [
+        f"# Generated by isa/generate.py from {source}, do not edit.",
+        "",
+        "# fixed: (name, start, end, value), operands: (name, cathegory, [(start, end), ...]) in assembly order,",
+        "# bit ranges of an operand go from its least significant part",
+        "INSTRUCTIONS = [",
+    ]
+    for inst in python_tables(instructions):
+        fixed = ', '.join(repr(f) for f in inst['fixed'])
+        out += [
+            "    {",
+            f"        'name': {inst['name']!r}, 'opcode': {inst['opcode']}, 'size': {inst['size']}, 'lr': {inst['lr']!r},",
+            f"        'fixed': [{fixed}],",
+            "        'operands': [",
+            *[f"            ({name!r}, {category!r}, {bits!r})," for name, category, bits in inst['operands']],
+            "        ],",
+            "    },",
+        ]
+    out += ["]", ""]
+    return '\n'.join(out)
+
+
+def write_if_changed(path: str, content: str):
+    try:
+        with open(path) as f:
+            if f.read() == content:
+                return
+    except FileNotFoundError:
+        pass
+    with open(path, 'w') as f:
+        f.write(content)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="NanoVM instruction tables generator")
+    parser.add_argument('description')
+    parser.add_argument('--cpp')
+    parser.add_argument('--python')
+    args = parser.parse_args()
+
+    instructions, doc = load(args.description)
+    source = 'isa/nanovm.json'
+    if args.cpp:
+        write_if_changed(args.cpp, generate_cpp(instructions, doc, source))
+    if args.python:
+        write_if_changed(args.python, generate_python(instructions, source))
+
+
+if __name__ == '__main__':
+    main()
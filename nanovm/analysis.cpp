@@ -0,0 +1,635 @@
+#include "analysis.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "utils.hpp"
+#include "vmop.hpp"
+
+
+
+
+namespace {
+
+
+constexpr size_t max_values = 8;
+constexpr size_t max_combinations = 64;
+
+
+// set of possible constant values of a ram word, top - anything
+struct Values
+{
+    bool top = false;
+    std::vector<uint32_t> values;
+
+    static Values any()
+    {
+        Values v;
+        v.top = true;
+        return v;
+    }
+
+    static Values of(uint32_t value)
+    {
+        Values v;
+        v.values.push_back(value);
+        return v;
+    }
+
+    void add(uint32_t value)
+    {
+        if (top)
+            return;
+        auto it = std::lower_bound(values.begin(), values.end(), value);
+        if (it == values.end() or *it != value)
+            values.insert(it, value);
+        if (values.size() > max_values) {
+            top = true;
+            values.clear();
+        }
+    }
+
+    // returns true if changed
+    bool join(const Values& other)
+    {
+        if (top)
+            return false;
+        if (other.top) {
+            *this = any();
+            return true;
+        }
+        auto before = values.size();
+        for (auto v : other.values)
+            add(v);
+        return top or values.size() != before;
+    }
+};
+
+using Env = std::array<Values, 32>;
+
+
+struct Decoded
+{
+    Instruction inst;
+    bool reachable = false;
+    bool unresolved = false;
+    std::vector<uint8_t> successors;
+};
+
+
+// all combinations of values of registers in mask, false if there are too many
+bool for_each_combination(const Env& env, uint32_t mask, const std::function<void (uint32_t* ram)>& fn)
+{
+    std::vector<uint8_t> regs;
+    size_t count = 1;
+    for (uint8_t r = 0; r < 32; r++) {
+        if (mask & (1u << r)) {
+            if (env[r].top)
+                return false;
+            regs.push_back(r);
+            count *= env[r].values.size();
+        }
+    }
+    if (count > max_combinations)
+        return false;
+
+    uint32_t ram[32] = {0};
+    std::vector<size_t> index(regs.size(), 0);
+    for (size_t n = 0; n < count; n++) {
+        for (size_t i = 0; i < regs.size(); i++)
+            ram[regs[i]] = env[regs[i]].values[index[i]];
+        fn(ram);
+        for (size_t i = 0; i < index.size(); i++) {
+            if (++index[i] < env[regs[i]].values.size())
+                break;
+            index[i] = 0;
+        }
+    }
+    return true;
+}
+
+
+// transfer function of one instruction, fills successors of d
+Env transfer(const uint8_t* code, uint8_t pc, Decoded& d, const Env& in)
+{
+    auto& inst = d.inst;
+    auto out = in;
+    auto reads = read_registers(inst);
+    auto writes = written_registers(inst);
+    uint8_t next = pc + inst.size;
+
+    switch (inst.op)
+    {
+    case Mnemonic::Halt:
+    case Mnemonic::Unknown:
+        return out;
+
+    case Mnemonic::Jl:
+    case Mnemonic::Jz: {
+        if (inst.arg1 == 0) {
+            d.successors = {(uint8_t)(inst.op == Mnemonic::Jz ? inst.imm : next)};
+            return out;
+        }
+        bool taken = false;
+        bool not_taken = false;
+        bool known = for_each_combination(in, reads, [&] (uint32_t* ram) {
+            uint8_t new_pc = pc;
+            execute_one(ram, code, new_pc, nullptr);
+            (new_pc == next ? not_taken : taken) = true;
+        });
+        if (not known or not_taken)
+            d.successors.push_back(next);
+        if ((not known or taken) and inst.imm != next)
+            d.successors.push_back(inst.imm);
+        return out;
+    }
+
+    case Mnemonic::PcSwp: {
+        auto& target = in[inst.arg1];
+        if (target.top)
+            d.unresolved = true;
+        for (auto v : target.values)
+            if (std::find(d.successors.begin(), d.successors.end(), (uint8_t)v) == d.successors.end())
+                d.successors.push_back(v);
+        out[inst.result] = Values::of(next);
+        return out;
+    }
+
+    case Mnemonic::Call:
+        out[inst.result] = Values::any();
+        d.successors = {next};
+        return out;
+
+    // the word is known if the pointer is, otherwise any word may be accessed
+    case Mnemonic::LoadInd: {
+        auto& ptr = in[inst.arg1];
+        Values result = (ptr.top ? Values::any() : Values());
+        for (auto v : ptr.values)
+            result.join(in[v & 31]);
+        out[0] = result;
+        d.successors = {next};
+        return out;
+    }
+
+    case Mnemonic::StoreInd: {
+        auto& ptr = in[inst.arg1];
+        if (not ptr.top and ptr.values.size() == 1)
+            out[ptr.values[0] & 31] = in[0];
+        else
+            for (uint8_t r = 0; r < 32; r++)
+                if (ptr.top or std::count_if(ptr.values.begin(), ptr.values.end(),
+                                             [r] (uint32_t v) { return (v & 31) == r; }))
+                    out[r].join(in[0]);
+        d.successors = {next};
+        return out;
+    }
+
+    default: {
+        Values result;
+        uint8_t written = 0;
+        while (not (writes & (1u << written)))
+            written++;
+        bool known = for_each_combination(in, reads, [&] (uint32_t* ram) {
+            uint8_t new_pc = pc;
+            execute_one(ram, code, new_pc, nullptr);
+            result.add(ram[written]);
+        });
+        out[written] = (known ? result : Values::any());
+        d.successors = {next};
+        return out;
+    }
+    }
+}
+
+
+std::map<uint8_t, Decoded> decode_reachable(const uint8_t* code, const std::vector<uint8_t>& entries)
+{
+    std::map<uint8_t, Decoded> insts;
+    std::map<uint8_t, Env> states;
+    std::deque<uint8_t> worklist;
+
+    // the host may start at pc 0 or at any entry point with any ram
+    Env entry;
+    entry.fill(Values::any());
+    states[0] = entry;
+    worklist.push_back(0);
+    for (auto pc : entries) {
+        if (states.count(pc))
+            continue;
+        states[pc] = entry;
+        worklist.push_back(pc);
+    }
+
+    while (worklist.size()) {
+        auto pc = worklist.front();
+        worklist.pop_front();
+
+        Decoded d;
+        d.inst = decode_instruction(code, pc);
+        d.reachable = true;
+        auto out = transfer(code, pc, d, states.at(pc));
+
+        for (auto succ : d.successors) {
+            bool changed = false;
+            if (not states.count(succ)) {
+                states[succ] = out;
+                changed = true;
+            }
+            else {
+                auto& state = states.at(succ);
+                for (size_t r = 0; r < state.size(); r++)
+                    changed |= state[r].join(out[r]);
+            }
+            if (changed and std::find(worklist.begin(), worklist.end(), succ) == worklist.end())
+                worklist.push_back(succ);
+        }
+
+        // successors only grow, keep the union
+        if (insts.count(pc)) {
+            auto& old = insts.at(pc);
+            for (auto succ : old.successors)
+                if (std::find(d.successors.begin(), d.successors.end(), succ) == d.successors.end())
+                    d.successors.push_back(succ);
+            d.unresolved |= old.unresolved;
+        }
+        insts[pc] = std::move(d);
+    }
+    return insts;
+}
+
+
+void static_successors(Decoded& d, uint8_t pc)
+{
+    uint8_t next = pc + d.inst.size;
+    switch (d.inst.op)
+    {
+    case Mnemonic::Halt:
+    case Mnemonic::Unknown:
+        break;
+    case Mnemonic::PcSwp:
+        d.unresolved = true;
+        break;
+    case Mnemonic::Jz:
+        if (d.inst.arg1 != 0)
+            d.successors.push_back(next);
+        d.successors.push_back(d.inst.imm);
+        break;
+    case Mnemonic::Jl:
+        d.successors.push_back(next);
+        if (d.inst.arg1 != 0)
+            d.successors.push_back(d.inst.imm);
+        break;
+    default:
+        d.successors.push_back(next);
+    }
+}
+
+
+uint64_t text_hash(const std::vector<uint8_t>& text, uint32_t exit_live, const std::vector<uint8_t>& entries)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&] (uint8_t byte) {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    };
+    for (auto byte : text)
+        mix(byte);
+    for (int i = 0; i < 4; i++)
+        mix(exit_live >> (i * 8));
+    mix(text.size());
+    for (auto pc : entries)
+        mix(pc);
+    return hash;
+}
+
+
+} // namespace
+
+
+ControlFlowGraph build_cfg(const std::vector<uint8_t>& text, uint32_t exit_live, const std::vector<uint8_t>& entries)
+{
+    if (text.size() > 256)
+        throw std::runtime_error("Text section is bigger than 256 bytes");
+
+    std::array<uint8_t, 256 + 4> code;
+    code.fill(0xFF);
+    std::copy(text.begin(), text.end(), code.begin());
+
+    ControlFlowGraph cfg;
+    cfg.hash = text_hash(text, exit_live, entries);
+    cfg.block_at.fill(BasicBlock::npos);
+
+    // reachable instructions, then linear sweep over the rest of text
+    auto insts = decode_reachable(code.data(), entries);
+    for (size_t pc = 0; pc < text.size(); ) {
+        if (insts.count(pc)) {
+            pc += insts.at(pc).inst.size;
+            continue;
+        }
+        Decoded d;
+        d.inst = decode_instruction(code.data(), pc);
+        bool overlaps = false;
+        for (size_t p = pc + 1; p < pc + d.inst.size; p++)
+            overlaps |= insts.count(p) and insts.at(p).reachable;
+        if (overlaps) {
+            pc++;
+            continue;
+        }
+        static_successors(d, pc);
+        insts[pc] = std::move(d);
+        pc += insts.at(pc).inst.size;
+    }
+
+    // leaders
+    std::vector<bool> leader(256, false);
+    leader[0] = true;
+    for (auto pc : entries)
+        leader[pc] = true;
+    int prev_end = -1;
+    bool prev_reachable = true;
+    for (auto& [pc, d] : insts) {
+        if ((int)pc != prev_end or d.reachable != prev_reachable)
+            leader[pc] = true;
+        if (is_branch(d.inst)) {
+            for (auto succ : d.successors)
+                leader[succ] = true;
+            leader[(uint8_t)(pc + d.inst.size)] = true;
+        }
+        prev_end = pc + d.inst.size;
+        prev_reachable = d.reachable;
+    }
+
+    // blocks
+    for (auto it = insts.begin(); it != insts.end(); ++it) {
+        auto pc = it->first;
+        auto& d = it->second;
+        if (leader[pc] or cfg.blocks.empty() or is_branch(cfg.blocks.back().code.back())) {
+            BasicBlock block;
+            block.start = pc;
+            block.reachable = d.reachable;
+            cfg.blocks.push_back(block);
+        }
+        auto& block = cfg.blocks.back();
+        block.pcs.push_back(pc);
+        block.code.push_back(d.inst);
+        block.end = pc + d.inst.size;
+        cfg.block_at[pc] = cfg.blocks.size() - 1;
+    }
+
+    // edges
+    for (size_t id = 0; id < cfg.blocks.size(); id++) {
+        auto& block = cfg.blocks[id];
+        auto& last = insts.at(block.pcs.back());
+        block.exit = (last.inst.op == Mnemonic::Halt or last.inst.op == Mnemonic::Unknown);
+        block.unresolved_indirect = last.unresolved;
+        cfg.has_unresolved_indirect |= (block.reachable and last.unresolved);
+        for (auto succ : last.successors) {
+            auto target = cfg.block_at[succ];
+            if (target == BasicBlock::npos)
+                continue;
+            if (std::find(block.successors.begin(), block.successors.end(), target) == block.successors.end()) {
+                block.successors.push_back(target);
+                cfg.blocks[target].predecessors.push_back(id);
+            }
+        }
+    }
+
+    // dominators (Cooper, Harvey, Kennedy) over reachable blocks
+    auto& rpo = cfg.rpo;
+    std::vector<size_t> rpo_index(cfg.blocks.size(), BasicBlock::npos);
+    if (cfg.blocks.size() and cfg.blocks[0].reachable) {
+        std::vector<bool> visited(cfg.blocks.size(), false);
+        std::vector<std::pair<size_t, size_t>> stack = {{0, 0}};
+        visited[0] = true;
+        while (stack.size()) {
+            auto& [id, next] = stack.back();
+            if (next < cfg.blocks[id].successors.size()) {
+                auto succ = cfg.blocks[id].successors[next++];
+                if (not visited[succ]) {
+                    visited[succ] = true;
+                    stack.push_back({succ, 0});
+                }
+            }
+            else {
+                rpo.push_back(id);
+                stack.pop_back();
+            }
+        }
+        std::reverse(rpo.begin(), rpo.end());
+        for (size_t i = 0; i < rpo.size(); i++)
+            rpo_index[rpo[i]] = i;
+
+        cfg.blocks[0].idom = 0;
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (auto id : rpo) {
+                if (id == 0)
+                    continue;
+                size_t idom = BasicBlock::npos;
+                for (auto pred : cfg.blocks[id].predecessors) {
+                    if (cfg.blocks[pred].idom == BasicBlock::npos)
+                        continue;
+                    if (idom == BasicBlock::npos) {
+                        idom = pred;
+                        continue;
+                    }
+                    auto a = pred;
+                    auto b = idom;
+                    while (a != b) {
+                        while (rpo_index[a] > rpo_index[b])
+                            a = cfg.blocks[a].idom;
+                        while (rpo_index[b] > rpo_index[a])
+                            b = cfg.blocks[b].idom;
+                    }
+                    idom = a;
+                }
+                if (idom != cfg.blocks[id].idom) {
+                    cfg.blocks[id].idom = idom;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // natural loops, one per header
+    std::map<size_t, Loop> loops;
+    for (auto id : rpo) {
+        for (auto succ : cfg.blocks[id].successors) {
+            if (not cfg.dominates(succ, id))
+                continue;
+            auto& loop = loops[succ];
+            loop.header = succ;
+            loop.latches.push_back(id);
+
+            std::vector<bool> in_loop(cfg.blocks.size(), false);
+            for (auto b : loop.blocks)
+                in_loop[b] = true;
+            in_loop[succ] = true;
+            std::vector<size_t> stack = {id};
+            while (stack.size()) {
+                auto b = stack.back();
+                stack.pop_back();
+                if (in_loop[b])
+                    continue;
+                in_loop[b] = true;
+                for (auto pred : cfg.blocks[b].predecessors)
+                    if (cfg.blocks[pred].reachable)
+                        stack.push_back(pred);
+            }
+            loop.blocks.clear();
+            for (size_t b = 0; b < in_loop.size(); b++)
+                if (in_loop[b])
+                    loop.blocks.push_back(b);
+        }
+    }
+    for (auto& [header, loop] : loops)
+        cfg.loops.push_back(std::move(loop));
+
+    auto contains = [&] (const Loop& loop, size_t block) {
+        return std::binary_search(loop.blocks.begin(), loop.blocks.end(), block);
+    };
+    for (size_t i = 0; i < cfg.loops.size(); i++) {
+        for (size_t j = 0; j < cfg.loops.size(); j++) {
+            if (i == j or cfg.loops[j].blocks.size() <= cfg.loops[i].blocks.size()
+                    or not contains(cfg.loops[j], cfg.loops[i].header))
+                continue;
+            auto parent = cfg.loops[i].parent;
+            if (parent == BasicBlock::npos or cfg.loops[j].blocks.size() < cfg.loops[parent].blocks.size())
+                cfg.loops[i].parent = j;
+        }
+    }
+    for (auto& loop : cfg.loops) {
+        loop.depth = 1;
+        for (auto p = loop.parent; p != BasicBlock::npos; p = cfg.loops[p].parent)
+            loop.depth++;
+    }
+    for (size_t i = 0; i < cfg.loops.size(); i++) {
+        for (auto b : cfg.loops[i].blocks) {
+            auto& block = cfg.blocks[b];
+            if (block.loop == BasicBlock::npos or cfg.loops[i].depth > block.loop_depth) {
+                block.loop = i;
+                block.loop_depth = cfg.loops[i].depth;
+            }
+        }
+    }
+
+    // uses/defs and liveness
+    for (auto& block : cfg.blocks) {
+        for (auto& inst : block.code) {
+            block.uses |= read_registers(inst) & ~block.defs;
+            block.defs |= defined_registers(inst);
+        }
+    }
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (size_t i = cfg.blocks.size(); i-- > 0; ) {
+            auto& block = cfg.blocks[i];
+            uint32_t out = 0;
+            if (block.exit)
+                out |= exit_live;
+            if (block.unresolved_indirect)
+                out = 0xFFFFFFFF;
+            for (auto succ : block.successors)
+                out |= cfg.blocks[succ].live_in;
+            uint32_t in = block.uses | (out & ~block.defs);
+            if (out != block.live_out or in != block.live_in) {
+                block.live_out = out;
+                block.live_in = in;
+                changed = true;
+            }
+        }
+    }
+
+    return cfg;
+}
+
+
+bool ControlFlowGraph::dominates(size_t a, size_t b) const
+{
+    if (blocks[b].idom == BasicBlock::npos)
+        return false;
+    while (true) {
+        if (a == b)
+            return true;
+        if (blocks[b].idom == b)
+            return false;
+        b = blocks[b].idom;
+    }
+}
+
+
+std::string ControlFlowGraph::dump(const std::map<uint8_t, std::string>& names) const
+{
+    auto list = [] (const std::vector<size_t>& ids) {
+        std::string out;
+        for (auto id : ids)
+            out += (out.size() ? " " : "") + std::to_string(id);
+        return out.size() ? out : "-";
+    };
+
+    std::ostringstream out;
+    for (size_t id = 0; id < blocks.size(); id++) {
+        auto& block = blocks[id];
+        out << "block " << id << " [" << fhex(block.start, 2) << ", " << fhex(block.end, 2) << ")"
+            << (block.reachable ? "" : " unreachable")
+            << " succ: " << list(block.successors)
+            << " pred: " << list(block.predecessors);
+        if (block.idom != BasicBlock::npos)
+            out << " idom: " << block.idom;
+        if (block.loop_depth)
+            out << " loop: " << fhex(blocks[loops[block.loop].header].start, 2) << " depth " << block.loop_depth;
+        if (block.unresolved_indirect)
+            out << " indirect";
+        out << "\n";
+        for (size_t i = 0; i < block.code.size(); i++)
+            out << "    " << fhex(block.pcs[i], 2) << ": " << format_instruction(block.code[i], names) << "\n";
+    }
+    return out.str();
+}
+
+
+std::shared_ptr<const ControlFlowGraph> analyze(const NVMAObject& obj)
+{
+    require_width(obj, 32);
+
+    // the hash only picks the slot, a hit must match the whole key
+    struct Entry
+    {
+        std::vector<uint8_t> text;
+        uint32_t outputs;
+        std::vector<uint8_t> entries;
+        std::shared_ptr<const ControlFlowGraph> cfg;
+    };
+    static constexpr size_t max_cached = 256;
+    static std::mutex mutex;
+    static std::map<uint64_t, Entry> cache;
+
+    uint32_t outputs = 0;
+    for (auto& [name, label] : obj.output.labels)
+        for (size_t pos = label.pos; pos < (size_t)label.pos + label.size; pos += 4)
+            outputs |= 1u << (pos / 4);
+    std::vector<uint8_t> entries;
+    for (auto& entry : entry_points(obj))
+        entries.push_back(entry.pos);
+
+    auto hash = text_hash(obj.text.data, outputs, entries);
+    {
+        std::lock_guard lock(mutex);
+        auto it = cache.find(hash);
+        if (it != cache.end() and it->second.text == obj.text.data and it->second.outputs == outputs
+                and it->second.entries == entries)
+            return it->second.cfg;
+    }
+
+    auto cfg = std::make_shared<const ControlFlowGraph>(build_cfg(obj.text.data, outputs, entries));
+    std::lock_guard lock(mutex);
+    // a collision replaces the slot, a full cache drops an arbitrary one
+    if (not cache.count(hash) and cache.size() >= max_cached)
+        cache.erase(cache.begin());
+    cache[hash] = Entry{obj.text.data, outputs, entries, cfg};
+    return cfg;
+}
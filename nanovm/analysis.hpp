@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "isa.hpp"
+#include "runtime_compiler.hpp"
+
+
+
+
+/*
+Граф потока управления text секции.
+
+Переходы: JL/JZ - переход и следующая инструкция (JZ lr всегда переходит, JL lr никогда),
+PC_SWP - косвенный переход, цели ищутся распространением множеств констант по ram
+(адрес должен быть загружен константой или сохранен другим PC_SWP как адрес возврата),
+HALT - выход. Недостижимый код тоже разбивается на блоки (reachable = false).
+
+Для блоков считаются доминаторы, естественные циклы (с вложенностью), множества
+uses (читаются до записи) / defs и живые слова на входе/выходе. На HALT живыми
+считаются слова exit_live (для analyze(obj) - слова .output), после неразрешенного
+PC_SWP - все слова.
+*/
+
+
+struct BasicBlock
+{
+    static constexpr size_t npos = (size_t)-1;
+
+    uint8_t start = 0;
+    uint16_t end = 0; // exclusive
+    std::vector<uint8_t> pcs;
+    std::vector<Instruction> code;
+
+    std::vector<size_t> successors;
+    std::vector<size_t> predecessors;
+
+    bool reachable = false;
+    bool exit = false;                // ends with HALT
+    bool unresolved_indirect = false; // PC_SWP with unknown targets
+
+    size_t idom = npos;
+    size_t loop = npos;  // innermost loop
+    size_t loop_depth = 0;
+
+    uint32_t uses = 0;
+    uint32_t defs = 0;
+    uint32_t live_in = 0;
+    uint32_t live_out = 0;
+};
+
+
+struct Loop
+{
+    size_t header;
+    std::vector<size_t> blocks; // sorted, header included
+    std::vector<size_t> latches;
+    size_t parent = BasicBlock::npos;
+    size_t depth = 1;
+};
+
+
+struct ControlFlowGraph
+{
+    uint64_t hash = 0;
+    std::vector<BasicBlock> blocks;
+    std::vector<Loop> loops;
+    // reachable blocks in reverse postorder
+    std::vector<size_t> rpo;
+    // block index for every pc which starts an instruction, npos otherwise
+    std::array<size_t, 256> block_at;
+    bool has_unresolved_indirect = false;
+
+    const BasicBlock* block_of(uint8_t pc) const
+    {
+        return block_at[pc] == BasicBlock::npos ? nullptr : &blocks[block_at[pc]];
+    }
+
+    bool dominates(size_t a, size_t b) const;
+    std::string dump(const std::map<uint8_t, std::string>& names = {}) const;
+};
+
+
+// entries - pcs of entry points besides 0 (entry_points of a linked object), reachable with any ram,
+// dominators are still computed from pc 0
+ControlFlowGraph build_cfg(const std::vector<uint8_t>& text, uint32_t exit_live = 0xFFFFFFFF,
+                           const std::vector<uint8_t>& entries = {});
+
+// cached by text, live .output words and entry points (at most 256 programs)
+std::shared_ptr<const ControlFlowGraph> analyze(const NVMAObject& obj);
@@ -0,0 +1,672 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "isa.hpp"
+#include "runtime_compiler.hpp"
+
+
+
+
+/*
+Ассемблер .nvma, работающий во время компиляции C++:
+```
+> constexpr auto prog = nanovm::assemble(R"(
+>     .input
+>     MEMORY 4, n
+>     .code
+>     ...
+> )");
+> static_assert(prog.word("n") == 1);
+```
+Синтаксис и раскладка памяти те же, что у asm/compiler.py: секции .code,
+.input, .output, .data, .rodata, метки `name:`, `MEMORY size[, name[, count]]`, MOV, LOAD_REF, `EXPORT`
+(для asm/linker.py, здесь пропускается), аргументы -
+числа (десятичные, 0x, 0b) или метки. Метка в аргументе-регистре дает номер
+слова (pos / размер слова), в адресе перехода и константе - смещение в байтах.
+ram начинается с lr (одно слово), дальше подряд .input, .output и .data.
+.rodata лежит в text сразу за кодом, в ней только MEMORY и BYTE/HALF/WORD
+(до max_args значений в строке, метка text дает адрес, метка ram - номер слова).
+`WIDTH 16|32|64` задает ширину слова программы (по умолчанию 32), text от нее
+не зависит.
+
+Ошибка ассемблирования в constexpr контексте - ошибка компиляции: вызов
+assembly_error не constexpr, и компилятор показывает строку с сообщением.
+При вызове во время выполнения бросается std::runtime_error с номером строки.
+
+text дополняется HALT (0xFF) до 256 байт и готов для execute, начальная ram -
+32 слова в words (uint64_t для любой ширины), ram<Word>() дает ее для execute.
+*/
+
+
+namespace nanovm {
+
+
+constexpr size_t max_labels = 128;
+constexpr size_t max_label_name = 31;
+constexpr size_t max_args = 32;
+
+
+enum class AsmSection : uint8_t {
+    Code,
+    Input,
+    Output,
+    Data,
+    Rodata,
+    Lr,
+};
+
+
+struct AsmLabel
+{
+    std::array<char, max_label_name + 1> chars{};
+    uint8_t length = 0;
+    AsmSection section = AsmSection::Code;
+    bool region = false;  // section itself: lr, code, input, output, data, rodata
+    uint16_t pos = 0;     // bytes from the start of text or ram
+    uint16_t size = 0;
+
+    constexpr std::string_view name() const { return {chars.data(), length}; }
+};
+
+
+namespace detail {
+
+
+[[noreturn]] inline void assembly_error(size_t line, const char* message, std::string_view what = {})
+{
+    std::string text = "Line " + std::to_string(line + 1) + ": " + message;
+    if (what.size())
+        text += " '" + std::string(what) + "'";
+    throw std::runtime_error(text);
+}
+
+
+[[noreturn]] inline void missing_label(std::string_view name)
+{
+    throw std::runtime_error("Label " + std::string(name) + " not found");
+}
+
+
+[[noreturn]] inline void width_mismatch(unsigned width)
+{
+    throw std::runtime_error("Program has " + std::to_string(width) + "-bit words");
+}
+
+
+} // namespace detail
+
+
+struct AsmProgram
+{
+    std::array<uint8_t, 256> text{};
+    uint16_t text_size = 0;
+    std::array<uint64_t, 32> words{};  // initial ram, see ram<Word>()
+    uint16_t ram_size = 0;
+    uint8_t width = 32;
+    std::array<AsmLabel, max_labels> labels{};
+    size_t label_count = 0;
+
+    constexpr const AsmLabel* find(std::string_view name) const
+    {
+        for (size_t i = 0; i < label_count; i++)
+            if (labels[i].name() == name)
+                return &labels[i];
+        return nullptr;
+    }
+
+    constexpr const AsmLabel& label(std::string_view name) const
+    {
+        auto label = find(name);
+        if (not label)
+            detail::missing_label(name);
+        return *label;
+    }
+
+    // byte offset, for code labels - the address to jump or PC_SWP to
+    constexpr uint16_t address(std::string_view name) const { return label(name).pos; }
+
+    // ram word of a data label
+    constexpr uint8_t word(std::string_view name) const { return label(name).pos / (width / 8); }
+
+    // initial ram for execute<Word>, Word must match WIDTH of the program
+    template <typename Word>
+    constexpr std::array<Word, 32> ram() const
+    {
+        if (sizeof(Word) * 8 != width)
+            detail::width_mismatch(width);
+        std::array<Word, 32> out{};
+        for (size_t i = 0; i < out.size(); i++)
+            out[i] = words[i];
+        return out;
+    }
+
+    // same object as compile() returns, for the runtime tools
+    NVMAObject object() const;
+};
+
+
+namespace detail {
+
+
+enum class ArgField : uint8_t {
+    Result,
+    Arg1,
+    Arg2,
+    Imm,
+};
+
+
+struct ArgDesc
+{
+    ArgField field;
+    uint8_t bits;
+    bool address;  // label is used as a byte offset, otherwise as a word
+};
+
+
+struct OpDesc
+{
+    std::string_view name;
+    Mnemonic op;
+    uint8_t size;
+    uint8_t argc;
+    std::array<ArgDesc, 3> args;
+};
+
+
+constexpr ArgDesc reg4(ArgField field) { return {field, 4, false}; }
+constexpr ArgDesc reg5(ArgField field) { return {field, 5, false}; }
+constexpr ArgDesc imm(uint8_t bits) { return {ArgField::Imm, bits, true}; }
+
+
+constexpr OpDesc packed(std::string_view name, Mnemonic op, uint8_t argc)
+{
+    return {name, op, 3, argc, {reg4(ArgField::Result), reg4(ArgField::Arg1), reg4(ArgField::Arg2)}};
+}
+
+
+// argument order as in asm/instruction.py
+constexpr OpDesc ops[] = {
+    {"LOAD_OP",   Mnemonic::LoadOp,   1, 1, {reg5(ArgField::Arg1)}},
+    {"STORE_OP",  Mnemonic::StoreOp,  1, 1, {reg5(ArgField::Result)}},
+    {"JL",        Mnemonic::Jl,       2, 2, {reg4(ArgField::Arg1), imm(8)}},
+    {"JZ",        Mnemonic::Jz,       2, 2, {reg4(ArgField::Arg1), imm(8)}},
+    {"LOAD_LOW",  Mnemonic::LoadLow,  2, 1, {imm(12)}},
+    {"LOAD_HIGH", Mnemonic::LoadHigh, 3, 1, {imm(20)}},
+    {"ADD",       Mnemonic::Add,      2, 3, {reg4(ArgField::Result), reg4(ArgField::Arg1), reg4(ArgField::Arg2)}},
+    {"SUB",       Mnemonic::Sub,      2, 3, {reg4(ArgField::Result), reg4(ArgField::Arg1), reg4(ArgField::Arg2)}},
+    {"AND",       Mnemonic::And,      2, 3, {reg4(ArgField::Result), reg4(ArgField::Arg1), reg4(ArgField::Arg2)}},
+    {"OR",        Mnemonic::Or,       2, 3, {reg4(ArgField::Result), reg4(ArgField::Arg1), reg4(ArgField::Arg2)}},
+    {"LS",        Mnemonic::Ls,       2, 3, {reg4(ArgField::Result), reg4(ArgField::Arg1), imm(4)}},
+    {"RS",        Mnemonic::Rs,       2, 3, {reg4(ArgField::Result), reg4(ArgField::Arg1), imm(4)}},
+    {"CALL",      Mnemonic::Call,     2, 3, {reg4(ArgField::Result), reg4(ArgField::Arg1), reg4(ArgField::Arg2)}},
+    {"PC_SWP",    Mnemonic::PcSwp,    2, 2, {reg5(ArgField::Result), reg5(ArgField::Arg1)}},
+    {"HALT",      Mnemonic::Halt,     1, 0, {}},
+    {"LOAD3",     Mnemonic::Load3,    1, 1, {imm(3)}},
+    packed("PADDUSB", Mnemonic::PAddUSB, 3),
+    packed("PSUBUSB", Mnemonic::PSubUSB, 3),
+    packed("PADDUSH", Mnemonic::PAddUSH, 3),
+    packed("PSUBUSH", Mnemonic::PSubUSH, 3),
+    packed("PMINUB",  Mnemonic::PMinUB,  3),
+    packed("PMAXUB",  Mnemonic::PMaxUB,  3),
+    packed("PMINUH",  Mnemonic::PMinUH,  3),
+    packed("PMAXUH",  Mnemonic::PMaxUH,  3),
+    packed("PSHUFB",  Mnemonic::PShufB,  3),
+    packed("POPCNT",  Mnemonic::PopCnt,  2),
+    {"LOAD_IND",  Mnemonic::LoadInd,  2, 1, {reg5(ArgField::Arg1)}},
+    {"STORE_IND", Mnemonic::StoreInd, 2, 1, {reg5(ArgField::Arg1)}},
+    // LOAD_LOW with the word of a data label, a pointer for LOAD_IND/STORE_IND
+    {"LOAD_REF",  Mnemonic::LoadLow,  2, 1, {{ArgField::Imm, 12, false}}},
+    {"LOAD_ROMB", Mnemonic::LoadRomB, 3, 2, {imm(8), reg5(ArgField::Arg1)}},
+    {"LOAD_ROMH", Mnemonic::LoadRomH, 3, 2, {imm(8), reg5(ArgField::Arg1)}},
+    {"LOAD_ROMW", Mnemonic::LoadRomW, 3, 2, {imm(8), reg5(ArgField::Arg1)}},
+};
+
+
+constexpr bool is_space(char c) { return c == ' ' or c == '\t' or c == '\r'; }
+constexpr bool is_digit(char c) { return c >= '0' and c <= '9'; }
+
+constexpr bool is_word(char c)
+{
+    return is_digit(c) or (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or c == '_';
+}
+
+constexpr bool is_word(std::string_view s)
+{
+    if (s.empty())
+        return false;
+    for (auto c : s)
+        if (not is_word(c))
+            return false;
+    return true;
+}
+
+constexpr char to_upper(char c) { return (c >= 'a' and c <= 'z') ? c - 'a' + 'A' : c; }
+
+constexpr bool equal_nocase(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (to_upper(a[i]) != to_upper(b[i]))
+            return false;
+    return true;
+}
+
+constexpr std::string_view trim(std::string_view s)
+{
+    while (s.size() and is_space(s.front()))
+        s.remove_prefix(1);
+    while (s.size() and is_space(s.back()))
+        s.remove_suffix(1);
+    return s;
+}
+
+
+class Assembler
+{
+public:
+    constexpr explicit Assembler(std::string_view source)
+        : source(source)
+    {
+        // the order matches the ram layout
+        add_label(AsmSection::Lr, "lr", 0, 4, true);
+        add_label(AsmSection::Code, "code", 0, 0, true);
+        add_label(AsmSection::Input, "input", 0, 0, true);
+        add_label(AsmSection::Output, "output", 0, 0, true);
+        add_label(AsmSection::Data, "data", 0, 0, true);
+        add_label(AsmSection::Rodata, "rodata", 0, 0, true);
+    }
+
+    constexpr AsmProgram run()
+    {
+        pass(false);
+        layout();
+        pass(true);
+
+        auto rodata = (size_t)AsmSection::Rodata;
+        for (size_t i = 0; i < prog.text.size(); i++)
+            prog.text[i] = (i < sizes[0] ? bytes[0][i]
+                            : i < bases[rodata] + sizes[rodata] ? bytes[rodata][i - bases[rodata]] : 0xFF);
+        for (size_t s = 1; s < 4; s++)
+            for (size_t i = 0; i < sizes[s]; i++) {
+                uint16_t pos = bases[s] + i;
+                prog.words[pos / word_bytes()] |= (uint64_t)bytes[s][i] << (pos % word_bytes() * 8);
+            }
+        return prog;
+    }
+
+private:
+    std::string_view source;
+    AsmProgram prog;
+    std::array<std::array<uint8_t, 256>, 5> bytes{};
+    std::array<uint16_t, 5> sizes{};
+    std::array<uint16_t, 5> bases{};
+
+    bool width_set = false;
+
+    // current line
+    size_t line = 0;
+    size_t section = 0;
+    std::array<uint16_t, 5> offsets{};
+
+    constexpr uint8_t word_bytes() const { return prog.width / 8; }
+
+    constexpr void add_label(AsmSection sec, std::string_view name, uint16_t pos, uint16_t size, bool region)
+    {
+        if (name.size() > max_label_name)
+            assembly_error(line, "Label name is too long", name);
+        if (prog.find(name))
+            assembly_error(line, "Duplicate label", name);
+        if (prog.label_count == max_labels)
+            assembly_error(line, "Too many labels", name);
+
+        auto& label = prog.labels[prog.label_count++];
+        for (size_t i = 0; i < name.size(); i++)
+            label.chars[i] = name[i];
+        label.length = name.size();
+        label.section = sec;
+        label.region = region;
+        label.pos = pos;
+        label.size = size;
+    }
+
+    constexpr void pass(bool emit)
+    {
+        line = 0;
+        section = (size_t)AsmSection::Code;
+        offsets = {};
+
+        std::string_view rest = source;
+        while (true) {
+            auto end = rest.find('\n');
+            auto text = rest.substr(0, end);
+            text = trim(text.substr(0, text.find(';')));
+            if (text.size())
+                process_line(text, emit);
+            if (end == rest.npos)
+                break;
+            rest.remove_prefix(end + 1);
+            line++;
+        }
+    }
+
+    constexpr void process_line(std::string_view text, bool emit)
+    {
+        if (text.front() == '.') {
+            auto name = text.substr(1);
+            if (name == "code")
+                section = (size_t)AsmSection::Code;
+            else if (name == "input")
+                section = (size_t)AsmSection::Input;
+            else if (name == "output")
+                section = (size_t)AsmSection::Output;
+            else if (name == "data")
+                section = (size_t)AsmSection::Data;
+            else if (name == "rodata")
+                section = (size_t)AsmSection::Rodata;
+            else
+                assembly_error(line, "Unknown section", name);
+            return;
+        }
+
+        if (text.back() == ':') {
+            auto name = text.substr(0, text.size() - 1);
+            if (not is_word(name))
+                assembly_error(line, "Syntax error", text);
+            if (not emit)
+                add_label((AsmSection)section, name, offsets[section], 0, false);
+            return;
+        }
+
+        size_t n = 0;
+        while (n < text.size() and is_word(text[n]))
+            n++;
+        auto name = text.substr(0, n);
+        if (name.empty() or (n < text.size() and not is_space(text[n])))
+            assembly_error(line, "Syntax error", text);
+
+        std::array<std::string_view, max_args> args{};
+        size_t argc = 0;
+        for (auto rest = trim(text.substr(n)); rest.size(); ) {
+            auto comma = rest.find(',');
+            auto arg = trim(rest.substr(0, comma));
+            if (not is_word(arg))
+                assembly_error(line, "Syntax error", text);
+            if (argc == args.size())
+                assembly_error(line, "Wrong number of arguments", name);
+            args[argc++] = arg;
+            if (comma == rest.npos)
+                break;
+            rest = rest.substr(comma + 1);
+            if (trim(rest).empty())
+                assembly_error(line, "Syntax error", text);
+        }
+
+        if (equal_nocase(name, "WIDTH")) {
+            if (argc != 1)
+                assembly_error(line, "Wrong number of arguments", name);
+            auto width = number(args[0]);
+            if (width != 16 and width != 32 and width != 64)
+                assembly_error(line, "Width must be 16, 32 or 64", args[0]);
+            if (not emit) {
+                if (width_set)
+                    assembly_error(line, "Duplicate WIDTH");
+                width_set = true;
+                prog.width = width;
+            }
+            return;
+        }
+
+        // EXPORT name, ... - labels visible to other objects for asm/linker.py, a single program ignores it
+        if (equal_nocase(name, "EXPORT")) {
+            if (argc == 0)
+                assembly_error(line, "Wrong number of arguments", name);
+            return;
+        }
+
+        if (equal_nocase(name, "MEMORY")) {
+            if (argc < 1 or argc > 3)
+                assembly_error(line, "Wrong number of arguments", name);
+            // MEMORY size, name, count - array of count cells
+            uint64_t size = (uint64_t)number(args[0]) * (argc == 3 ? number(args[2]) : 1);
+            auto pos = reserve(size);
+            if (not emit and argc >= 2)
+                add_label((AsmSection)section, args[1], pos, size, false);
+            return;
+        }
+
+        // BYTE/HALF/WORD v1, v2, ... - table of 1, 2 or 4 byte values for LOAD_ROMB/H/W
+        uint8_t item = (equal_nocase(name, "BYTE") ? 1 : equal_nocase(name, "HALF") ? 2
+                        : equal_nocase(name, "WORD") ? 4 : 0);
+        if (item) {
+            if (section != (size_t)AsmSection::Rodata)
+                assembly_error(line, "Data is only allowed in .rodata", name);
+            if (argc == 0)
+                assembly_error(line, "Wrong number of arguments", name);
+            auto pos = reserve(argc * item);
+            if (emit) {
+                for (size_t i = 0; i < argc; i++) {
+                    auto value = table_value(args[i], item);
+                    for (size_t b = 0; b < item; b++)
+                        bytes[section][pos + i * item + b] = value >> (b * 8);
+                }
+            }
+            return;
+        }
+
+        if (section == (size_t)AsmSection::Rodata)
+            assembly_error(line, "Instructions are not allowed in .rodata", name);
+
+        if (equal_nocase(name, "MOV")) {
+            if (argc != 2)
+                assembly_error(line, "Wrong number of arguments", name);
+            auto pos = reserve(2);
+            if (emit) {
+                Instruction load, store;
+                load.op = Mnemonic::LoadOp;
+                load.arg1 = resolve(args[1], reg5(ArgField::Arg1));
+                store.op = Mnemonic::StoreOp;
+                store.result = resolve(args[0], reg5(ArgField::Result));
+                encode_instruction(load, &bytes[section][pos]);
+                encode_instruction(store, &bytes[section][pos + 1]);
+            }
+            return;
+        }
+
+        for (auto& desc : ops) {
+            if (not equal_nocase(name, desc.name))
+                continue;
+            if (argc != desc.argc)
+                assembly_error(line, "Wrong number of arguments", name);
+            auto pos = reserve(desc.size);
+            if (emit) {
+                Instruction inst;
+                inst.op = desc.op;
+                for (size_t i = 0; i < argc; i++) {
+                    auto value = resolve(args[i], desc.args[i]);
+                    switch (desc.args[i].field)
+                    {
+                    case ArgField::Result: inst.result = value; break;
+                    case ArgField::Arg1: inst.arg1 = value; break;
+                    case ArgField::Arg2: inst.arg2 = value; break;
+                    case ArgField::Imm: inst.imm = value; break;
+                    }
+                }
+                // the encoder may write 3 bytes, the section can end earlier
+                std::array<uint8_t, 3> out{};
+                encode_instruction(inst, out.data());
+                for (size_t i = 0; i < desc.size; i++)
+                    bytes[section][pos + i] = out[i];
+            }
+            return;
+        }
+        assembly_error(line, "Unknown instruction", name);
+    }
+
+    // returns offset of the reserved bytes
+    constexpr uint16_t reserve(uint64_t size)
+    {
+        auto pos = offsets[section];
+        if (pos + size > 256)
+            assembly_error(line, "Section is bigger than 256 bytes");
+        offsets[section] += size;
+        return pos;
+    }
+
+    constexpr uint32_t number(std::string_view arg) const
+    {
+        if (not is_digit(arg.front()))
+            assembly_error(line, "Expected number", arg);
+
+        uint32_t base = 10;
+        if (arg.size() > 2 and arg[0] == '0' and (arg[1] == 'x' or arg[1] == 'X'))
+            base = 16;
+        else if (arg.size() > 2 and arg[0] == '0' and (arg[1] == 'b' or arg[1] == 'B'))
+            base = 2;
+        if (base != 10)
+            arg.remove_prefix(2);
+
+        uint64_t value = 0;
+        for (auto c : arg) {
+            uint32_t digit = base;
+            if (is_digit(c))
+                digit = c - '0';
+            else if (to_upper(c) >= 'A' and to_upper(c) <= 'F')
+                digit = to_upper(c) - 'A' + 10;
+            if (digit >= base)
+                assembly_error(line, "Bad number", arg);
+            value = value * base + digit;
+            if (value > UINT32_MAX)
+                assembly_error(line, "Number is too big", arg);
+        }
+        return value;
+    }
+
+    constexpr uint32_t resolve(std::string_view arg, ArgDesc desc) const
+    {
+        uint32_t value = 0;
+        if (is_digit(arg.front()))
+            value = number(arg);
+        else {
+            auto label = prog.find(arg);
+            if (not label)
+                assembly_error(line, "Label not found", arg);
+            value = (desc.address ? label->pos : label->pos / word_bytes());
+        }
+        if (value >> desc.bits)
+            assembly_error(line, "Argument overflow", arg);
+        return value;
+    }
+
+    // a text label gives its address, a ram label - its word
+    constexpr uint32_t table_value(std::string_view arg, uint8_t item) const
+    {
+        uint32_t value = 0;
+        if (is_digit(arg.front()))
+            value = number(arg);
+        else {
+            auto label = prog.find(arg);
+            if (not label)
+                assembly_error(line, "Label not found", arg);
+            bool text = (label->section == AsmSection::Code or label->section == AsmSection::Rodata);
+            value = (text ? label->pos : label->pos / word_bytes());
+        }
+        if (item < 4 and value >> (item * 8))
+            assembly_error(line, "Argument overflow", arg);
+        return value;
+    }
+
+    // positions of ram sections, labels become absolute
+    constexpr void layout()
+    {
+        sizes = offsets;
+        auto rodata = (size_t)AsmSection::Rodata;
+        if (sizes[0] + sizes[rodata] > 256)
+            assembly_error(line, "Text is bigger than 256 bytes");
+
+        bases[0] = 0;
+        bases[rodata] = sizes[0];
+        bases[1] = word_bytes();
+        bases[2] = bases[1] + sizes[1];
+        bases[3] = bases[2] + sizes[2];
+        if (bases[3] + sizes[3] > 32 * word_bytes())
+            assembly_error(line, "RAM is bigger than 32 words");
+
+        prog.text_size = sizes[0] + sizes[rodata];
+        prog.ram_size = bases[3] + sizes[3];
+        for (size_t i = 0; i < prog.label_count; i++) {
+            auto& label = prog.labels[i];
+            if (label.section == AsmSection::Lr) {
+                label.size = word_bytes();
+                continue;
+            }
+            auto s = (size_t)label.section;
+            if (label.region) {
+                label.pos = bases[s];
+                label.size = sizes[s];
+            }
+            else {
+                label.pos += bases[s];
+            }
+        }
+    }
+};
+
+
+} // namespace detail
+
+
+constexpr AsmProgram assemble(std::string_view source)
+{
+    return detail::Assembler(source).run();
+}
+
+
+inline NVMAObject AsmProgram::object() const
+{
+    NVMAObject obj;
+    obj.text.name = "text";
+    obj.ram.name = "ram";
+    obj.input.name = "input";
+    obj.output.name = "output";
+    obj.data.name = "data";
+
+    obj.width = width;
+    obj.text.data.assign(text.begin(), text.begin() + text_size);
+    for (size_t i = 0; i < ram_size; i++)
+        obj.ram.data.push_back(words[i / (width / 8)] >> (i % (width / 8) * 8));
+
+    NVMAObject::Section* sections[] = {&obj.text, &obj.input, &obj.output, &obj.data};
+    for (size_t i = 0; i < label_count; i++) {
+        auto& label = labels[i];
+        NVMAObject::Label l{std::string(label.name()), (uint8_t)label.pos, (uint8_t)label.size};
+        if (label.section == AsmSection::Code or label.section == AsmSection::Rodata) {
+            // text lists only its sections, as the compiler does, .rodata when it is used
+            if (label.region and (label.size or label.section == AsmSection::Code))
+                obj.text.labels[l.name] = l;
+        }
+        else if (label.section == AsmSection::Lr or label.region)
+            obj.ram.labels[l.name] = l;
+        else
+            sections[(size_t)label.section]->labels[l.name] = l;
+    }
+
+    for (auto sec : {&obj.input, &obj.output, &obj.data}) {
+        auto& region = obj.ram.labels.at(sec->name);
+        sec->data.assign(obj.ram.data.begin() + region.pos, obj.ram.data.begin() + region.pos + region.size);
+    }
+    return obj;
+}
+
+
+} // namespace nanovm
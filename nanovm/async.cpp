@@ -0,0 +1,193 @@
+#include "async.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+
+
+
+std::shared_ptr<const ProgramImage> ProgramImage::from_text(const std::vector<uint8_t>& text)
+{
+    if (text.size() > 256)
+        throw std::runtime_error("Text section is bigger than 256 bytes");
+
+    auto image = std::make_shared<ProgramImage>();
+    image->code.fill(0xFF);
+    std::copy(text.begin(), text.end(), image->code.begin());
+    return image;
+}
+
+
+struct AsyncVm
+{
+    std::shared_ptr<const ProgramImage> image;
+    VmResult state;
+    uint8_t pc;
+    std::promise<VmResult> done;
+    // number of the call the VM is suspended on, 0 while it runs;
+    // cleared by the one who resumes or fails the VM
+    std::atomic<uint64_t> waiting{0};
+};
+
+
+struct SchedulerState : std::enable_shared_from_this<SchedulerState>
+{
+    BatchHandler handler;
+    AsyncOptions options;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::deque<std::shared_ptr<AsyncVm>> ready;
+    std::map<uint32_t, std::vector<AsyncCall>> pending;
+    size_t pending_calls = 0;
+
+    void push_ready(std::shared_ptr<AsyncVm> vm)
+    {
+        {
+            std::lock_guard lock(mutex);
+            if (stopping)
+                return;
+            ready.push_back(std::move(vm));
+        }
+        wakeup.notify_one();
+    }
+
+    void run(std::shared_ptr<AsyncVm> vm)
+    {
+        auto& ram = vm->state.ram;
+        PendingCall call;
+        auto status = execute_until_call(ram.data(), vm->image->code.data(), vm->pc, call, options.quantum);
+
+        switch (status)
+        {
+        case ExecStatus::Halted:
+            vm->done.set_value(vm->state);
+            break;
+
+        case ExecStatus::Call: {
+            auto number = ++vm->state.calls;
+            vm->waiting = number;
+            std::lock_guard lock(mutex);
+            if (not stopping) {
+                pending[call.proc_id].push_back(AsyncCall(std::move(vm), shared_from_this(), call, number));
+                pending_calls++;
+            }
+            break;
+        }
+
+        case ExecStatus::Yield:
+            push_ready(std::move(vm));
+            break;
+        }
+    }
+
+    void handle(uint32_t proc_id, std::vector<AsyncCall> calls)
+    {
+        std::vector<std::pair<std::shared_ptr<AsyncVm>, uint64_t>> suspended;
+        for (auto& call : calls)
+            suspended.emplace_back(call.vm, call.number);
+        try {
+            handler(proc_id, std::move(calls));
+        }
+        catch (...) {
+            // the calls the handler has not completed fail their VMs, later complete() is ignored
+            auto error = std::current_exception();
+            for (auto& [vm, number] : suspended)
+                if (vm->waiting.compare_exchange_strong(number, 0))
+                    vm->done.set_exception(error);
+        }
+    }
+
+    void worker()
+    {
+        std::unique_lock lock(mutex);
+        while (true) {
+            wakeup.wait(lock, [&] { return stopping or ready.size() or pending.size(); });
+            if (stopping)
+                return;
+
+            // calls are collected while there are VMs to run and go out in batches
+            if (pending.size() and (ready.empty() or pending_calls >= options.max_batch)) {
+                auto batches = std::move(pending);
+                pending.clear();
+                pending_calls = 0;
+                lock.unlock();
+                for (auto& [proc_id, calls] : batches)
+                    handle(proc_id, std::move(calls));
+                lock.lock();
+                continue;
+            }
+
+            auto vm = std::move(ready.front());
+            ready.pop_front();
+            lock.unlock();
+            run(std::move(vm));
+            lock.lock();
+        }
+    }
+};
+
+
+void AsyncCall::complete(uint32_t result)
+{
+    if (not vm)
+        throw std::runtime_error("Call is already completed");
+
+    auto expected = number;
+    if (vm->waiting.compare_exchange_strong(expected, 0)) {
+        vm->state.ram[call.result] = result;
+        state->push_ready(std::move(vm));
+    }
+    vm.reset();
+    state.reset();
+}
+
+
+BatchHandler sync_handler(uint32_t (*proc)(uint32_t proc_id, uint32_t arg))
+{
+    return [proc] (uint32_t proc_id, std::vector<AsyncCall> calls) {
+        for (auto& call : calls)
+            call.complete(proc(proc_id, call.arg()));
+    };
+}
+
+
+AsyncScheduler::AsyncScheduler(BatchHandler handler, AsyncOptions options)
+    : state(std::make_shared<SchedulerState>())
+{
+    state->handler = std::move(handler);
+    state->options = options;
+    for (size_t i = 0; i < std::max<size_t>(1, options.workers); i++)
+        workers.emplace_back([state = state] { state->worker(); });
+}
+
+
+AsyncScheduler::~AsyncScheduler()
+{
+    {
+        std::lock_guard lock(state->mutex);
+        state->stopping = true;
+        state->ready.clear();
+        state->pending.clear();
+        state->pending_calls = 0;
+    }
+    state->wakeup.notify_all();
+    for (auto& w : workers)
+        w.join();
+}
+
+
+std::future<VmResult> AsyncScheduler::submit(std::shared_ptr<const ProgramImage> image, const Ram& ram, uint8_t start)
+{
+    auto vm = std::make_shared<AsyncVm>();
+    vm->image = std::move(image);
+    vm->state.ram = ram;
+    vm->pc = start;
+    auto future = vm->done.get_future();
+    state->push_ready(std::move(vm));
+    return future;
+}
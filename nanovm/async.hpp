@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "vmop.hpp"
+
+
+
+
+/*
+Асинхронное исполнение: CALL не вызывает хост синхронно, а приостанавливает VM.
+Приостановленные вызовы собираются в пачки по proc_id и отдаются обработчику,
+обработчик (сразу или позже, из любого потока) завершает каждый вызов через
+AsyncCall::complete(), после чего VM продолжает работу с сохраненного pc.
+Много VM разделяют небольшой пул рабочих потоков.
+*/
+
+
+using Ram = std::array<uint32_t, 32>;
+
+
+// text padded to 256 bytes + 4 with HALT, shared between VMs
+struct ProgramImage
+{
+    std::array<uint8_t, 256 + 4> code;
+
+    static std::shared_ptr<const ProgramImage> from_text(const std::vector<uint8_t>& text);
+};
+
+
+struct VmResult
+{
+    Ram ram;
+    uint64_t calls = 0;
+};
+
+
+struct AsyncVm;
+struct SchedulerState;
+
+
+// One suspended CALL, complete() must be called exactly once, from any thread.
+// Calls completed after the scheduler is destroyed or after their handler threw are ignored.
+class AsyncCall
+{
+public:
+    uint32_t proc_id() const { return call.proc_id; }
+    uint32_t arg() const { return call.arg; }
+
+    void complete(uint32_t result);
+
+    AsyncCall(AsyncCall&&) = default;
+    AsyncCall& operator=(AsyncCall&&) = default;
+
+private:
+    friend struct SchedulerState;
+
+    AsyncCall(std::shared_ptr<AsyncVm> vm, std::shared_ptr<SchedulerState> state, PendingCall call, uint64_t number)
+        : vm(std::move(vm))
+        , state(std::move(state))
+        , call(call)
+        , number(number)
+    {}
+
+    std::shared_ptr<AsyncVm> vm;
+    std::shared_ptr<SchedulerState> state;
+    PendingCall call;
+    uint64_t number; // of the call in the VM, from 1
+};
+
+
+// all pending calls of one proc_id; if the handler throws, the calls it has not completed yet
+// fail the futures of their VMs with the exception
+using BatchHandler = std::function<void (uint32_t proc_id, std::vector<AsyncCall> calls)>;
+
+// handler for synchronous host functions, every call is completed immediately
+BatchHandler sync_handler(uint32_t (*proc)(uint32_t proc_id, uint32_t arg));
+
+
+struct AsyncOptions
+{
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    // instructions per run of one VM before it goes back to the queue
+    uint32_t quantum = 4096;
+    // pending calls are handed to the handler when there is nothing to run or this many are collected
+    size_t max_batch = 64;
+};
+
+
+class AsyncScheduler
+{
+public:
+    explicit AsyncScheduler(BatchHandler handler, AsyncOptions options = AsyncOptions{});
+    ~AsyncScheduler();
+
+    AsyncScheduler(const AsyncScheduler&) = delete;
+    AsyncScheduler& operator=(const AsyncScheduler&) = delete;
+
+    std::future<VmResult> submit(std::shared_ptr<const ProgramImage> image, const Ram& ram, uint8_t start = 0);
+
+private:
+    std::shared_ptr<SchedulerState> state;
+    std::vector<std::thread> workers;
+};
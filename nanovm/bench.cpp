@@ -0,0 +1,542 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "assembler.hpp"
+#include "host.hpp"
+#include "imagecache.hpp"
+#include "isa.hpp"
+#include "runtime_compiler.hpp"
+#include "utils.hpp"
+#include "vmop.hpp"
+
+#include <nlohmann/json.hpp>
+
+
+
+
+/*
+Бенчмарки:
+```
+> op.*        - циклы из одной операции (ADD, JL, LOAD_LOW/LOAD_HIGH, PC_SWP, LOAD_ROMB, CALL), собираются без компилятора,
+>               CALL также через HostRegistry и StaticHost
+> program.*   - factorial.nvma и isatest.nvma целиком (factorial для нескольких n), собираются assembler.hpp
+> object.*    - разбор дампа объекта, compile/decompile через компилятор
+```
+Каждый бенчмарк повторяется repeats раз, один повтор крутит тело не меньше min_time.
+Результат - ns на элемент (инструкцию или операцию): среднее, отклонение и минимум.
+Программы и компилятор недоступны - бенчмарк пропускается.
+*/
+
+
+struct Benchmark
+{
+    std::string name;
+    std::string unit;
+    // one run, returns number of units
+    std::function<uint64_t()> body;
+};
+
+
+struct BenchResult
+{
+    std::string name;
+    std::string unit;
+    size_t repeats = 0;
+    double mean = 0;   // ns per unit
+    double stddev = 0;
+    double min = 0;
+
+    double per_second() const { return mean > 0 ? 1e9 / mean : 0; }
+};
+
+
+static uint32_t bench_proc(uint32_t proc_id, uint32_t arg)
+{
+    return proc_id + arg;
+}
+
+
+struct BenchHostContext
+{
+    uint32_t step = 1;
+};
+
+static uint32_t bench_host(BenchHostContext& ctx, uint32_t arg)
+{
+    return arg + ctx.step;
+}
+
+
+class CodeBuilder
+{
+public:
+    CodeBuilder()
+    {
+        code.fill(0xFF);
+        ram.fill(0);
+    }
+
+    uint8_t pc() const { return size; }
+
+    void emit(Instruction inst)
+    {
+        uint8_t out[4];
+        auto n = encode_instruction(inst, out);
+        if (size + n > 256)
+            throw std::runtime_error("Benchmark program is bigger than 256 bytes");
+        std::copy(out, out + n, code.begin() + size);
+        size += n;
+    }
+
+    void emit(Mnemonic op, uint8_t result, uint8_t arg1, uint8_t arg2, uint32_t imm = 0)
+    {
+        Instruction inst;
+        inst.op = op;
+        inst.result = result;
+        inst.arg1 = arg1;
+        inst.arg2 = arg2;
+        inst.imm = imm;
+        emit(inst);
+    }
+
+    std::array<uint8_t, 256> code;
+    std::array<uint32_t, 32> ram;
+    size_t size = 0;
+};
+
+
+// ram words used by the loops
+enum : uint8_t {
+    Counter = 1,
+    One     = 2,
+    Zero    = 3,
+    Acc     = 4,
+    Target  = 5,
+    Save    = 6,
+    Ret     = 7,
+};
+
+
+// body repeated `unroll` times inside a loop of `iterations`
+static CodeBuilder counted_loop(uint32_t iterations, size_t unroll, const std::function<void (CodeBuilder&)>& body)
+{
+    CodeBuilder b;
+    b.ram[Counter] = iterations;
+    b.ram[One] = 1;
+    auto start = b.pc();
+    for (size_t i = 0; i < unroll; i++)
+        body(b);
+    b.emit(Mnemonic::Sub, Counter, Counter, One);
+    b.emit(Mnemonic::LoadOp, 0, Zero, 0);
+    auto exit = b.pc() + 4;
+    b.emit(Mnemonic::Jz, 0, Counter, 0, exit);
+    b.emit(Mnemonic::Jz, 0, Zero, 0, start);
+    b.emit(Mnemonic::Halt, 0, 0, 0);
+    return b;
+}
+
+
+static Benchmark program_benchmark(const std::string& name, const std::array<uint8_t, 256>& code,
+                                   const std::array<uint32_t, 32>& image,
+                                   uint32_t (*proc)(uint32_t, uint32_t) = nullptr)
+{
+    // instructions are counted once, timed runs use the plain engine
+    std::array<uint32_t, 32> ram = image;
+    uint8_t pc = 0;
+    uint32_t steps = 0;
+    execute_bounded(ram.data(), code.data(), pc, proc, UINT32_MAX, steps);
+    uint64_t instructions = steps + 1;
+
+    return {name, "instruction", [=] {
+        auto ram = image;
+        execute(ram.data(), code.data(), 0, proc, nullptr);
+        return instructions;
+    }};
+}
+
+
+// the same with a host object instead of proc, host must outlive the benchmark
+template <typename Host>
+static Benchmark host_benchmark(const std::string& name, const std::array<uint8_t, 256>& code,
+                                const std::array<uint32_t, 32>& image, Host& host)
+{
+    std::array<uint32_t, 32> ram = image;
+    uint8_t pc = 0;
+    uint64_t instructions = 1;
+    while (execute_step(ram.data(), code.data(), pc, host))
+        instructions++;
+
+    return {name, "instruction", [=, &host] {
+        auto ram = image;
+        execute_host(ram.data(), code.data(), 0, host, nullptr);
+        return instructions;
+    }};
+}
+
+
+static std::array<uint32_t, 32> ram_image(const NVMAObject& obj)
+{
+    std::array<uint32_t, 32> ram = {0};
+    std::memcpy(ram.data(), obj.ram.data.data(), std::min(obj.ram.data.size(), sizeof(ram)));
+    return ram;
+}
+
+
+static std::array<uint8_t, 256> text_image(const NVMAObject& obj)
+{
+    if (obj.text.data.size() > 256)
+        throw std::runtime_error("Text section is bigger than 256 bytes");
+    std::array<uint8_t, 256> code;
+    code.fill(0xFF);
+    std::copy(obj.text.data.begin(), obj.text.data.end(), code.begin());
+    return code;
+}
+
+
+// private image cache directory, removed with the last benchmark using it
+struct BenchImageCache
+{
+    std::string dir;
+    std::shared_ptr<const SharedImage> published;
+
+    BenchImageCache()
+    {
+        char path[] = "/tmp/nanovm-bench-XXXXXX";
+        if (not mkdtemp(path))
+            throw std::runtime_error("Can't create a directory for the image cache");
+        dir = path;
+    }
+
+    ~BenchImageCache()
+    {
+        published.reset();
+        ImageCache(dir).evict_unused();
+        rmdir(dir.c_str());
+    }
+};
+
+
+std::vector<Benchmark> make_benchmarks(const std::string& dir)
+{
+    std::vector<Benchmark> out;
+    const uint32_t iterations = 1000;
+
+    auto add_chain = counted_loop(iterations, 16, [] (CodeBuilder& b) {
+        b.emit(Mnemonic::Add, Acc, Acc, One);
+    });
+    out.push_back(program_benchmark("op.add_chain", add_chain.code, add_chain.ram));
+
+    {
+        // ADD i, i, one; LOAD_OP i; JL n, loop
+        CodeBuilder b;
+        b.ram[Counter] = iterations * 16;
+        b.ram[One] = 1;
+        b.emit(Mnemonic::Add, Acc, Acc, One);
+        b.emit(Mnemonic::LoadOp, 0, Acc, 0);
+        b.emit(Mnemonic::Jl, 0, Counter, 0, 0);
+        b.emit(Mnemonic::Halt, 0, 0, 0);
+        out.push_back(program_benchmark("op.jl_loop", b.code, b.ram));
+    }
+
+    auto load1 = counted_loop(iterations, 8, [] (CodeBuilder& b) {
+        b.emit(Mnemonic::LoadLow, 0, 0, 0, 0x123);
+        b.emit(Mnemonic::LoadHigh, 0, 0, 0, 0x45678);
+    });
+    out.push_back(program_benchmark("op.load1_pairs", load1.code, load1.ram));
+
+    {
+        // the subroutine just returns, it is placed after HALT
+        auto b = counted_loop(iterations, 8, [] (CodeBuilder& b) {
+            b.emit(Mnemonic::PcSwp, Ret, Target, 0);
+        });
+        b.ram[Target] = b.pc();
+        b.emit(Mnemonic::PcSwp, Save, Ret, 0);
+        out.push_back(program_benchmark("op.pc_swp_ping_pong", b.code, b.ram));
+    }
+
+    {
+        // dependent lookups acc = table[acc], the 16-byte table lives after HALT
+        const uint8_t table = 0xF0;
+        auto b = counted_loop(iterations, 8, [=] (CodeBuilder& b) {
+            b.emit(Mnemonic::LoadRomB, 0, Acc, 0, table);
+            b.emit(Mnemonic::StoreOp, Acc, 0, 0);
+        });
+        for (uint8_t i = 0; i < 16; i++)
+            b.code[table + i] = (i * 7 + 3) & 15;
+        out.push_back(program_benchmark("op.rom_lookup", b.code, b.ram));
+    }
+
+    auto call = counted_loop(iterations, 8, [] (CodeBuilder& b) {
+        b.emit(Mnemonic::Call, Acc, Acc, One);
+    });
+    out.push_back(program_benchmark("op.call_round_trip", call.code, call.ram, bench_proc));
+
+    {
+        // proc_id is ram[One] = 1, the first registered function
+        static BenchHostContext context;
+        static HostRegistry<uint32_t> registry;
+        static StaticHost<uint32_t, BenchHostContext, bench_host> fixed{context, {"step"}};
+        if (not registry.id("step"))
+            registry.add<bench_host>("step", context);
+        auto call_id = counted_loop(iterations, 8, [] (CodeBuilder& b) {
+            b.emit(Mnemonic::Call, Acc, One, Acc);
+        });
+        out.push_back(program_benchmark("op.call_proc", call_id.code, call_id.ram, bench_proc));
+        out.push_back(host_benchmark("op.call_registry", call_id.code, call_id.ram, registry));
+        out.push_back(host_benchmark("op.call_static_host", call_id.code, call_id.ram, fixed));
+    }
+
+    {
+        NVMAObject obj;
+        obj.text = {"text", std::vector<uint8_t>(add_chain.code.begin(), add_chain.code.begin() + add_chain.size), {}};
+        obj.ram = {"ram", std::vector<uint8_t>(128), {}};
+        std::memcpy(obj.ram.data.data(), add_chain.ram.data(), 128);
+        obj.input = {"input", {}, {{"counter", {"counter", Counter * 4, 4}}}};
+        obj.output = {"output", {}, {{"acc", {"acc", Acc * 4, 4}}}};
+        obj.data = {"data", {}, {{"one", {"one", One * 4, 4}}, {"zero", {"zero", Zero * 4, 4}}}};
+        auto dump = obj.dump();
+        out.push_back({"object.parse", "object", [dump] {
+            auto parsed = parse_nvma_object(dump);
+            return (uint64_t)(parsed.text.data.size() ? 1 : 0);
+        }});
+        // cold start of a worker: parse and verify the object, or map the image another process published
+        out.push_back({"object.load_verified", "object", [dump] {
+            return (uint64_t)(VerifiedImage::load(parse_nvma_object(dump)).text_size ? 1 : 0);
+        }});
+        try {
+            auto cache = std::make_shared<BenchImageCache>();
+            cache->published = ImageCache(cache->dir).get(obj);
+            out.push_back({"object.map_cached", "object", [cache, dump] {
+                return (uint64_t)(ImageCache(cache->dir).find(dump) ? 1 : 0);
+            }});
+        }
+        catch (const std::exception& err) {
+            std::cerr << "Skipped image cache benchmark: " << err.what() << std::endl;
+        }
+    }
+
+    // the fixtures go through the C++ assembler, the program benchmarks don't need the compiler service
+    auto source = load_file(dir + "/factorial.nvma");
+    auto factorial = nanovm::assemble(source).object();
+    auto code = text_image(factorial);
+    for (uint32_t n : {1, 5, 12}) {
+        auto ram = ram_image(factorial);
+        ram[factorial.input.labels.at("n").pos / 4] = n;
+        out.push_back(program_benchmark("program.factorial.n" + std::to_string(n), code, ram));
+    }
+
+    auto isatest = nanovm::assemble(load_file(dir + "/isatest.nvma")).object();
+    parse_sections_file(isatest, load_file(dir + "/isatest_input.json"));
+    out.push_back(program_benchmark("program.isatest", text_image(isatest), ram_image(isatest)));
+
+    try {
+        auto compiled = compile(source);
+        out.push_back({"object.compile", "object", [source] {
+            return (uint64_t)(compile(source).text.data.size() ? 1 : 0);
+        }});
+        out.push_back({"object.decompile", "object", [compiled] {
+            return (uint64_t)(decompile(compiled).size() ? 1 : 0);
+        }});
+    }
+    catch (const std::exception& err) {
+        std::cerr << "Skipped compiler benchmarks: " << err.what() << std::endl;
+    }
+
+    return out;
+}
+
+
+BenchResult measure(const Benchmark& bench, size_t repeats, double min_time)
+{
+    using clock = std::chrono::steady_clock;
+
+    // warm up and find how many runs fill min_time
+    uint64_t runs = 1;
+    while (true) {
+        auto start = clock::now();
+        for (uint64_t i = 0; i < runs; i++)
+            bench.body();
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        if (elapsed >= min_time or runs >= (1ull << 30))
+            break;
+        runs *= (elapsed > 0 ? std::min<uint64_t>(10, std::ceil(min_time / elapsed)) : 10);
+    }
+
+    std::vector<double> samples;
+    for (size_t r = 0; r < repeats; r++) {
+        uint64_t units = 0;
+        auto start = clock::now();
+        for (uint64_t i = 0; i < runs; i++)
+            units += bench.body();
+        double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        samples.push_back(ns / std::max<uint64_t>(units, 1));
+    }
+
+    BenchResult result;
+    result.name = bench.name;
+    result.unit = bench.unit;
+    result.repeats = repeats;
+    for (auto s : samples)
+        result.mean += s;
+    result.mean /= samples.size();
+    for (auto s : samples)
+        result.stddev += (s - result.mean) * (s - result.mean);
+    result.stddev = std::sqrt(result.stddev / samples.size());
+    result.min = *std::min_element(samples.begin(), samples.end());
+    return result;
+}
+
+
+nlohmann::json to_json(const std::vector<BenchResult>& results)
+{
+    nlohmann::json out = nlohmann::json::object();
+    for (auto& r : results) {
+        out[r.name] = {
+            {"unit", r.unit},
+            {"repeats", r.repeats},
+            {"ns_per_unit", r.mean},
+            {"ns_per_unit_stddev", r.stddev},
+            {"ns_per_unit_min", r.min},
+            {"units_per_second", r.per_second()},
+        };
+    }
+    return nlohmann::json{{"benchmarks", out}};
+}
+
+
+struct Arguments
+{
+    std::string dir = ".";
+    std::string filter;
+    std::string json_output;
+    std::string baseline;
+    size_t repeats = 10;
+    double min_time = 0.05;
+    double threshold = 5;
+    int cpu = 0;
+};
+
+
+Arguments parse_args(int argc, char* argv[])
+{
+    Arguments args;
+    auto proc = [&] (char opt, const std::string& value)
+    {
+        switch (opt) {
+        case 'd':
+            args.dir = value;
+            break;
+
+        case 'f':
+            args.filter = value;
+            break;
+
+        case 'o':
+            args.json_output = value;
+            break;
+
+        case 'B':
+            args.baseline = value;
+            break;
+
+        case 'r':
+            args.repeats = std::max(1, std::stoi(value));
+            break;
+
+        case 't':
+            args.threshold = std::stod(value);
+            break;
+
+        case 'm':
+            args.min_time = std::stod(value) / 1000;
+            break;
+
+        case 'c':
+            args.cpu = std::stoi(value);
+            break;
+        }
+    };
+
+    parse_args("d:f:o:B:r:t:m:c:", argc, argv, proc);
+
+    return args;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try {
+        auto args = parse_args(argc, argv);
+
+        if (args.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(args.cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set))
+                std::cerr << "Can't pin to cpu " << args.cpu << ", running unpinned" << std::endl;
+        }
+
+        std::vector<BenchResult> results;
+        std::cout << std::left << std::setw(28) << "benchmark" << std::right
+                  << std::setw(12) << "ns/unit" << std::setw(10) << "stddev"
+                  << std::setw(12) << "min" << std::setw(16) << "units/s" << "  unit" << std::endl;
+        for (auto& bench : make_benchmarks(args.dir)) {
+            if (bench.name.find(args.filter) == std::string::npos)
+                continue;
+            auto r = measure(bench, args.repeats, args.min_time);
+            results.push_back(r);
+            std::cout << std::left << std::setw(28) << r.name << std::right << std::fixed
+                      << std::setprecision(3) << std::setw(12) << r.mean
+                      << std::setprecision(1) << std::setw(9) << (r.mean > 0 ? 100 * r.stddev / r.mean : 0) << "%"
+                      << std::setprecision(3) << std::setw(12) << r.min
+                      << std::setprecision(0) << std::setw(16) << r.per_second()
+                      << "  " << r.unit << std::endl;
+        }
+
+        auto json = to_json(results);
+        if (args.json_output.size()) {
+            std::ofstream out(args.json_output);
+            if (not out)
+                throw std::runtime_error("Can't write " + args.json_output);
+            out << json.dump(4) << std::endl;
+        }
+
+        if (args.baseline.empty())
+            return 0;
+
+        // regression: best run is slower than the best baseline run by more than threshold
+        // and than the noise of both runs
+        auto baseline = nlohmann::json::parse(load_file(args.baseline)).at("benchmarks");
+        bool regressed = false;
+        std::cout << std::endl << "Compared with " << args.baseline << ":" << std::endl;
+        for (auto& r : results) {
+            if (not baseline.contains(r.name)) {
+                std::cout << std::left << std::setw(28) << r.name << "  not in baseline" << std::endl;
+                continue;
+            }
+            auto& base = baseline[r.name];
+            double base_min = base.at("ns_per_unit_min").get<double>();
+            double noise = base.at("ns_per_unit_stddev").get<double>() + r.stddev;
+            double change = (base_min > 0 ? 100 * (r.min - base_min) / base_min : 0);
+            bool slower = change > args.threshold and r.min - base_min > noise;
+            regressed |= slower;
+            std::cout << std::left << std::setw(28) << r.name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(9) << std::showpos << change << "%" << std::noshowpos
+                      << (slower ? "  REGRESSION" : "") << std::endl;
+        }
+        return regressed ? 3 : 0;
+    }
+    catch (const std::exception& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+}
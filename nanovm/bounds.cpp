@@ -0,0 +1,740 @@
+#include "bounds.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <optional>
+#include <set>
+
+#include "utils.hpp"
+
+
+
+
+static uint64_t saturating_add(uint64_t a, uint64_t b)
+{
+    return (a > UINT64_MAX - b ? UINT64_MAX : a + b);
+}
+
+
+static uint64_t saturating_mul(uint64_t a, uint64_t b)
+{
+    return (a and b > UINT64_MAX / a ? UINT64_MAX : a * b);
+}
+
+
+Bound Bound::constant(uint64_t value)
+{
+    Bound b;
+    if (value)
+        b.terms[{}] = value;
+    return b;
+}
+
+
+Bound Bound::variable(const std::string& name)
+{
+    Bound b;
+    b.terms[{name}] = 1;
+    return b;
+}
+
+
+Bound Bound::operator+(const Bound& other) const
+{
+    auto out = *this;
+    for (auto& [monomial, coeff] : other.terms)
+        out.terms[monomial] = saturating_add(out.terms[monomial], coeff);
+    return out;
+}
+
+
+Bound Bound::operator*(const Bound& other) const
+{
+    Bound out;
+    for (auto& [m1, c1] : terms) {
+        for (auto& [m2, c2] : other.terms) {
+            auto monomial = m1;
+            monomial.insert(monomial.end(), m2.begin(), m2.end());
+            std::sort(monomial.begin(), monomial.end());
+            out.terms[monomial] = saturating_add(out.terms[monomial], saturating_mul(c1, c2));
+        }
+    }
+    return out;
+}
+
+
+Bound Bound::max(const Bound& a, const Bound& b)
+{
+    auto out = a;
+    for (auto& [monomial, coeff] : b.terms)
+        out.terms[monomial] = std::max(out.terms[monomial], coeff);
+    return out;
+}
+
+
+uint64_t Bound::evaluate(const std::map<std::string, uint64_t>& values) const
+{
+    uint64_t sum = 0;
+    for (auto& [monomial, coeff] : terms) {
+        uint64_t term = coeff;
+        for (auto& name : monomial) {
+            if (not values.count(name))
+                throw std::runtime_error("Value of " + name + " is not set");
+            term = saturating_mul(term, values.at(name));
+        }
+        sum = saturating_add(sum, term);
+    }
+    return sum;
+}
+
+
+bool Bound::is_constant() const
+{
+    return terms.empty() or (terms.size() == 1 and terms.begin()->first.empty());
+}
+
+
+std::string Bound::str() const
+{
+    std::vector<std::pair<std::vector<std::string>, uint64_t>> sorted(terms.begin(), terms.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [] (auto& a, auto& b) {
+        return a.first.size() > b.first.size();
+    });
+
+    std::string out;
+    for (auto& [monomial, coeff] : sorted) {
+        std::string term;
+        if (coeff != 1 or monomial.empty())
+            term = std::to_string(coeff);
+        for (size_t i = 0; i < monomial.size(); ) {
+            size_t j = i;
+            while (j < monomial.size() and monomial[j] == monomial[i])
+                j++;
+            term += (term.size() ? "*" : "") + monomial[i];
+            if (j - i > 1)
+                term += "^" + std::to_string(j - i);
+            i = j;
+        }
+        out += (out.size() ? " + " : "") + term;
+    }
+    return out.size() ? out : "0";
+}
+
+
+
+
+namespace {
+
+
+constexpr size_t max_defs = 32 + 256;
+using DefSet = std::bitset<max_defs>;
+
+
+constexpr uint8_t any_word = 32;
+
+
+struct Def
+{
+    size_t block;    // npos - value at program start
+    size_t index;
+    uint8_t reg;     // any_word - STORE_IND, may be a def of every word
+};
+
+
+struct Counter
+{
+    bool down;
+    uint8_t reg;
+    size_t step_def;
+    size_t test_block;
+    uint8_t bound_reg = 0; // up counters
+    bool decrement_first = false; // down counter decremented before the test
+    bool wraps = false;           // ... and it may start at 0, then it wraps around
+};
+
+
+class WcetAnalyzer
+{
+public:
+    WcetAnalyzer(const NVMAObject& obj)
+        : obj(obj)
+        , cfg(analyze(obj))
+        , inputs(input_variables(obj))
+    {
+        for (size_t i = 0; i < 32 and i * 4 + 4 <= obj.ram.data.size(); i++)
+            std::memcpy(&image[i], obj.ram.data.data() + i * 4, 4);
+    }
+
+    WcetResult run();
+
+private:
+    const NVMAObject& obj;
+    std::shared_ptr<const ControlFlowGraph> cfg;
+    std::map<uint8_t, std::string> inputs;
+    uint32_t image[32] = {0};
+
+    std::vector<Def> defs;
+    std::vector<std::vector<size_t>> def_at;
+    std::array<DefSet, 32> defs_of_reg;
+    DefSet indirect_defs;   // reach every word, killed by nothing
+    std::vector<DefSet> reach_in;
+
+    std::map<size_t, Counter> counters;      // loop index -> counter
+    std::map<size_t, size_t> step_defs;      // def -> loop index
+    std::set<size_t> tracing;
+
+    void reaching_definitions();
+    std::vector<size_t> reaching(uint8_t reg, size_t block, size_t index);
+    std::optional<uint8_t> indirect_word(size_t def);
+
+    bool in_loop(size_t loop, size_t block) const
+    {
+        auto& blocks = cfg->loops[loop].blocks;
+        return std::binary_search(blocks.begin(), blocks.end(), block);
+    }
+
+    std::optional<uint32_t> exact(uint8_t reg, size_t block, size_t index);
+    bool nonzero(uint8_t reg, size_t block, size_t index, size_t except);
+    std::optional<Bound> upper(uint8_t reg, size_t block, size_t index);
+    std::optional<Bound> upper_def(size_t def);
+
+    std::optional<Counter> find_counter(size_t loop, std::string& reason);
+};
+
+
+void WcetAnalyzer::reaching_definitions()
+{
+    for (uint8_t r = 0; r < 32; r++) {
+        defs.push_back({BasicBlock::npos, 0, r});
+        defs_of_reg[r].set(r);
+    }
+
+    auto& blocks = cfg->blocks;
+    def_at.resize(blocks.size());
+    std::vector<DefSet> gen(blocks.size()), kill(blocks.size());
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (size_t i = 0; i < blocks[b].code.size(); i++) {
+            auto& inst = blocks[b].code[i];
+            def_at[b].push_back(BasicBlock::npos);
+            if (instruction_info[(uint8_t)inst.op].indirect_write) {
+                def_at[b][i] = defs.size();
+                indirect_defs.set(defs.size());
+                defs.push_back({b, i, any_word});
+                continue;
+            }
+            auto writes = written_registers(inst);
+            for (uint8_t r = 0; r < 32; r++) {
+                if (not (writes & (1u << r)))
+                    continue;
+                auto id = defs.size();
+                defs.push_back({b, i, r});
+                defs_of_reg[r].set(id);
+                def_at[b][i] = id;
+            }
+        }
+    }
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (size_t i = 0; i < blocks[b].code.size(); i++) {
+            auto id = def_at[b][i];
+            if (id == BasicBlock::npos)
+                continue;
+            auto reg = defs[id].reg;
+            if (reg != any_word) {
+                gen[b] &= ~defs_of_reg[reg];
+                kill[b] |= defs_of_reg[reg];
+            }
+            gen[b].set(id);
+        }
+    }
+
+    reach_in.assign(blocks.size(), DefSet());
+    std::vector<DefSet> reach_out(blocks.size());
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto b : cfg->rpo) {
+            DefSet in;
+            if (b == cfg->rpo.front())
+                for (uint8_t r = 0; r < 32; r++)
+                    in.set(r);
+            for (auto pred : blocks[b].predecessors)
+                if (blocks[pred].reachable)
+                    in |= reach_out[pred];
+            auto out = gen[b] | (in & ~kill[b]);
+            if (in != reach_in[b] or out != reach_out[b]) {
+                reach_in[b] = in;
+                reach_out[b] = out;
+                changed = true;
+            }
+        }
+    }
+}
+
+
+std::vector<size_t> WcetAnalyzer::reaching(uint8_t reg, size_t block, size_t index)
+{
+    // indirect stores before the nearest def in the block are added to it,
+    // the ones with a known pointer only when they write reg; a store whose pointer
+    // is being resolved is assumed not to write it, indirect_word() checks that
+    auto may_write = [&] (size_t id) {
+        if (tracing.count(id))
+            return reg != cfg->blocks[defs[id].block].code[defs[id].index].arg1;
+        auto word = indirect_word(id);
+        return not word or *word == reg;
+    };
+    std::vector<size_t> out;
+    for (size_t i = index; i-- > 0; ) {
+        auto id = def_at[block][i];
+        if (id == BasicBlock::npos)
+            continue;
+        if (defs[id].reg == any_word) {
+            if (may_write(id))
+                out.push_back(id);
+        }
+        else if (defs[id].reg == reg) {
+            out.push_back(id);
+            return out;
+        }
+    }
+    auto set = reach_in[block] & (defs_of_reg[reg] | indirect_defs);
+    for (size_t id = 0; id < defs.size(); id++)
+        if (set.test(id) and (defs[id].reg != any_word or may_write(id)))
+            out.push_back(id);
+    return out;
+}
+
+
+std::optional<uint8_t> WcetAnalyzer::indirect_word(size_t id)
+{
+    // the word of a STORE_IND whose pointer is the same constant on every path
+    if (tracing.count(id))
+        return std::nullopt;
+    auto& def = defs[id];
+    tracing.insert(id);
+    auto pointer = cfg->blocks[def.block].code[def.index].arg1;
+    auto ptr = exact(pointer, def.block, def.index);
+    tracing.erase(id);
+    if (not ptr or (*ptr & 31) == pointer)
+        return std::nullopt;
+    return *ptr & 31;
+}
+
+
+std::optional<uint32_t> WcetAnalyzer::exact(uint8_t reg, size_t block, size_t index)
+{
+    std::optional<uint32_t> value;
+    for (auto id : reaching(reg, block, index)) {
+        if (tracing.count(id))
+            return std::nullopt;
+
+        std::optional<uint32_t> v;
+        auto& def = defs[id];
+        if (def.block == BasicBlock::npos) {
+            if (not inputs.count(reg))
+                v = image[reg];
+        }
+        else {
+            auto& inst = cfg->blocks[def.block].code[def.index];
+            tracing.insert(id);
+            switch (inst.op)
+            {
+            case Mnemonic::LoadLow:
+            case Mnemonic::Load3:
+                v = inst.imm;
+                break;
+            case Mnemonic::LoadOp:
+                v = exact(inst.arg1, def.block, def.index);
+                break;
+            case Mnemonic::StoreOp:
+                v = exact(0, def.block, def.index);
+                break;
+            default:
+                break;
+            }
+            tracing.erase(id);
+        }
+
+        if (not v or (value and *value != *v))
+            return std::nullopt;
+        value = v;
+    }
+    return value;
+}
+
+
+bool WcetAnalyzer::nonzero(uint8_t reg, size_t block, size_t index, size_t except)
+{
+    // every def but except is a non-zero constant, a copy of one or an OR with one
+    for (auto id : reaching(reg, block, index)) {
+        if (id == except)
+            continue;
+        if (tracing.count(id))
+            return false;
+
+        bool v = false;
+        auto& def = defs[id];
+        if (def.block == BasicBlock::npos) {
+            v = not inputs.count(reg) and image[reg] != 0;
+        }
+        else {
+            auto& inst = cfg->blocks[def.block].code[def.index];
+            auto arg = [&] (uint8_t r) { return nonzero(r, def.block, def.index, except); };
+            tracing.insert(id);
+            switch (inst.op)
+            {
+            case Mnemonic::LoadLow:
+            case Mnemonic::Load3:
+                v = inst.imm != 0;
+                break;
+            case Mnemonic::LoadHigh:
+                v = inst.imm != 0 or arg(0);
+                break;
+            case Mnemonic::LoadOp:
+                v = arg(inst.arg1);
+                break;
+            case Mnemonic::StoreOp:
+                v = arg(0);
+                break;
+            case Mnemonic::Or:
+                v = arg(inst.arg1) or arg(inst.arg2);
+                break;
+            default:
+                break;
+            }
+            tracing.erase(id);
+        }
+        if (not v)
+            return false;
+    }
+    return true;
+}
+
+
+std::optional<Bound> WcetAnalyzer::upper(uint8_t reg, size_t block, size_t index)
+{
+    Bound out;
+    for (auto id : reaching(reg, block, index)) {
+        auto b = upper_def(id);
+        if (not b)
+            return std::nullopt;
+        out = Bound::max(out, *b);
+    }
+    return out;
+}
+
+
+std::optional<Bound> WcetAnalyzer::upper_def(size_t id)
+{
+    auto& def = defs[id];
+    if (def.block == BasicBlock::npos) {
+        if (inputs.count(def.reg))
+            return Bound::variable(inputs.at(def.reg));
+        return Bound::constant(image[def.reg]);
+    }
+
+    // counters: decrement never goes above the initial value, increment - above the bound
+    if (step_defs.count(id)) {
+        auto& counter = counters.at(step_defs.at(id));
+        if (counter.down)
+            return Bound();
+        auto& test = cfg->blocks[counter.test_block];
+        return upper(counter.bound_reg, counter.test_block, test.code.size() - 1);
+    }
+
+    if (tracing.count(id))
+        return std::nullopt;
+    tracing.insert(id);
+
+    auto& inst = cfg->blocks[def.block].code[def.index];
+    auto arg = [&] (uint8_t reg) { return upper(reg, def.block, def.index); };
+
+    std::optional<Bound> out;
+    switch (inst.op)
+    {
+    case Mnemonic::LoadLow:
+    case Mnemonic::Load3:
+        out = Bound::constant(inst.imm);
+        break;
+    case Mnemonic::LoadHigh:
+        out = Bound::constant(((uint64_t)inst.imm << 12) | 0xFFF);
+        break;
+    case Mnemonic::LoadOp:
+        out = arg(inst.arg1);
+        break;
+    case Mnemonic::StoreOp:
+        out = arg(0);
+        break;
+    case Mnemonic::PcSwp:
+        out = Bound::constant((uint8_t)(cfg->blocks[def.block].pcs[def.index] + 2));
+        break;
+    case Mnemonic::Add:
+    case Mnemonic::Or: {
+        auto a = arg(inst.arg1);
+        auto b = arg(inst.arg2);
+        if (a and b)
+            out = *a + *b;
+        break;
+    }
+    case Mnemonic::And: {
+        out = arg(inst.arg1);
+        if (not out)
+            out = arg(inst.arg2);
+        break;
+    }
+    case Mnemonic::Ls: {
+        auto a = arg(inst.arg1);
+        if (a)
+            out = *a * Bound::constant(1ull << inst.imm);
+        break;
+    }
+    case Mnemonic::Rs:
+        out = arg(inst.arg1);
+        break;
+    case Mnemonic::PopCnt:
+        out = Bound::constant(32);
+        break;
+    // a table entry is bounded by its width whatever the index
+    case Mnemonic::LoadRomB:
+        out = Bound::constant(0xFF);
+        break;
+    case Mnemonic::LoadRomH:
+        out = Bound::constant(0xFFFF);
+        break;
+    default:
+        break;
+    }
+
+    tracing.erase(id);
+    return out;
+}
+
+
+std::optional<Counter> WcetAnalyzer::find_counter(size_t loop_index, std::string& reason)
+{
+    auto& loop = cfg->loops[loop_index];
+    auto& blocks = cfg->blocks;
+
+    auto dominates_latches = [&] (size_t block) {
+        for (auto latch : loop.latches)
+            if (not cfg->dominates(block, latch))
+                return false;
+        return true;
+    };
+
+    reason = "no counted exit";
+    for (auto t : loop.blocks) {
+        auto& test = blocks[t];
+        auto& jump = test.code.back();
+        if (jump.op != Mnemonic::Jz and jump.op != Mnemonic::Jl)
+            continue;
+        if (test.loop != loop_index or not dominates_latches(t))
+            continue;
+
+        auto taken = cfg->block_at[(uint8_t)jump.imm];
+        auto fallthrough = cfg->block_at[(uint8_t)test.end];
+        bool taken_exits = (taken == BasicBlock::npos or not in_loop(loop_index, taken));
+        bool fallthrough_exits = (fallthrough == BasicBlock::npos or not in_loop(loop_index, fallthrough));
+        if (taken_exits == fallthrough_exits)
+            continue;
+
+        size_t last = test.code.size() - 1;
+        Counter counter;
+        counter.test_block = t;
+        counter.down = (jump.op == Mnemonic::Jz);
+
+        if (counter.down) {
+            if (not taken_exits)
+                continue;
+            if (jump.arg1 != 0 and exact(0, t, last) == 0u)
+                counter.reg = jump.arg1;
+            else if (exact(jump.arg1, t, last) == 0u)
+                counter.reg = 0;
+            else
+                continue;
+        }
+        else {
+            if (not fallthrough_exits or last == 0 or jump.arg1 == 0)
+                continue;
+            auto& load = test.code[last - 1];
+            if (load.op != Mnemonic::LoadOp or load.arg1 == 0 or load.arg1 == jump.arg1)
+                continue;
+            counter.reg = load.arg1;
+            counter.bound_reg = jump.arg1;
+        }
+
+        // the only write of the counter in the loop is the step by one,
+        // executed exactly once per iteration
+        uint32_t watched = (1u << counter.reg) | (counter.down ? 0 : 1u << counter.bound_reg);
+        std::vector<size_t> writes;
+        int clobber = -1;
+        for (auto b : loop.blocks) {
+            for (size_t i = 0; i < blocks[b].code.size(); i++) {
+                auto id = def_at[b][i];
+                if (id != BasicBlock::npos and defs[id].reg == any_word) {
+                    auto word = indirect_word(id);
+                    if (not word or (watched & (1u << *word)))
+                        clobber = blocks[b].pcs[i];
+                }
+                else if (written_registers(blocks[b].code[i]) & watched) {
+                    writes.push_back(id);
+                }
+            }
+        }
+        if (clobber >= 0) {
+            reason = "STORE_IND at " + fhex(clobber, 2) + " may overwrite counter " + std::to_string(counter.reg);
+            continue;
+        }
+        if (writes.size() != 1 or defs[writes[0]].reg != counter.reg) {
+            reason = "counter " + std::to_string(counter.reg) + " is written more than once per iteration";
+            continue;
+        }
+
+        auto& step_def = defs[writes[0]];
+        auto& step = blocks[step_def.block].code[step_def.index];
+        uint8_t other;
+        if (counter.down) {
+            if (step.op != Mnemonic::Sub or step.result != counter.reg or step.arg1 != counter.reg)
+                continue;
+            other = step.arg2;
+        }
+        else {
+            if (step.op != Mnemonic::Add or step.result != counter.reg
+                    or (step.arg1 != counter.reg and step.arg2 != counter.reg))
+                continue;
+            other = (step.arg1 == counter.reg ? step.arg2 : step.arg1);
+        }
+        if (exact(other, step_def.block, step_def.index) != 1u) {
+            reason = "step of counter " + std::to_string(counter.reg) + " is not 1";
+            continue;
+        }
+        if (blocks[step_def.block].loop != loop_index or not dominates_latches(step_def.block))
+            continue;
+
+        bool tested_first = (step_def.block != t and cfg->dominates(t, step_def.block));
+        if (not counter.down and not tested_first)
+            continue;
+        counter.decrement_first = (counter.down and not tested_first);
+        counter.step_def = writes[0];
+        return counter;
+    }
+    return std::nullopt;
+}
+
+
+WcetResult WcetAnalyzer::run()
+{
+    WcetResult result;
+    auto& blocks = cfg->blocks;
+
+    auto fail = [&] (const std::string& reason, int pc) {
+        result.bounded = false;
+        result.reason = reason;
+        result.offending_pc = pc;
+        return result;
+    };
+
+    for (auto b : cfg->rpo)
+        if (blocks[b].unresolved_indirect)
+            return fail("PC_SWP with unknown target", blocks[b].pcs.back());
+
+    std::vector<size_t> rpo_index(blocks.size(), BasicBlock::npos);
+    for (size_t i = 0; i < cfg->rpo.size(); i++)
+        rpo_index[cfg->rpo[i]] = i;
+    for (auto b : cfg->rpo)
+        for (auto succ : blocks[b].successors)
+            if (rpo_index[succ] <= rpo_index[b] and not cfg->dominates(succ, b))
+                return fail("irreducible loop", blocks[succ].start);
+
+    reaching_definitions();
+
+    // counters first, their steps are known before bounds are traced
+    std::vector<std::string> reasons(cfg->loops.size());
+    for (size_t l = 0; l < cfg->loops.size(); l++) {
+        auto counter = find_counter(l, reasons[l]);
+        if (counter and counter->decrement_first) {
+            // from a non-zero start the decrement reaches 0 before it can wrap
+            auto& step = defs[counter->step_def];
+            counter->wraps = not nonzero(counter->reg, step.block, step.index, counter->step_def);
+        }
+        if (counter) {
+            counters[l] = *counter;
+            if (not counter->wraps)
+                step_defs[counter->step_def] = l;
+        }
+    }
+
+    for (size_t l = 0; l < cfg->loops.size(); l++) {
+        LoopBound bound;
+        bound.header = blocks[cfg->loops[l].header].start;
+        if (counters.count(l)) {
+            auto& counter = counters.at(l);
+            auto& test = blocks[counter.test_block];
+            bound.counter = (counter.reg == 0 ? "lr" : std::to_string(counter.reg));
+            for (auto psec : NVMAObject::sections)
+                for (auto& [name, label] : (obj.*psec).labels)
+                    if (psec != &NVMAObject::text and label.pos / 4 == counter.reg)
+                        bound.counter = name;
+
+            std::optional<Bound> limit;
+            auto& step = defs[counter.step_def];
+            if (counter.wraps)
+                limit = Bound::constant(1ull << 32);
+            else if (counter.decrement_first)
+                // the test sees the decremented value, the initial one reaches the step
+                limit = upper(counter.reg, step.block, step.index);
+            else
+                limit = upper(counter.down ? counter.reg : counter.bound_reg, counter.test_block, test.code.size() - 1);
+
+            if (limit) {
+                bound.bounded = true;
+                bound.iterations = *limit + Bound::constant(1);
+            }
+            else {
+                bound.reason = "initial value of " + bound.counter + " is not bounded by inputs";
+            }
+        }
+        else {
+            bound.reason = reasons[l];
+        }
+        result.loops.push_back(bound);
+    }
+
+    for (auto b : cfg->rpo) {
+        auto count = Bound::constant(1);
+        for (size_t l = 0; l < cfg->loops.size(); l++) {
+            if (not in_loop(l, b))
+                continue;
+            if (not result.loops[l].bounded)
+                return fail("loop at " + fhex(result.loops[l].header, 2) + ": " + result.loops[l].reason,
+                            result.loops[l].header);
+            count = count * result.loops[l].iterations;
+        }
+        result.instructions = result.instructions + count * Bound::constant(blocks[b].code.size());
+    }
+    result.bounded = true;
+    return result;
+}
+
+
+} // namespace
+
+
+std::map<uint8_t, std::string> input_variables(const NVMAObject& obj)
+{
+    std::map<uint8_t, std::string> inputs;
+    if (obj.ram.labels.count("input")) {
+        auto& section = obj.ram.labels.at("input");
+        for (size_t pos = section.pos; pos + 4 <= (size_t)section.pos + section.size; pos += 4)
+            inputs[pos / 4] = "ram[" + std::to_string(pos / 4) + "]";
+    }
+    for (auto& [name, label] : obj.input.labels)
+        for (size_t i = 0; i * 4 < label.size; i++)
+            inputs[label.pos / 4 + i] = (label.size == 4 ? name : name + "[" + std::to_string(i) + "]");
+    return inputs;
+}
+
+
+WcetResult analyze_wcet(const NVMAObject& obj)
+{
+    return WcetAnalyzer(obj).run();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "analysis.hpp"
+
+
+
+
+/*
+Оценка сверху числа исполняемых инструкций.
+
+Поддерживаются циклы со счетчиком:
+```
+> счетчик вниз: выход по JZ c (lr = 0) или JZ zero (счетчик lr, zero = 0), в теле SUB c, c, one
+> счетчик вверх: LOAD_OP c; JL b, тело - в теле ADD c, c, one, b в цикле не меняется
+```
+где one = 1, проверка и шаг исполняются ровно один раз за итерацию и других записей
+счетчика в цикле нет (STORE_IND с константным указателем пишет только свое слово,
+с неизвестным - любое). Если SUB стоит до проверки, счетчик, который может начать с 0,
+проходит 2^32 значений; иначе итераций не больше начального значения. Начальное значение счетчика (и граница b) оцениваются по
+достигающим определениям: константы, копии, входные слова (.input), ADD/OR/AND/LS/RS,
+а также значения других счетчиков (не больше их начальных значений).
+Оценка - многочлен от входных слов, если оценить не удалось - цикл считается неограниченным.
+Хост пишет все слова .input, поэтому переменная - каждое из них, включая ячейки массивов
+и слова без метки; их значения из образа ram не используются.
+*/
+
+
+// polynomial with non-negative coefficients over .input words
+struct Bound
+{
+    // sorted variable names (with repeats) -> coefficient
+    std::map<std::vector<std::string>, uint64_t> terms;
+
+    static Bound constant(uint64_t value);
+    static Bound variable(const std::string& name);
+
+    Bound operator+(const Bound& other) const;
+    Bound operator*(const Bound& other) const;
+    // coefficient-wise maximum, not less than both for non-negative variables
+    static Bound max(const Bound& a, const Bound& b);
+
+    // saturates at UINT64_MAX
+    uint64_t evaluate(const std::map<std::string, uint64_t>& values) const;
+    bool is_constant() const;
+    std::string str() const;
+};
+
+
+struct LoopBound
+{
+    uint8_t header;
+    bool bounded = false;
+    std::string counter;
+    Bound iterations; // times the header is entered for one entry of the loop
+    std::string reason;
+};
+
+
+struct WcetResult
+{
+    bool bounded = false;
+    Bound instructions;
+    std::string reason;
+    int offending_pc = -1;
+    std::vector<LoopBound> loops;
+};
+
+
+// variable of every .input word: label name, name[i] for cells of arrays, ram[w] for unlabelled words
+std::map<uint8_t, std::string> input_variables(const NVMAObject& obj);
+
+WcetResult analyze_wcet(const NVMAObject& obj);
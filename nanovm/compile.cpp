@@ -2,6 +2,7 @@
 #include "utils.hpp"
 
 #include "runtime_compiler.hpp"
+#include "verifier.hpp"
 
 
 
@@ -9,6 +10,7 @@ struct Arguments
 {
     std::string source;
     std::string binary;
+    bool verify = false;
 };
 
 
@@ -25,15 +27,29 @@ Arguments parse_args(int argc, char* argv[])
         case 'b':
             args.binary = value;
             break;
+
+        case 'v':
+            args.verify = true;
+            break;
         }
     };
 
-    parse_args("i:b:", argc, argv, proc);
+    parse_args("i:b:v", argc, argv, proc);
 
     return args;
 }
 
 
+// prints diagnostics of the load-time verifier, returns false if the program is rejected
+static bool report_verify(const NVMAObject& obj)
+{
+    auto errors = verify_program(obj);
+    for (auto& e : errors)
+        std::cerr << fhex(e.pc, 2) << ": " << e.message << std::endl;
+    return errors.empty();
+}
+
+
 int main(int argc, char* argv[])
 {
     try {
@@ -43,12 +59,20 @@ int main(int argc, char* argv[])
         {
             auto source = load_file(args.source);
             auto obj = compile(source);
+            if (args.verify and not report_verify(obj))
+                return 1;
             std::cout << obj.dump() << std::endl;
         }
         else if (args.binary.size())
         {
             auto binary = load_file(args.binary);
             auto obj = parse_nvma_object(binary);
+            if (args.verify) {
+                if (not report_verify(obj))
+                    return 1;
+                std::cout << "OK" << std::endl;
+                return 0;
+            }
             auto decompiled = decompile(obj);
 
             for (auto& line : decompiled)
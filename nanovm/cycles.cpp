@@ -0,0 +1,109 @@
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include "runtime_compiler.hpp"
+#include "timing.hpp"
+#include "utils.hpp"
+
+
+
+
+struct Arguments
+{
+    std::string source;
+    std::string binary;
+    std::string bindings;
+    std::string profile;
+};
+
+
+Arguments parse_args(int argc, char* argv[])
+{
+    Arguments args;
+    auto proc = [&] (char opt, const std::string& value)
+    {
+        switch (opt) {
+        case 'i':
+            args.source = value;
+            break;
+
+        case 'b':
+            args.binary = value;
+            break;
+
+        case 'I':
+            args.bindings = value;
+            break;
+
+        case 'T':
+            args.profile = value;
+            break;
+        }
+    };
+
+    parse_args("i:b:I:T:", argc, argv, proc);
+
+    return args;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try {
+        auto args = parse_args(argc, argv);
+
+        NVMAObject obj;
+        if (args.source.size())
+            obj = compile(load_file(args.source));
+        else if (args.binary.size())
+            obj = parse_nvma_object(load_file(args.binary));
+        else
+            throw std::runtime_error("Must be specified -i <source> or -b <binary>");
+
+        if (obj.text.data.size() > 256)
+            throw std::runtime_error("Text section is bigger than 256 bytes");
+        require_width(obj, 32);
+        if (args.bindings.size())
+            parse_sections_file(obj, load_file(args.bindings));
+
+        TimingModel model;
+        if (args.profile.size())
+            model = TimingModel::from_json(load_file(args.profile));
+
+        uint8_t code[256];
+        std::memset(code, 0xFF, sizeof(code));
+        std::copy(obj.text.data.begin(), obj.text.data.end(), code);
+        uint32_t ram[32] = {0};
+        std::memcpy(ram, obj.ram.data.data(), std::min(obj.ram.data.size(), sizeof(ram)));
+
+        TimingReport report;
+        TimedEngine(model, code).run(ram, 0, nullptr, report);
+
+        std::map<uint8_t, std::string> names;
+        for (auto psec : NVMAObject::sections) {
+            if (psec == &NVMAObject::text)
+                continue;
+            for (auto& [name, label] : (obj.*psec).labels)
+                names[label.pos / 4] = name;
+        }
+
+        std::cout << "  pc  instruction                     count      cycles       %" << std::endl;
+        for (size_t pc = 0; pc < 256; pc++) {
+            if (not report.pc_steps[pc])
+                continue;
+            std::cout << "  " << fhex(pc, 2) << "  " << std::left << std::setw(28)
+                      << format_instruction(decode_instruction(code, pc), names) << std::right
+                      << std::setw(9) << report.pc_steps[pc]
+                      << std::setw(12) << report.pc_cycles[pc]
+                      << std::setw(8) << std::fixed << std::setprecision(1)
+                      << 100.0 * report.pc_cycles[pc] / report.cycles << std::endl;
+        }
+        std::cout << "Total: " << report.cycles << " cycles, " << report.steps << " instructions" << std::endl;
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+}
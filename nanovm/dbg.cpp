@@ -1,11 +1,15 @@
 #include <atomic>
 #include <csignal>
+#include <iomanip>
 #include <iostream>
 #include <unordered_set>
 
 #include <getopt.h>
 
+#include "analysis.hpp"
 #include "runtime_compiler.hpp"
+#include "timing.hpp"
+#include "verifier.hpp"
 #include "vmop.hpp"
 #include "utils.hpp"
 
@@ -16,8 +20,9 @@
 
 class Debugger {
 public:
-    Debugger(NVMAObject& obj)
-        : obj(obj), pc(0), running(true)
+    // image is verified, so pc needs no checks
+    Debugger(NVMAObject& obj, const VerifiedImage& image, const TimingModel& model)
+        : obj(obj), pc(0), running(true), halted(false), image(image), engine(model, this->image.code.data())
     {
         memset(ram, 0, sizeof(ram));
     }
@@ -45,6 +50,10 @@ private:
             step();
         } else if (command.substr(0, 4) == "goto" or command.substr(0, 2) == "g " or command == "g") {
             go_to(command);
+        } else if (command == "blocks") {
+            show_blocks();
+        } else if (command == "cycles") {
+            show_cycles();
         } else if (command == "continue" or command.substr(0, 1) == "c") {
             continue_execution();
         } else if (command.substr(0, 5) == "break" or command.substr(0, 1) == "b") {
@@ -53,6 +62,8 @@ private:
             show_memory(command);
         } else if (command == "lr") {
             show_lr();
+        } else if (command.substr(0, 3) == "rom") {
+            show_rom(command);
         } else if (command.substr(0, 4) == "list"
                    or command.substr(0, 2) == "l "
                    or command == "l") {
@@ -60,13 +71,13 @@ private:
         } else if (command == "exit" or command.substr(0, 1) == "q") {
             running = false;
         } else {
-            std::cout << "Unknown command! Available: step, continue, break [addr], mem [addr], lr, list, exit" << std::endl;
+            std::cout << "Unknown command! Available: step, continue, break [addr], mem [addr], lr, rom [addr], list, blocks, cycles, exit" << std::endl;
         }
     }
 
     void step()
     {
-        if (pc >= obj.text.data.size()) {
+        if (halted) {
             std::cout << "End of program." << std::endl;
             running = false;
             return;
@@ -74,20 +85,23 @@ private:
         uint32_t prev_ram[sizeof(ram) / 4];
         std::memcpy(prev_ram, ram, sizeof(ram));
         auto prev = pc;
-        execute_one(ram, obj.text.data.data(), pc, nullptr);
-        std::cout << format_line(get_decompiled_map().at(prev), ram, nullptr, all_labels, true) << std::endl;
+        auto cycles = timing.cycles;
+        halted = not engine.step(ram, pc, nullptr, timing);
+        std::cout << format_line(get_decompiled_map().at(prev), ram, nullptr, all_labels, true)
+                  << "    ; +" << timing.cycles - cycles << " cycles, total " << timing.cycles << std::endl;
     }
 
     void go_to(const std::string& command)
     {
         auto arg = (command.find(' ') != command.npos ? command.substr(command.find(' ') + 1) : std::to_string((int)pc));
         pc = std::stoi(arg);
+        halted = false;
         std::cout << "pc = " << "0123456789abcdef"[pc / 16] << "0123456789abcdef"[pc & 0xF] << std::endl;
     }
 
     void continue_execution()
     {
-        while (pc < obj.text.data.size()) {
+        while (not halted) {
             if (breakpoints.count(pc) or cancel) {
                 cancel = false;
                 std::cout << "Hit breakpoint at PC: " << (int)pc << std::endl;
@@ -165,11 +179,66 @@ private:
 
         std::cout << "Listing instructions:" << std::endl;
 
+        auto cfg = analyze(obj);
         for (auto current = start; current != end; ++current) {
+            auto block = cfg->block_of(current->pos);
+            if (block and block->start == current->pos) {
+                std::cout << "  ; block " << cfg->block_at[current->pos]
+                          << (block->reachable ? "" : ", unreachable");
+                if (block->loop_depth)
+                    std::cout << ", loop depth " << block->loop_depth;
+                std::cout << std::endl;
+            }
             std::cout << format_line(*current, ram, nullptr, all_labels, current == it) << std::endl;
         }
     }
 
+    // .rodata, or 16 bytes of text from a hex address
+    void show_rom(const std::string& command)
+    {
+        size_t from = code_size(obj);
+        size_t to = obj.text.data.size();
+        if (command.find(' ') != command.npos) {
+            from = std::min(std::stoul(command.substr(command.find(' ') + 1), nullptr, 16), 255ul);
+            to = std::min<size_t>(from + 16, 256);
+        }
+        if (from >= to) {
+            std::cout << "Program has no .rodata" << std::endl;
+            return;
+        }
+        for (size_t row = from; row < to; row += 16) {
+            std::cout << fhex(row, 2) << ":";
+            for (size_t i = row; i < std::min(row + 16, to); i++)
+                std::cout << " " << fhex(image.code[i], 2);
+            std::cout << std::endl;
+        }
+    }
+
+    void show_blocks()
+    {
+        std::map<uint8_t, std::string> names;
+        for (auto psec : NVMAObject::sections) {
+            if (psec == &NVMAObject::text or psec == &NVMAObject::ram)
+                continue;
+            for (auto& [k, v] : (obj.*psec).labels)
+                names[v.pos / 4] = k;
+        }
+        std::cout << analyze(obj)->dump(names);
+    }
+
+    void show_cycles()
+    {
+        std::cout << "Cycles by line:" << std::endl;
+        for (auto& line : get_decompiled()) {
+            if (not timing.pc_steps[line.pos])
+                continue;
+            std::cout << std::setw(10) << timing.pc_cycles[line.pos]
+                      << std::setw(8) << "x" + std::to_string(timing.pc_steps[line.pos])
+                      << "  " << line.original << std::endl;
+        }
+        std::cout << "Total: " << timing.cycles << " cycles, " << timing.steps << " instructions" << std::endl;
+    }
+
     const std::vector<DecompiledLine>& get_decompiled()
     {
         if (decompiled_cache.empty()) {
@@ -205,6 +274,10 @@ private:
     uint32_t ram[32];
     uint8_t pc;
     bool running;
+    bool halted;
+    VerifiedImage image;
+    TimedEngine engine;
+    TimingReport timing;
     std::map<std::string, NVMAObject::Label> all_labels;
     std::unordered_set<uint8_t> breakpoints;
     std::atomic<bool> cancel;
@@ -231,6 +304,7 @@ struct Arguments
 {
     std::string source;
     std::string binding;
+    std::string profile;
 };
 
 
@@ -246,10 +320,13 @@ Arguments parse_args(int argc, char* argv[])
         case 'I':
             args.binding = optarg;
             break;
+        case 'T':
+            args.profile = optarg;
+            break;
         }
     };
 
-    parse_args("i:I:", argc, argv, proc);
+    parse_args("i:I:T:", argc, argv, proc);
 
     return args;
 }
@@ -260,22 +337,28 @@ int main(int argc, char* argv[]) {
 
     Arguments args;
     NVMAObject obj;
+    VerifiedImage image;
+    TimingModel model;
     try {
-        parse_args(argc, argv);
+        args = parse_args(argc, argv);
         auto code = load_file(args.source);
         obj = compile(code);
+        require_width(obj, 32);
 
         if (args.binding.size()) {
             auto content = load_file(args.binding);
             parse_sections_file(obj, content);
         }
+        image = VerifiedImage::load(obj);
+        if (args.profile.size())
+            model = TimingModel::from_json(load_file(args.profile));
     }
     catch (const std::runtime_error& e) {
         std::cout << "Error while process args: " << e.what() << std::endl;
         return 1;
     }
 
-    Debugger debugger(obj);
+    Debugger debugger(obj, image, model);
     global_dbg = &debugger;
     debugger.run();
     global_dbg = nullptr;
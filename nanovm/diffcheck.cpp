@@ -0,0 +1,148 @@
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "differential.hpp"
+#include "runtime_compiler.hpp"
+#include "utils.hpp"
+
+
+
+
+struct Arguments
+{
+    std::string source;
+    std::string binary;
+    std::string bindings;
+    uint64_t random = 0;
+    size_t workers = 1;
+    uint64_t seed = 1;
+    DiffOptions options;
+};
+
+
+Arguments parse_args(int argc, char* argv[])
+{
+    Arguments args;
+    args.workers = std::max(1u, std::thread::hardware_concurrency());
+    auto proc = [&] (char opt, const std::string& value)
+    {
+        switch (opt) {
+        case 'i':
+            args.source = value;
+            break;
+
+        case 'b':
+            args.binary = value;
+            break;
+
+        case 'I':
+            args.bindings = value;
+            break;
+
+        case 'N':
+            args.options.every = std::max(1ul, std::stoul(value));
+            break;
+
+        case 's':
+            args.options.max_steps = std::stoull(value);
+            break;
+
+        case 'e': {
+            std::string list = value;
+            while (list.size()) {
+                auto end = list.find(',');
+                args.options.engines.push_back(list.substr(0, end));
+                list = (end == list.npos ? "" : list.substr(end + 1));
+            }
+            break;
+        }
+
+        case 'R':
+            args.random = std::stoull(value);
+            break;
+
+        case 'j':
+            args.workers = std::stoul(value);
+            break;
+
+        case 'S':
+            args.seed = std::stoull(value);
+            break;
+        }
+    };
+
+    parse_args("i:b:I:N:s:e:R:j:S:", argc, argv, proc);
+
+    return args;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try {
+        auto args = parse_args(argc, argv);
+
+        std::cout << "Engines:";
+        for (auto& engine : engine_registry())
+            std::cout << " " << engine.name << (engine.lockstep ? "" : " (final state)");
+        std::cout << std::endl;
+
+        if (args.random) {
+            if (args.options.max_steps == DiffOptions().max_steps)
+                args.options.max_steps = 10000;
+            auto result = differential_bulk(args.random, args.workers, args.seed, args.options);
+            std::cout << result.programs << " random programs, " << result.divergent << " divergent" << std::endl;
+            for (auto& [code, ram, divergence] : result.examples) {
+                std::cout << std::endl << "text:";
+                for (size_t i = 0; i < code.size(); i++)
+                    std::cout << (i % 32 ? " " : "\n    ") << fhex(code[i], 2);
+                std::cout << std::endl << "ram:";
+                for (size_t i = 0; i < ram.size(); i++)
+                    std::cout << (i % 8 ? " " : "\n    ") << fhex(ram[i], 8);
+                std::cout << std::endl << divergence.report(code.data());
+            }
+            return result.divergent ? 2 : 0;
+        }
+
+        NVMAObject obj;
+        if (args.source.size())
+            obj = compile(load_file(args.source));
+        else if (args.binary.size())
+            obj = parse_nvma_object(load_file(args.binary));
+        else
+            throw std::runtime_error("Must be specified -i <source>, -b <binary> or -R <count>");
+
+        if (obj.text.data.size() > 256)
+            throw std::runtime_error("Text section is bigger than 256 bytes");
+        require_width(obj, 32);
+        if (args.bindings.size())
+            parse_sections_file(obj, load_file(args.bindings));
+
+        std::array<uint8_t, 256> code;
+        code.fill(0xFF);
+        std::copy(obj.text.data.begin(), obj.text.data.end(), code.begin());
+        std::array<uint32_t, 32> ram = {0};
+        std::memcpy(ram.data(), obj.ram.data.data(), std::min(obj.ram.data.size(), sizeof(ram)));
+
+        std::map<uint8_t, std::string> names;
+        for (auto psec : NVMAObject::sections) {
+            if (psec == &NVMAObject::text)
+                continue;
+            for (auto& [name, label] : (obj.*psec).labels)
+                names[label.pos / 4] = name;
+        }
+
+        auto divergences = differential_run(code, ram, args.options);
+        for (auto& divergence : divergences)
+            std::cout << divergence.report(code.data(), names) << std::endl;
+        if (divergences.empty())
+            std::cout << "All engines agree" << std::endl;
+        return divergences.empty() ? 0 : 2;
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+}
@@ -0,0 +1,352 @@
+#include "differential.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+#include "isa.hpp"
+#include "timing.hpp"
+#include "utils.hpp"
+#include "vmop.hpp"
+
+
+
+
+uint32_t diff_host_proc(uint32_t proc_id, uint32_t arg)
+{
+    return proc_id * 0x9E3779B1u ^ arg;
+}
+
+
+static EngineRunner reference_runner(const uint8_t* code)
+{
+    return [code] (uint32_t* ram, uint8_t& pc, uint32_t max_steps, uint32_t& steps) {
+        for (steps = 0; steps < max_steps; steps++)
+            if (not execute_one(ram, code, pc, diff_host_proc))
+                return false;
+        return true;
+    };
+}
+
+
+static std::vector<EngineVariant> builtin_engines()
+{
+    std::vector<EngineVariant> engines;
+
+    engines.push_back({"execute_bounded", true, [] (const uint8_t* code) -> EngineRunner {
+        return [code] (uint32_t* ram, uint8_t& pc, uint32_t max_steps, uint32_t& steps) {
+            return execute_bounded(ram, code, pc, diff_host_proc, max_steps, steps);
+        };
+    }});
+
+    // one instruction per call, CALL is completed by the host as the async scheduler does
+    engines.push_back({"execute_until_call", true, [] (const uint8_t* code) -> EngineRunner {
+        return [code] (uint32_t* ram, uint8_t& pc, uint32_t max_steps, uint32_t& steps) {
+            PendingCall call;
+            for (steps = 0; steps < max_steps; steps++) {
+                auto status = execute_until_call(ram, code, pc, call, 1);
+                if (status == ExecStatus::Halted)
+                    return false;
+                if (status == ExecStatus::Call)
+                    ram[call.result] = diff_host_proc(call.proc_id, call.arg);
+            }
+            return true;
+        };
+    }});
+
+    engines.push_back({"timed", true, [] (const uint8_t* code) -> EngineRunner {
+        auto engine = std::make_shared<TimedEngine>(TimingModel(), code);
+        auto report = std::make_shared<TimingReport>();
+        return [engine, report] (uint32_t* ram, uint8_t& pc, uint32_t max_steps, uint32_t& steps) {
+            for (steps = 0; steps < max_steps; steps++)
+                if (not engine->step(ram, pc, diff_host_proc, *report))
+                    return false;
+            return true;
+        };
+    }});
+
+    // no step limit, compared only after HALT
+    engines.push_back({"execute", false, [] (const uint8_t* code) -> EngineRunner {
+        return [code] (uint32_t* ram, uint8_t& pc, uint32_t, uint32_t& steps) {
+            execute(ram, code, pc, diff_host_proc, nullptr);
+            steps = 0;
+            return false;
+        };
+    }});
+
+    return engines;
+}
+
+
+std::vector<EngineVariant>& engine_registry()
+{
+    static std::vector<EngineVariant> engines = builtin_engines();
+    return engines;
+}
+
+
+void register_engine(EngineVariant engine)
+{
+    for (auto& e : engine_registry())
+        if (e.name == engine.name)
+            throw std::runtime_error("Engine " + engine.name + " is already registered");
+    engine_registry().push_back(std::move(engine));
+}
+
+
+std::string Divergence::report(const uint8_t* code, const std::map<uint8_t, std::string>& names) const
+{
+    std::stringstream out;
+    out << engine << " diverged at step " << step << ", pc " << fhex(pc, 2) << ": "
+        << format_instruction(decode_instruction(code, pc), names) << std::endl;
+    out << "    reference: pc " << fhex(reference_pc, 2) << (reference_halted ? " (halted)" : "")
+        << ", " << engine << ": pc " << fhex(engine_pc, 2) << (engine_halted ? " (halted)" : "") << std::endl;
+    for (uint8_t r = 0; r < 32; r++) {
+        if (reference_ram[r] == engine_ram[r])
+            continue;
+        out << "    word " << (int)r << (names.count(r) ? " (" + names.at(r) + ")" : std::string(r ? "" : " (lr)"))
+            << ": reference 0x" << fhex(reference_ram[r], 8) << ", " << engine << " 0x" << fhex(engine_ram[r], 8)
+            << std::endl;
+    }
+
+    // context from linear decode, pc itself may be inside another instruction
+    std::vector<uint8_t> starts;
+    for (size_t p = 0; p < 256; p += decode_instruction(code, p).size)
+        starts.push_back(p);
+    auto it = std::lower_bound(starts.begin(), starts.end(), pc);
+    auto index = it - starts.begin();
+    out << "context:" << std::endl;
+    if (it == starts.end() or *it != pc)
+        out << "  > " << fhex(pc, 2) << ": " << format_instruction(decode_instruction(code, pc), names)
+            << "    ; not on linear decode" << std::endl;
+    for (auto i = std::max<ptrdiff_t>(0, index - 4); i < std::min<ptrdiff_t>(starts.size(), index + 4); i++) {
+        auto inst = decode_instruction(code, starts[i]);
+        out << (starts[i] == pc ? "  > " : "    ") << fhex(starts[i], 2) << ": "
+            << format_instruction(inst, names) << std::endl;
+        if (inst.op == Mnemonic::Halt and starts[i] > pc)
+            break;
+    }
+    return out.str();
+}
+
+
+namespace {
+
+
+struct State
+{
+    std::array<uint32_t, 32> ram;
+    uint8_t pc = 0;
+    bool running = true;
+    uint32_t steps = 0;
+
+    bool operator==(const State& other) const
+    {
+        return ram == other.ram and running == other.running and steps == other.steps
+               and (not running or pc == other.pc);
+    }
+};
+
+
+Divergence make_divergence(const std::string& engine, uint64_t step, uint8_t pc, const State& ref, const State& eng)
+{
+    Divergence d;
+    d.engine = engine;
+    d.step = step;
+    d.pc = pc;
+    d.reference_pc = ref.pc;
+    d.engine_pc = eng.pc;
+    d.reference_halted = not ref.running;
+    d.engine_halted = not eng.running;
+    d.reference_ram = ref.ram;
+    d.engine_ram = eng.ram;
+    return d;
+}
+
+
+std::optional<Divergence> run_lockstep(const EngineVariant& variant, const uint8_t* code,
+                                       const std::array<uint32_t, 32>& ram, const DiffOptions& options)
+{
+    auto reference = reference_runner(code);
+    auto engine = variant.prepare(code);
+
+    State ref{ram}, eng{ram};
+    uint64_t total = 0;
+    while (ref.running and total < options.max_steps) {
+        auto checkpoint_ref = ref;
+        auto checkpoint_eng = eng;
+
+        uint32_t n = std::min<uint64_t>(options.every, options.max_steps - total);
+        ref.running = reference(ref.ram.data(), ref.pc, n, ref.steps);
+        eng.running = engine(eng.ram.data(), eng.pc, n, eng.steps);
+        if (ref == eng) {
+            total += ref.steps;
+            continue;
+        }
+
+        // find the first instruction which differs
+        ref = checkpoint_ref;
+        eng = checkpoint_eng;
+        for (uint32_t i = 0; i < n; i++) {
+            auto pc = ref.pc;
+            ref.running = reference(ref.ram.data(), ref.pc, 1, ref.steps);
+            eng.running = engine(eng.ram.data(), eng.pc, 1, eng.steps);
+            if (not (ref == eng))
+                return make_divergence(variant.name, total + i, pc, ref, eng);
+            if (not ref.running)
+                break;
+        }
+        // differs only when run in chunks
+        return make_divergence(variant.name + " (chunk of " + std::to_string(n) + ")", total,
+                               checkpoint_ref.pc, ref, eng);
+    }
+    return std::nullopt;
+}
+
+
+std::optional<Divergence> run_final(const EngineVariant& variant, const uint8_t* code,
+                                    const std::array<uint32_t, 32>& ram, const DiffOptions& options)
+{
+    State ref{ram};
+    uint64_t total = 0;
+    auto reference = reference_runner(code);
+    while (ref.running and total < options.max_steps) {
+        ref.running = reference(ref.ram.data(), ref.pc, std::min<uint64_t>(options.max_steps - total, UINT32_MAX), ref.steps);
+        total += ref.steps;
+    }
+    if (ref.running)
+        return std::nullopt; // no HALT, the engine would not stop either
+
+    State eng{ram};
+    eng.running = variant.prepare(code)(eng.ram.data(), eng.pc, UINT32_MAX, eng.steps);
+    if (eng.ram == ref.ram and not eng.running)
+        return std::nullopt;
+    eng.pc = ref.pc; // not reported by the engine
+    return make_divergence(variant.name, total, ref.pc, ref, eng);
+}
+
+
+} // namespace
+
+
+std::vector<Divergence> differential_run(const std::array<uint8_t, 256>& code,
+                                         const std::array<uint32_t, 32>& ram,
+                                         const DiffOptions& options)
+{
+    std::vector<Divergence> out;
+    for (auto& variant : engine_registry()) {
+        if (options.engines.size()
+                and std::find(options.engines.begin(), options.engines.end(), variant.name) == options.engines.end())
+            continue;
+        auto d = (variant.lockstep ? run_lockstep(variant, code.data(), ram, options)
+                                   : run_final(variant, code.data(), ram, options));
+        if (d)
+            out.push_back(*d);
+    }
+    return out;
+}
+
+
+
+
+namespace {
+
+
+void random_program(Rng& rng, std::array<uint8_t, 256>& code, std::array<uint32_t, 32>& ram)
+{
+    code.fill(0xFF);
+    std::vector<uint8_t> starts;
+    std::vector<uint8_t> jumps;
+    size_t size = 0;
+    size_t length = 8 + rng.below(240);
+
+    while (size + 4 < length) {
+        Instruction inst;
+        inst.op = (Mnemonic)rng.below((uint8_t)Mnemonic::Unknown);
+        if (inst.op == Mnemonic::Halt and rng.below(4))
+            inst.op = Mnemonic::Add;
+        bool wide = (inst.op == Mnemonic::LoadOp or inst.op == Mnemonic::StoreOp or inst.op == Mnemonic::PcSwp
+                     or inst.op == Mnemonic::LoadInd or inst.op == Mnemonic::StoreInd
+                     or is_rom_load(inst.op));
+        inst.result = rng.below(wide ? 32 : 16);
+        inst.arg1 = rng.below(wide ? 32 : 16);
+        inst.arg2 = rng.below(16);
+        switch (inst.op)
+        {
+        case Mnemonic::LoadLow: inst.imm = rng.below(1 << 12); break;
+        case Mnemonic::LoadHigh: inst.imm = rng.below(1 << 20); break;
+        case Mnemonic::Load3: inst.imm = rng.below(8); break;
+        case Mnemonic::Ls:
+        case Mnemonic::Rs: inst.imm = rng.below(16); break;
+        case Mnemonic::LoadRomB:
+        case Mnemonic::LoadRomH:
+        case Mnemonic::LoadRomW: inst.imm = rng.below(256); break;
+        default: break;
+        }
+
+        starts.push_back(size);
+        if (inst.op == Mnemonic::Jl or inst.op == Mnemonic::Jz)
+            jumps.push_back(size);
+        size += encode_instruction(inst, code.data() + size);
+    }
+    starts.push_back(size); // final HALT
+
+    for (auto pc : jumps)
+        code[pc + 1] = starts[rng.below(starts.size())];
+
+    // a third of words are addresses for PC_SWP, the rest are random or small
+    for (auto& word : ram) {
+        switch (rng.below(3))
+        {
+        case 0: word = starts[rng.below(starts.size())]; break;
+        case 1: word = rng.below(16); break;
+        default: word = rng.next(); break;
+        }
+    }
+}
+
+
+} // namespace
+
+
+BulkResult differential_bulk(uint64_t programs, size_t workers, uint64_t seed, const DiffOptions& options)
+{
+    BulkResult result;
+    std::mutex mutex;
+    std::atomic<uint64_t> next{0};
+
+    auto worker = [&] (size_t index) {
+        Rng rng{seed * 0x9E3779B97F4A7C15ull + index + 1};
+        uint64_t done = 0;
+        while (next++ < programs) {
+            std::array<uint8_t, 256> code;
+            std::array<uint32_t, 32> ram;
+            random_program(rng, code, ram);
+            auto divergences = differential_run(code, ram, options);
+            done++;
+            if (divergences.empty())
+                continue;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            result.divergent++;
+            if (result.examples.size() < 8)
+                result.examples.emplace_back(code, ram, divergences.front());
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        result.programs += done;
+    };
+
+    // the registry is built before threads start
+    engine_registry();
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); i++)
+        threads.emplace_back(worker, i);
+    for (auto& thread : threads)
+        thread.join();
+    return result;
+}
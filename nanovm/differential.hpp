@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+
+
+
+/*
+Сравнение вариантов движка с эталоном (цикл execute_one).
+
+Движок регистрируется в реестре: prepare(code) привязывает его к 256-байтному
+text и возвращает функцию, которая исполняет не больше max_steps инструкций.
+Движки с lockstep = true сравниваются с эталоном после каждых every инструкций
+(ram и pc), остальные (execute без ограничения шагов) - только после HALT.
+При расхождении шаги от последней совпавшей точки повторяются по одному, чтобы
+найти первую отличающуюся инструкцию.
+
+CALL во всех движках вызывает diff_host_proc.
+*/
+
+
+// runs at most max_steps instructions, steps - how many were executed (HALT
+// is not counted), returns false after HALT
+using EngineRunner = std::function<bool(uint32_t* ram, uint8_t& pc, uint32_t max_steps, uint32_t& steps)>;
+
+
+struct EngineVariant
+{
+    std::string name;
+    bool lockstep = true;
+    std::function<EngineRunner(const uint8_t* code)> prepare;
+};
+
+
+std::vector<EngineVariant>& engine_registry();
+void register_engine(EngineVariant engine);
+
+uint32_t diff_host_proc(uint32_t proc_id, uint32_t arg);
+
+
+struct Divergence
+{
+    std::string engine;
+    uint64_t step = 0;       // instructions executed by the reference before the diverging one
+    uint8_t pc = 0;          // pc of the diverging instruction
+    uint8_t reference_pc = 0;
+    uint8_t engine_pc = 0;
+    bool reference_halted = false;
+    bool engine_halted = false;
+    std::array<uint32_t, 32> reference_ram;
+    std::array<uint32_t, 32> engine_ram;
+
+    // differences and disassembly around pc, names - ram word names
+    std::string report(const uint8_t* code, const std::map<uint8_t, std::string>& names = {}) const;
+};
+
+
+struct DiffOptions
+{
+    uint32_t every = 1;
+    uint64_t max_steps = 1000000;
+    std::vector<std::string> engines; // empty - all registered
+};
+
+
+// empty when all engines agree with the reference
+std::vector<Divergence> differential_run(const std::array<uint8_t, 256>& code,
+                                         const std::array<uint32_t, 32>& ram,
+                                         const DiffOptions& options);
+
+
+struct BulkResult
+{
+    uint64_t programs = 0;
+    uint64_t divergent = 0;
+    // first divergences with their programs
+    std::vector<std::tuple<std::array<uint8_t, 256>, std::array<uint32_t, 32>, Divergence>> examples;
+};
+
+
+// random programs (valid instructions, jumps to instruction starts, random ram) on workers threads
+BulkResult differential_bulk(uint64_t programs, size_t workers, uint64_t seed, const DiffOptions& options);
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "isa_tables.hpp"
+#include "vmop.hpp"
+
+
+
+
+/*
+Кодировки команд описаны в isa/nanovm.json, операнды читаются через
+сгенерированные isa::<Mnemonic>::<operand>(code, pc).
+
+Упакованные операции (PACK), P - номер операции над полосами:
+```
+> 0 PADDUSB  - сложение с насыщением, 4 x 8 бит
+> 1 PSUBUSB  - вычитание с насыщением, 4 x 8 бит
+> 2 PADDUSH  - сложение с насыщением, 2 x 16 бит
+> 3 PSUBUSH  - вычитание с насыщением, 2 x 16 бит
+> 4 PMINUB   - минимум, 4 x 8 бит
+> 5 PMAXUB   - максимум, 4 x 8 бит
+> 6 PMINUH   - минимум, 2 x 16 бит
+> 7 PMAXUH   - максимум, 2 x 16 бит
+> 8 PSHUFB   - перестановка байт L, индекс байта i берется из битов R[2i+1:2i]
+> 9 POPCNT   - количество единичных бит в L (R не используется)
+```
+Ширина полос не зависит от ширины слова, меняется их число: для 16-битного
+слова это 2 x 8 и 1 x 16 бит, для 64-битного - 8 x 8 и 4 x 16. PSHUFB берет
+индекс байта i из log2(sizeof(Word)) бит R, начиная с бита i * log2(sizeof(Word)).
+
+LOAD_IND ptr / STORE_IND ptr - косвенный доступ lr = ram[ram[ptr]] и
+ram[ram[ptr]] = lr. Номер слова берется по модулю 32 (младшие 5 бит ram[ptr]),
+поэтому любой указатель попадает в ram, проверять его не нужно.
+
+LOAD_ROMB/LOAD_ROMH/LOAD_ROMW table, idx - чтение 1, 2 или 4 байт из text (.rodata):
+lr = text[table + ram[idx] * size], little endian с нулевым расширением до слова
+(у 16-битного слова от LOAD_ROMW остаются младшие 16 бит). Адрес каждого байта
+берется по модулю 256, code всегда 256 байт, за концом text лежат HALT (0xFF).
+
+LOAD_HIGH записывает биты 12..31 (старшие биты 64-битного слова обнуляются,
+для 16-битного остаются только 4 младших бита константы), сдвиги LS/RS и
+сравнение JL выполняются в ширине слова.
+*/
+
+
+enum PackedOpcode {
+    PAddUSB = 0,
+    PSubUSB = 1,
+    PAddUSH = 2,
+    PSubUSH = 3,
+    PMinUB  = 4,
+    PMaxUB  = 5,
+    PMinUH  = 6,
+    PMaxUH  = 7,
+    PShufB  = 8,
+    PopCnt  = 9,
+};
+
+
+// SWAR: lanes are processed inside one word, high bit of every lane is
+// handled separately so carries and borrows never cross lane boundaries.
+// high - mask with the high bit of every lane (0x8080... or 0x80008000...),
+// operands of 16-bit words are promoted to int, results are truncated on return
+
+template <typename Word>
+constexpr Word lanes_high(int lane_bits)
+{
+    // 0x80 or 0x8000 repeated over the word
+    constexpr Word ones = ~Word(0);
+    return Word(ones / (lane_bits == 8 ? 0xFF : 0xFFFF) * (lane_bits == 8 ? 0x80 : 0x8000));
+}
+
+template <typename Word>
+inline Word lanes_fill(Word high_bits, int lane_bits)
+{
+    // spread high bit of each lane over the whole lane
+    return (high_bits - (high_bits >> (lane_bits - 1))) | high_bits;
+}
+
+template <typename Word>
+inline Word lanes_carry(Word a, Word b, Word& sum, Word high)
+{
+    sum = ((a & ~high) + (b & ~high)) ^ ((a ^ b) & high);
+    return ((a & b) | ((a | b) & ~sum)) & high;
+}
+
+template <typename Word>
+inline Word lanes_borrow(Word a, Word b, Word& diff, Word high)
+{
+    diff = ((a | high) - (b & ~high)) ^ ((a ^ ~b) & high);
+    return ((~a & b) | ((~a | b) & diff)) & high;
+}
+
+template <typename Word>
+inline Word execute_packed(uint8_t op, Word a, Word b)
+{
+    const int lane_bits = (op & 0x2) ? 16 : 8;
+    const Word high = lanes_high<Word>(lane_bits);
+    Word r = 0;
+
+    switch (op)
+    {
+    case PAddUSB:
+    case PAddUSH: {
+        auto carry = lanes_carry(a, b, r, high);
+        return r | lanes_fill(carry, lane_bits);
+    }
+
+    case PSubUSB:
+    case PSubUSH: {
+        auto borrow = lanes_borrow(a, b, r, high);
+        return r & ~lanes_fill(borrow, lane_bits);
+    }
+
+    case PMinUB:
+    case PMaxUB:
+    case PMinUH:
+    case PMaxUH: {
+        auto less = lanes_fill(lanes_borrow(a, b, r, high), lane_bits);
+        if (op == PMinUB or op == PMinUH)
+            return (a & less) | (b & ~less);
+        else
+            return (b & less) | (a & ~less);
+    }
+
+    case PShufB: {
+        // bits of a byte index: 1, 2 or 3
+        constexpr int index_bits = sizeof(Word) == 2 ? 1 : sizeof(Word) == 4 ? 2 : 3;
+        for (int i = 0; i < (int)sizeof(Word); i++)
+            r |= Word((a >> ((b >> (i * index_bits)) & (sizeof(Word) - 1)) * 8) & 0xFF) << (i * 8);
+        return r;
+    }
+
+    case PopCnt: {
+        constexpr Word ones = ~Word(0);
+        constexpr Word m1 = ones / 3;    // 0x5555...
+        constexpr Word m2 = ones / 5;    // 0x3333...
+        constexpr Word m4 = ones / 17;   // 0x0F0F...
+        constexpr Word h01 = ones / 255; // 0x0101...
+        a = a - ((a >> 1) & m1);
+        a = (a & m2) + ((a >> 2) & m2);
+        a = (a + (a >> 4)) & m4;
+        return Word(a * h01) >> (VmWord<Word>::bits - 8);
+    }
+
+    default:
+        return 0;
+    }
+}
+
+
+// zero-extended little endian value at table + index * bytes, addresses wrap at 256
+template <typename Word>
+inline Word load_rom(const uint8_t* code, uint8_t table, Word index, int bytes)
+{
+    uint8_t addr = table + uint8_t(index * bytes);
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= uint32_t(code[uint8_t(addr + i)]) << (i * 8);
+    return Word(value);
+}
+
+
+// Executes one instruction, CALL is completed by host(proc_id, arg).
+// Returns false after HALT.
+template <typename Word, typename Host>
+inline bool execute_step(Word* ram, const uint8_t* code, uint8_t& pc, Host&& host)
+{
+    auto op = decode_mnemonic(code, pc);
+    uint8_t next = pc + decode_table[code[pc]].size;
+
+    switch (op)
+    {
+    case Mnemonic::LoadOp:
+        ram[0] = ram[isa::LoadOp::mem(code, pc)];
+        break;
+
+    case Mnemonic::StoreOp:
+        ram[isa::StoreOp::mem(code, pc)] = ram[0];
+        break;
+
+    case Mnemonic::Jl:
+        if (ram[0] < ram[isa::Jl::rarg(code, pc)])
+            next = isa::Jl::data(code, pc);
+        break;
+
+    case Mnemonic::Jz:
+        if (ram[0] == ram[isa::Jz::rarg(code, pc)])
+            next = isa::Jz::data(code, pc);
+        break;
+
+    case Mnemonic::LoadLow:
+        ram[0] = isa::LoadLow::low(code, pc);
+        break;
+
+    case Mnemonic::LoadHigh:
+        ram[0] = (ram[0] & 0xFFF) | Word(Word(isa::LoadHigh::low(code, pc)) << 12);
+        break;
+
+    // 16-bit operands are promoted to int, the result is truncated on store
+    case Mnemonic::Add:
+        ram[isa::Add::result(code, pc)] = ram[isa::Add::mem1(code, pc)] + ram[isa::Add::mem2(code, pc)];
+        break;
+
+    case Mnemonic::Sub:
+        ram[isa::Sub::result(code, pc)] = ram[isa::Sub::mem1(code, pc)] - ram[isa::Sub::mem2(code, pc)];
+        break;
+
+    case Mnemonic::And:
+        ram[isa::And::result(code, pc)] = ram[isa::And::mem1(code, pc)] & ram[isa::And::mem2(code, pc)];
+        break;
+
+    case Mnemonic::Or:
+        ram[isa::Or::result(code, pc)] = ram[isa::Or::mem1(code, pc)] | ram[isa::Or::mem2(code, pc)];
+        break;
+
+    case Mnemonic::Ls:
+        ram[isa::Ls::result(code, pc)] = Word(ram[isa::Ls::mem(code, pc)] << isa::Ls::count(code, pc));
+        break;
+
+    case Mnemonic::Rs:
+        ram[isa::Rs::result(code, pc)] = ram[isa::Rs::mem(code, pc)] >> isa::Rs::count(code, pc);
+        break;
+
+    case Mnemonic::Call: {
+        Word value = host(ram[isa::Call::callback(code, pc)], ram[isa::Call::arg(code, pc)]);
+        ram[isa::Call::result(code, pc)] = value;
+        break;
+    }
+
+    case Mnemonic::PcSwp: {
+        auto target = ram[isa::PcSwp::mem(code, pc)];
+        ram[isa::PcSwp::save(code, pc)] = next;
+        next = target;
+        break;
+    }
+
+    case Mnemonic::Load3:
+        ram[0] = isa::Load3::value(code, pc);
+        break;
+
+    case Mnemonic::PAddUSB:
+    case Mnemonic::PSubUSB:
+    case Mnemonic::PAddUSH:
+    case Mnemonic::PSubUSH:
+    case Mnemonic::PMinUB:
+    case Mnemonic::PMaxUB:
+    case Mnemonic::PMinUH:
+    case Mnemonic::PMaxUH:
+    case Mnemonic::PShufB:
+    case Mnemonic::PopCnt:
+        // all packed operations share the layout of PADDUSB, POPCNT ignores mem2
+        ram[isa::PAddUSB::result(code, pc)] = execute_packed((uint8_t)op - (uint8_t)Mnemonic::PAddUSB,
+                                                             ram[isa::PAddUSB::mem1(code, pc)],
+                                                             ram[isa::PAddUSB::mem2(code, pc)]);
+        break;
+
+    // the word index is taken modulo 32, an indirect access never leaves ram
+    case Mnemonic::LoadInd:
+        ram[0] = ram[ram[isa::LoadInd::ptr(code, pc)] & 31];
+        break;
+
+    case Mnemonic::StoreInd:
+        ram[ram[isa::StoreInd::ptr(code, pc)] & 31] = ram[0];
+        break;
+
+    case Mnemonic::LoadRomB:
+        ram[0] = load_rom(code, isa::LoadRomB::table(code, pc), ram[isa::LoadRomB::idx(code, pc)], 1);
+        break;
+
+    case Mnemonic::LoadRomH:
+        ram[0] = load_rom(code, isa::LoadRomH::table(code, pc), ram[isa::LoadRomH::idx(code, pc)], 2);
+        break;
+
+    case Mnemonic::LoadRomW:
+        ram[0] = load_rom(code, isa::LoadRomW::table(code, pc), ram[isa::LoadRomW::idx(code, pc)], 4);
+        break;
+
+    case Mnemonic::Halt:
+    case Mnemonic::Unknown: // unknown headers and lane operations stop like HALT
+        pc++;
+        return false;
+    }
+
+    pc = next;
+    return true;
+}
+
+
+
+// host for the function pointer API: without a procedure CALL returns proc_id
+template <typename Word>
+struct ProcHost
+{
+    typename VmWord<Word>::Proc proc;
+
+    Word operator()(Word proc_id, Word arg) const
+    {
+        return proc ? proc(proc_id, arg) : proc_id;
+    }
+};
+
+
+// execute() with an arbitrary host, the host call can be inlined into the loop
+template <typename Word, typename Host>
+void execute_host(Word* ram, const void* text, uint8_t start, Host&& host, uint8_t* exec_flag)
+{
+    uint8_t pc = start;
+    const uint8_t* code = reinterpret_cast<const uint8_t*>(text);
+    while ((not exec_flag or *exec_flag)
+           and execute_step(ram, code, pc, host)) {}
+}
@@ -0,0 +1,153 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+#include "fuzzing.hpp"
+#include "runtime_compiler.hpp"
+#include "utils.hpp"
+
+
+
+
+struct Arguments
+{
+    std::string source;
+    std::string binary;
+    std::string bindings;
+    std::string replay;
+    FuzzOptions options;
+};
+
+
+Arguments parse_args(int argc, char* argv[])
+{
+    Arguments args;
+    args.options.workers = std::max(1u, std::thread::hardware_concurrency());
+    auto proc = [&] (char opt, const std::string& value)
+    {
+        switch (opt) {
+        case 'i':
+            args.source = value;
+            break;
+
+        case 'b':
+            args.binary = value;
+            break;
+
+        case 'I':
+            args.bindings = value;
+            break;
+
+        case 'R':
+            args.replay = value;
+            break;
+
+        case 'E':
+            args.options.engine = true;
+            break;
+
+        case 'j':
+            args.options.workers = std::stoul(value);
+            break;
+
+        case 't':
+            args.options.seconds = std::stod(value);
+            break;
+
+        case 'n':
+            args.options.max_execs = std::stoull(value);
+            break;
+
+        case 's':
+            args.options.max_steps = std::stoul(value);
+            break;
+
+        case 'S':
+            args.options.seed = std::stoull(value);
+            break;
+
+        case 'o':
+            args.options.output_dir = value;
+            break;
+        }
+    };
+
+    parse_args("i:b:I:R:Ej:t:n:s:S:o:", argc, argv, proc);
+
+    return args;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try {
+        auto args = parse_args(argc, argv);
+
+        NVMAObject obj;
+        if (args.source.size())
+            obj = compile(load_file(args.source));
+        else if (args.binary.size())
+            obj = parse_nvma_object(load_file(args.binary));
+        else if (not args.options.engine)
+            throw std::runtime_error("Must be specified -i <source> or -b <binary>, or -E");
+
+        if (args.bindings.size())
+            parse_sections_file(obj, load_file(args.bindings));
+
+        Fuzzer fuzzer(obj, args.options);
+
+        if (args.replay.size()) {
+            auto run = fuzzer.replay(load_file(args.replay));
+            switch (run.outcome)
+            {
+            case FuzzOutcome::Ok:
+                std::cout << "ok, " << run.steps << " steps" << std::endl;
+                return 0;
+            case FuzzOutcome::Hang:
+                std::cout << "hang, no HALT after " << run.steps << " steps" << std::endl;
+                return 2;
+            case FuzzOutcome::Crash:
+                std::cout << "crash, " << run.error << std::endl;
+                return 2;
+            }
+        }
+
+        std::filesystem::create_directories(args.options.output_dir);
+
+        auto start = std::chrono::steady_clock::now();
+        std::atomic<bool> done{false};
+        std::thread runner([&] { fuzzer.run(); done = true; });
+
+        auto& stats = fuzzer.stats();
+        auto report = [&] {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "execs " << stats.execs
+                      << ", " << (uint64_t)(stats.execs / std::max(elapsed, 1e-3)) << "/s"
+                      << ", coverage " << stats.coverage_count() << "/256"
+                      << ", corpus " << stats.corpus
+                      << ", crashes " << stats.crashes
+                      << ", hangs " << stats.hangs << std::endl;
+        };
+        auto last = start;
+        while (not done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (std::chrono::steady_clock::now() - last >= std::chrono::seconds(1)) {
+                last = std::chrono::steady_clock::now();
+                report();
+            }
+        }
+        runner.join();
+        report();
+
+        for (auto& name : fuzzer.findings())
+            std::cout << "saved " << name << std::endl;
+        return fuzzer.findings().empty() ? 0 : 2;
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+}
@@ -0,0 +1,28 @@
+#include <cstring>
+#include <iostream>
+
+#include "fuzzing.hpp"
+
+
+
+
+// libFuzzer entry, built with -DNANOVM_LIBFUZZER=ON (clang):
+// the first 128 bytes are ram, the rest is text (up to 256 bytes, padded with HALT).
+// Engine/decoder disagreement aborts, memory errors are caught by the sanitizer.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    FuzzCase c;
+    c.ram.fill(0);
+    c.code.fill(0xFF);
+    auto ram_size = std::min(size, sizeof(c.ram));
+    std::memcpy(c.ram.data(), data, ram_size);
+    std::memcpy(c.code.data(), data + ram_size, std::min(size - ram_size, c.code.size()));
+
+    Coverage coverage;
+    auto run = run_engine_checked(c, 4096, coverage);
+    if (run.outcome == FuzzOutcome::Crash) {
+        std::cerr << "Engine check failed " << run.error << std::endl;
+        std::abort();
+    }
+    return 0;
+}
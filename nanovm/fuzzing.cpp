@@ -0,0 +1,393 @@
+#include "fuzzing.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+#include "isa.hpp"
+#include "utils.hpp"
+#include "vmop.hpp"
+
+
+
+
+size_t Coverage::count() const
+{
+    size_t n = 0;
+    for (auto word : bits)
+        n += __builtin_popcountll(word);
+    return n;
+}
+
+
+size_t FuzzStats::coverage_count() const
+{
+    size_t n = 0;
+    for (auto& word : coverage)
+        n += __builtin_popcountll(word.load(std::memory_order_relaxed));
+    return n;
+}
+
+
+std::array<bool, 256> instruction_starts(const std::vector<uint8_t>& text, size_t size)
+{
+    std::array<bool, 256> valid{};
+    std::array<uint8_t, 256> code;
+    code.fill(0xFF);
+    std::copy(text.begin(), text.begin() + std::min<size_t>(text.size(), 256), code.begin());
+    for (size_t pc = 0; pc < size and pc < 256; pc += decode_instruction(code.data(), pc).size)
+        valid[pc] = true;
+    return valid;
+}
+
+
+// steps after the cutoff of a hang to find the loop it spins in
+static constexpr size_t hang_window = 256;
+
+
+FuzzRun run_program(const FuzzCase& c, const std::array<bool, 256>& valid,
+                    uint32_t max_steps, Coverage& coverage)
+{
+    FuzzRun run;
+    auto ram = c.ram;
+    uint8_t pc = 0;
+    uint8_t prev = 0;
+    for (run.steps = 0; run.steps < max_steps; run.steps++) {
+        if (not valid[pc]) {
+            run.outcome = FuzzOutcome::Crash;
+            run.pc = pc;
+            run.from = prev;
+            run.error = "jump from " + fhex(prev, 2) + " to " + fhex(pc, 2) + " which is not an instruction";
+            run.signature = "crash " + fhex(prev, 2) + " " + fhex(pc, 2);
+            return run;
+        }
+        coverage.mark(prev, pc);
+        prev = pc;
+        if (not execute_one(ram.data(), c.code.data(), pc, nullptr))
+            return run;
+    }
+    // the cutoff pc varies with the inputs, the lowest pc of the cycle names the loop
+    run.outcome = FuzzOutcome::Hang;
+    run.pc = pc;
+    for (size_t i = 0; i < hang_window and valid[pc]; i++) {
+        run.pc = std::min(run.pc, pc);
+        if (not execute_one(ram.data(), c.code.data(), pc, nullptr))
+            break;
+    }
+    run.signature = "hang " + fhex(run.pc, 2);
+    return run;
+}
+
+
+// checks one execute_one against decode_instruction, empty string if they agree,
+// kind - mnemonic and check which failed
+static std::string check_step(uint32_t* ram, const uint8_t* code, uint8_t& pc, bool& running, std::string& kind)
+{
+    auto inst = decode_instruction(code, pc);
+    uint8_t next = pc + inst.size;
+    uint32_t before[32];
+    std::memcpy(before, ram, sizeof(before));
+
+    running = execute_one(ram, code, pc, nullptr);
+    bool halt = (inst.op == Mnemonic::Halt or inst.op == Mnemonic::Unknown);
+    kind = std::string(mnemonic_name(inst.op)) + " stop";
+    if (running == halt)
+        return std::string("engine ") + (running ? "continued after " : "stopped at ") + mnemonic_name(inst.op);
+    if (halt)
+        return "";
+
+    kind = std::string(mnemonic_name(inst.op)) + " pc";
+    switch (inst.op)
+    {
+    case Mnemonic::Jl:
+    case Mnemonic::Jz:
+        if (pc != next and pc != (uint8_t)inst.imm)
+            return "branch went to " + fhex(pc, 2);
+        break;
+    case Mnemonic::PcSwp:
+        if (pc != (uint8_t)before[inst.arg1])
+            return "PC_SWP went to " + fhex(pc, 2);
+        if (ram[inst.result] != next)
+            return "PC_SWP saved " + fhex(ram[inst.result], 8);
+        break;
+    default:
+        if (pc != next)
+            return std::string(mnemonic_name(inst.op)) + " of size " + std::to_string(inst.size)
+                   + " moved pc to " + fhex(pc, 2);
+    }
+
+    kind = std::string(mnemonic_name(inst.op)) + " ram";
+    auto written = written_registers(inst);
+    for (uint8_t r = 0; r < 32; r++)
+        if (not (written & (1u << r)) and ram[r] != before[r])
+            return std::string(mnemonic_name(inst.op)) + " changed word " + std::to_string(r);
+    return "";
+}
+
+
+FuzzRun run_engine_checked(const FuzzCase& c, uint32_t max_steps, Coverage& coverage)
+{
+    FuzzRun run;
+    auto ram = c.ram;
+    uint8_t pc = 0;
+    uint8_t prev = 0;
+    bool running = true;
+    std::string kind;
+    for (run.steps = 0; run.steps < max_steps and running; run.steps++) {
+        coverage.mark(prev, pc);
+        prev = pc;
+        auto error = check_step(ram.data(), c.code.data(), pc, running, kind);
+        if (error.size()) {
+            run.outcome = FuzzOutcome::Crash;
+            run.signature = kind;
+            run.pc = prev;
+            run.error = "at " + fhex(prev, 2) + ": " + error;
+            return run;
+        }
+    }
+    return run;
+}
+
+
+
+
+namespace {
+
+
+const uint32_t interesting[] = {
+    0, 1, 2, 3, 4, 7, 8, 15, 16, 31, 32, 63, 64, 127, 128, 255, 256,
+    0x7FFF, 0x8000, 0xFFFF, 0x10000, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFE, 0xFFFFFFFF,
+};
+
+
+uint32_t mutate_word(uint32_t value, Rng& rng)
+{
+    switch (rng.below(5))
+    {
+    case 0:
+        return value ^ (1u << rng.below(32));
+    case 1:
+        return interesting[rng.below(sizeof(interesting) / sizeof(interesting[0]))];
+    case 2:
+        return value + 1 + rng.below(16);
+    case 3:
+        return value - 1 - rng.below(16);
+    default:
+        return rng.next();
+    }
+}
+
+
+} // namespace
+
+
+Fuzzer::Fuzzer(const NVMAObject& obj, const FuzzOptions& options)
+    : obj(obj)
+    , options(options)
+{
+    if (obj.text.data.size() > 256)
+        throw std::runtime_error("Text section is bigger than 256 bytes");
+    require_width(obj, 32);
+
+    initial.code.fill(0xFF);
+    std::copy(obj.text.data.begin(), obj.text.data.end(), initial.code.begin());
+    initial.ram.fill(0);
+    std::memcpy(initial.ram.data(), obj.ram.data.data(), std::min(obj.ram.data.size(), sizeof(initial.ram)));
+    valid = instruction_starts(obj.text.data, code_size(obj));
+
+    for (auto& [name, label] : obj.input.labels)
+        if (label.size == 4)
+            inputs.emplace_back(label.pos / 4, name);
+    if (not options.engine and inputs.empty())
+        throw std::runtime_error("Program has no .input words to mutate");
+}
+
+
+FuzzRun Fuzzer::execute(const FuzzCase& c, Coverage& coverage) const
+{
+    if (options.engine)
+        return run_engine_checked(c, options.max_steps, coverage);
+    return run_program(c, valid, options.max_steps, coverage);
+}
+
+
+FuzzCase Fuzzer::minimize(FuzzCase c, const FuzzRun& run) const
+{
+    auto reproduces = [&] (const FuzzCase& candidate) {
+        Coverage coverage;
+        auto again = execute(candidate, coverage);
+        return again.outcome == run.outcome and again.signature == run.signature;
+    };
+
+    auto shrink_word = [&] (uint32_t& word) {
+        for (uint32_t candidate : {0u, 1u}) {
+            if (word <= candidate)
+                return;
+            auto old = word;
+            word = candidate;
+            if (reproduces(c))
+                return;
+            word = old;
+        }
+        // halve while the finding stays
+        while (word > 1) {
+            auto old = word;
+            word >>= 1;
+            if (not reproduces(c)) {
+                word = old;
+                return;
+            }
+        }
+    };
+
+    if (options.engine) {
+        for (auto& byte : c.code) {
+            if (byte == 0xFF)
+                continue;
+            auto old = byte;
+            byte = 0xFF;
+            if (not reproduces(c))
+                byte = old;
+        }
+        for (auto& word : c.ram)
+            shrink_word(word);
+    }
+    else {
+        for (auto& [index, name] : inputs)
+            shrink_word(c.ram[index]);
+    }
+    return c;
+}
+
+
+void Fuzzer::save(const FuzzCase& c, const FuzzRun& run)
+{
+    nlohmann::json json;
+    if (options.engine) {
+        std::string text;
+        for (auto byte : c.code)
+            text += fhex(byte, 2);
+        json["text"] = text;
+        json["ram"] = c.ram;
+        json["pc"] = run.pc;
+        json["error"] = run.error;
+    }
+    else {
+        auto& input = json["input"] = nlohmann::json::object();
+        for (auto& [index, name] : inputs)
+            input[name] = c.ram[index];
+    }
+
+    auto name = options.output_dir + "/"
+                + (run.outcome == FuzzOutcome::Hang ? "hang-" : "crash-") + fhex(run.pc, 2)
+                + "-" + std::to_string(saved.size()) + ".json";
+    std::ofstream out(name);
+    if (not out)
+        throw std::runtime_error("Can't write " + name);
+    out << json.dump(4) << std::endl;
+    saved.push_back(name);
+}
+
+
+FuzzRun Fuzzer::replay(const std::string& content) const
+{
+    auto json = nlohmann::json::parse(content);
+    auto c = initial;
+    if (json.contains("text")) {
+        auto text = json["text"].get<std::string>();
+        for (size_t i = 0; i + 1 < text.size() and i / 2 < c.code.size(); i += 2)
+            c.code[i / 2] = std::stoul(text.substr(i, 2), nullptr, 16);
+        auto ram = json["ram"].get<std::vector<uint32_t>>();
+        std::copy(ram.begin(), ram.begin() + std::min<size_t>(ram.size(), 32), c.ram.begin());
+    }
+    else {
+        auto bound = obj;
+        parse_sections_file(bound, content);
+        std::memcpy(c.ram.data(), bound.ram.data.data(), std::min(bound.ram.data.size(), sizeof(c.ram)));
+    }
+
+    Coverage coverage;
+    return execute(c, coverage);
+}
+
+
+void Fuzzer::worker(size_t index)
+{
+    Rng rng{options.seed * 0x9E3779B97F4A7C15ull + index + 1};
+    std::vector<FuzzCase> corpus = {initial};
+    Coverage known;
+    uint64_t local_execs = 0;
+
+    auto deadline = std::chrono::steady_clock::now()
+                    + std::chrono::microseconds((int64_t)(options.seconds * 1e6));
+
+    while (not stopped) {
+        // time and global counters are checked in batches
+        if ((local_execs & 1023) == 0) {
+            fuzz_stats.execs += (local_execs ? 1024 : 0);
+            if (fuzz_stats.execs >= options.max_execs or std::chrono::steady_clock::now() >= deadline)
+                break;
+            for (size_t i = 0; i < 4; i++)
+                known.bits[i] |= fuzz_stats.coverage[i].load(std::memory_order_relaxed);
+        }
+        local_execs++;
+
+        auto c = corpus[rng.below(corpus.size())];
+        for (size_t n = 1 + rng.below(4); n; n--) {
+            if (options.engine) {
+                if (rng.below(4))
+                    c.code[rng.below(256)] = (rng.below(2) ? rng.next() : c.code[rng.below(256)] ^ (1 << rng.below(8)));
+                else
+                    c.ram[rng.below(32)] = mutate_word(c.ram[rng.below(32)], rng);
+            }
+            else {
+                auto word = inputs[rng.below(inputs.size())].first;
+                c.ram[word] = mutate_word(c.ram[word], rng);
+            }
+        }
+
+        Coverage coverage;
+        auto run = execute(c, coverage);
+
+        bool fresh = false;
+        for (size_t i = 0; i < 4; i++) {
+            if (coverage.bits[i] & ~known.bits[i]) {
+                fresh = true;
+                known.bits[i] |= fuzz_stats.coverage[i].fetch_or(coverage.bits[i]) | coverage.bits[i];
+            }
+        }
+        if (fresh and run.outcome == FuzzOutcome::Ok) {
+            corpus.push_back(c);
+            fuzz_stats.corpus++;
+        }
+
+        if (run.outcome == FuzzOutcome::Ok)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(findings_mutex);
+            if (not seen.insert(run.signature).second)
+                continue;
+        }
+
+        auto minimized = minimize(c, run);
+        std::lock_guard<std::mutex> lock(findings_mutex);
+        (run.outcome == FuzzOutcome::Hang ? fuzz_stats.hangs : fuzz_stats.crashes)++;
+        save(minimized, run);
+    }
+    fuzz_stats.execs += local_execs & 1023;
+}
+
+
+void Fuzzer::run()
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::max<size_t>(options.workers, 1); i++)
+        threads.emplace_back([this, i] { worker(i); });
+    for (auto& thread : threads)
+        thread.join();
+}
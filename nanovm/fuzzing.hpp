@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "runtime_compiler.hpp"
+
+
+
+
+/*
+Фаззинг программ и движка.
+
+Покрытие - 256 бит на ребра переходов, как в AFL: бит (prev_pc >> 1) ^ pc.
+Каждый запуск начинается со снимка 128-байтной ram (memcpy), мутируются
+слова .input (режим Program) или байты text и ram (режим Engine).
+
+Program: crash - переход на pc, который не является началом инструкции
+text секции (середина инструкции или за концом text), hang - не остановилась
+за max_steps инструкций; hang различаются по наименьшему pc цикла, в котором крутится программа.
+Engine: после каждой инструкции execute_one сверяется с decode_instruction:
+следующий pc, HALT, и что изменены только слова из written_registers.
+Расхождение - crash, hang не бывает (случайный код просто обрывается).
+*/
+
+
+struct Coverage
+{
+    std::array<uint64_t, 4> bits{};
+
+    void mark(uint8_t prev, uint8_t pc)
+    {
+        uint8_t edge = (prev >> 1) ^ pc;
+        bits[edge >> 6] |= 1ull << (edge & 63);
+    }
+
+    size_t count() const;
+};
+
+
+enum class FuzzOutcome : uint8_t {
+    Ok,
+    Hang,
+    Crash,
+};
+
+
+struct FuzzCase
+{
+    std::array<uint8_t, 256> code;
+    std::array<uint32_t, 32> ram;
+};
+
+
+struct FuzzRun
+{
+    FuzzOutcome outcome = FuzzOutcome::Ok;
+    uint8_t pc = 0;      // where crash happened, the lowest pc of the loop of a hang
+    uint8_t from = 0;    // previous pc
+    uint32_t steps = 0;
+    std::string error;
+    std::string signature; // same for findings of one bug, used to deduplicate
+};
+
+
+// Program mode: runs case from pc 0, valid - starts of instructions in text
+FuzzRun run_program(const FuzzCase& c, const std::array<bool, 256>& valid,
+                    uint32_t max_steps, Coverage& coverage);
+
+// Engine mode: runs case from pc 0 comparing every step with the decoder
+FuzzRun run_engine_checked(const FuzzCase& c, uint32_t max_steps, Coverage& coverage);
+
+// starts of instructions for a linear decode of the first size bytes of text,
+// .rodata after the code is not decoded
+std::array<bool, 256> instruction_starts(const std::vector<uint8_t>& text, size_t size);
+
+
+struct FuzzOptions
+{
+    bool engine = false;
+    size_t workers = 1;
+    double seconds = 10;
+    uint64_t max_execs = UINT64_MAX;
+    uint32_t max_steps = 100000;
+    uint64_t seed = 1;
+    std::string output_dir = "fuzz-out";
+};
+
+
+struct FuzzStats
+{
+    std::atomic<uint64_t> execs{0};
+    std::atomic<uint64_t> corpus{0};
+    std::atomic<uint64_t> crashes{0};
+    std::atomic<uint64_t> hangs{0};
+    std::array<std::atomic<uint64_t>, 4> coverage{};
+
+    size_t coverage_count() const;
+};
+
+
+// Findings are minimized and saved to output_dir as JSON: in Program mode the file
+// is input bindings ({"input": {...}}) for any tool with -I, in Engine mode
+// {"text": "hex", "ram": [...], "pc": ..., "error": ...}.
+class Fuzzer
+{
+public:
+    Fuzzer(const NVMAObject& obj, const FuzzOptions& options);
+
+    // blocks until time or execs are over, stats are updated on the fly
+    void run();
+    void stop() { stopped = true; }
+
+    const FuzzStats& stats() const { return fuzz_stats; }
+    const std::vector<std::string>& findings() const { return saved; }
+
+    // replays a saved finding
+    FuzzRun replay(const std::string& json) const;
+
+private:
+    NVMAObject obj;
+    FuzzOptions options;
+    FuzzCase initial;
+    std::array<bool, 256> valid;
+    std::vector<std::pair<uint8_t, std::string>> inputs; // word, name
+
+    FuzzStats fuzz_stats;
+    std::atomic<bool> stopped{false};
+    std::mutex findings_mutex;
+    std::vector<std::string> saved;
+    std::set<std::string> seen;
+
+    void worker(size_t index);
+    FuzzRun execute(const FuzzCase& c, Coverage& coverage) const;
+    FuzzCase minimize(FuzzCase c, const FuzzRun& run) const;
+    void save(const FuzzCase& c, const FuzzRun& run);
+};
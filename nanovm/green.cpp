@@ -0,0 +1,244 @@
+#include "green.hpp"
+
+
+
+
+struct GreenScheduler::Tenant
+{
+    std::atomic<uint8_t> priority{1};
+    std::atomic<uint64_t> quota{0};
+
+    std::atomic<uint64_t> instructions{0};
+    std::atomic<uint64_t> quanta{0};
+    std::atomic<uint64_t> running{0};
+    std::atomic<uint64_t> finished{0};
+    std::atomic<uint64_t> quota_exceeded{0};
+
+    // reserves up to want instructions of quota, returns how many were reserved
+    uint32_t reserve(uint32_t want)
+    {
+        auto limit = quota.load();
+        if (not limit) {
+            instructions += want;
+            return want;
+        }
+        auto used = instructions.load();
+        while (true) {
+            if (used >= limit)
+                return 0;
+            auto take = (uint32_t)std::min<uint64_t>(want, limit - used);
+            if (instructions.compare_exchange_weak(used, used + take))
+                return take;
+        }
+    }
+};
+
+
+struct GreenScheduler::Task
+{
+    Tenant* tenant;
+    std::shared_ptr<const ProgramImage> image;
+    GreenResult result;
+    uint8_t pc;
+    uint32_t quanta = 0;
+    std::promise<GreenResult> done;
+
+    size_t level(const GreenOptions& options) const
+    {
+        return std::min<size_t>(tenant->priority + quanta / std::max(1u, options.demote_after),
+                                green_levels - 1);
+    }
+};
+
+
+GreenScheduler::GreenScheduler(uint32_t (*proc)(uint32_t proc_id, uint32_t arg), GreenOptions options)
+    : proc(proc)
+    , options(options)
+    , queues(std::max<size_t>(1, options.workers))
+{
+    for (size_t i = 0; i < queues.size(); i++)
+        workers.emplace_back([this, i] { worker(i); });
+}
+
+
+GreenScheduler::~GreenScheduler()
+{
+    {
+        std::lock_guard lock(sleep_mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto& w : workers)
+        w.join();
+}
+
+
+GreenScheduler::Tenant& GreenScheduler::tenant(uint32_t id)
+{
+    std::lock_guard lock(tenants_mutex);
+    auto& t = tenants[id];
+    if (not t)
+        t = std::make_unique<Tenant>();
+    return *t;
+}
+
+
+void GreenScheduler::set_tenant(uint32_t id, TenantLimits limits)
+{
+    auto& t = tenant(id);
+    t.priority = std::min<uint8_t>(limits.priority, green_levels - 1);
+    t.quota = limits.instruction_quota;
+}
+
+
+std::future<GreenResult> GreenScheduler::submit(uint32_t tenant_id,
+                                                std::shared_ptr<const ProgramImage> image,
+                                                const Ram& ram,
+                                                uint8_t start)
+{
+    auto task = std::make_unique<Task>();
+    task->tenant = &tenant(tenant_id);
+    task->image = std::move(image);
+    task->result.ram = ram;
+    task->pc = start;
+    task->tenant->running++;
+
+    auto future = task->done.get_future();
+    push(next_queue++ % queues.size(), std::move(task));
+    { std::lock_guard lock(sleep_mutex); }
+    wakeup.notify_one();
+    return future;
+}
+
+
+void GreenScheduler::push(size_t worker, std::unique_ptr<Task> task)
+{
+    auto& q = queues[worker];
+    std::lock_guard lock(q.mutex);
+    q.levels[task->level(options)].push_back(std::move(task));
+    q.size++;
+    queued++;
+}
+
+
+std::unique_ptr<GreenScheduler::Task> GreenScheduler::pop(size_t worker)
+{
+    auto& q = queues[worker];
+    std::lock_guard lock(q.mutex);
+    if (not q.size)
+        return nullptr;
+
+    // highest level first, sometimes the lowest one so heavy VMs still progress
+    bool lowest_first = (++q.picks % std::max(1u, options.starvation_period) == 0);
+    for (size_t i = 0; i < green_levels; i++) {
+        auto& level = q.levels[lowest_first ? green_levels - 1 - i : i];
+        if (level.size()) {
+            auto task = std::move(level.front());
+            level.pop_front();
+            q.size--;
+            queued--;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+
+std::unique_ptr<GreenScheduler::Task> GreenScheduler::steal(size_t worker)
+{
+    for (size_t i = 1; i < queues.size(); i++) {
+        auto& q = queues[(worker + i) % queues.size()];
+        std::lock_guard lock(q.mutex);
+        // from the back of the highest level, victim keeps its oldest tasks
+        for (auto& level : q.levels) {
+            if (level.size()) {
+                auto task = std::move(level.back());
+                level.pop_back();
+                q.size--;
+                queued--;
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+
+void GreenScheduler::run(size_t worker, std::unique_ptr<Task> task)
+{
+    auto& tenant = *task->tenant;
+    auto finish = [&] (GreenStatus status) {
+        task->result.status = status;
+        tenant.running--;
+        if (status == GreenStatus::Halted)
+            tenant.finished++;
+        else
+            tenant.quota_exceeded++;
+        task->done.set_value(task->result);
+    };
+
+    auto budget = tenant.reserve(options.quantum);
+    if (not budget)
+        return finish(GreenStatus::QuotaExceeded);
+
+    uint32_t steps = 0;
+    bool running = execute_bounded(task->result.ram.data(), task->image->code.data(), task->pc, proc, budget, steps);
+    tenant.instructions -= budget - steps;
+    tenant.quanta++;
+    task->result.steps += steps;
+    task->quanta++;
+
+    if (not running)
+        return finish(GreenStatus::Halted);
+    push(worker, std::move(task));
+}
+
+
+void GreenScheduler::worker(size_t index)
+{
+    while (not stopping) {
+        auto task = pop(index);
+        if (not task)
+            task = steal(index);
+        if (task) {
+            run(index, std::move(task));
+            continue;
+        }
+
+        std::unique_lock lock(sleep_mutex);
+        wakeup.wait(lock, [&] { return stopping or queued > 0; });
+    }
+}
+
+
+size_t GreenScheduler::queue_depth() const
+{
+    return queued;
+}
+
+
+std::vector<size_t> GreenScheduler::queue_depths() const
+{
+    std::vector<size_t> out;
+    for (auto& q : queues) {
+        std::lock_guard lock(q.mutex);
+        out.push_back(q.size);
+    }
+    return out;
+}
+
+
+TenantStats GreenScheduler::tenant_stats(uint32_t id) const
+{
+    std::lock_guard lock(tenants_mutex);
+    TenantStats stats;
+    if (not tenants.count(id))
+        return stats;
+    auto& t = *tenants.at(id);
+    stats.instructions = t.instructions;
+    stats.quanta = t.quanta;
+    stats.running = t.running;
+    stats.finished = t.finished;
+    stats.quota_exceeded = t.quota_exceeded;
+    return stats;
+}
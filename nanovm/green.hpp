@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "async.hpp"
+
+
+
+
+/*
+Планировщик зеленых потоков: много VM разных арендаторов (tenant) на пуле потоков.
+VM исполняется квантами по quantum инструкций (execute_bounded), незавершенная VM
+возвращается в очередь своего рабочего потока, свободные потоки воруют работу у соседей.
+
+Очереди многоуровневые: уровень VM = приоритет арендатора + число отработанных
+квантов / demote_after, так короткие программы проходят раньше тяжелых, а чтобы
+нижние уровни не голодали, каждый starvation_period-й выбор делается с самого нижнего.
+Арендатор может иметь квоту инструкций, при ее исчерпании VM снимаются со статусом QuotaExceeded.
+*/
+
+
+constexpr size_t green_levels = 4;
+
+
+struct TenantLimits
+{
+    // 0 - highest, green_levels - 1 - lowest
+    uint8_t priority = 1;
+    // instructions for all VMs of tenant, 0 - unlimited
+    uint64_t instruction_quota = 0;
+};
+
+
+struct TenantStats
+{
+    uint64_t instructions = 0;
+    uint64_t quanta = 0;
+    uint64_t running = 0;
+    uint64_t finished = 0;
+    uint64_t quota_exceeded = 0;
+};
+
+
+enum class GreenStatus : uint8_t {
+    Halted,
+    QuotaExceeded,
+};
+
+
+struct GreenResult
+{
+    Ram ram;
+    GreenStatus status = GreenStatus::Halted;
+    uint64_t steps = 0;
+};
+
+
+struct GreenOptions
+{
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t quantum = 1024;
+    uint32_t demote_after = 4;
+    uint32_t starvation_period = 16;
+};
+
+
+class GreenScheduler
+{
+public:
+    explicit GreenScheduler(uint32_t (*proc)(uint32_t proc_id, uint32_t arg), GreenOptions options = GreenOptions{});
+    ~GreenScheduler();
+
+    GreenScheduler(const GreenScheduler&) = delete;
+    GreenScheduler& operator=(const GreenScheduler&) = delete;
+
+    // unknown tenants get default limits on first submit
+    void set_tenant(uint32_t tenant, TenantLimits limits);
+
+    std::future<GreenResult> submit(uint32_t tenant,
+                                    std::shared_ptr<const ProgramImage> image,
+                                    const Ram& ram,
+                                    uint8_t start = 0);
+
+    size_t queue_depth() const;
+    std::vector<size_t> queue_depths() const;
+    TenantStats tenant_stats(uint32_t tenant) const;
+
+private:
+    struct Tenant;
+    struct Task;
+
+    struct RunQueue
+    {
+        mutable std::mutex mutex;
+        std::deque<std::unique_ptr<Task>> levels[green_levels];
+        size_t size = 0;
+        uint64_t picks = 0;
+    };
+
+    Tenant& tenant(uint32_t id);
+
+    void push(size_t worker, std::unique_ptr<Task> task);
+    std::unique_ptr<Task> pop(size_t worker);
+    std::unique_ptr<Task> steal(size_t worker);
+    void run(size_t worker, std::unique_ptr<Task> task);
+    void worker(size_t index);
+
+    uint32_t (*proc)(uint32_t proc_id, uint32_t arg);
+    GreenOptions options;
+
+    mutable std::mutex tenants_mutex;
+    std::map<uint32_t, std::unique_ptr<Tenant>> tenants;
+
+    std::vector<RunQueue> queues;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> next_queue{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool> stopping{false};
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "engine.hpp"
+#include "runtime_compiler.hpp"
+#include "utils.hpp"
+
+
+
+
+/*
+Реестр функций хоста для CALL вместо одного указателя proc со switch по proc_id.
+
+Функции получают номера подряд с 1, номер 0 зарезервирован: незаполненная метка
+равна 0, и CALL с ним (как и с любым незарегистрированным номером) возвращает
+proc_id, как движок без хоста. Номер - индекс в плотной таблице
+{функция, контекст}, вызов - одна проверка границы и косвенный переход.
+
+Номера попадают в программу при загрузке: bind(obj) записывает номер функции
+в метку .input с тем же именем, например:
+```
+.input
+MEMORY 4, print_cb
+.code
+    CALL temp, print_cb, result
+```
+registry.add<print>("print_cb", console) и registry.bind(obj) перед созданием ram.
+
+HostRegistry собирается во время исполнения, контекст у каждой функции свой,
+так что несколько экземпляров VM с разными реестрами не делят глобального
+состояния. Если набор функций известен при компиляции, StaticHost перечисляет
+их в параметрах шаблона, и после подстановки в execute_host вызовы встраиваются.
+
+Для каждой функции считается число вызовов, с profile = true - и суммарное время.
+*/
+
+
+template <typename Word>
+class HostRegistry
+{
+public:
+    using Fn = Word (*)(void* ctx, Word arg);
+
+    struct Entry
+    {
+        std::string name;
+        Fn fn;
+        void* ctx;
+        uint64_t calls = 0;
+        uint64_t ns = 0;     // only with profile
+    };
+
+    // measure the latency of every call, off by default: it costs two clock reads
+    bool profile = false;
+    // calls with id 0 or an unregistered id
+    uint64_t unbound_calls = 0;
+
+    HostRegistry()
+    {
+        table.push_back({"", nullptr, nullptr});
+    }
+
+    Word add(const std::string& name, Fn fn, void* ctx)
+    {
+        if (name.empty() or id(name))
+            throw std::runtime_error("Host function '" + name + "' is already registered");
+        if ((uint64_t)table.size() > (uint64_t)(Word)~Word(0))
+            throw std::runtime_error("Too many host functions for " + std::to_string(VmWord<Word>::bits) + "-bit word");
+        table.push_back({name, fn, ctx});
+        return Word(table.size() - 1);
+    }
+
+    // add<print>("print_cb", console), print: Word (Ctx&, Word arg)
+    template <auto F, typename Ctx>
+    Word add(const std::string& name, Ctx& ctx)
+    {
+        return add(name, [] (void* ctx, Word arg) -> Word {
+            return F(*static_cast<Ctx*>(ctx), arg);
+        }, &ctx);
+    }
+
+    // any callable Word (Word arg), it is stored by pointer and must outlive the registry
+    template <typename F>
+    Word add(const std::string& name, F& callable)
+    {
+        return add(name, [] (void* ctx, Word arg) -> Word {
+            return (*static_cast<F*>(ctx))(arg);
+        }, &callable);
+    }
+
+    // 0 if there is no such function
+    Word id(const std::string& name) const
+    {
+        for (size_t i = 1; i < table.size(); i++)
+            if (table[i].name == name)
+                return Word(i);
+        return 0;
+    }
+
+    // Writes ids into .input labels named after the functions,
+    // returns how many labels were bound
+    size_t bind(NVMAObject& obj) const
+    {
+        require_width(obj, VmWord<Word>::bits);
+        size_t bound = 0;
+        for (size_t i = 1; i < table.size(); i++) {
+            if (obj.input.labels.count(table[i].name)) {
+                set_value(obj, obj.input, table[i].name, i);
+                bound++;
+            }
+        }
+        return bound;
+    }
+
+    Word operator()(Word proc_id, Word arg)
+    {
+        if (proc_id == 0 or proc_id >= table.size()) {
+            unbound_calls++;
+            return proc_id;
+        }
+        auto& entry = table[proc_id];
+        entry.calls++;
+        if (not profile)
+            return entry.fn(entry.ctx, arg);
+
+        auto start = std::chrono::steady_clock::now();
+        Word result = entry.fn(entry.ctx, arg);
+        entry.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    // entries()[0] is the reserved id 0
+    const std::vector<Entry>& entries() const { return table; }
+
+    void reset_stats()
+    {
+        for (auto& entry : table)
+            entry.calls = entry.ns = 0;
+        unbound_calls = 0;
+    }
+
+private:
+    std::vector<Entry> table;
+};
+
+
+
+// Functions are fixed at compile time: StaticHost<uint32_t, Console, print, read> host{console, {"print_cb", "read_cb"}},
+// print gets id 1, read - id 2. Each function is Word (Ctx&, Word arg).
+template <typename Word, typename Ctx, Word (*... Fns)(Ctx&, Word)>
+class StaticHost
+{
+public:
+    static constexpr size_t size = sizeof...(Fns);
+
+    Ctx& ctx;
+    std::array<const char*, size> names;
+    std::array<uint64_t, size + 1> calls{}; // calls[0] - unbound ids
+
+    size_t bind(NVMAObject& obj) const
+    {
+        require_width(obj, VmWord<Word>::bits);
+        size_t bound = 0;
+        for (size_t i = 0; i < size; i++) {
+            if (obj.input.labels.count(names[i])) {
+                set_value(obj, obj.input, names[i], i + 1);
+                bound++;
+            }
+        }
+        return bound;
+    }
+
+    Word operator()(Word proc_id, Word arg)
+    {
+        return dispatch(proc_id, arg, std::make_index_sequence<size>{});
+    }
+
+private:
+    template <size_t... I>
+    Word dispatch(Word proc_id, Word arg, std::index_sequence<I...>)
+    {
+        Word result = proc_id;
+        bool found = ((proc_id == I + 1 ? (calls[I + 1]++, result = Fns(ctx, arg), true) : false) or ...);
+        if (not found)
+            calls[0]++;
+        return result;
+    }
+};
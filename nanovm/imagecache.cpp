@@ -0,0 +1,484 @@
+#include "imagecache.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "utils.hpp"
+
+
+
+
+namespace {
+
+
+constexpr uint64_t image_magic = 0x31474D494D564EULL; // "NVMIMG1"
+constexpr uint32_t image_version = 2;
+constexpr size_t section_count = std::size(NVMAObject::sections);
+constexpr const char* section_names[section_count] = {"text", "ram", "input", "output", "data"};
+
+// attempts to map a key which other processes keep evicting
+constexpr int max_attempts = 4;
+
+
+struct ImageHeader
+{
+    uint64_t magic;
+    uint64_t key;
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t label_count;
+    uint32_t content_size;
+    uint16_t section_size[section_count];
+    uint8_t width;
+};
+
+
+// VerifiedImage follows the header at its alignment, mappings start at a page
+constexpr size_t image_offset = alignof(VerifiedImage);
+constexpr size_t sections_offset = image_offset + sizeof(VerifiedImage);
+
+static_assert(sizeof(ImageHeader) <= image_offset);
+static_assert(std::is_trivially_copyable_v<VerifiedImage>);
+
+
+size_t labels_offset(const ImageHeader& header)
+{
+    size_t offset = sections_offset;
+    for (auto size : header.section_size)
+        offset += size;
+    return (offset + alignof(SharedLabel) - 1) / alignof(SharedLabel) * alignof(SharedLabel);
+}
+
+
+size_t content_offset(const ImageHeader& header)
+{
+    return labels_offset(header) + (size_t)header.label_count * sizeof(SharedLabel);
+}
+
+
+size_t file_size(const ImageHeader& header)
+{
+    return content_offset(header) + header.content_size;
+}
+
+
+std::string system_error(const std::string& what, const std::string& path)
+{
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+
+std::vector<uint8_t> serialize(const std::string& content, const NVMAObject& obj, const VerifiedImage& image)
+{
+    ImageHeader header{};
+    header.magic = image_magic;
+    header.key = ImageCache::content_key(content);
+    header.version = image_version;
+    header.content_size = content.size();
+    header.width = obj.width;
+
+    std::vector<SharedLabel> labels;
+    for (size_t i = 0; i < section_count; i++) {
+        auto& sec = obj.*NVMAObject::sections[i];
+        if (sec.data.size() > 0xFFFF)
+            throw std::runtime_error("Section " + sec.name + " is too big for the image cache");
+        header.section_size[i] = sec.data.size();
+        for (auto& [name, label] : sec.labels) {
+            if (name.size() > SharedLabel::max_name)
+                throw std::runtime_error("Label " + name + " is longer than " + std::to_string(SharedLabel::max_name)
+                                         + " characters, the image cache can't store it");
+            SharedLabel shared{};
+            shared.section = i;
+            shared.pos = label.pos;
+            shared.size = label.size;
+            std::memcpy(shared.name, name.data(), name.size());
+            labels.push_back(shared);
+        }
+    }
+    header.label_count = labels.size();
+    header.file_size = file_size(header);
+
+    std::vector<uint8_t> bytes(header.file_size);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + image_offset, &image, sizeof(image));
+    auto offset = sections_offset;
+    for (auto psec : NVMAObject::sections) {
+        auto& data = (obj.*psec).data;
+        std::copy(data.begin(), data.end(), bytes.begin() + offset);
+        offset += data.size();
+    }
+    if (labels.size())
+        std::memcpy(bytes.data() + labels_offset(header), labels.data(), labels.size() * sizeof(SharedLabel));
+    std::copy(content.begin(), content.end(), bytes.begin() + content_offset(header));
+    return bytes;
+}
+
+
+// the mapping is trusted after this: VerifiedImage matches the text section, labels are in range
+bool valid_image(const uint8_t* base, const ImageHeader& header)
+{
+    if (header.width != 16 and header.width != 32 and header.width != 64)
+        return false;
+
+    auto& image = *reinterpret_cast<const VerifiedImage*>(base + image_offset);
+    auto text = base + sections_offset;
+    if (image.text_size > 256 or image.text_size != header.section_size[0]
+            or not std::equal(text, text + image.text_size, image.code.begin())
+            or std::any_of(image.code.begin() + image.text_size, image.code.end(), [] (uint8_t b) { return b != 0xFF; }))
+        return false;
+
+    auto labels = reinterpret_cast<const SharedLabel*>(base + labels_offset(header));
+    for (size_t i = 0; i < header.label_count; i++)
+        if (labels[i].section >= section_count
+                or std::memchr(labels[i].name, 0, sizeof(labels[i].name)) == nullptr)
+            return false;
+    return true;
+}
+
+
+// not a symlink, owned by this user, nobody else may add or replace images
+void check_private_dir(const std::string& dir, const struct stat& st)
+{
+    if (not S_ISDIR(st.st_mode))
+        throw std::runtime_error("Image cache " + dir + " is not a directory");
+    if (st.st_uid != geteuid())
+        throw std::runtime_error("Image cache " + dir + " belongs to another user");
+    if (st.st_mode & (S_IWGRP | S_IWOTH))
+        throw std::runtime_error("Image cache " + dir + " is writable by other users");
+}
+
+
+} // namespace
+
+
+
+
+SharedImage::SharedImage(int fd, const uint8_t* base, size_t size)
+    : fd(fd)
+    , base(base)
+    , size(size)
+{
+}
+
+
+SharedImage::~SharedImage()
+{
+    munmap(const_cast<uint8_t*>(base), size);
+    // drops the shared lock, the image may be evicted when no process holds one
+    close(fd);
+}
+
+
+bool SharedImage::holds(const std::string& content) const
+{
+    auto& header = *reinterpret_cast<const ImageHeader*>(base);
+    auto stored = base + content_offset(header);
+    return header.content_size == content.size() and std::equal(content.begin(), content.end(), stored);
+}
+
+
+uint64_t SharedImage::key() const
+{
+    return reinterpret_cast<const ImageHeader*>(base)->key;
+}
+
+
+uint8_t SharedImage::width() const
+{
+    return reinterpret_cast<const ImageHeader*>(base)->width;
+}
+
+
+const VerifiedImage& SharedImage::image() const
+{
+    return *reinterpret_cast<const VerifiedImage*>(base + image_offset);
+}
+
+
+const uint8_t* SharedImage::section(size_t index) const
+{
+    auto& header = *reinterpret_cast<const ImageHeader*>(base);
+    auto offset = sections_offset;
+    for (size_t i = 0; i < index; i++)
+        offset += header.section_size[i];
+    return base + offset;
+}
+
+
+const uint8_t* SharedImage::ram() const
+{
+    return section(1);
+}
+
+
+size_t SharedImage::ram_size() const
+{
+    return reinterpret_cast<const ImageHeader*>(base)->section_size[1];
+}
+
+
+const SharedLabel* SharedImage::find_label(const std::string& section, const std::string& name) const
+{
+    auto& header = *reinterpret_cast<const ImageHeader*>(base);
+    auto labels = reinterpret_cast<const SharedLabel*>(base + labels_offset(header));
+    for (size_t i = 0; i < header.label_count; i++)
+        if (section_names[labels[i].section] == section and labels[i].name == name)
+            return &labels[i];
+    return nullptr;
+}
+
+
+uint8_t SharedImage::entry_point(const std::string& name) const
+{
+    auto label = find_label("text", name);
+    if (not label or label->size != 0 or name == "code" or name == "rodata")
+        throw std::runtime_error("No entry point " + name + " in the program");
+    return label->pos;
+}
+
+
+NVMAObject SharedImage::object() const
+{
+    auto& header = *reinterpret_cast<const ImageHeader*>(base);
+    NVMAObject obj;
+    obj.width = header.width;
+    for (size_t i = 0; i < section_count; i++) {
+        auto& sec = obj.*NVMAObject::sections[i];
+        sec.name = section_names[i];
+        sec.data.assign(section(i), section(i) + header.section_size[i]);
+    }
+    auto labels = reinterpret_cast<const SharedLabel*>(base + labels_offset(header));
+    for (size_t i = 0; i < header.label_count; i++) {
+        auto& label = labels[i];
+        (obj.*NVMAObject::sections[label.section]).labels[label.name] = {label.name, label.pos, label.size};
+    }
+    return obj;
+}
+
+
+
+
+std::string ImageCache::default_dir()
+{
+    return "/dev/shm/nanovm-images-" + std::to_string(geteuid());
+}
+
+
+ImageCache::ImageCache(const std::string& dir)
+    : dir(dir)
+{
+}
+
+
+uint64_t ImageCache::content_key(const std::string& content)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char byte : content) {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+
+std::string ImageCache::path(uint64_t key) const
+{
+    return dir + "/" + fhex(key, 16) + ".nvmi";
+}
+
+
+bool ImageCache::open_dir(bool create)
+{
+    if (checked)
+        return true;
+
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0) {
+        if (errno != ENOENT)
+            throw std::runtime_error(system_error("Can't access image cache", dir));
+        if (not create)
+            return false;
+        if (mkdir(dir.c_str(), 0700) != 0 and errno != EEXIST)
+            throw std::runtime_error(system_error("Can't create image cache", dir));
+        if (lstat(dir.c_str(), &st) != 0)
+            throw std::runtime_error(system_error("Can't access image cache", dir));
+    }
+    check_private_dir(dir, st);
+    checked = true;
+    return true;
+}
+
+
+std::shared_ptr<const SharedImage> ImageCache::open(const std::string& content)
+{
+    auto key = content_key(content);
+    auto file = path(key);
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return nullptr;
+        throw std::runtime_error(system_error("Can't open image", file));
+    }
+
+    // the shared lock is the reference of this process, eviction needs none to be held
+    struct stat st;
+    if (flock(fd, LOCK_SH) != 0 or fstat(fd, &st) != 0) {
+        auto message = system_error("Can't lock image", file);
+        close(fd);
+        throw std::runtime_error(message);
+    }
+    if (st.st_nlink == 0) {
+        // evicted between open and flock
+        close(fd);
+        return nullptr;
+    }
+
+    ImageHeader header{};
+    bool read = (size_t)st.st_size >= sizeof(header)
+                and pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    if (not read or header.magic != image_magic or header.version != image_version or header.key != key
+            or header.file_size != (size_t)st.st_size or file_size(header) != header.file_size) {
+        close(fd);
+        throw std::runtime_error("Image cache file " + file + " is not a valid image");
+    }
+
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        auto message = system_error("Can't map image", file);
+        close(fd);
+        throw std::runtime_error(message);
+    }
+    std::shared_ptr<const SharedImage> image(new SharedImage(fd, static_cast<const uint8_t*>(base), st.st_size));
+    if (not valid_image(image->base, header))
+        throw std::runtime_error("Image cache file " + file + " is not a valid image");
+    // the key only names the file, two contents may share it
+    if (not image->holds(content))
+        throw std::runtime_error("Image cache file " + file + " holds another program with the same key");
+    return image;
+}
+
+
+void ImageCache::publish(const std::string& content, const NVMAObject& obj)
+{
+    auto bytes = serialize(content, obj, VerifiedImage::load(obj));
+    open_dir(true);
+
+    // <key>.<pid>-<sequence>.tmp, the pid lets evict_unused clean up after crashed processes
+    static std::atomic<uint64_t> sequence{0};
+    auto key = content_key(content);
+    auto file = path(key);
+    auto tmp = dir + "/" + fhex(key, 16) + "." + std::to_string(getpid()) + "-" + std::to_string(sequence++) + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw std::runtime_error(system_error("Can't create image", tmp));
+    bool written = write(fd, bytes.data(), bytes.size()) == (ssize_t)bytes.size();
+    close(fd);
+
+    // link does not replace an image another process published first, the content is the same
+    if (not written or (link(tmp.c_str(), file.c_str()) != 0 and errno != EEXIST)) {
+        auto message = system_error("Can't publish image", file);
+        unlink(tmp.c_str());
+        throw std::runtime_error(message);
+    }
+    unlink(tmp.c_str());
+}
+
+
+std::shared_ptr<const SharedImage> ImageCache::get(const std::string& content, const std::function<NVMAObject()>& build)
+{
+    auto key = content_key(content);
+    std::lock_guard lock(mutex);
+    if (auto image = mapped[key].lock(); image and image->holds(content))
+        return image;
+
+    std::optional<NVMAObject> obj;
+    for (int attempt = 0; attempt < max_attempts; attempt++) {
+        if (open_dir(false)) {
+            if (auto image = open(content)) {
+                mapped[key] = image;
+                return image;
+            }
+        }
+        if (not obj)
+            obj = build();
+        publish(content, *obj);
+    }
+    throw std::runtime_error("Image " + fhex(key, 16) + " is evicted faster than it is mapped");
+}
+
+
+std::shared_ptr<const SharedImage> ImageCache::get(const NVMAObject& obj)
+{
+    return get(obj.dump(), [&] { return obj; });
+}
+
+
+std::shared_ptr<const SharedImage> ImageCache::find(const std::string& content)
+{
+    auto key = content_key(content);
+    std::lock_guard lock(mutex);
+    if (auto image = mapped[key].lock(); image and image->holds(content))
+        return image;
+    if (not open_dir(false))
+        return nullptr;
+    auto image = open(content);
+    if (image)
+        mapped[key] = image;
+    return image;
+}
+
+
+size_t ImageCache::evict_unused()
+{
+    {
+        std::lock_guard lock(mutex);
+        if (not open_dir(false))
+            return 0;
+    }
+    DIR* listing = opendir(dir.c_str());
+    if (not listing)
+        return 0;
+
+    size_t removed = 0;
+    while (auto entry = readdir(listing)) {
+        std::string name = entry->d_name;
+        auto file = dir + "/" + name;
+        auto ends_with = [&] (const std::string& suffix) {
+            return name.size() > suffix.size() and name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+
+        if (ends_with(".tmp")) {
+            auto dot = name.find('.');
+            auto pid = std::atoi(name.c_str() + dot + 1);
+            if (dot != name.npos and pid > 0 and kill(pid, 0) != 0 and errno == ESRCH)
+                unlink(file.c_str());
+        }
+        else if (ends_with(".nvmi")) {
+            int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                continue;
+            // no process holds a shared lock, the ones opening it now see st_nlink == 0
+            if (flock(fd, LOCK_EX | LOCK_NB) == 0 and unlink(file.c_str()) == 0)
+                removed++;
+            close(fd);
+        }
+    }
+    closedir(listing);
+    return removed;
+}
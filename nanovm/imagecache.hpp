@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "runtime_compiler.hpp"
+#include "verifier.hpp"
+
+
+
+
+/*
+Кэш проверенных образов программ, общий для всех процессов машины.
+
+Образ - файл в tmpfs (по умолчанию /dev/shm/nanovm-images-<uid>), имя - 64-битный ключ
+содержимого (<ключ>.nvmi), внутри:
+```
+> заголовок: magic, версия, ключ, ширина слова, размеры секций, число меток, размер содержимого
+> VerifiedImage: text с HALT дополнением, готовый для execute, и размер text
+> байты секций text, ram, input, output, data как в NVMAObject
+> таблица меток всех секций, записи фиксированного размера
+> содержимое, по которому получен ключ (исходный текст или дамп объекта)
+```
+Ключ только называет файл: при открытии содержимое сравнивается целиком, чужая программа
+с тем же ключом - ошибка. Образ проверяется один раз при отображении: text VerifiedImage
+совпадает с секцией text и дополнен HALT, у меток допустимая секция и имя с нулем в конце.
+Каталог должен принадлежать пользователю процесса, не быть ссылкой и не быть доступным
+на запись группе и остальным, новый создается с правами 0700.
+Процесс отображает файл только для чтения (MAP_SHARED): на машине одна копия каждой
+программы, а холодный старт - open, flock и mmap без разбора, сборки и проверки.
+Отдельного предекодированного вида у программ нет, execute исполняет проверенный text
+образа напрямую.
+
+Первый процесс, которому нужен образ, проверяет программу (VerifiedImage::load), пишет
+образ во временный файл и публикует через link(). При гонке побеждает один, остальные
+отображают его образ. Опубликованный файл не меняется.
+
+Счетчик ссылок - разделяемые flock на дескрипторах отображений: ядро снимает их при
+завершении процесса, в том числе аварийном. evict_unused удаляет образы без блокировок
+(flock LOCK_EX | LOCK_NB) и временные файлы умерших процессов. Процесс, открывший
+удаляемый образ, видит st_nlink == 0 и публикует его заново. Внутри процесса одно
+отображение образа делят shared_ptr.
+*/
+
+
+struct SharedLabel
+{
+    static constexpr size_t max_name = 31;
+
+    uint8_t section; // index in NVMAObject::sections
+    uint8_t pos;
+    uint8_t size;
+    char name[max_name + 1];
+};
+
+
+// read-only view of one mapped image, the mapping lives while the pointer does
+class SharedImage
+{
+public:
+    SharedImage(const SharedImage&) = delete;
+    SharedImage& operator=(const SharedImage&) = delete;
+    ~SharedImage();
+
+    uint64_t key() const;
+    // the image was published for exactly this content
+    bool holds(const std::string& content) const;
+    uint8_t width() const;
+    const VerifiedImage& image() const;
+    // initial ram of the program, obj.ram.data of the object
+    const uint8_t* ram() const;
+    size_t ram_size() const;
+
+    // nullptr if the section (text, ram, input, output, data) has no such label
+    const SharedLabel* find_label(const std::string& section, const std::string& name) const;
+    // pc of an entry point of a linked program, see entry_points() in utils.hpp
+    uint8_t entry_point(const std::string& name) const;
+    // copy as an ordinary object for the tools
+    NVMAObject object() const;
+
+private:
+    friend class ImageCache;
+    SharedImage(int fd, const uint8_t* base, size_t size);
+
+    const uint8_t* section(size_t index) const;
+
+    int fd;
+    const uint8_t* base;
+    size_t size;
+};
+
+
+class ImageCache
+{
+public:
+    // /dev/shm/nanovm-images-<euid>
+    static std::string default_dir();
+
+    explicit ImageCache(const std::string& dir = default_dir());
+
+    // names the image file of any text
+    static uint64_t content_key(const std::string& content);
+
+    // maps the image published by any process for the content, otherwise verifies build() and
+    // publishes it, so a worker skips compiling a source whose image is published:
+    // cache.get(source, [&] { return compile(source); })
+    // throws std::runtime_error if the program is rejected or the cache is not usable
+    std::shared_ptr<const SharedImage> get(const std::string& content, const std::function<NVMAObject()>& build);
+    // keyed by the object dump
+    std::shared_ptr<const SharedImage> get(const NVMAObject& obj);
+    // nullptr if no process published the content
+    std::shared_ptr<const SharedImage> find(const std::string& content);
+
+    // removes images no process maps and temporary files of dead processes, returns removed images
+    size_t evict_unused();
+
+private:
+    std::string path(uint64_t key) const;
+    // false if the directory does not exist and create is not set, throws if it is not private
+    bool open_dir(bool create);
+    std::shared_ptr<const SharedImage> open(const std::string& content);
+    void publish(const std::string& content, const NVMAObject& obj);
+
+    std::string dir;
+    bool checked = false;
+    std::mutex mutex;
+    std::map<uint64_t, std::weak_ptr<const SharedImage>> mapped;
+};
@@ -0,0 +1,134 @@
+#include "isa.hpp"
+
+#include <sstream>
+
+
+
+
+Instruction decode_instruction(const uint8_t* code, uint8_t pc)
+{
+    Instruction inst;
+    inst.op = decode_mnemonic(code, pc);
+    inst.size = decode_table[code[pc]].size;
+
+    uint32_t values[3] = {};
+    decode_operands(inst.op, code, pc, values);
+    auto& info = instruction_info[(uint8_t)inst.op];
+    for (uint8_t i = 0; i < info.operand_count; i++)
+        set_operand(inst, info.operands[i].field, values[i]);
+    return inst;
+}
+
+
+const char* mnemonic_name(Mnemonic op)
+{
+    return instruction_info[(uint8_t)op].name;
+}
+
+
+Mnemonic mnemonic_from_name(const std::string& name)
+{
+    for (uint8_t op = 0; op < (uint8_t)Mnemonic::Unknown; op++)
+        if (name == instruction_info[op].name)
+            return (Mnemonic)op;
+    return Mnemonic::Unknown;
+}
+
+
+bool is_packed(Mnemonic op)
+{
+    return op >= Mnemonic::PAddUSB and op <= Mnemonic::PopCnt;
+}
+
+
+bool is_rom_load(Mnemonic op)
+{
+    return op >= Mnemonic::LoadRomB and op <= Mnemonic::LoadRomW;
+}
+
+
+bool is_branch(const Instruction& inst)
+{
+    switch (inst.op)
+    {
+    case Mnemonic::Jl:
+    case Mnemonic::Jz:
+    case Mnemonic::PcSwp:
+    case Mnemonic::Halt:
+    case Mnemonic::Unknown:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+uint32_t read_registers(const Instruction& inst)
+{
+    auto& info = instruction_info[(uint8_t)inst.op];
+    if (info.indirect_read)
+        return 0xFFFFFFFF;
+    uint32_t mask = (info.lr_read ? 1u : 0u);
+    for (uint8_t i = 0; i < info.operand_count; i++)
+        if (info.operands[i].read)
+            mask |= 1u << operand_value(inst, info.operands[i].field);
+    return mask;
+}
+
+
+uint32_t written_registers(const Instruction& inst)
+{
+    if (instruction_info[(uint8_t)inst.op].indirect_write)
+        return 0xFFFFFFFF;
+    return defined_registers(inst);
+}
+
+
+uint32_t defined_registers(const Instruction& inst)
+{
+    auto& info = instruction_info[(uint8_t)inst.op];
+    uint32_t mask = (info.lr_write ? 1u : 0u);
+    for (uint8_t i = 0; i < info.operand_count; i++)
+        if (info.operands[i].write)
+            mask |= 1u << operand_value(inst, info.operands[i].field);
+    return mask;
+}
+
+
+uint32_t encoded_registers(const Instruction& inst)
+{
+    auto& info = instruction_info[(uint8_t)inst.op];
+    uint32_t mask = (info.lr_read or info.lr_write ? 1u : 0u);
+    for (uint8_t i = 0; i < info.operand_count; i++)
+        if (info.operands[i].category == OperandCategory::Register)
+            mask |= 1u << operand_value(inst, info.operands[i].field);
+    return mask;
+}
+
+
+std::string format_instruction(const Instruction& inst, const std::map<uint8_t, std::string>& names)
+{
+    auto reg = [&] (uint8_t r) {
+        if (names.count(r))
+            return names.at(r);
+        return (r == 0 ? std::string("lr") : std::to_string(r));
+    };
+    auto hex = [] (uint32_t v) {
+        std::ostringstream oss;
+        oss << "0x" << std::hex << std::uppercase << v;
+        return oss.str();
+    };
+
+    auto& info = instruction_info[(uint8_t)inst.op];
+    std::string out = info.name;
+    for (uint8_t i = 0; i < info.operand_count; i++) {
+        auto& operand = info.operands[i];
+        auto value = operand_value(inst, operand.field);
+        out += (i ? ", " : " ");
+        if (operand.category == OperandCategory::Register)
+            out += reg(value);
+        else
+            out += (operand.decimal ? std::to_string(value) : hex(value));
+    }
+    return out;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "isa_tables.hpp"
+
+
+
+
+/*
+Mnemonic, таблицы декодирования и кодирования генерируются isa/generate.py
+из описания isa/nanovm.json (isa_tables.hpp в каталоге сборки), новая
+инструкция добавляется только туда и в execute_step (engine.hpp).
+*/
+
+
+/*
+Одна инструкция в разобранном виде, поля используются так:
+```
+> LOAD_OP mem              - arg1 = mem
+> STORE_OP mem             - result = mem
+> JL/JZ rarg, data         - arg1 = rarg, imm = data
+> LOAD_LOW/LOAD_HIGH/LOAD3 - imm
+> ADD result, mem1, mem2   - result, arg1 = mem1, arg2 = mem2 (SUB, AND, OR, PACK тоже)
+> LS/RS result, mem, count - result, arg1 = mem, imm = count
+> CALL result, cb, arg     - result, arg1 = cb, arg2 = arg
+> PC_SWP save, mem         - result = save, arg1 = mem
+> LOAD_IND/STORE_IND ptr   - arg1 = ptr
+> LOAD_ROMB/H/W table, idx - arg1 = idx, imm = table (адрес в text)
+```
+*/
+struct Instruction
+{
+    Mnemonic op = Mnemonic::Unknown;
+    uint8_t size = 1;
+    uint8_t result = 0;
+    uint8_t arg1 = 0;
+    uint8_t arg2 = 0;
+    uint32_t imm = 0;
+};
+
+
+Instruction decode_instruction(const uint8_t* code, uint8_t pc);
+
+
+constexpr uint32_t operand_value(const Instruction& inst, OperandField field)
+{
+    switch (field)
+    {
+    case OperandField::Result: return inst.result;
+    case OperandField::Arg1: return inst.arg1;
+    case OperandField::Arg2: return inst.arg2;
+    default: return inst.imm;
+    }
+}
+
+
+constexpr void set_operand(Instruction& inst, OperandField field, uint32_t value)
+{
+    switch (field)
+    {
+    case OperandField::Result: inst.result = value; break;
+    case OperandField::Arg1: inst.arg1 = value; break;
+    case OperandField::Arg2: inst.arg2 = value; break;
+    default: inst.imm = value; break;
+    }
+}
+
+
+// returns size of encoded instruction, out must have at least 3 bytes,
+// constexpr for the compile-time assembler (assembler.hpp)
+constexpr uint8_t encode_instruction(const Instruction& inst, uint8_t* out)
+{
+    auto& info = instruction_info[(uint8_t)inst.op];
+    uint32_t values[3] = {};
+    for (uint8_t i = 0; i < info.operand_count; i++)
+        values[i] = operand_value(inst, info.operands[i].field);
+    encode_operands(inst.op, values, out);
+    return info.size;
+}
+
+
+const char* mnemonic_name(Mnemonic op);
+
+// Unknown if there is no such instruction
+Mnemonic mnemonic_from_name(const std::string& name);
+
+// bit masks of ram words, bit 0 - lr; words that may be accessed,
+// LOAD_IND/STORE_IND may read/write any word
+uint32_t read_registers(const Instruction& inst);
+uint32_t written_registers(const Instruction& inst);
+// words that are always written, without the indirect store
+uint32_t defined_registers(const Instruction& inst);
+// words named by the operands and lr, without the indirect access
+uint32_t encoded_registers(const Instruction& inst);
+
+bool is_branch(const Instruction& inst);
+bool is_packed(Mnemonic op);
+// LOAD_ROMB/LOAD_ROMH/LOAD_ROMW, imm is an address in text
+bool is_rom_load(Mnemonic op);
+
+std::string format_instruction(const Instruction& inst,
+                               const std::map<uint8_t, std::string>& names = {});
@@ -0,0 +1,537 @@
+#include "peval.hpp"
+
+#include <array>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+
+#include "isa.hpp"
+#include "utils.hpp"
+#include "vmop.hpp"
+
+
+
+
+/*
+Частичный вычислитель (online специализация).
+
+Абстрактное состояние - 32 слова ram, каждое слово либо неизвестно (значение лежит в ram),
+либо известно (value), и тогда in_ram говорит, лежит ли оно уже в ram остаточной программы.
+Инструкции с известными аргументами исполняются на месте через execute_one и в остаточную
+программу не попадают, остальные копируются как есть, перед ними известные аргументы
+материализуются (LOAD константы + STORE_OP). Переходы с известным условием сворачиваются,
+с неизвестным - порождают два остаточных блока.
+
+Остаточный блок определяется парой (pc, состояние), одинаковые пары переиспользуются.
+Если для одного pc набралось больше max_versions разных состояний, состояние обобщается:
+слова, значения которых различаются между версиями, становятся неизвестными
+(так циклы с неизвестным условием сходятся, а короткие циклы разворачиваются).
+
+LOAD_ROMB/H/W с известным индексом исполняются как остальные, .rodata исходной программы
+копируется за остаточным кодом, адреса таблиц в оставшихся загрузках сдвигаются вместе с ней.
+*/
+
+
+namespace {
+
+
+struct Word
+{
+    bool known = false;
+    bool in_ram = true;
+    uint32_t value = 0;
+};
+
+using State = std::array<Word, 32>;
+
+
+struct Emitted
+{
+    Instruction inst;
+    int target = -1; // block id for JL/JZ
+};
+
+
+struct ResidualBlock
+{
+    std::vector<Emitted> code;
+    int next = -1; // unconditional jump / fallthrough, -1 after HALT
+};
+
+
+constexpr size_t max_fold_steps = 1 << 22;
+constexpr size_t max_blocks = 1024;
+
+
+class Specializer
+{
+public:
+    Specializer(const std::vector<uint8_t>& text, size_t code_end, const State& initial, uint32_t outputs,
+                int max_versions)
+        : rodata(text.begin() + code_end, text.end())
+        , rodata_start(code_end)
+        , outputs(outputs)
+        , max_versions(max_versions)
+    {
+        code.fill(0xFF);
+        std::copy(text.begin(), text.end(), code.begin());
+
+        request(0, initial);
+        while (worklist.size()) {
+            auto id = worklist.front();
+            worklist.pop_front();
+            build(id);
+        }
+    }
+
+    // residual code followed by .rodata, nullopt if it does not fit into 256 bytes
+    std::optional<std::vector<uint8_t>> layout() const;
+
+    bool constant() const { return blocks.size() == 1 and constant_run; }
+    const State& final_state() const { return last_halt; }
+
+private:
+    std::array<uint8_t, 256 + 4> code;
+    std::vector<uint8_t> rodata;
+    size_t rodata_start;
+    uint32_t outputs;
+    int max_versions;
+
+    std::vector<ResidualBlock> blocks;
+    std::vector<std::pair<uint8_t, State>> entries;
+    std::deque<int> worklist;
+    std::map<std::string, int> blocks_by_key;
+    std::map<uint8_t, int> versions;
+    std::map<uint8_t, State> generalized;
+    size_t fold_steps = 0;
+
+    bool constant_run = true;
+    State last_halt;
+
+    static std::string key(uint8_t pc, const State& state);
+
+    int find(uint8_t pc, const State& state) const;
+    int request(uint8_t pc, State state);
+    int jump(ResidualBlock& block, uint8_t pc, State& state);
+
+    void build(int id);
+
+    void load_const(ResidualBlock& block, State& state, uint32_t value);
+    void materialize(ResidualBlock& block, State& state, uint32_t mask);
+};
+
+
+std::string Specializer::key(uint8_t pc, const State& state)
+{
+    std::string out(1, (char)pc);
+    for (auto& w : state) {
+        out += (char)(w.known | (w.in_ram << 1));
+        if (w.known)
+            out.append(reinterpret_cast<const char*>(&w.value), sizeof(w.value));
+    }
+    return out;
+}
+
+
+int Specializer::find(uint8_t pc, const State& state) const
+{
+    auto it = blocks_by_key.find(key(pc, state));
+    return it == blocks_by_key.end() ? -1 : it->second;
+}
+
+
+int Specializer::request(uint8_t pc, State state)
+{
+    auto k = key(pc, state);
+    if (blocks_by_key.count(k))
+        return blocks_by_key.at(k);
+    if (blocks.size() >= max_blocks)
+        throw std::runtime_error("Too many residual blocks");
+
+    int id = blocks.size();
+    blocks.emplace_back();
+    entries.emplace_back(pc, state);
+    blocks_by_key[k] = id;
+    worklist.push_back(id);
+    return id;
+}
+
+
+// Transfer of control to pc from block, may generalize state (and emit materialization
+// into block) when pc has too many versions.
+int Specializer::jump(ResidualBlock& block, uint8_t pc, State& state)
+{
+    auto id = find(pc, state);
+    if (id >= 0)
+        return id;
+
+    if (++versions[pc] <= max_versions) {
+        if (not generalized.count(pc))
+            generalized[pc] = state;
+        return request(pc, state);
+    }
+
+    materialize(block, state, 0xFFFFFFFF);
+    auto& general = generalized.at(pc);
+    auto target = state;
+    for (size_t r = 0; r < target.size(); r++) {
+        if (not general[r].known or not target[r].known or general[r].value != target[r].value)
+            target[r] = Word{};
+        general[r] = target[r];
+    }
+    return request(pc, target);
+}
+
+
+void Specializer::load_const(ResidualBlock& block, State& state, uint32_t value)
+{
+    if (state[0].known and state[0].in_ram and state[0].value == value)
+        return;
+
+    Instruction inst;
+    if (value < 8) {
+        inst.op = Mnemonic::Load3;
+        inst.size = 1;
+        inst.imm = value;
+        block.code.push_back({inst});
+    }
+    else {
+        inst.op = Mnemonic::LoadLow;
+        inst.size = 2;
+        inst.imm = value & 0xFFF;
+        if (value > 0xFFF and inst.imm < 8) {
+            inst.op = Mnemonic::Load3;
+            inst.size = 1;
+        }
+        block.code.push_back({inst});
+        if (value > 0xFFF) {
+            Instruction high;
+            high.op = Mnemonic::LoadHigh;
+            high.size = 3;
+            high.imm = value >> 12;
+            block.code.push_back({high});
+        }
+    }
+    state[0] = Word{true, true, value};
+}
+
+
+void Specializer::materialize(ResidualBlock& block, State& state, uint32_t mask)
+{
+    for (uint8_t r = 1; r < state.size(); r++) {
+        if (not (mask & (1u << r)) or not state[r].known or state[r].in_ram)
+            continue;
+
+        auto lr = state[0];
+        int stash = -1;
+        if (not lr.known) {
+            // lr holds residual value, keep it in word which is not materialized yet,
+            // words outside of mask first - they stay free for next constants
+            for (uint32_t preferred : {~mask, 0xFFFFFFFF})
+                for (uint8_t t = 1; t < state.size() and stash < 0; t++)
+                    if (t != r and (preferred & (1u << t)) and state[t].known and not state[t].in_ram)
+                        stash = t;
+            if (stash < 0)
+                throw std::runtime_error("No free word to keep lr while materializing constant");
+
+            Instruction store;
+            store.op = Mnemonic::StoreOp;
+            store.result = stash;
+            block.code.push_back({store});
+        }
+
+        load_const(block, state, state[r].value);
+        Instruction store;
+        store.op = Mnemonic::StoreOp;
+        store.result = r;
+        block.code.push_back({store});
+        state[r].in_ram = true;
+
+        if (stash >= 0) {
+            Instruction load;
+            load.op = Mnemonic::LoadOp;
+            load.arg1 = stash;
+            block.code.push_back({load});
+            state[0] = lr;
+        }
+        else if (lr.known) {
+            state[0] = Word{true, lr.value == state[r].value, lr.value};
+        }
+    }
+
+    if ((mask & 1u) and state[0].known and not state[0].in_ram)
+        load_const(block, state, state[0].value);
+}
+
+
+void Specializer::build(int id)
+{
+    auto [pc, state] = entries[id];
+    ResidualBlock block;
+    bool entered = true;
+
+    auto finish = [&] (int next) {
+        block.next = next;
+        blocks[id] = std::move(block);
+    };
+
+    while (true) {
+        // loop heads and subroutine entries are checked against existing blocks
+        if (not entered) {
+            auto existing = find(pc, state);
+            if (existing >= 0)
+                return finish(existing);
+            if (block.code.size())
+                return finish(jump(block, pc, state));
+        }
+        entered = false;
+
+        for (uint8_t next_pc = pc; ; ) {
+            if (++fold_steps > max_fold_steps)
+                throw std::runtime_error("Evaluation does not terminate in " + std::to_string(max_fold_steps) + " steps");
+
+            auto inst = decode_instruction(code.data(), next_pc);
+            uint32_t reads = read_registers(inst);
+            uint32_t writes = written_registers(inst);
+            if ((inst.op == Mnemonic::LoadInd or inst.op == Mnemonic::StoreInd) and state[inst.arg1].known) {
+                // the accessed word is known from the pointer
+                uint32_t word = 1u << (state[inst.arg1].value & 31);
+                reads = (1u << inst.arg1) | (inst.op == Mnemonic::LoadInd ? word : 1u);
+                writes = (inst.op == Mnemonic::LoadInd ? 1u : word);
+            }
+            bool known = true;
+            for (uint8_t r = 0; r < state.size(); r++)
+                if ((reads & (1u << r)) and not state[r].known)
+                    known = false;
+
+            if (inst.op == Mnemonic::Halt or inst.op == Mnemonic::Unknown) {
+                materialize(block, state, outputs);
+                Instruction halt;
+                halt.op = Mnemonic::Halt;
+                block.code.push_back({halt});
+                last_halt = state;
+                return finish(-1);
+            }
+
+            if (inst.op == Mnemonic::Call or not known) {
+                constant_run = false;
+
+                if (inst.op == Mnemonic::PcSwp)
+                    throw std::runtime_error("PC_SWP with unknown target at " + fhex(next_pc, 2));
+
+                // an unknown pointer may overwrite any word, the folded values must be in ram first
+                bool any_word = inst.op == Mnemonic::StoreInd and not state[inst.arg1].known;
+                materialize(block, state, any_word ? reads | writes : reads);
+                if (inst.op == Mnemonic::Jl or inst.op == Mnemonic::Jz) {
+                    auto fallthrough = jump(block, next_pc + inst.size, state);
+                    auto taken = jump(block, inst.imm, state);
+                    block.code.push_back({inst, taken});
+                    return finish(fallthrough);
+                }
+
+                block.code.push_back({inst});
+                for (uint8_t r = 0; r < state.size(); r++)
+                    if (writes & (1u << r))
+                        state[r] = Word{};
+                next_pc += inst.size;
+                continue;
+            }
+
+            uint32_t ram[32];
+            for (uint8_t r = 0; r < state.size(); r++)
+                ram[r] = state[r].value;
+
+            uint8_t new_pc = next_pc;
+            execute_one(ram, code.data(), new_pc, nullptr);
+            for (uint8_t r = 0; r < state.size(); r++)
+                if (writes & (1u << r))
+                    state[r] = Word{true, false, ram[r]};
+
+            if (is_branch(inst) and new_pc != (uint8_t)(next_pc + inst.size)) {
+                pc = new_pc;
+                break;
+            }
+            next_pc = new_pc;
+        }
+    }
+}
+
+
+std::optional<std::vector<uint8_t>> Specializer::layout() const
+{
+    // blocks without code are only jumps, thread through them
+    auto resolve = [&] (int id) {
+        for (size_t hops = 0; blocks[id].code.empty() and blocks[id].next >= 0 and hops < blocks.size(); hops++)
+            id = blocks[id].next;
+        return id;
+    };
+
+    // chains of fallthrough blocks are placed one after another
+    std::vector<int> order;
+    std::vector<bool> placed(blocks.size(), false);
+    std::vector<int> pending = {resolve(0)};
+    while (pending.size()) {
+        auto id = pending.back();
+        pending.pop_back();
+        for (; id >= 0 and not placed[id]; id = (blocks[id].next >= 0 ? resolve(blocks[id].next) : -1)) {
+            placed[id] = true;
+            order.push_back(id);
+            for (auto& e : blocks[id].code)
+                if (e.target >= 0)
+                    pending.push_back(resolve(e.target));
+        }
+    }
+
+    auto jumps = [&] (size_t index) {
+        auto id = order[index];
+        return blocks[id].next >= 0
+               and (index + 1 == order.size() or resolve(blocks[id].next) != order[index + 1]);
+    };
+
+    std::vector<size_t> address(blocks.size());
+    size_t size = 0;
+    for (size_t index = 0; index < order.size(); index++) {
+        address[order[index]] = size;
+        for (auto& e : blocks[order[index]].code)
+            size += e.inst.size;
+        if (jumps(index))
+            size += 2;
+    }
+    if (size + rodata.size() > 256)
+        return std::nullopt;
+
+    std::vector<uint8_t> text;
+    auto emit = [&] (Instruction inst) {
+        uint8_t buf[3];
+        auto n = encode_instruction(inst, buf);
+        text.insert(text.end(), buf, buf + n);
+    };
+
+    for (size_t index = 0; index < order.size(); index++) {
+        auto id = order[index];
+        for (auto& e : blocks[id].code) {
+            auto inst = e.inst;
+            if (e.target >= 0)
+                inst.imm = address[resolve(e.target)];
+            if (is_rom_load(inst.op)) {
+                if (inst.imm < rodata_start)
+                    throw std::runtime_error(std::string(mnemonic_name(inst.op)) + " reads code at "
+                                             + fhex(inst.imm, 2) + ", the table can't be moved");
+                inst.imm += size - rodata_start;
+            }
+            emit(inst);
+        }
+        if (jumps(index)) {
+            Instruction jz;
+            jz.op = Mnemonic::Jz;
+            jz.size = 2;
+            jz.imm = address[resolve(blocks[id].next)];
+            emit(jz);
+        }
+    }
+    text.insert(text.end(), rodata.begin(), rodata.end());
+    return text;
+}
+
+
+uint32_t words_mask(const NVMAObject::Section& sec)
+{
+    uint32_t mask = 0;
+    for (auto& [name, label] : sec.labels)
+        for (size_t pos = label.pos; pos < (size_t)label.pos + label.size; pos += 4)
+            mask |= 1u << (pos / 4);
+    return mask;
+}
+
+
+} // namespace
+
+
+SpecializationResult specialize(const NVMAObject& obj, const std::string& bindings)
+{
+    if (obj.text.data.size() > 256)
+        throw std::runtime_error("Text section is bigger than 256 bytes");
+    require_width(obj, 32);
+
+    auto bound = obj;
+    parse_sections_file(bound, bindings);
+
+    uint32_t known_inputs = 0;
+    auto json = nlohmann::json::parse(bindings);
+    for (auto& [name, sec] : json.items()) {
+        auto& section = bound.*NVMAObject::sections_mapping.at(name);
+        for (auto& [label, value] : sec.items())
+            known_inputs |= 1u << (section.labels.at(label).pos / 4);
+    }
+
+    uint32_t ram[32] = {0};
+    std::memcpy(ram, bound.ram.data.data(), std::min(bound.ram.data.size(), sizeof(ram)));
+
+    // host writes .input before start, other words start from ram image
+    State initial;
+    uint32_t unknown = words_mask(obj.input) & ~known_inputs;
+    for (uint8_t r = 0; r < initial.size(); r++) {
+        if (unknown & (1u << r))
+            initial[r] = Word{};
+        else
+            initial[r] = Word{true, not (known_inputs & (1u << r)), ram[r]};
+    }
+
+    uint32_t outputs = words_mask(obj.output);
+    size_t code_end = code_size(obj);
+    size_t rodata_size = obj.text.data.size() - code_end;
+
+    // more versions - faster residual program, fewer versions - smaller one;
+    // take the most specialized variant which is smaller than original
+    std::string error;
+    bool too_big = false;
+    std::optional<SpecializationResult> best;
+    for (int max_versions : {16, 4, 1}) {
+        try {
+            Specializer specializer(obj.text.data, code_end, initial, outputs, max_versions);
+            auto text = specializer.layout();
+            if (not text) {
+                too_big = true;
+                continue;
+            }
+
+            SpecializationResult result;
+            result.object = obj;
+            result.object.text.data = std::move(*text);
+            uint8_t residual = result.object.text.data.size() - rodata_size;
+            result.object.text.labels = {{"code", {"code", 0, residual}}};
+            if (rodata_size)
+                result.object.text.labels["rodata"] = {"rodata", residual, (uint8_t)rodata_size};
+            result.original_size = obj.text.data.size();
+            result.specialized_size = result.object.text.data.size();
+
+            result.constant = specializer.constant();
+            if (result.constant) {
+                uint32_t out[32];
+                for (uint8_t r = 0; r < 32; r++)
+                    out[r] = specializer.final_state()[r].value;
+                for (auto& [name, label] : obj.output.labels)
+                    result.constant_outputs[name] = get_value<uint32_t>(out, obj.output, name);
+            }
+
+            if (not best or result.specialized_size < best->specialized_size)
+                best = std::move(result);
+            if (best->specialized_size < best->original_size)
+                break;
+        }
+        catch (const std::runtime_error& e) {
+            error = e.what();
+        }
+    }
+    if (not best and not too_big)
+        throw std::runtime_error("Can't specialize: " + error);
+    if (best and best->specialized_size < best->original_size)
+        return *best;
+
+    // nothing known shrinks the program, it stays as it is with the bound values in its ram image
+    SpecializationResult original;
+    original.object = bound;
+    original.original = true;
+    original.original_size = original.specialized_size = obj.text.data.size();
+    return original;
+}
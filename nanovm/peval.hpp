@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "runtime_compiler.hpp"
+
+
+
+
+struct SpecializationResult
+{
+    NVMAObject object;
+    // all outputs are known, text only stores them
+    bool constant = false;
+    std::map<std::string, uint32_t> constant_outputs;
+    // residual program was not smaller, object is the original one
+    bool original = false;
+    size_t original_size = 0;
+    size_t specialized_size = 0;
+};
+
+
+// bindings - same json as parse_sections_file() accepts, bound words are known,
+// unbound .input words are unknown, everything else starts from obj.ram.
+// If the residual program is not smaller than the original or does not fit into 256 bytes,
+// the original program is returned with the bound values in its ram image.
+// Throws std::runtime_error if program can't be specialized (unknown PC_SWP target
+// or evaluation does not terminate).
+SpecializationResult specialize(const NVMAObject& obj, const std::string& bindings);
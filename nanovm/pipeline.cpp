@@ -0,0 +1,262 @@
+#include "pipeline.hpp"
+
+#include <cstring>
+
+#include "utils.hpp"
+#include "vmop.hpp"
+
+
+
+
+static uint8_t word_index(const NVMAObject::Section& section, const std::string& name)
+{
+    if (not section.labels.count(name))
+        throw std::runtime_error("Name " + name + " not found in section " + section.name);
+    auto& label = section.labels.at(name);
+    if (label.size != 4)
+        throw std::runtime_error("Size not 4 not supported");
+    return label.pos / 4;
+}
+
+
+void PipelineInput::push(const std::vector<uint32_t>& values)
+{
+    if (values.size() != connection->dst.size())
+        throw std::runtime_error("Expected " + std::to_string(connection->dst.size()) + " values");
+
+    PipelineRecord record;
+    std::copy(values.begin(), values.end(), record.words.begin());
+    if (not pipeline->push(*connection, record))
+        throw std::runtime_error("Pipeline is stopped");
+}
+
+
+void PipelineInput::close()
+{
+    PipelineRecord record;
+    record.last = true;
+    pipeline->push(*connection, record);
+}
+
+
+bool PipelineOutput::pop(std::vector<uint32_t>& values)
+{
+    PipelineRecord record;
+    if (not pipeline->pop(*connection, record) or record.last)
+        return false;
+    values.assign(record.words.begin(), record.words.begin() + connection->src.size());
+    return true;
+}
+
+
+Pipeline::Pipeline(uint32_t (*proc)(uint32_t proc_id, uint32_t arg), size_t ring_capacity)
+    : proc(proc)
+    , ring_capacity(ring_capacity)
+{
+}
+
+
+Pipeline::~Pipeline()
+{
+    stop();
+}
+
+
+size_t Pipeline::add_stage(const NVMAObject& obj, const std::string& bindings)
+{
+    if (obj.text.data.size() > 256)
+        throw std::runtime_error("Text section is bigger than 256 bytes");
+    require_width(obj, 32);
+
+    auto stage = std::make_unique<Stage>();
+    stage->obj = obj;
+    parse_sections_file(stage->obj, bindings);
+
+    stage->code.fill(0xFF);
+    std::copy(obj.text.data.begin(), obj.text.data.end(), stage->code.begin());
+    stage->ram.fill(0);
+    std::memcpy(stage->ram.data(), stage->obj.ram.data.data(),
+                std::min(stage->obj.ram.data.size(), sizeof(stage->ram)));
+
+    stages.push_back(std::move(stage));
+    return stages.size() - 1;
+}
+
+
+PipelineConnection* Pipeline::link(Stage* from, Stage* to)
+{
+    if (threads.size())
+        throw std::runtime_error("Pipeline is already started");
+
+    if (from and to) {
+        for (size_t i = 0; i < connections.size(); i++)
+            if (ends[i] == std::make_pair(from, to))
+                return connections[i].get();
+    }
+
+    auto connection = std::make_unique<PipelineConnection>();
+    connection->ring = std::make_unique<SpscRing<PipelineRecord>>(ring_capacity);
+    if (from)
+        from->outputs.push_back(connection.get());
+    if (to)
+        to->inputs.push_back(connection.get());
+
+    connections.push_back(std::move(connection));
+    ends.emplace_back(from, to);
+    return connections.back().get();
+}
+
+
+void Pipeline::connect(size_t from, const std::string& output, size_t to, const std::string& input)
+{
+    auto& src = *stages.at(from);
+    auto& dst = *stages.at(to);
+    auto src_index = word_index(src.obj.output, output);
+    auto dst_index = word_index(dst.obj.input, input);
+
+    auto connection = link(&src, &dst);
+    if (connection->src.size() == PipelineRecord::max_words)
+        throw std::runtime_error("Too many edges between two stages");
+    connection->src.push_back(src_index);
+    connection->dst.push_back(dst_index);
+}
+
+
+static void check_port_size(const std::vector<std::string>& labels)
+{
+    if (labels.size() > PipelineRecord::max_words)
+        throw std::runtime_error("Port has " + std::to_string(labels.size()) + " labels, a record holds "
+                                 + std::to_string(PipelineRecord::max_words) + " words");
+}
+
+
+PipelineInput Pipeline::input(size_t stage, const std::vector<std::string>& labels)
+{
+    check_port_size(labels);
+    auto& dst = *stages.at(stage);
+    PipelineInput port;
+    port.pipeline = this;
+    port.connection = link(nullptr, &dst);
+    for (size_t i = 0; i < labels.size(); i++) {
+        port.connection->src.push_back(i);
+        port.connection->dst.push_back(word_index(dst.obj.input, labels[i]));
+    }
+    return port;
+}
+
+
+PipelineOutput Pipeline::output(size_t stage, const std::vector<std::string>& labels)
+{
+    check_port_size(labels);
+    auto& src = *stages.at(stage);
+    PipelineOutput port;
+    port.pipeline = this;
+    port.connection = link(&src, nullptr);
+    for (size_t i = 0; i < labels.size(); i++) {
+        port.connection->src.push_back(word_index(src.obj.output, labels[i]));
+        port.connection->dst.push_back(i);
+    }
+    return port;
+}
+
+
+bool Pipeline::push(PipelineConnection& connection, const PipelineRecord& record)
+{
+    while (not stopping.load(std::memory_order_relaxed)) {
+        if (connection.ring->try_push(record))
+            return true;
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+
+bool Pipeline::pop(PipelineConnection& connection, PipelineRecord& record)
+{
+    while (not stopping.load(std::memory_order_relaxed)) {
+        if (connection.ring->try_pop(record))
+            return true;
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+
+void Pipeline::run(Stage& stage)
+{
+    PipelineRecord record;
+    PipelineRecord out;
+    std::vector<bool> ended(stage.inputs.size());
+    while (true) {
+        auto ram = stage.ram;
+
+        // every input gives one record per round, so no producer runs ahead of the others
+        bool last = false;
+        for (size_t c = 0; c < stage.inputs.size(); c++) {
+            auto connection = stage.inputs[c];
+            if (not pop(*connection, record))
+                return;
+            ended[c] = record.last;
+            last |= record.last;
+            for (size_t i = 0; i < connection->dst.size(); i++)
+                ram[connection->dst[i]] = record.words[i];
+        }
+        if (last)
+            break;
+
+        execute(ram.data(), stage.code.data(), 0, proc, &running);
+        if (stopping.load(std::memory_order_relaxed))
+            return;
+        stage.runs++;
+
+        for (auto connection : stage.outputs) {
+            for (size_t i = 0; i < connection->src.size(); i++)
+                out.words[i] = ram[connection->src[i]];
+            if (not push(*connection, out))
+                return;
+        }
+    }
+
+    // the stream ends with the first closed input, the records of this round are incomplete
+    // and dropped, the other inputs are drained to their end so their producers don't block
+    for (size_t c = 0; c < stage.inputs.size(); c++)
+        while (not ended[c]) {
+            if (not pop(*stage.inputs[c], record))
+                return;
+            ended[c] = record.last;
+        }
+
+    out.last = true;
+    for (auto connection : stage.outputs)
+        if (not push(*connection, out))
+            return;
+}
+
+
+void Pipeline::start()
+{
+    if (threads.size())
+        throw std::runtime_error("Pipeline is already started");
+    for (size_t i = 0; i < stages.size(); i++)
+        if (stages[i]->inputs.empty())
+            throw std::runtime_error("Stage " + std::to_string(i) + " has no inputs");
+
+    for (auto& stage : stages)
+        threads.emplace_back([this, stage = stage.get()] { run(*stage); });
+}
+
+
+void Pipeline::wait()
+{
+    for (auto& thread : threads)
+        if (thread.joinable())
+            thread.join();
+}
+
+
+void Pipeline::stop()
+{
+    stopping = true;
+    running = 0;
+    wait();
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "runtime_compiler.hpp"
+
+
+
+
+/*
+Конвейер программ: стадия - программа со статическими привязками, ребро - слово .output
+одной стадии в слово .input другой. Ребра разрешаются в смещения ram один раз при
+соединении, стадии работают в своих потоках и обмениваются записями через lock-free
+SPSC кольца (одно кольцо на пару стадий). Каждая запись - один запуск программы
+с чистой ram (образ + привязки).
+*/
+
+
+// single producer single consumer, capacity - power of two; waiting is up to the owner, see Pipeline::push/pop
+template<typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity)
+        : slots(round_up(capacity))
+        , mask(slots.size() - 1)
+    {}
+
+    bool try_push(const T& value)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        value = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static size_t round_up(size_t n)
+    {
+        size_t out = 1;
+        while (out < n)
+            out <<= 1;
+        return out;
+    }
+
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+
+struct PipelineRecord
+{
+    static constexpr size_t max_words = 32;
+
+    std::array<uint32_t, max_words> words;
+    bool last = false;
+};
+
+
+// resolved transfer between two stages (or host and stage): words[i] goes to/from ram[index[i]]
+struct PipelineConnection
+{
+    std::vector<uint8_t> src;
+    std::vector<uint8_t> dst;
+    std::unique_ptr<SpscRing<PipelineRecord>> ring;
+};
+
+
+class Pipeline;
+
+
+// host side of a stage input, only one thread may push
+class PipelineInput
+{
+public:
+    // throws std::runtime_error if the pipeline is stopped
+    void push(const std::vector<uint32_t>& values);
+    // nothing to end in a stopped pipeline
+    void close();
+
+private:
+    friend class Pipeline;
+    Pipeline* pipeline = nullptr;
+    PipelineConnection* connection = nullptr;
+};
+
+
+// host side of a stage output, only one thread may pop
+class PipelineOutput
+{
+public:
+    // false after the end of stream or when the pipeline is stopped
+    bool pop(std::vector<uint32_t>& values);
+
+private:
+    friend class Pipeline;
+    Pipeline* pipeline = nullptr;
+    PipelineConnection* connection = nullptr;
+};
+
+
+class Pipeline
+{
+public:
+    explicit Pipeline(uint32_t (*proc)(uint32_t proc_id, uint32_t arg) = nullptr, size_t ring_capacity = 1024);
+    ~Pipeline();
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // bindings - same json as parse_sections_file() accepts, applied before every run
+    size_t add_stage(const NVMAObject& obj, const std::string& bindings = "{}");
+
+    // output label of stage from -> input label of stage to
+    void connect(size_t from, const std::string& output, size_t to, const std::string& input);
+
+    // host feeds/reads listed labels (at most PipelineRecord::max_words), values are in the same order
+    PipelineInput input(size_t stage, const std::vector<std::string>& labels);
+    PipelineOutput output(size_t stage, const std::vector<std::string>& labels);
+
+    // every stage needs at least one input (connection or host input)
+    void start();
+    // waits until all stages got end of stream
+    void wait();
+    // stages stop at the next record even if inputs are not closed, a running program is interrupted,
+    // records in flight are dropped and host ports blocked on a ring return;
+    // the destructor stops a pipeline which is still running
+    void stop();
+
+private:
+    friend class PipelineInput;
+    friend class PipelineOutput;
+
+    struct Stage
+    {
+        NVMAObject obj;
+        std::array<uint8_t, 256 + 4> code;
+        std::array<uint32_t, 32> ram;
+        std::vector<PipelineConnection*> inputs;
+        std::vector<PipelineConnection*> outputs;
+        uint64_t runs = 0;
+    };
+
+    PipelineConnection* link(Stage* from, Stage* to);
+    // false if the pipeline is stopped
+    bool push(PipelineConnection& connection, const PipelineRecord& record);
+    bool pop(PipelineConnection& connection, PipelineRecord& record);
+    void run(Stage& stage);
+
+    uint32_t (*proc)(uint32_t proc_id, uint32_t arg);
+    size_t ring_capacity;
+
+    std::vector<std::unique_ptr<Stage>> stages;
+    std::vector<std::unique_ptr<PipelineConnection>> connections;
+    std::vector<std::pair<Stage*, Stage*>> ends;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stopping{false};
+    // exec flag of execute(), cleared by stop()
+    uint8_t running = 1;
+};
@@ -34,6 +34,10 @@ struct NVMAObject
     Section output;
     Section data;
 
+    // bits of a ram word: 16, 32 or 64, the line "width <bits>" of the object,
+    // omitted for 32; ram is 32 words of this width and label positions are in its bytes
+    uint8_t width = 32;
+
     static NVMAObject::Section NVMAObject::* sections[];
     static std::map<std::string, NVMAObject::Section NVMAObject::*> sections_mapping;
 
@@ -61,6 +65,8 @@ inline std::map<std::string, NVMAObject::Section NVMAObject::*> NVMAObject::sect
 
 inline std::ostream& operator<<(std::ostream& os, const NVMAObject& obj)
 {
+    if (obj.width != 32)
+        os << ".width: " << (int)obj.width << "\n";
     for (auto psec : NVMAObject::sections) {
         auto& sec = (obj.*psec);
         os << "." << sec.name << ":\n";
@@ -76,6 +82,7 @@ inline NVMAObject parse_nvma_object(std::string data)
 {
     std::regex pattern(R"((\w+)((?: +[0-9A-Fa-f]{2})+| ),((?: +\w+=\d+:\d+)+| ))");
     std::regex label_pattern(R"( (\w+)=(\d+):(\d+))");
+    std::regex width_pattern(R"(width (16|32|64))");
 
     NVMAObject obj;
 
@@ -83,7 +90,10 @@ inline NVMAObject parse_nvma_object(std::string data)
         std::smatch match;
         auto line = data.substr(0, data.find('\n'));
         data = data.substr(line.size() + 1);
-        if (std::regex_match(line, match, pattern)) {
+        if (std::regex_match(line, match, width_pattern)) {
+            obj.width = std::stoi(match.str(1));
+        }
+        else if (std::regex_match(line, match, pattern)) {
             std::vector<uint8_t> bin;
             auto bindata = match.str(2);
             bin.resize(bindata.size() / 3);
@@ -289,6 +299,8 @@ inline std::vector<DecompiledLine> decompile(const NVMAObject& obj)
 inline std::string NVMAObject::dump() const
 {
     std::ostringstream output;
+    if (width != 32)
+        output << "width " << (int)width << "\n";
     for (auto psec : sections) {
         auto& sec = (this->*psec);
         output << sec.name;
@@ -303,6 +315,8 @@ inline std::string NVMAObject::dump() const
         for (auto& [k, l] : sec.labels) {
             output << " " << l.name << "=" << (int)l.pos << ":" << (int)l.size;
         }
+        if (sec.labels.empty())
+            output << " ";
         output << "\n";
     }
     return output.str();
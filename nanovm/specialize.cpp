@@ -0,0 +1,78 @@
+#include <iostream>
+
+#include "peval.hpp"
+#include "runtime_compiler.hpp"
+#include "utils.hpp"
+
+
+
+
+struct Arguments
+{
+    std::string source;
+    std::string binary;
+    std::string bindings;
+};
+
+
+Arguments parse_args(int argc, char* argv[])
+{
+    Arguments args;
+    auto proc = [&] (char opt, const std::string& value)
+    {
+        switch (opt) {
+        case 'i':
+            args.source = value;
+            break;
+
+        case 'b':
+            args.binary = value;
+            break;
+
+        case 'I':
+            args.bindings = value;
+            break;
+        }
+    };
+
+    parse_args("i:b:I:", argc, argv, proc);
+
+    return args;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try {
+        auto args = parse_args(argc, argv);
+
+        NVMAObject obj;
+        if (args.source.size())
+            obj = compile(load_file(args.source));
+        else if (args.binary.size())
+            obj = parse_nvma_object(load_file(args.binary));
+        else
+            throw std::runtime_error("Must be specified -i <source> or -b <binary>");
+
+        if (args.bindings.empty())
+            throw std::runtime_error("Must be specified -I <bindings.json>");
+
+        auto result = specialize(obj, load_file(args.bindings));
+
+        std::cout << result.object.dump();
+
+        std::cerr << "Text: " << result.original_size << " -> " << result.specialized_size << " bytes" << std::endl;
+        if (result.original)
+            std::cerr << "Residual program is not smaller, the original text is kept" << std::endl;
+        if (result.constant) {
+            std::cerr << "All outputs are constant:" << std::endl;
+            for (auto& [name, value] : result.constant_outputs)
+                std::cerr << "    " << name << " = 0x" << fhex(value, 8) << std::endl;
+        }
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+}
@@ -0,0 +1,512 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "isa.hpp"
+#include "runtime_compiler.hpp"
+#include "vmop.hpp"
+#include "utils.hpp"
+
+
+
+
+/*
+Супероптимизатор линейных участков кода.
+
+Спецификация участка - значения live-out регистров как функция live-in регистров.
+Перебираются все последовательности инструкций длины 1, 2, ... над регистрами участка,
+каждый кандидат сначала проверяется на нескольких случайных состояниях (инструкции
+исполняются по одной через execute_one, состояния префиксов кешируются), затем на
+большом наборе случайных состояний и на декартовом произведении граничных значений
+live-in регистров.
+*/
+
+
+using Ram = std::array<uint32_t, 32>;
+
+
+struct Block
+{
+    std::vector<Instruction> code;
+    uint32_t live_in = 0;
+    uint32_t live_out = 0;
+    uint32_t writable = 0;
+    size_t bytes = 0;
+};
+
+
+struct Options
+{
+    int max_length = 3;
+    bool packed = false;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t random_checks = 100000;
+};
+
+
+static const uint32_t boundary_values[] = {
+    0, 1, 2, 3, 7, 0x7F, 0x80, 0xFF, 0x100, 0x7FFF, 0x8000, 0xFFFF,
+    0x7FFFFFFF, 0x80000000, 0xFFFFFFFE, 0xFFFFFFFF, 0x55555555, 0xAAAAAAAA, 0x12345678,
+};
+
+
+static void run_sequence(Ram& ram, const uint8_t* code)
+{
+    execute(ram.data(), code, 0, nullptr, nullptr);
+}
+
+
+static size_t encode_sequence(const std::vector<Instruction>& seq, std::array<uint8_t, 256>& code)
+{
+    code.fill(0xFF);
+    size_t pos = 0;
+    for (auto& inst : seq)
+        pos += encode_instruction(inst, code.data() + pos);
+    return pos;
+}
+
+
+class Superoptimizer
+{
+public:
+    Superoptimizer(const Block& block, const Options& options)
+        : block(block), options(options)
+    {
+        std::array<uint8_t, 256> code;
+        encode_sequence(block.code, code);
+
+        // first states are filled with boundary values, the rest are random
+        std::mt19937 rng(0x5EED);
+        for (size_t i = 0; i < quick_tests; i++) {
+            Ram ram;
+            for (size_t r = 0; r < ram.size(); r++)
+                ram[r] = (i < quick_tests / 2 ? boundary_values[(i + r) % std::size(boundary_values)] : rng());
+            quick_inputs.push_back(ram);
+            run_sequence(ram, code.data());
+            quick_outputs.push_back(ram);
+        }
+
+        build_alphabet();
+    }
+
+    size_t alphabet_size() const
+    {
+        return alphabet.size();
+    }
+
+    std::optional<std::vector<Instruction>> search()
+    {
+        auto original_length = (int)block.code.size();
+        for (int length = 1; length < original_length and length <= options.max_length; length++)
+        {
+            std::cerr << "Searching length " << length << " ..." << std::endl;
+            found.clear();
+            std::atomic<size_t> next_first = 0;
+            std::vector<std::thread> workers;
+            for (unsigned t = 0; t < options.threads; t++) {
+                workers.emplace_back([&, length] {
+                    Worker worker(*this, length);
+                    for (size_t first = next_first++; first < alphabet.size(); first = next_first++)
+                        worker.run(first);
+                });
+            }
+            for (auto& w : workers)
+                w.join();
+
+            // fewer instructions may still take more bytes, such candidates are no gain,
+            // a longer length may give a smaller one
+            found.erase(std::remove_if(found.begin(), found.end(), [&] (auto& seq) {
+                return sequence_bytes(seq) >= block.bytes;
+            }), found.end());
+            if (found.size()) {
+                return *std::min_element(found.begin(), found.end(), [] (auto& a, auto& b) {
+                    return sequence_bytes(a) < sequence_bytes(b);
+                });
+            }
+        }
+        return std::nullopt;
+    }
+
+    static size_t sequence_bytes(const std::vector<Instruction>& seq)
+    {
+        size_t size = 0;
+        for (auto& inst : seq)
+            size += inst.size;
+        return size;
+    }
+
+private:
+    struct Letter
+    {
+        Instruction inst;
+        uint8_t code[4];
+    };
+
+    class Worker
+    {
+    public:
+        Worker(Superoptimizer& owner, int length)
+            : owner(owner), length(length), states(length + 1), sequence(length)
+        {
+            states[0] = owner.quick_inputs;
+        }
+
+        void run(size_t first)
+        {
+            step(0, first);
+        }
+
+    private:
+        void step(int depth, size_t letter)
+        {
+            auto& l = owner.alphabet[letter];
+            states[depth + 1] = states[depth];
+            for (auto& ram : states[depth + 1]) {
+                uint8_t pc = 0;
+                execute_one(ram.data(), l.code, pc, nullptr);
+            }
+            sequence[depth] = l.inst;
+
+            if (depth + 1 == length) {
+                if (owner.matches_quick(states[depth + 1]) and owner.verify(sequence)) {
+                    std::lock_guard lock(owner.found_mutex);
+                    owner.found.push_back(sequence);
+                }
+                return;
+            }
+
+            for (size_t next = 0; next < owner.alphabet.size(); next++)
+                step(depth + 1, next);
+        }
+
+        Superoptimizer& owner;
+        int length;
+        std::vector<std::vector<Ram>> states;
+        std::vector<Instruction> sequence;
+    };
+
+    void add_letter(const Instruction& inst)
+    {
+        Letter l{inst, {0xFF, 0xFF, 0xFF, 0xFF}};
+        encode_instruction(inst, l.code);
+        alphabet.push_back(l);
+    }
+
+    void build_alphabet()
+    {
+        std::vector<uint8_t> readable, writable, readable4, writable4;
+        for (uint8_t r = 0; r < 32; r++) {
+            if ((block.live_in | block.writable) & (1u << r)) {
+                readable.push_back(r);
+                if (r < 16)
+                    readable4.push_back(r);
+            }
+            if (block.writable & (1u << r)) {
+                writable.push_back(r);
+                if (r < 16)
+                    writable4.push_back(r);
+            }
+        }
+
+        std::vector<uint32_t> low_consts, high_consts, shifts = {1};
+        for (auto& inst : block.code) {
+            if (inst.op == Mnemonic::LoadLow)
+                low_consts.push_back(inst.imm);
+            if (inst.op == Mnemonic::LoadHigh)
+                high_consts.push_back(inst.imm);
+            if (inst.op == Mnemonic::Ls or inst.op == Mnemonic::Rs)
+                shifts.push_back(inst.imm);
+        }
+        for (auto v : {&low_consts, &high_consts, &shifts}) {
+            std::sort(v->begin(), v->end());
+            v->erase(std::unique(v->begin(), v->end()), v->end());
+        }
+
+        bool lr_writable = block.writable & 1u;
+        for (auto r : readable)
+            if (r and lr_writable)
+                add_letter({Mnemonic::LoadOp, 1, 0, r});
+        for (auto r : writable)
+            if (r)
+                add_letter({Mnemonic::StoreOp, 1, r});
+        if (lr_writable) {
+            for (uint32_t v = 0; v < 8; v++)
+                add_letter({Mnemonic::Load3, 1, 0, 0, 0, v});
+            for (auto v : low_consts)
+                add_letter({Mnemonic::LoadLow, 2, 0, 0, 0, v});
+            for (auto v : high_consts)
+                add_letter({Mnemonic::LoadHigh, 3, 0, 0, 0, v});
+        }
+
+        std::vector<Mnemonic> binary = {Mnemonic::Add, Mnemonic::Sub, Mnemonic::And, Mnemonic::Or};
+        if (options.packed) {
+            for (auto op = (uint8_t)Mnemonic::PAddUSB; op < (uint8_t)Mnemonic::PopCnt; op++)
+                binary.push_back((Mnemonic)op);
+        }
+        for (auto op : binary) {
+            bool commutative = (op == Mnemonic::Add or op == Mnemonic::And or op == Mnemonic::Or);
+            for (auto s : writable4)
+                for (auto a : readable4)
+                    for (auto b : readable4)
+                        if (not commutative or a <= b)
+                            add_letter({op, (uint8_t)(is_packed(op) ? 3 : 2), s, a, b});
+        }
+        for (auto s : writable4) {
+            for (auto a : readable4) {
+                for (auto count : shifts) {
+                    add_letter({Mnemonic::Ls, 2, s, a, 0, count});
+                    add_letter({Mnemonic::Rs, 2, s, a, 0, count});
+                }
+                if (options.packed)
+                    add_letter({Mnemonic::PopCnt, 3, s, a});
+            }
+        }
+    }
+
+    bool matches(const Ram& got, const Ram& expected) const
+    {
+        for (int r = 0; r < 32; r++)
+            if ((block.live_out & (1u << r)) and got[r] != expected[r])
+                return false;
+        return true;
+    }
+
+    bool matches_quick(const std::vector<Ram>& states) const
+    {
+        for (size_t i = 0; i < states.size(); i++)
+            if (not matches(states[i], quick_outputs[i]))
+                return false;
+        return true;
+    }
+
+    bool check(const Ram& input, const uint8_t* original, const uint8_t* candidate) const
+    {
+        Ram expected = input, got = input;
+        run_sequence(expected, original);
+        run_sequence(got, candidate);
+        return matches(got, expected);
+    }
+
+    bool verify(const std::vector<Instruction>& sequence) const
+    {
+        std::array<uint8_t, 256> original, candidate;
+        encode_sequence(block.code, original);
+        encode_sequence(sequence, candidate);
+
+        std::mt19937 rng(0xC0FFEE);
+        Ram ram;
+
+        for (size_t i = 0; i < options.random_checks; i++) {
+            for (auto& w : ram)
+                w = rng();
+            if (not check(ram, original.data(), candidate.data()))
+                return false;
+        }
+
+        // all combinations of boundary values for live-in registers
+        std::vector<uint8_t> inputs;
+        for (uint8_t r = 0; r < 32; r++)
+            if (block.live_in & (1u << r))
+                inputs.push_back(r);
+
+        std::vector<size_t> index(inputs.size(), 0);
+        while (true) {
+            for (auto& w : ram)
+                w = rng();
+            for (size_t i = 0; i < inputs.size(); i++)
+                ram[inputs[i]] = boundary_values[index[i]];
+            if (not check(ram, original.data(), candidate.data()))
+                return false;
+
+            size_t i = 0;
+            for (; i < index.size(); i++) {
+                if (++index[i] < std::size(boundary_values))
+                    break;
+                index[i] = 0;
+            }
+            if (i == index.size())
+                break;
+        }
+
+        return true;
+    }
+
+private:
+    static constexpr size_t quick_tests = 16;
+
+    const Block& block;
+    const Options& options;
+    std::vector<Letter> alphabet;
+    std::vector<Ram> quick_inputs;
+    std::vector<Ram> quick_outputs;
+    std::mutex found_mutex;
+    std::vector<std::vector<Instruction>> found;
+
+};
+
+
+struct Arguments
+{
+    std::string source;
+    std::string binary;
+    std::string region;
+    std::string live_out;
+    Options options;
+};
+
+
+Arguments parse_args(int argc, char* argv[])
+{
+    Arguments args;
+    auto proc = [&] (char opt, const std::string& value)
+    {
+        switch (opt) {
+        case 'i':
+            args.source = value;
+            break;
+        case 'b':
+            args.binary = value;
+            break;
+        case 'r':
+            args.region = value;
+            break;
+        case 'o':
+            args.live_out = value;
+            break;
+        case 'n':
+            args.options.max_length = std::stoi(value);
+            break;
+        case 'j':
+            args.options.threads = std::max(1, std::stoi(value));
+            break;
+        case 'p':
+            args.options.packed = true;
+            break;
+        }
+    };
+
+    parse_args("i:b:r:o:n:j:p", argc, argv, proc);
+
+    return args;
+}
+
+
+Block extract_block(const NVMAObject& obj, const std::string& region)
+{
+    auto sep = region.find(':');
+    if (sep == region.npos)
+        throw std::runtime_error("Expected -r <from>:<to> (hex pc, end exclusive)");
+
+    auto from = std::stoul(region.substr(0, sep), nullptr, 16);
+    auto to = std::stoul(region.substr(sep + 1), nullptr, 16);
+    if (from >= to or to > obj.text.data.size())
+        throw std::runtime_error("Region " + region + " is out of text section");
+
+    std::array<uint8_t, 256 + 4> code;
+    code.fill(0xFF);
+    std::copy(obj.text.data.begin(), obj.text.data.end(), code.begin());
+
+    Block block;
+    for (auto pc = from; pc < to; ) {
+        auto inst = decode_instruction(code.data(), pc);
+        if (is_branch(inst) or inst.op == Mnemonic::Call)
+            throw std::runtime_error("Region contains " + std::string(mnemonic_name(inst.op))
+                                     + " at " + fhex(pc, 2) + ", only straight-line code is supported");
+        if (inst.op == Mnemonic::LoadInd or inst.op == Mnemonic::StoreInd)
+            throw std::runtime_error("Region contains " + std::string(mnemonic_name(inst.op))
+                                     + " at " + fhex(pc, 2) + ", indirect accesses are not supported");
+        if (is_rom_load(inst.op))
+            throw std::runtime_error("Region contains " + std::string(mnemonic_name(inst.op))
+                                     + " at " + fhex(pc, 2) + ", loads from text are not supported");
+        block.live_in |= read_registers(inst) & ~block.writable;
+        block.writable |= written_registers(inst);
+        block.bytes += inst.size;
+        block.code.push_back(inst);
+        pc += inst.size;
+        if (pc > to)
+            throw std::runtime_error("Instruction at " + fhex(pc - inst.size, 2) + " crosses end of region");
+    }
+    block.live_out = block.writable;
+    return block;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try {
+        auto args = parse_args(argc, argv);
+
+        NVMAObject obj;
+        if (args.source.size())
+            obj = compile(load_file(args.source));
+        else if (args.binary.size())
+            obj = parse_nvma_object(load_file(args.binary));
+        else
+            throw std::runtime_error("Must be specified -i <source> or -b <binary>");
+        require_width(obj, 32);
+
+        std::map<uint8_t, std::string> names;
+        std::map<std::string, uint8_t> registers = {{"lr", 0}};
+        for (auto psec : NVMAObject::sections) {
+            for (auto& [name, label] : (obj.*psec).labels) {
+                if (psec != &NVMAObject::text and psec != &NVMAObject::ram) {
+                    names[label.pos / 4] = name;
+                    registers[name] = label.pos / 4;
+                }
+            }
+        }
+
+        auto block = extract_block(obj, args.region);
+        if (args.live_out.size()) {
+            block.live_out = 0;
+            std::istringstream iss(args.live_out);
+            for (std::string name; std::getline(iss, name, ','); ) {
+                if (registers.count(name))
+                    block.live_out |= 1u << registers.at(name);
+                else
+                    block.live_out |= 1u << std::stoi(name);
+            }
+        }
+
+        auto print_mask = [&] (uint32_t mask) {
+            std::string out;
+            for (uint8_t r = 0; r < 32; r++)
+                if (mask & (1u << r))
+                    out += (out.size() ? ", " : "") + (names.count(r) ? names.at(r) : (r ? std::to_string(r) : "lr"));
+            return out;
+        };
+
+        std::cout << "Original (" << block.code.size() << " instructions, " << block.bytes << " bytes):" << std::endl;
+        for (auto& inst : block.code)
+            std::cout << "    " << format_instruction(inst, names) << std::endl;
+        std::cout << "live-in: " << print_mask(block.live_in) << std::endl;
+        std::cout << "live-out: " << print_mask(block.live_out) << std::endl;
+
+        Superoptimizer optimizer(block, args.options);
+        std::cerr << "Alphabet: " << optimizer.alphabet_size() << " instructions, "
+                  << args.options.threads << " threads" << std::endl;
+
+        auto result = optimizer.search();
+        if (not result) {
+            std::cout << "No shorter sequence up to " << args.options.max_length << " instructions" << std::endl;
+            return 0;
+        }
+
+        std::cout << "Found (" << result->size() << " instructions, "
+                  << Superoptimizer::sequence_bytes(*result) << " bytes):" << std::endl;
+        for (auto& inst : *result)
+            std::cout << "    " << format_instruction(inst, names) << std::endl;
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
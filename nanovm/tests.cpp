@@ -1,12 +1,27 @@
 
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <future>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <vector>
 #include <memory>
 #include <getopt.h>
 
+#include "assembler.hpp"
+#include "async.hpp"
+#include "bounds.hpp"
+#include "green.hpp"
+#include "host.hpp"
+#include "imagecache.hpp"
+#include "pipeline.hpp"
+#include "peval.hpp"
 #include "runtime_compiler.hpp"
+#include "verifier.hpp"
 #include "vmop.hpp"
 #include "utils.hpp"
 
@@ -21,33 +36,66 @@ public:
     virtual ~AbstractNVMTest() = default;
     virtual std::string get_name() const { return "Unknown"; }
     virtual const NVMAObject& get_binary() const = 0;
-    virtual bool check_result(const uint32_t* ram) const = 0;
-    virtual void dump_error(const uint32_t* ram) const = 0;
+    virtual const VerifiedImage& get_image() const = 0;
+    // ram - 32 words of the program width
+    virtual bool check_result(const void* ram) const = 0;
+    virtual void dump_error(const void* ram) const = 0;
+
+    // pc of the entry point the test starts at
+    virtual uint8_t get_start() const { return 0; }
+
+    // CALL returns proc_id unless a test provides host functions
+    virtual void run(void* ram) const
+    {
+        dispatch_width(get_binary().width, [&] (auto word) {
+            execute(reinterpret_cast<decltype(word)*>(ram), get_image().code.data(), get_start(), nullptr, nullptr);
+        });
+    }
 };
 
 
 class NVMTestFromFile : public AbstractNVMTest
 {
 public:
+    // binary - object dump (e.g. linked by asm/linker.py), entry - its entry point to start at
     NVMTestFromFile(const std::string& source,
                     const std::string& input,
-                    const std::map<std::string, uint32_t>& values)
-        : name(source)
+                    const std::map<std::string, uint64_t>& values,
+                    bool binary = false,
+                    const std::string& entry = "")
+        : name(entry.size() ? source + "@" + entry : source)
     {
-        obj = compile(load_file(source));
+        obj = binary ? parse_nvma_object(load_file(source)) : compile(load_file(source));
+        if (entry.size())
+            start = entry_point(obj, entry);
 
         if (input.size())
             parse_sections_file(obj, load_file(input));
 
+        set_values(values);
+        image = VerifiedImage::load(obj);
+    }
+
+    // program assembled at compile time
+    NVMTestFromFile(const std::string& name,
+                    const NVMAObject& obj,
+                    const std::map<std::string, uint64_t>& values)
+        : name(name)
+        , obj(obj)
+    {
+        set_values(values);
+        image = VerifiedImage::load(obj);
+    }
+
+    void set_values(const std::map<std::string, uint64_t>& values)
+    {
         for (auto& [key, value] : values) {
             if (key.find('.') == key.npos)
                 throw std::runtime_error("Can't set value to section, use <section>.<label>=<value>");
             auto first = key.substr(0, key.find('.'));
             auto second = key.substr(key.find('.') + 1);
             if (NVMAObject::sections_mapping.count(first))
-                ref_value32(obj.ram,
-                            obj.*NVMAObject::sections_mapping.at(first),
-                            second) = value;
+                set_value(obj, obj.*NVMAObject::sections_mapping.at(first), second, value);
             else
                 throw std::runtime_error("Unknown section " + first);
         }
@@ -64,26 +112,50 @@ public:
         return obj;
     }
 
-    bool check_result(const uint32_t* ram) const override
+    const VerifiedImage& get_image() const override
+    {
+        return image;
+    }
+
+    uint8_t get_start() const override
+    {
+        return start;
+    }
+
+    bool check_result(const void* ram) const override
     {
         for (auto [name, label] : obj.output.labels)
         {
-            if (get_value32(ram, obj.output, name) != get_value32(obj.ram, obj.output, name))
-                return false;
+            for (size_t i = 0; i < label_words(obj, obj.output, name); i++)
+                if (get_value(obj, ram, obj.output, name, i) != get_value(obj, obj.ram.data.data(), obj.output, name, i))
+                    return false;
         }
         return true;
     }
 
-    void dump_error(const uint32_t* ram) const override
+    void dump_error(const void* ram) const override
     {
+        // words of arrays are printed as name[i]
+        std::vector<std::pair<std::string, size_t>> words;
+        for (auto& [name, label] : obj.output.labels) {
+            auto count = label_words(obj, obj.output, name);
+            for (size_t i = 0; i < count; i++)
+                words.push_back({name, i});
+        }
+        auto title = [&] (const std::pair<std::string, size_t>& word) {
+            return label_words(obj, obj.output, word.first) > 1
+                   ? word.first + "[" + std::to_string(word.second) + "]" : word.first;
+        };
+
         int max = -1;
-        for (auto& [name, label] : obj.output.labels)
-            max = std::max<int>(name.size(), max);
+        for (auto& word : words)
+            max = std::max<int>(title(word).size(), max);
 
-        for (auto& [name, label] : obj.output.labels)
+        for (auto& word : words)
         {
-            auto v = get_value32(ram, obj.output, name);
-            auto e = get_value32(obj.ram, obj.output, name);
+            auto name = title(word);
+            auto v = get_value(obj, ram, obj.output, word.first, word.second);
+            auto e = get_value(obj, obj.ram.data.data(), obj.output, word.first, word.second);
 
             const std::string ok_color = "\033[38;5;118m";
             const std::string er_color = "\033[38;5;196m";
@@ -92,22 +164,914 @@ public:
             std::cerr
                     << (v == e ? ok_color + "OK\033[0m   : " : er_color + "ERROR\033[0m: ")
                     << pd << name << ": "
-                    << "got=" << (v == e ? "" : er_color) << "0x" << fhex(v, 8) << "\033[0m" << ", "
-                    << "exp=" << (v == e ? "" : wn_color) << "0x" << fhex(e, 8) << "\033[0m" << std::endl;
+                    << "got=" << (v == e ? "" : er_color) << "0x" << fhex(v, obj.width / 4) << "\033[0m" << ", "
+                    << "exp=" << (v == e ? "" : wn_color) << "0x" << fhex(e, obj.width / 4) << "\033[0m" << std::endl;
         }
     }
 
-private:
+protected:
     std::string name;
     NVMAObject obj;
+    VerifiedImage image;
+    uint8_t start = 0;
+
+};
+
+
+
+// ids of host functions are bound to .input labels by name, the result goes to .output
+constexpr auto embedded_host = nanovm::assemble(R"(
+.input
+MEMORY 4, n
+MEMORY 4, offset_cb
+MEMORY 4, twice_cb
+MEMORY 4, missing_cb
+
+.output
+MEMORY 4, sum
+MEMORY 4, twice
+MEMORY 4, missing
+
+.code
+    CALL sum, offset_cb, n
+    CALL twice, twice_cb, sum
+    CALL missing, missing_cb, n
+    HALT
+)");
+
+
+struct HostTestContext
+{
+    uint32_t offset;
+};
+
+static uint32_t host_offset(HostTestContext& ctx, uint32_t arg)
+{
+    return arg + ctx.offset;
+}
+
+static uint32_t host_twice(HostTestContext&, uint32_t arg)
+{
+    return arg * 2;
+}
+
+
+class HostNVMTest : public NVMTestFromFile
+{
+public:
+    using Static = StaticHost<uint32_t, HostTestContext, host_offset, host_twice>;
+
+    HostNVMTest(const std::string& name, bool static_host, const std::map<std::string, uint64_t>& values)
+        : NVMTestFromFile(name, embedded_host.object(), values)
+        , static_host(static_host)
+    {
+        registry.add<host_offset>("offset_cb", context);
+        registry.add("twice_cb", twice);
+        if (static_host)
+            fixed.bind(obj);
+        else
+            registry.bind(obj);
+    }
 
+    void run(void* ram) const override
+    {
+        auto words = reinterpret_cast<uint32_t*>(ram);
+        if (static_host)
+            execute_host(words, image.code.data(), 0, fixed, nullptr);
+        else
+            execute_host(words, image.code.data(), 0, registry, nullptr);
+    }
+
+    bool check_result(const void* ram) const override
+    {
+        // missing_cb is not registered and stays 0, such calls return proc_id
+        bool counted = static_host
+                ? fixed.calls == std::array<uint64_t, 3>{1, 1, 1}
+                : registry.entries()[1].calls == 1 and registry.entries()[2].calls == 1 and registry.unbound_calls == 1;
+        return counted and NVMTestFromFile::check_result(ram);
+    }
+
+private:
+    bool static_host;
+    mutable HostTestContext context{100};
+    mutable Static fixed{context, {"offset_cb", "twice_cb"}};
+    // a plain callable without context
+    struct Twice { uint32_t operator()(uint32_t arg) const { return arg * 2; } } twice;
+    mutable HostRegistry<uint32_t> registry;
+};
+
+
+// loops counted by a cell of an .input array and by an unlabelled .input word (word 5),
+// every .input word is a variable of the bound, not its value in the ram image
+constexpr auto embedded_input_loops = nanovm::assemble(R"(
+.input
+MEMORY 4, table, 4
+MEMORY 4
+
+.output
+MEMORY 4, count
+
+.data
+MEMORY 4, one
+MEMORY 4, n
+
+.code
+    LOAD3 1
+    STORE_OP one
+    MOV n, table
+loop:
+    LOAD3 0
+    JZ n, unlabelled
+    ADD count, count, one
+    SUB n, n, one
+    JZ lr, loop
+unlabelled:
+    MOV n, 5
+loop2:
+    LOAD3 0
+    JZ n, end
+    ADD count, count, one
+    SUB n, n, one
+    JZ lr, loop2
+end:
+    HALT
+)");
+
+static_assert(embedded_input_loops.word("table") == 1 and embedded_input_loops.word("count") == 6);
+
+
+// the counter is decremented before its test and starts at 8, it can't wrap around
+constexpr auto embedded_countdown = nanovm::assemble(R"(
+.input
+MEMORY 4, x
+
+.output
+MEMORY 4, sum
+
+.data
+MEMORY 4, one
+MEMORY 4, count
+
+.code
+    LOAD3 1
+    STORE_OP one
+    LOAD_LOW 8
+    STORE_OP count
+loop:
+    ADD sum, sum, x
+    SUB count, count, one
+    LOAD3 0
+    JZ count, end
+    JZ lr, loop
+end:
+    HALT
+)");
+
+
+// STORE_IND in a counted loop, the pointer is a constant (copy) or an input (ptr)
+constexpr auto embedded_indirect_known = nanovm::assemble(R"(
+.input
+MEMORY 4, n
+MEMORY 4, ptr
+
+.output
+MEMORY 4, out
+MEMORY 4, copy
+
+.data
+MEMORY 4, one
+MEMORY 4, count
+MEMORY 4, target
+
+.code
+    LOAD3 1
+    STORE_OP one
+    MOV count, n
+    LOAD_REF copy
+    STORE_OP target
+loop:
+    LOAD3 0
+    JZ count, end
+    ADD out, out, one
+    LOAD_OP out
+    STORE_IND target
+    SUB count, count, one
+    JZ lr, loop
+end:
+    HALT
+)");
+constexpr auto embedded_indirect_unknown = nanovm::assemble(R"(
+.input
+MEMORY 4, n
+MEMORY 4, ptr
+
+.output
+MEMORY 4, out
+MEMORY 4, copy
+
+.data
+MEMORY 4, one
+MEMORY 4, count
+
+.code
+    LOAD3 1
+    STORE_OP one
+    MOV count, n
+loop:
+    LOAD3 0
+    JZ count, end
+    ADD out, out, one
+    LOAD_OP out
+    STORE_IND ptr
+    SUB count, count, one
+    JZ lr, loop
+end:
+    HALT
+)");
+
+static_assert(embedded_indirect_known.word("copy") == 4 and embedded_indirect_unknown.word("copy") == 4);
+
+
+// the worst-case bound evaluated for the inputs of the run is not below the executed instructions
+// and not above max_bound; with a reason the program must be reported unbounded for it
+class WcetNVMTest : public NVMTestFromFile
+{
+public:
+    WcetNVMTest(const std::string& name, const NVMAObject& object, const std::map<uint8_t, uint32_t>& words,
+                const std::map<std::string, uint64_t>& values, uint64_t max_bound = UINT64_MAX,
+                const std::string& reason = {})
+        : NVMTestFromFile(name, object, values)
+        , words(words)
+        , wcet(analyze_wcet(obj))
+        , max_bound(max_bound)
+        , reason(reason)
+    {
+    }
+
+    void run(void* ram) const override
+    {
+        auto words32 = reinterpret_cast<uint32_t*>(ram);
+        for (auto [word, value] : words)
+            words32[word] = value;
+
+        std::map<std::string, uint64_t> inputs;
+        for (auto& [word, name] : input_variables(obj))
+            inputs[name] = words32[word];
+        bound = wcet.bounded ? wcet.instructions.evaluate(inputs) : 0;
+
+        uint8_t pc = 0;
+        execute_bounded(words32, image.code.data(), pc, nullptr, UINT32_MAX, steps);
+    }
+
+    bool check_result(const void* ram) const override
+    {
+        bool expected = reason.empty() ? wcet.bounded and bound >= steps and bound <= max_bound
+                                       : not wcet.bounded and wcet.reason.find(reason) != std::string::npos;
+        return expected and NVMTestFromFile::check_result(ram);
+    }
+
+private:
+    std::map<uint8_t, uint32_t> words;
+    WcetResult wcet;
+    uint64_t max_bound;
+    std::string reason;
+    mutable uint64_t bound = 0;
+    mutable uint32_t steps = 0;
 };
 
 
+// the code after the first HALT is reached only through an entry point
+constexpr auto embedded_entry = nanovm::assemble(R"(
+.output
+MEMORY 4, out
+
+.code
+    LOAD3 1
+    STORE_OP out
+    HALT
+second:
+    LOAD3 2
+    STORE_OP out
+    HALT
+)");
+
+
+// analyze() of the same text with an entry point added marks that code reachable,
+// the graph of the program without it stays cached apart
+class EntryCfgNVMTest : public NVMTestFromFile
+{
+public:
+    EntryCfgNVMTest(const std::string& name, const NVMAObject& object, const std::map<std::string, uint64_t>& values)
+        : NVMTestFromFile(name, object, values)
+    {
+        auto plain = analyze(obj);
+        for (auto& block : plain->blocks)
+            if (not block.reachable)
+                entry = block.start;
+
+        auto linked = obj;
+        linked.text.labels["second"] = NVMAObject::Label{"second", entry, 0};
+        reached = entry and analyze(linked)->block_of(entry)->reachable
+                  and not analyze(obj)->block_of(entry)->reachable;
+    }
+
+    bool check_result(const void* ram) const override
+    {
+        return reached and NVMTestFromFile::check_result(ram);
+    }
+
+private:
+    uint8_t entry = 0;
+    bool reached = false;
+};
+
+
+// several VMs of embedded_host on the async scheduler, the handler holds every call until all VMs
+// are suspended on the same proc_id and completes them in reverse order; a handler which throws
+// after completing the first call of a batch fails the other VMs of it
+class AsyncNVMTest : public NVMTestFromFile
+{
+public:
+    static constexpr size_t vms = 8;
+
+    AsyncNVMTest(const std::string& name, const std::map<std::string, uint64_t>& values)
+        : NVMTestFromFile(name, embedded_host.object(), values)
+    {
+    }
+
+    void run(void* ram) const override
+    {
+        std::mutex mutex;
+        std::map<uint32_t, std::vector<AsyncCall>> held;
+        auto handler = [&] (uint32_t proc_id, std::vector<AsyncCall> calls) {
+            std::vector<AsyncCall> ready;
+            {
+                std::lock_guard lock(mutex);
+                auto& waiting = held[proc_id];
+                for (auto& call : calls)
+                    waiting.push_back(std::move(call));
+                if (waiting.size() == vms)
+                    ready = std::move(waiting);
+            }
+            for (auto call = ready.rbegin(); call != ready.rend(); call++) {
+                uint32_t result = call->proc_id() == 1 ? call->arg() + 100
+                                : call->proc_id() == 2 ? call->arg() * 2 : call->proc_id();
+                call->complete(result);
+            }
+        };
+
+        AsyncOptions options;
+        options.workers = 2;
+        options.max_batch = 3;
+        AsyncScheduler scheduler(handler, options);
+
+        auto image = ProgramImage::from_text(obj.text.data);
+        auto n = obj.input.labels.at("n").pos / 4;
+        std::vector<std::future<VmResult>> futures;
+        for (size_t i = 0; i < vms; i++) {
+            Ram vm_ram;
+            std::memcpy(vm_ram.data(), ram, sizeof(vm_ram));
+            vm_ram[n] += i;
+            futures.push_back(scheduler.submit(image, vm_ram));
+        }
+        results.clear();
+        for (auto& future : futures)
+            results.push_back(future.get());
+        std::memcpy(ram, results[0].ram.data(), sizeof(Ram));
+
+        auto failing = [] (uint32_t proc_id, std::vector<AsyncCall> calls) {
+            for (auto& call : calls) {
+                call.complete(proc_id == 1 ? call.arg() + 100 : proc_id == 2 ? call.arg() * 2 : proc_id);
+                if (proc_id == 2)
+                    throw std::runtime_error("twice failed");
+            }
+        };
+        AsyncScheduler failing_scheduler(failing, options);
+        futures.clear();
+        for (size_t i = 0; i < vms; i++) {
+            Ram vm_ram;
+            std::memcpy(vm_ram.data(), ram, sizeof(vm_ram));
+            futures.push_back(failing_scheduler.submit(image, vm_ram));
+        }
+        failed = completed = 0;
+        for (auto& future : futures) {
+            try {
+                completed += future.get().calls == 3;
+            }
+            catch (const std::runtime_error& e) {
+                failed += std::string(e.what()) == "twice failed";
+            }
+        }
+    }
+
+    bool check_result(const void* ram) const override
+    {
+        auto n = obj.input.labels.at("n").pos / 4;
+        auto sum = obj.output.labels.at("sum").pos / 4;
+        auto twice = obj.output.labels.at("twice").pos / 4;
+        for (auto& result : results) {
+            // every result went to the VM which made the call
+            if (result.calls != 3 or result.ram[sum] != result.ram[n] + 100 or result.ram[twice] != result.ram[sum] * 2)
+                return false;
+        }
+        return results.size() == vms and completed > 0 and failed > 0 and completed + failed == vms
+               and NVMTestFromFile::check_result(ram);
+    }
+
+private:
+    mutable std::vector<VmResult> results;
+    mutable size_t completed = 0;
+    mutable size_t failed = 0;
+};
+
+
+// green threads of the factorial on one worker with short quanta: a short thread submitted behind
+// long ones finishes first, every thread ends as a sequential run, a quota stops its tenant
+class GreenNVMTest : public NVMTestFromFile
+{
+public:
+    static constexpr size_t long_threads = 3;
+    static constexpr uint32_t long_n = 1000;
+    static constexpr uint64_t quota = 100;
+
+    GreenNVMTest(const std::string& name, const NVMAObject& object, const std::map<std::string, uint64_t>& values)
+        : NVMTestFromFile(name, object, values)
+    {
+    }
+
+    void run(void* ram) const override
+    {
+        GreenOptions options;
+        options.workers = 1;
+        options.quantum = 16;
+        GreenScheduler scheduler(nullptr, options);
+        scheduler.set_tenant(long_tenant, TenantLimits{1, 0});
+        scheduler.set_tenant(short_tenant, TenantLimits{1, 0});
+        scheduler.set_tenant(limited_tenant, TenantLimits{1, quota});
+
+        auto image = ProgramImage::from_text(obj.text.data);
+        auto n = obj.input.labels.at("n").pos / 4;
+        Ram initial;
+        std::memcpy(initial.data(), ram, sizeof(initial));
+
+        std::vector<Ram> inputs;
+        std::vector<std::future<GreenResult>> futures;
+        for (size_t i = 0; i < long_threads; i++) {
+            inputs.push_back(initial);
+            inputs.back()[n] = long_n + i;
+            futures.push_back(scheduler.submit(long_tenant, image, inputs.back()));
+        }
+        auto limited = scheduler.submit(limited_tenant, image, inputs.back());
+        auto short_result = scheduler.submit(short_tenant, image, initial).get();
+        overtaken = std::all_of(futures.begin(), futures.end(), [] (auto& future) {
+            return future.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+        });
+
+        sequential = true;
+        uint64_t steps = 0;
+        for (size_t i = 0; i < long_threads; i++) {
+            auto result = futures[i].get();
+            auto expected = inputs[i];
+            uint8_t pc = 0;
+            uint32_t expected_steps = 0;
+            execute_bounded(expected.data(), image->code.data(), pc, nullptr, UINT32_MAX, expected_steps);
+            sequential &= result.status == GreenStatus::Halted and result.ram == expected
+                          and result.steps == expected_steps;
+            steps += result.steps;
+        }
+        auto stats = scheduler.tenant_stats(long_tenant);
+        sequential &= stats.finished == long_threads and stats.running == 0 and stats.instructions == steps;
+
+        auto limited_result = limited.get();
+        limited_stopped = limited_result.status == GreenStatus::QuotaExceeded and limited_result.steps <= quota
+                          and scheduler.tenant_stats(limited_tenant).quota_exceeded == 1;
+
+        std::memcpy(ram, short_result.ram.data(), sizeof(Ram));
+    }
+
+    bool check_result(const void* ram) const override
+    {
+        return overtaken and sequential and limited_stopped and NVMTestFromFile::check_result(ram);
+    }
+
+private:
+    static constexpr uint32_t long_tenant = 1;
+    static constexpr uint32_t short_tenant = 2;
+    static constexpr uint32_t limited_tenant = 3;
+
+    mutable bool overtaken = false;
+    mutable bool sequential = false;
+    mutable bool limited_stopped = false;
+};
+
+
+// never halts
+constexpr auto embedded_endless = nanovm::assemble(R"(
+.input
+MEMORY 4, n
+
+.output
+MEMORY 4, result
+
+.code
+loop:
+    LOAD3 0
+    JZ lr, loop
+)");
+
+
+// factorial -> width32 (sum = n + 16) pipeline, then one which is destroyed with its input open
+class PipelineNVMTest : public NVMTestFromFile
+{
+public:
+    PipelineNVMTest(const std::string& name, const NVMAObject& factorial, const NVMAObject& add16,
+                    const std::map<std::string, uint64_t>& values)
+        : NVMTestFromFile(name, factorial, values)
+        , add16(add16)
+    {
+    }
+
+    void run(void* ram) const override
+    {
+        NVMTestFromFile::run(ram);
+
+        std::vector<uint32_t> got;
+        {
+            Pipeline pipeline;
+            auto first = pipeline.add_stage(obj);
+            auto second = pipeline.add_stage(add16);
+            pipeline.connect(first, "result", second, "n");
+            auto in = pipeline.input(first, {"n"});
+            auto out = pipeline.output(second, {"sum"});
+            pipeline.start();
+            for (uint32_t n = 0; n < 8; n++)
+                in.push({n});
+            in.close();
+            for (std::vector<uint32_t> values; out.pop(values); )
+                got.push_back(values.at(0));
+            pipeline.wait();
+        }
+        chained = (got == std::vector<uint32_t>{17, 17, 18, 22, 40, 136, 736, 5056});
+
+        // a record holds 32 words
+        Pipeline open;
+        open.add_stage(obj);
+        try {
+            open.input(0, std::vector<std::string>(PipelineRecord::max_words + 1, "n"));
+            rejected = false;
+        }
+        catch (const std::runtime_error&) {
+            rejected = true;
+        }
+        auto in = open.input(0, {"n"});
+        open.output(0, {"result"});
+        open.start();
+        in.push({3});
+        // the destructor stops the stage waiting for the next input
+
+        // the first input ends the stream, the other one is drained past the ring capacity
+        {
+            Pipeline pipeline(nullptr, 2);
+            auto stage = pipeline.add_stage(add16);
+            auto short_in = pipeline.input(stage, {"n"});
+            auto long_in = pipeline.input(stage, {"n"});
+            auto out = pipeline.output(stage, {"sum"});
+            pipeline.start();
+            short_in.push({1});
+            short_in.close();
+            for (uint32_t n = 0; n < 16; n++)
+                long_in.push({n});
+            long_in.close();
+            size_t records = 0;
+            for (std::vector<uint32_t> values; out.pop(values); )
+                records++;
+            pipeline.wait();
+            drained = (records == 1);
+        }
+
+        // a program which never halts is interrupted, the host port does not block a stopped pipeline
+        Pipeline endless;
+        endless.add_stage(embedded_endless.object());
+        auto endless_in = endless.input(0, {"n"});
+        auto endless_out = endless.output(0, {"result"});
+        endless.start();
+        endless_in.push({1});
+        endless.stop();
+        std::vector<uint32_t> values;
+        bool ended = not endless_out.pop(values);
+        bool refused = false;
+        try {
+            endless_in.push({2});
+        }
+        catch (const std::runtime_error&) {
+            refused = true;
+        }
+        interrupted = ended and refused;
+    }
+
+    bool check_result(const void* ram) const override
+    {
+        return chained and rejected and drained and interrupted and NVMTestFromFile::check_result(ram);
+    }
+
+private:
+    NVMAObject add16;
+    mutable bool chained = false;
+    mutable bool rejected = false;
+    mutable bool drained = false;
+    mutable bool interrupted = false;
+};
+
+
+// published to a private cache directory and mapped back as another worker process would
+class SharedImageNVMTest : public NVMTestFromFile
+{
+public:
+    SharedImageNVMTest(const std::string& name, const NVMAObject& object, const std::map<std::string, uint64_t>& values)
+        : NVMTestFromFile(name, object, values)
+    {
+        char path[] = "/tmp/nanovm-images-XXXXXX";
+        if (not mkdtemp(path))
+            throw std::runtime_error("Can't create a directory for the image cache");
+        dir = path;
+
+        ImageCache publisher(dir), worker(dir);
+        auto published = publisher.get(obj);
+        shared = worker.find(obj.dump());
+        if (not shared or shared == published)
+            throw std::runtime_error("Image cache did not map the published image");
+        published.reset();
+        if (worker.evict_unused() != 0)
+            throw std::runtime_error("Image cache evicted a mapped image");
+        check_rejected();
+
+        // the test runs on what the mapping holds
+        obj = shared->object();
+    }
+
+    ~SharedImageNVMTest() override
+    {
+        shared.reset();
+        ImageCache(dir).evict_unused();
+        rmdir(dir.c_str());
+    }
+
+    const VerifiedImage& get_image() const override
+    {
+        return shared->image();
+    }
+
+private:
+    static bool rejects(const std::string& dir, const std::string& content)
+    {
+        try {
+            ImageCache(dir).find(content);
+        }
+        catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    }
+
+    // an image with other content under the same key, a shared directory and a symlink are refused
+    void check_rejected() const
+    {
+        auto content = obj.dump();
+        auto name = fhex(ImageCache::content_key(content), 16) + ".nvmi";
+        std::ifstream in(dir + "/" + name, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        char path[] = "/tmp/nanovm-images-XXXXXX";
+        if (bytes.empty() or not mkdtemp(path))
+            throw std::runtime_error("Can't copy the published image");
+        std::string other = path, link = other + ".link";
+        bytes.back() ^= 1;
+        std::ofstream(other + "/" + name, std::ios::binary) << bytes;
+        bool tampered = rejects(other, content);
+        chmod(other.c_str(), 0777);
+        bool shared_dir = rejects(other, content);
+        bool symlinked = symlink(dir.c_str(), link.c_str()) == 0 and rejects(link, content);
+
+        unlink(link.c_str());
+        unlink((other + "/" + name).c_str());
+        rmdir(other.c_str());
+        if (not tampered or not shared_dir or not symlinked)
+            throw std::runtime_error("Image cache accepted an image it must refuse");
+    }
+
+    std::string dir;
+    std::shared_ptr<const SharedImage> shared;
+};
+
+
+// specialized for the bindings first, a residual program must not be bigger than the original
+class SpecializedNVMTest : public NVMTestFromFile
+{
+public:
+    SpecializedNVMTest(const std::string& name, const NVMAObject& object, const std::string& bindings,
+                       bool expect_original, const std::map<std::string, uint64_t>& values)
+        : NVMTestFromFile(name, object, {})
+        , result(specialize(object, bindings))
+        , expect_original(expect_original)
+    {
+        obj = result.object;
+        set_values(values);
+        image = VerifiedImage::load(obj);
+    }
+
+    bool check_result(const void* ram) const override
+    {
+        return result.original == expect_original and result.specialized_size <= result.original_size
+               and NVMTestFromFile::check_result(ram);
+    }
+
+private:
+    SpecializationResult result;
+    bool expect_original;
+};
+
+
+// x is folded, the store through an unknown pointer must not lose it (ptr 3 writes y)
+constexpr auto embedded_store_ind = nanovm::assemble(R"(
+.input
+MEMORY 4, ptr
+
+.output
+MEMORY 4, out
+
+.data
+MEMORY 4, y
+MEMORY 4, x
+
+.code
+    LOAD3 5
+    STORE_OP x
+    LOAD3 1
+    STORE_IND ptr
+    LOAD_OP x
+    STORE_OP out
+    HALT
+)");
+
+// the same with x computed, so the residual program is smaller
+constexpr auto embedded_store_ind_folded = nanovm::assemble(R"(
+.input
+MEMORY 4, ptr
+
+.output
+MEMORY 4, out
+
+.data
+MEMORY 4, y
+MEMORY 4, x
+
+.code
+    LOAD3 5
+    STORE_OP x
+    ADD x, x, x
+    ADD x, x, x
+    LOAD3 1
+    STORE_IND ptr
+    LOAD_OP x
+    STORE_OP out
+    HALT
+)");
+
+static_assert(embedded_store_ind.word("y") == 3 and embedded_store_ind_folded.word("x") == 4);
+
+
+// the same factorial.nvma, embedded into the binary
+constexpr auto embedded_factorial = nanovm::assemble(R"(
+.input
+MEMORY 4, n
+
+.output
+MEMORY 4, result
+
+.data
+MEMORY 4, zero
+MEMORY 4, one
+MEMORY 4, counter
+MEMORY 4, accum
+MEMORY 4, tmp1
+MEMORY 4, tmp2
+MEMORY 4, return
+
+.code
+init:
+    LOAD3 0
+    STORE_OP zero
+    LOAD3 1
+    STORE_OP one
+    JZ lr, factorial
+
+multiply:
+    LOAD_OP tmp1
+    AND tmp1, tmp1, zero
+    multipy_loop:
+    JZ zero, multiply_end
+        ADD tmp1, tmp1, tmp2
+        SUB lr, lr, one
+        JZ lr, multipy_loop
+    multiply_end:
+    LOAD_OP tmp1
+    PC_SWP return, return
+
+factorial:
+    MOV result, one
+    MOV counter, n
+    loop:
+    LOAD3 0
+    JZ counter, end
+        MOV tmp1, counter
+        MOV tmp2, result
+        LOAD_LOW multiply
+        PC_SWP return, lr
+        STORE_OP result
+        SUB counter, counter, one
+        JZ lr, loop
+end:
+HALT
+)");
+
+static_assert(embedded_factorial.text_size == 41);
+static_assert(embedded_factorial.text[0] == 0xF0 and embedded_factorial.text[41] == 0xFF);
+static_assert(embedded_factorial.word("n") == 1 and embedded_factorial.word("result") == 2);
+static_assert(embedded_factorial.address("multiply") == 6 and embedded_factorial.address("end") == 40);
+static_assert(embedded_factorial.ram_size == 40);
+
+
+// one source for every word width, only the size of a word differs
+#define WIDTH_TEST_SOURCE(bits, bytes)  \
+    "WIDTH " #bits "\n"                 \
+    ".input\n"                          \
+    "MEMORY " #bytes ", n\n"            \
+    ".output\n"                         \
+    "MEMORY " #bytes ", sum\n"          \
+    "MEMORY " #bytes ", shifted\n"      \
+    "MEMORY " #bytes ", high\n"         \
+    "MEMORY " #bytes ", bits\n"         \
+    ".data\n"                           \
+    "MEMORY " #bytes ", step\n"         \
+    ".code\n"                           \
+    "    LOAD_LOW 16\n"                 \
+    "    STORE_OP step\n"               \
+    "    ADD sum, n, step\n"            \
+    "    LS shifted, n, 12\n"           \
+    "    POPCNT bits, n\n"              \
+    "    LOAD_LOW 0xFFF\n"              \
+    "    LOAD_HIGH 0xABCDE\n"           \
+    "    STORE_OP high\n"               \
+    "    HALT\n"
+
+constexpr auto embedded_width16 = nanovm::assemble(WIDTH_TEST_SOURCE(16, 2));
+constexpr auto embedded_width32 = nanovm::assemble(WIDTH_TEST_SOURCE(32, 4));
+constexpr auto embedded_width64 = nanovm::assemble(WIDTH_TEST_SOURCE(64, 8));
+
+#undef WIDTH_TEST_SOURCE
+
+constexpr bool same_text(const nanovm::AsmProgram& a, const nanovm::AsmProgram& b)
+{
+    for (size_t i = 0; i < a.text.size(); i++)
+        if (a.text[i] != b.text[i])
+            return false;
+    return true;
+}
+
+static_assert(same_text(embedded_width16, embedded_width32) and same_text(embedded_width32, embedded_width64));
+static_assert(embedded_width16.width == 16 and embedded_width16.word("bits") == 5 and embedded_width16.ram_size == 14);
+static_assert(embedded_width64.width == 64 and embedded_width64.word("bits") == 5 and embedded_width64.ram_size == 56);
+
+
+// .rodata follows the code, a 16-bit program keeps the low half of LOAD_ROMW
+constexpr auto embedded_rom16 = nanovm::assemble(R"(
+WIDTH 16
+.input
+MEMORY 2, i
+.output
+MEMORY 2, half
+MEMORY 2, word
+.code
+    LOAD_ROMH halves, i
+    STORE_OP half
+    LOAD_ROMW words, i
+    STORE_OP word
+    HALT
+.rodata
+halves:
+    HALF 0x1234, 0xBEEF
+words:
+    WORD 0x11112222, 0xCAFEF00D
+)");
+
+static_assert(embedded_rom16.address("halves") == 9 and embedded_rom16.address("words") == 13);
+static_assert(embedded_rom16.text_size == 21 and embedded_rom16.text[13] == 0x22 and embedded_rom16.text[21] == 0xFF);
+
+
 std::map<std::string, size_t> stdout_pos_map;
 size_t stdout_last_pos = 0;
 
-std::unique_lock<std::mutex> lock_stdout_for_test(const AbstractNVMTest& test)
+auto lock_stdout_for_test(const AbstractNVMTest& test)
 {
     class StdoutLock : public std::unique_lock<std::mutex>
     {
@@ -117,6 +1081,7 @@ std::unique_lock<std::mutex> lock_stdout_for_test(const AbstractNVMTest& test)
         {
             std::cout << "\033[s" << std::flush;
         }
+        StdoutLock(StdoutLock&&) = default;
         ~StdoutLock()
         {
             if (this->owns_lock()) {
@@ -137,7 +1102,7 @@ std::unique_lock<std::mutex> lock_stdout_for_test(const AbstractNVMTest& test)
 }
 
 
-std::array<uint32_t, 32> run_test(const AbstractNVMTest& test, size_t pd)
+std::vector<uint8_t> run_test(const AbstractNVMTest& test, size_t pd)
 {
     {
         auto lock = lock_stdout_for_test(test);
@@ -145,15 +1110,14 @@ std::array<uint32_t, 32> run_test(const AbstractNVMTest& test, size_t pd)
     }
 
     const NVMAObject& obj = test.get_binary();
-    std::array<uint32_t, 32> ram = {0};
+    std::vector<uint8_t> ram(32 * obj.width / 8);
     for (auto& [name, label] : obj.input.labels) {
-        std::memcpy((uint8_t*)&ram + label.pos, obj.ram.data.data() + label.pos, 4);
+        std::memcpy(ram.data() + label.pos, obj.ram.data.data() + label.pos, label_words(obj, obj.input, name) * obj.width / 8);
     }
 
-    if (obj.text.data.size())
-        execute(ram.data(), obj.text.data.data(), 0, nullptr, nullptr);
-    else
+    if (obj.text.data.empty())
         throw std::runtime_error(".text section is empty");
+    test.run(ram.data());
 
     auto lock = lock_stdout_for_test(test);
     if (test.check_result(ram.data())) {
@@ -167,15 +1131,296 @@ std::array<uint32_t, 32> run_test(const AbstractNVMTest& test, size_t pd)
 }
 
 
+/*
+Перебор входов (sweep): для каждого -i перебираются все сочетания значений
+из -r <label>=<диапазон> (декартово произведение), остальные входы берутся из
+input файла. Диапазон: a..b (включительно), a..b/step или список a,b,c.
+Ожидаемые выходы - от функции хоста (-f <имя>, входы и выходы в порядке имен
+меток) или из golden файла (-g), где строка k - выходы для k-го сочетания:
+"<label>=<value> ..." по всем .output. Адреса меток разрешаются один раз,
+пространство делится на блоки между потоками, печатаются только расхождения.
+*/
+
+
+struct SweepRange
+{
+    std::string label;
+    uint8_t word = 0;
+    std::vector<uint32_t> list; // if empty - range
+    uint32_t start = 0;
+    uint32_t step = 1;
+    uint64_t count = 0;
+
+    uint32_t value(uint64_t i) const
+    {
+        return list.size() ? list[i] : start + (uint32_t)i * step;
+    }
+};
+
+
+using SweepReference = void (*)(const uint32_t* inputs, uint32_t* outputs);
+
+
+static void factorial_reference(const uint32_t* inputs, uint32_t* outputs)
+{
+    uint32_t result = 1;
+    for (uint32_t i = 2; i <= inputs[0]; i++)
+        result *= i;
+    outputs[0] = result;
+}
+
+
+static const std::map<std::string, SweepReference> sweep_references = {
+    {"factorial", factorial_reference},
+};
+
+
+struct SweepArguments
+{
+    std::vector<std::string> ranges;
+    std::string reference;
+    std::string golden;
+    std::string write_golden;
+    size_t workers = 1;
+    uint32_t max_steps = 10000000;
+    uint64_t max_reported = 100;
+};
+
+
+static uint32_t parse_number(const std::string& value)
+{
+    bool hex = (value.substr(0, 2) == "0x" or value.substr(0, 2) == "0X");
+    size_t used = 0;
+    auto number = std::stoul(value.substr(hex ? 2 : 0), &used, hex ? 16 : 10);
+    if (used + (hex ? 2 : 0) != value.size())
+        throw std::runtime_error("Bad number '" + value + "'");
+    return number;
+}
+
+
+static SweepRange parse_range(const NVMAObject& obj, const std::string& spec)
+{
+    auto eq_pos = spec.find('=');
+    if (eq_pos == std::string::npos)
+        throw std::runtime_error("Expected -r <label>=<range>, got '" + spec + "'");
+
+    SweepRange range;
+    range.label = spec.substr(0, eq_pos);
+    if (not obj.input.labels.count(range.label) or obj.input.labels.at(range.label).size != 4)
+        throw std::runtime_error("Name " + range.label + " not found in section input");
+    range.word = obj.input.labels.at(range.label).pos / 4;
+
+    auto value = spec.substr(eq_pos + 1);
+    auto dots = value.find("..");
+    if (dots == std::string::npos) {
+        for (size_t pos = 0; pos != std::string::npos; ) {
+            auto end = value.find(',', pos);
+            range.list.push_back(parse_number(value.substr(pos, end - pos)));
+            pos = (end == std::string::npos ? end : end + 1);
+        }
+        range.count = range.list.size();
+        return range;
+    }
+
+    auto slash = value.find('/', dots);
+    range.start = parse_number(value.substr(0, dots));
+    uint32_t last = parse_number(value.substr(dots + 2, slash - dots - 2));
+    if (slash != std::string::npos)
+        range.step = parse_number(value.substr(slash + 1));
+    if (last < range.start or range.step == 0)
+        throw std::runtime_error("Empty range '" + spec + "'");
+    range.count = (uint64_t)(last - range.start) / range.step + 1;
+    return range;
+}
+
+
+// outputs of every combination in sweep order
+static std::vector<uint32_t> load_golden(const std::string& path, const NVMAObject& obj, uint64_t total)
+{
+    std::ifstream in(path);
+    if (not in)
+        throw std::runtime_error("Can't open golden file " + path);
+
+    std::map<std::string, size_t> index;
+    for (auto& [name, label] : obj.output.labels)
+        index.emplace(name, index.size());
+
+    std::vector<uint32_t> golden;
+    golden.reserve(total * index.size());
+    std::string line;
+    while (golden.size() < total * index.size() and std::getline(in, line)) {
+        std::vector<uint32_t> row(index.size());
+        std::vector<bool> seen(index.size());
+        std::stringstream fields(line);
+        std::string field;
+        while (fields >> field) {
+            auto eq_pos = field.find('=');
+            auto name = field.substr(0, eq_pos);
+            if (eq_pos == std::string::npos or not index.count(name))
+                continue; // inputs are kept only for reading
+            row[index.at(name)] = parse_number(field.substr(eq_pos + 1));
+            seen[index.at(name)] = true;
+        }
+        if (std::find(seen.begin(), seen.end(), false) != seen.end())
+            throw std::runtime_error("Golden line " + std::to_string(golden.size() / index.size() + 1)
+                                     + " misses outputs");
+        golden.insert(golden.end(), row.begin(), row.end());
+    }
+    if (golden.size() != total * index.size())
+        throw std::runtime_error("Golden file has less lines than the sweep");
+    return golden;
+}
+
+
+// returns number of mismatches
+uint64_t run_sweep(const NVMAObject& obj, const VerifiedImage& image, const std::string& name,
+                   const SweepArguments& args)
+{
+    require_width(obj, 32);
+
+    std::vector<SweepRange> ranges;
+    uint64_t total = 1;
+    for (auto& spec : args.ranges) {
+        ranges.push_back(parse_range(obj, spec));
+        if (total > UINT64_MAX / ranges.back().count)
+            throw std::runtime_error("Sweep space is too big");
+        total *= ranges.back().count;
+    }
+
+    auto code = image.code.data();
+    std::array<uint32_t, 32> ram_image = {0};
+    std::memcpy(ram_image.data(), obj.ram.data.data(), std::min(obj.ram.data.size(), sizeof(ram_image)));
+
+    // pre-resolved words, labels in name order
+    std::vector<uint8_t> input_words, output_words;
+    std::vector<std::string> output_names;
+    for (auto& [label_name, label] : obj.input.labels)
+        input_words.push_back(label.pos / 4);
+    for (auto& [label_name, label] : obj.output.labels) {
+        output_words.push_back(label.pos / 4);
+        output_names.push_back(label_name);
+    }
+    const size_t outputs = output_words.size();
+
+    SweepReference reference = nullptr;
+    if (args.reference.size()) {
+        if (not sweep_references.count(args.reference))
+            throw std::runtime_error("Unknown reference function " + args.reference);
+        reference = sweep_references.at(args.reference);
+    }
+    std::vector<uint32_t> golden;
+    if (args.golden.size())
+        golden = load_golden(args.golden, obj, total);
+    std::vector<uint32_t> written;
+    if (args.write_golden.size())
+        written.resize(total * outputs);
+    if (not reference and golden.empty() and written.empty())
+        throw std::runtime_error("Sweep needs -f <reference>, -g <golden> or -w <golden>");
+
+    std::atomic<uint64_t> next_chunk{0};
+    std::atomic<uint64_t> mismatches{0};
+    std::atomic<uint64_t> hangs{0};
+    const uint64_t chunk = 4096;
+
+    auto worker = [&] {
+        std::vector<uint32_t> inputs(input_words.size());
+        std::vector<uint32_t> expected(outputs);
+        std::string report;
+
+        for (uint64_t begin; (begin = next_chunk++ * chunk) < total; ) {
+            for (uint64_t index = begin; index < std::min(total, begin + chunk); index++) {
+                auto ram = ram_image;
+                for (uint64_t rest = index, r = ranges.size(); r-- > 0; rest /= ranges[r].count)
+                    ram[ranges[r].word] = ranges[r].value(rest % ranges[r].count);
+
+                uint8_t pc = 0;
+                uint32_t steps = 0;
+                bool hang = execute_bounded(ram.data(), code, pc, nullptr, args.max_steps, steps);
+                hangs += hang;
+
+                if (written.size())
+                    for (size_t o = 0; o < outputs; o++)
+                        written[index * outputs + o] = ram[output_words[o]];
+
+                if (reference) {
+                    for (size_t i = 0; i < input_words.size(); i++)
+                        inputs[i] = ram[input_words[i]];
+                    reference(inputs.data(), expected.data());
+                }
+                else if (golden.size()) {
+                    std::copy(golden.begin() + index * outputs, golden.begin() + (index + 1) * outputs, expected.begin());
+                }
+                else {
+                    continue;
+                }
+
+                bool same = not hang;
+                for (size_t o = 0; o < outputs; o++)
+                    same &= (ram[output_words[o]] == expected[o]);
+                if (same or mismatches++ >= args.max_reported)
+                    continue;
+
+                std::stringstream line;
+                line << "MISMATCH";
+                for (auto& range : ranges)
+                    line << " " << range.label << "=" << ram[range.word];
+                line << ":";
+                if (hang)
+                    line << " no HALT after " << args.max_steps << " steps";
+                for (size_t o = 0; o < outputs; o++)
+                    if (ram[output_words[o]] != expected[o])
+                        line << " " << output_names[o] << " got=0x" << fhex(ram[output_words[o]], 8)
+                             << " exp=0x" << fhex(expected[o], 8);
+                report += line.str() + "\n";
+            }
+
+            if (report.size()) {
+                std::lock_guard<std::mutex> lock(stdout_mutex);
+                std::cout << report << std::flush;
+                report.clear();
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::max<size_t>(args.workers, 1); i++)
+        threads.emplace_back(worker);
+    for (auto& thread : threads)
+        thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (written.size()) {
+        std::ofstream out(args.write_golden);
+        for (uint64_t index = 0; index < total; index++) {
+            for (uint64_t rest = index, r = ranges.size(); r-- > 0; rest /= ranges[r].count)
+                out << ranges[r].label << "=" << ranges[r].value(rest % ranges[r].count) << " ";
+            for (size_t o = 0; o < outputs; o++)
+                out << output_names[o] << "=" << written[index * outputs + o] << (o + 1 < outputs ? " " : "");
+            out << "\n";
+        }
+    }
+
+    std::cout << "Sweep " << name << ": " << total << " inputs in " << elapsed << " s ("
+              << (uint64_t)(total / std::max(elapsed, 1e-9)) << "/s), "
+              << mismatches << " mismatches, " << hangs << " without HALT" << std::endl;
+    return mismatches;
+}
+
+
 struct Arguments
 {
     struct Source {
         std::string source;
         std::string input;
-        std::map<std::string, uint32_t> values;
+        std::map<std::string, uint64_t> values;
+        bool binary = false;
+        std::string entry;
     };
 
     std::vector<Source> sources;
+    bool embedded = false;
+    SweepArguments sweep;
 };
 
 
@@ -185,10 +1430,12 @@ Arguments parse_args(int argc, char* argv[])
     auto proc = [&] (char opt, const std::string& value)
     {
         switch (opt) {
-        case 'i': {
+        case 'i':
+        case 'b': {
             std::string arg = optarg;
             if (arg.find(':') == arg.npos)
-                throw std::runtime_error("Expected -i <source>:<input>[:<name>=<value>]*");
+                throw std::runtime_error(opt == 'i' ? "Expected -i <source>:<input>[:<name>=<value>]*"
+                                                    : "Expected -b <binary>[@<entry>]:<input>[:<name>=<value>]*");
 
             auto source_end = arg.find(':');
             auto input_end = arg.find(':', source_end + 1);
@@ -198,6 +1445,13 @@ Arguments parse_args(int argc, char* argv[])
             auto vars_start = input_end;
 
             Arguments::Source info{source, input};
+            if (opt == 'b') {
+                info.binary = true;
+                if (source.find('@') != source.npos) {
+                    info.entry = source.substr(source.find('@') + 1);
+                    info.source = source.substr(0, source.find('@'));
+                }
+            }
             for (auto next = vars_start;
                  next != std::string::npos;
                  next = arg.find(':', next + 1))
@@ -210,13 +1464,13 @@ Arguments parse_args(int argc, char* argv[])
                     throw std::runtime_error("Parse pair '" + pair + "' error");
 
                 auto value = pair.substr(eq_pos + 1);
-                uint32_t uvalue;
+                uint64_t uvalue;
                 if (value.substr(0, 2) == "0x"
                         or value.substr(0, 2) == "0X") {
-                    uvalue = std::stoul(value.substr(2), nullptr, 16);
+                    uvalue = std::stoull(value.substr(2), nullptr, 16);
                 }
                 else {
-                    uvalue = std::stoul(value);
+                    uvalue = std::stoull(value);
                 }
 
                 info.values.emplace(std::make_pair(pair.substr(0, eq_pos),
@@ -225,10 +1479,43 @@ Arguments parse_args(int argc, char* argv[])
 
             args.sources.emplace_back(std::move(info));
         }   break;
+
+        case 'e':
+            args.embedded = true;
+            break;
+
+        case 'r':
+            args.sweep.ranges.push_back(value);
+            break;
+
+        case 'f':
+            args.sweep.reference = value;
+            break;
+
+        case 'g':
+            args.sweep.golden = value;
+            break;
+
+        case 'w':
+            args.sweep.write_golden = value;
+            break;
+
+        case 'j':
+            args.sweep.workers = std::stoul(value);
+            break;
+
+        case 's':
+            args.sweep.max_steps = std::stoul(value);
+            break;
+
+        case 'm':
+            args.sweep.max_reported = std::stoull(value);
+            break;
         }
     };
 
-    parse_args("i:", argc, argv, proc);
+    args.sweep.workers = std::max(1u, std::thread::hardware_concurrency());
+    parse_args("i:b:er:f:g:w:j:s:m:", argc, argv, proc);
 
     return args;
 }
@@ -237,12 +1524,70 @@ Arguments parse_args(int argc, char* argv[])
 int main(int argc, char* argv[])
 {
     std::vector<std::unique_ptr<AbstractNVMTest>> tests;
+    Arguments args;
 
     try {
-        auto args = parse_args(argc, argv);
-        for (auto& [source, input, values] : args.sources)
+        args = parse_args(argc, argv);
+        for (auto& source : args.sources)
         {
-            tests.push_back(std::make_unique<NVMTestFromFile>(source, input, values));
+            tests.push_back(std::make_unique<NVMTestFromFile>(source.source, source.input, source.values,
+                                                              source.binary, source.entry));
+        }
+        if (args.embedded) {
+            tests.push_back(std::make_unique<NVMTestFromFile>("embedded:factorial", embedded_factorial.object(),
+                    std::map<std::string, uint64_t>{{"input.n", 5}, {"output.result", 120}}));
+            // the same text at every width
+            tests.push_back(std::make_unique<NVMTestFromFile>("embedded:width16", embedded_width16.object(),
+                    std::map<std::string, uint64_t>{{"input.n", 0xFFF5}, {"output.sum", 0x0005},
+                                                    {"output.shifted", 0x5000}, {"output.high", 0xEFFF},
+                                                    {"output.bits", 14}}));
+            tests.push_back(std::make_unique<NVMTestFromFile>("embedded:width32", embedded_width32.object(),
+                    std::map<std::string, uint64_t>{{"input.n", 0xFFF5}, {"output.sum", 0x10005},
+                                                    {"output.shifted", 0xFFF5000}, {"output.high", 0xABCDEFFF},
+                                                    {"output.bits", 14}}));
+            tests.push_back(std::make_unique<NVMTestFromFile>("embedded:width64", embedded_width64.object(),
+                    std::map<std::string, uint64_t>{{"input.n", 0xFFFFFFF5}, {"output.sum", 0x100000005},
+                                                    {"output.shifted", 0xFFFFFFF5000}, {"output.high", 0xABCDEFFF},
+                                                    {"output.bits", 30}}));
+            tests.push_back(std::make_unique<NVMTestFromFile>("embedded:rom16", embedded_rom16.object(),
+                    std::map<std::string, uint64_t>{{"input.i", 1}, {"output.half", 0xBEEF}, {"output.word", 0xF00D}}));
+            tests.push_back(std::make_unique<SharedImageNVMTest>("embedded:image_cache", embedded_factorial.object(),
+                    std::map<std::string, uint64_t>{{"input.n", 6}, {"output.result", 720}}));
+            tests.push_back(std::make_unique<WcetNVMTest>("embedded:wcet_input_array", embedded_input_loops.object(),
+                    std::map<uint8_t, uint32_t>{{5, 7}},
+                    std::map<std::string, uint64_t>{{"input.table", 5000}, {"output.count", 5007}}));
+            tests.push_back(std::make_unique<WcetNVMTest>("embedded:wcet_countdown", embedded_countdown.object(),
+                    std::map<uint8_t, uint32_t>{}, std::map<std::string, uint64_t>{{"input.x", 3}, {"output.sum", 24}}, 64));
+            tests.push_back(std::make_unique<WcetNVMTest>("embedded:wcet_store_ind", embedded_indirect_known.object(),
+                    std::map<uint8_t, uint32_t>{}, std::map<std::string, uint64_t>{{"input.n", 5}, {"output.out", 5}, {"output.copy", 5}}));
+            tests.push_back(std::make_unique<WcetNVMTest>("embedded:wcet_store_ind_unknown", embedded_indirect_unknown.object(),
+                    std::map<uint8_t, uint32_t>{}, std::map<std::string, uint64_t>{{"input.n", 5}, {"input.ptr", 4},
+                                                                                  {"output.out", 5}, {"output.copy", 5}},
+                    UINT64_MAX, "STORE_IND at 0A may overwrite counter 6"));
+            tests.push_back(std::make_unique<EntryCfgNVMTest>("embedded:entry_cfg", embedded_entry.object(),
+                    std::map<std::string, uint64_t>{{"output.out", 1}}));
+            tests.push_back(std::make_unique<AsyncNVMTest>("embedded:async",
+                    std::map<std::string, uint64_t>{{"input.n", 5}, {"input.offset_cb", 1}, {"input.twice_cb", 2},
+                                                    {"output.sum", 105}, {"output.twice", 210}, {"output.missing", 0}}));
+            tests.push_back(std::make_unique<GreenNVMTest>("embedded:green", embedded_factorial.object(),
+                    std::map<std::string, uint64_t>{{"input.n", 3}, {"output.result", 6}}));
+            tests.push_back(std::make_unique<PipelineNVMTest>("embedded:pipeline", embedded_factorial.object(),
+                    embedded_width32.object(), std::map<std::string, uint64_t>{{"input.n", 5}, {"output.result", 120}}));
+            // nothing is known, the original program is kept
+            tests.push_back(std::make_unique<SpecializedNVMTest>("embedded:specialize_unbound", embedded_factorial.object(),
+                    "{}", true, std::map<std::string, uint64_t>{{"input.n", 5}, {"output.result", 120}}));
+            tests.push_back(std::make_unique<SpecializedNVMTest>("embedded:specialize", embedded_factorial.object(),
+                    R"({"input": {"n": 5}})", false, std::map<std::string, uint64_t>{{"output.result", 120}}));
+            // a store through an unknown pointer keeps the folded words
+            tests.push_back(std::make_unique<SpecializedNVMTest>("embedded:specialize_store_ind", embedded_store_ind.object(),
+                    "{}", true, std::map<std::string, uint64_t>{{"input.ptr", 3}, {"output.out", 5}}));
+            tests.push_back(std::make_unique<SpecializedNVMTest>("embedded:specialize_store_ind_folded",
+                    embedded_store_ind_folded.object(), "{}", false,
+                    std::map<std::string, uint64_t>{{"input.ptr", 3}, {"output.out", 20}}));
+            for (bool static_host : {false, true})
+                tests.push_back(std::make_unique<HostNVMTest>(static_host ? "embedded:static_host" : "embedded:host_registry",
+                        static_host, std::map<std::string, uint64_t>{{"input.n", 5}, {"output.sum", 105},
+                                                                     {"output.twice", 210}, {"output.missing", 0}}));
         }
     }
     catch (const std::runtime_error& e) {
@@ -250,15 +1595,28 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if (args.sweep.ranges.size()) {
+        try {
+            uint64_t mismatches = 0;
+            for (auto& test : tests)
+                mismatches += run_sweep(test->get_binary(), test->get_image(), test->get_name(), args.sweep);
+            return mismatches ? 2 : 0;
+        }
+        catch (const std::runtime_error& e) {
+            std::cout << "Error while sweep: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     auto max_name_size = 0;
     for (const auto& test : tests)
         max_name_size = std::max<size_t>(max_name_size, test->get_name().size());
 
-    std::vector<std::future<std::pair<AbstractNVMTest*, std::array<uint32_t, 32>>>> futures;
+    std::vector<std::future<std::pair<AbstractNVMTest*, std::vector<uint8_t>>>> futures;
     for (const auto& test : tests)
     {
         futures.push_back(std::async(std::launch::async,
-                          [&] () -> std::pair<AbstractNVMTest*, std::array<uint32_t, 32>>
+                          [&] () -> std::pair<AbstractNVMTest*, std::vector<uint8_t>>
         {
             return std::make_pair(test.get(), run_test(*test, max_name_size - test->get_name().size()));
         }));
@@ -0,0 +1,105 @@
+#include "timing.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include "vmop.hpp"
+
+
+
+
+static uint32_t get_cycles(const nlohmann::json& value, const std::string& name)
+{
+    if (not value.is_number_unsigned())
+        throw std::runtime_error("Expected unsigned number for " + name);
+    return value.get<uint32_t>();
+}
+
+
+TimingModel TimingModel::from_json(const std::string& content)
+{
+    nlohmann::json json;
+    try {
+        json = nlohmann::json::parse(content);
+    }
+    catch (const nlohmann::json::exception& err) {
+        throw std::runtime_error(std::string("Bad timing profile: ") + err.what());
+    }
+    if (not json.is_object())
+        throw std::runtime_error("Timing profile must be an object");
+
+    TimingModel model;
+    for (auto& [key, value] : json.items()) {
+        if (key == "fetch_extra_byte")
+            model.fetch_extra_byte = get_cycles(value, key);
+        else if (key == "branch_taken")
+            model.branch_taken = get_cycles(value, key);
+        else if (key == "host_call")
+            model.host_call = get_cycles(value, key);
+        else if (key != "cycles")
+            throw std::runtime_error("Unknown timing profile key " + key);
+    }
+
+    if (not json.contains("cycles"))
+        return model;
+    auto& cycles = json["cycles"];
+    if (not cycles.is_object())
+        throw std::runtime_error("cycles must be an object");
+
+    if (cycles.contains("default"))
+        model.cycles.fill(get_cycles(cycles["default"], "default"));
+    for (auto& [key, value] : cycles.items()) {
+        if (key == "default")
+            continue;
+        size_t op = 0;
+        while (op < (size_t)Mnemonic::Unknown and key != mnemonic_name((Mnemonic)op))
+            op++;
+        if (op == (size_t)Mnemonic::Unknown)
+            throw std::runtime_error("Unknown mnemonic " + key);
+        model.cycles[op] = get_cycles(value, key);
+    }
+    return model;
+}
+
+
+uint32_t TimingModel::cost(const Instruction& inst) const
+{
+    return cycles[(size_t)inst.op] + fetch_extra_byte * (inst.size - 1);
+}
+
+
+TimedEngine::TimedEngine(const TimingModel& model, const uint8_t* code)
+    : code(code)
+    , branch_taken(model.branch_taken)
+{
+    for (size_t pc = 0; pc < 256; pc++) {
+        auto inst = decode_instruction(code, pc);
+        costs[pc] = model.cost(inst);
+        if (inst.op == Mnemonic::Call)
+            costs[pc] += model.host_call;
+        next_pc[pc] = pc + inst.size;
+        branch[pc] = is_branch(inst);
+    }
+}
+
+
+bool TimedEngine::step(uint32_t* ram, uint8_t& pc, uint32_t (*proc)(uint32_t, uint32_t), TimingReport& report) const
+{
+    auto prev = pc;
+    auto cycles = costs[prev];
+    bool running = execute_one(ram, code, pc, proc);
+    if (branch[prev] and pc != next_pc[prev])
+        cycles += branch_taken;
+
+    report.cycles += cycles;
+    report.steps++;
+    report.pc_cycles[prev] += cycles;
+    report.pc_steps[prev]++;
+    return running;
+}
+
+
+void TimedEngine::run(uint32_t* ram, uint8_t pc, uint32_t (*proc)(uint32_t, uint32_t),
+                      TimingReport& report, uint64_t max_steps) const
+{
+    for (uint64_t i = 0; i < max_steps and step(ram, pc, proc, report); i++) {}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <string>
+
+#include "isa.hpp"
+
+
+
+
+/*
+Модель времени исполнения на целевом устройстве, профиль в JSON:
+```
+> {
+>     "cycles": {"default": 1, "ADD": 2, "CALL": 4, "POPCNT": 3},
+>     "fetch_extra_byte": 1,
+>     "branch_taken": 2,
+>     "host_call": 20
+> }
+```
+cycles - стоимость инструкции по мнемонике (имена как в дизассемблере), остальные - default.
+fetch_extra_byte - добавляется за каждый байт инструкции после первого,
+branch_taken - за JL/JZ/PC_SWP, после которых pc не равен следующей инструкции,
+host_call - за вызов функции хоста в CALL (сверх стоимости самой инструкции).
+*/
+
+
+struct TimingModel
+{
+    std::array<uint32_t, (size_t)Mnemonic::Unknown + 1> cycles;
+    uint32_t fetch_extra_byte = 0;
+    uint32_t branch_taken = 0;
+    uint32_t host_call = 0;
+
+    TimingModel() { cycles.fill(1); }
+
+    static TimingModel from_json(const std::string& content);
+
+    // cost of instruction without branch penalty
+    uint32_t cost(const Instruction& inst) const;
+};
+
+
+struct TimingReport
+{
+    uint64_t cycles = 0;
+    uint64_t steps = 0;
+    // by pc of instruction
+    std::array<uint64_t, 256> pc_cycles{};
+    std::array<uint64_t, 256> pc_steps{};
+};
+
+
+// Engine with the timing model: costs are precomputed per pc for the text
+// (code must have 256 bytes, unused tail filled with HALT),
+// execution itself goes through execute_one.
+class TimedEngine
+{
+public:
+    TimedEngine(const TimingModel& model, const uint8_t* code);
+
+    // executes one instruction, returns false after HALT
+    bool step(uint32_t* ram, uint8_t& pc, uint32_t (*proc)(uint32_t, uint32_t), TimingReport& report) const;
+
+    // runs until HALT or max_steps instructions
+    void run(uint32_t* ram, uint8_t pc, uint32_t (*proc)(uint32_t, uint32_t),
+             TimingReport& report, uint64_t max_steps = UINT64_MAX) const;
+
+private:
+    const uint8_t* code;
+    uint32_t branch_taken;
+    std::array<uint32_t, 256> costs;
+    std::array<uint8_t, 256> next_pc;
+    std::array<bool, 256> branch;
+};
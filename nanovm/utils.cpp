@@ -2,7 +2,12 @@
 
 #include <getopt.h>
 
+#include <algorithm>
 #include <stdexcept>
+#include <vector>
+
+#include "isa.hpp"
+#include "vmop.hpp"
 
 
 
@@ -24,25 +29,74 @@ std::string load_file(const std::string& path, std::ios::openmode mode)
 }
 
 
-uint32_t& ref_value32(NVMAObject::Section& master, const NVMAObject::Section& sec, const std::string& name)
+static size_t word_offset(const NVMAObject& obj, const NVMAObject::Section& sec, const std::string& name, size_t index)
+{
+    if (index and index >= label_words(obj, sec, name))
+        throw std::runtime_error("Index " + std::to_string(index) + " is out of " + sec.name + "." + name);
+    return sec.labels.at(name).pos + index * (obj.width / 8);
+}
+
+
+size_t label_words(const NVMAObject& obj, const NVMAObject::Section& sec, const std::string& name)
 {
-    return ref_value32(master.data.data(), sec, name);
+    return std::max<size_t>(sec.labels.at(name).size / (obj.width / 8), 1);
 }
 
-uint32_t get_value32(const NVMAObject::Section& master, const NVMAObject::Section& sec, const std::string& name)
+
+size_t code_size(const NVMAObject& obj)
 {
-    return get_value32(master.data.data(), sec, name);
+    auto rodata = obj.text.labels.find("rodata");
+    return (rodata != obj.text.labels.end() ? rodata->second.pos : obj.text.data.size());
 }
 
 
-uint32_t& ref_value32(void* ram, const NVMAObject::Section& sec, const std::string& name)
+std::vector<NVMAObject::Label> entry_points(const NVMAObject& obj)
 {
-    return *reinterpret_cast<uint32_t*>((uint8_t*)ram + sec.labels.at(name).pos);
+    std::vector<NVMAObject::Label> entries;
+    for (auto& [name, label] : obj.text.labels)
+        if (label.size == 0 and name != "code" and name != "rodata")
+            entries.push_back(label);
+    return entries;
 }
 
-uint32_t get_value32(const void* ram, const NVMAObject::Section& sec, const std::string& name)
+
+uint8_t entry_point(const NVMAObject& obj, const std::string& name)
 {
-    return *reinterpret_cast<const uint32_t*>((const uint8_t*)ram + sec.labels.at(name).pos);
+    for (auto& label : entry_points(obj))
+        if (label.name == name)
+            return label.pos;
+    throw std::runtime_error("No entry point " + name + " in the program");
+}
+
+
+uint64_t get_value(const NVMAObject& obj, const void* ram, const NVMAObject::Section& sec, const std::string& name,
+                   size_t index)
+{
+    auto pos = word_offset(obj, sec, name, index);
+    return dispatch_width(obj.width, [&] (auto word) -> uint64_t {
+        return *reinterpret_cast<const decltype(word)*>((const uint8_t*)ram + pos);
+    });
+}
+
+void set_value(NVMAObject& obj, const NVMAObject::Section& sec, const std::string& name, uint64_t value,
+               size_t index)
+{
+    auto pos = word_offset(obj, sec, name, index);
+    dispatch_width(obj.width, [&] (auto word) {
+        using Word = decltype(word);
+        if (value != (Word)value)
+            throw std::runtime_error("Value of " + sec.name + "." + name + " does not fit "
+                                     + std::to_string(obj.width) + "-bit word");
+        *reinterpret_cast<Word*>(obj.ram.data.data() + pos) = value;
+    });
+}
+
+
+void require_width(const NVMAObject& obj, unsigned width)
+{
+    if (obj.width != width)
+        throw std::runtime_error("Program has " + std::to_string(obj.width) + "-bit words, only "
+                                 + std::to_string(width) + "-bit programs are supported");
 }
 
 
@@ -57,40 +111,57 @@ std::string fhex(uint64_t hex, int octets)
 
 
 
-void parse_section(NVMAObject::Section& master_section, NVMAObject::Section& section, const nlohmann::json::object_t& binding)
+void parse_section(NVMAObject& obj, NVMAObject::Section& section, const nlohmann::json::object_t& binding)
 {
     for (auto& [name, jvalue] : binding)
     {
         auto full_name = section.name + "." + name;
-        if (not jvalue.is_number() and not jvalue.is_string()) {
-            throw std::runtime_error("Type of " + full_name + " not supported");
-        }
         if (not section.labels.count(name)) {
             throw std::runtime_error("Name " + name + " not found in section " + section.name);
         }
-        if (section.labels.at(name).size != 4) {
-            throw std::runtime_error("Size not 4 not supported");
+
+        // an array label takes a list with a value for every word
+        std::vector<const nlohmann::json*> values;
+        if (jvalue.is_array()) {
+            for (auto& item : jvalue)
+                values.push_back(&item);
+            if (values.size() != label_words(obj, section, name) or section.labels.at(name).size % (obj.width / 8))
+                throw std::runtime_error(full_name + " has " + std::to_string(label_words(obj, section, name))
+                                         + " words, got " + std::to_string(values.size()) + " values");
+        }
+        else {
+            if (section.labels.at(name).size != obj.width / 8) {
+                throw std::runtime_error("Size not " + std::to_string(obj.width / 8) + " not supported");
+            }
+            values.push_back(&jvalue);
         }
 
-        uint32_t uvalue;
-        if (jvalue.is_string()) {
-            auto svalue = *jvalue.get_ptr<const nlohmann::json::string_t*>();
-            if (svalue.substr(0, 2) == "0x"
-                    or svalue.substr(0, 2) == "0X") {
-                uvalue = std::stoul(svalue.substr(2), nullptr, 16);
+        for (size_t index = 0; index < values.size(); index++) {
+            auto& value = *values[index];
+            if (not value.is_number() and not value.is_string()) {
+                throw std::runtime_error("Type of " + full_name + " not supported");
+            }
+
+            uint64_t uvalue;
+            if (value.is_string()) {
+                auto svalue = *value.get_ptr<const nlohmann::json::string_t*>();
+                if (svalue.substr(0, 2) == "0x"
+                        or svalue.substr(0, 2) == "0X") {
+                    uvalue = std::stoull(svalue.substr(2), nullptr, 16);
+                }
+                else {
+                    uvalue = std::stoull(svalue.substr(2));
+                }
             }
             else {
-                uvalue = std::stoul(svalue.substr(2));
+                uvalue = *(value.get_ptr<const nlohmann::json::number_unsigned_t*>()
+                           ? value.get_ptr<const nlohmann::json::number_unsigned_t*>()
+                           : (const nlohmann::json::number_unsigned_t*)
+                             value.get_ptr<const nlohmann::json::number_integer_t*>());
             }
-        }
-        else if (jvalue.is_number()) {
-            uvalue = *(jvalue.get_ptr<const nlohmann::json::number_unsigned_t*>()
-                       ? jvalue.get_ptr<const nlohmann::json::number_unsigned_t*>()
-                       : (const nlohmann::json::number_unsigned_t*)
-                         jvalue.get_ptr<const nlohmann::json::number_integer_t*>());
-        }
 
-        std::memcpy(master_section.data.data() + section.labels.at(name).pos, &uvalue, 4);
+            set_value(obj, section, name, uvalue, index);
+        }
     }
 }
 
@@ -109,7 +180,7 @@ void parse_sections_file(NVMAObject& obj, const std::string& content)
             throw std::runtime_error("Section " + name + " is not object");
 
         if (NVMAObject::sections_mapping.count(name))
-            parse_section(obj.ram,
+            parse_section(obj,
                           obj.*NVMAObject::sections_mapping.at(name),
                           *bind);
         else
@@ -167,12 +238,12 @@ void parse_args(const char* optargs,
 }
 
 
-inline const static std::map<std::string, bool> instructions_with_lr = {
-    {"LOAD_OP", true}, {"STORE_OP", true},
-    {"LOAD_LOW", true}, {"LOAD_HIGH", true},
-    {"JZ", true}, {"JL", true},
-    {"LOAD3", true}
-};
+// lr is an implicit operand of the instruction
+static bool uses_lr(const std::string& command)
+{
+    auto& info = instruction_info[(uint8_t)mnemonic_from_name(command)];
+    return info.lr_read or info.lr_write;
+}
 
 std::string format_line(const DecompiledLine& line,
                         const uint32_t* ram,
@@ -201,7 +272,7 @@ std::string format_line(const DecompiledLine& line,
             if (&arg != &line.args.back())
                 oss << ", ";
         }
-        if (ram and instructions_with_lr.count(line.command)) {
+        if (ram and uses_lr(line.command)) {
             oss << " | lr[";
             if (prev_ram and ram[0] != prev_ram[0])
                 oss << "0x" << fhex(prev_ram[0], 8) << "->";
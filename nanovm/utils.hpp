@@ -13,15 +13,73 @@
 
 std::string load_file(const std::string& path, std::ios::openmode mode = std::ios::in);
 
-uint32_t& ref_value32(NVMAObject::Section& master, const NVMAObject::Section& sec, const std::string& name);
-uint32_t get_value32(const NVMAObject::Section& master, const NVMAObject::Section& sec, const std::string& name);
-
-uint32_t& ref_value32(void* ram, const NVMAObject::Section& sec, const std::string& name);
-uint32_t get_value32(const void* ram, const NVMAObject::Section& sec, const std::string& name);
+// label positions are byte offsets in ram of the program width, Word must match NVMAObject::width
+template <typename Word>
+Word& ref_value(void* ram, const NVMAObject::Section& sec, const std::string& name)
+{
+    return *reinterpret_cast<Word*>((uint8_t*)ram + sec.labels.at(name).pos);
+}
+
+template <typename Word>
+Word get_value(const void* ram, const NVMAObject::Section& sec, const std::string& name)
+{
+    return *reinterpret_cast<const Word*>((const uint8_t*)ram + sec.labels.at(name).pos);
+}
+
+template <typename Word>
+Word& ref_value(NVMAObject::Section& master, const NVMAObject::Section& sec, const std::string& name)
+{
+    return ref_value<Word>(master.data.data(), sec, name);
+}
+
+template <typename Word>
+Word get_value(const NVMAObject::Section& master, const NVMAObject::Section& sec, const std::string& name)
+{
+    return get_value<Word>(master.data.data(), sec, name);
+}
+
+// the word type is taken from obj.width, ram - image of the program ram,
+// index - word of an array label (MEMORY size, name, count)
+uint64_t get_value(const NVMAObject& obj, const void* ram, const NVMAObject::Section& sec, const std::string& name,
+                   size_t index = 0);
+// writes to obj.ram, throws if the value does not fit the word
+void set_value(NVMAObject& obj, const NVMAObject::Section& sec, const std::string& name, uint64_t value,
+               size_t index = 0);
+
+// number of words of a label, 1 for a plain MEMORY cell
+size_t label_words(const NVMAObject& obj, const NVMAObject::Section& sec, const std::string& name);
+
+// bytes of instructions at the start of text, .rodata tables follow them
+size_t code_size(const NVMAObject& obj);
+
+// entry points of a program linked by asm/linker.py: text labels of zero size (name=pos:0),
+// execute() may start at their pos besides 0
+std::vector<NVMAObject::Label> entry_points(const NVMAObject& obj);
+// pc of the entry point, throws if the program has no such entry
+uint8_t entry_point(const NVMAObject& obj, const std::string& name);
+
+// for tools which evaluate programs only with 32-bit words
+void require_width(const NVMAObject& obj, unsigned width);
 
 std::string fhex(uint64_t hex, int octets);
 
-void parse_section(NVMAObject::Section& master_section,
+// xorshift64*, the same sequence for the same seed on every platform, state must not be 0
+struct Rng
+{
+    uint64_t state;
+
+    uint64_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    uint32_t below(uint32_t n) { return next() % n; }
+};
+
+void parse_section(NVMAObject& obj,
                    NVMAObject::Section& section,
                    const nlohmann::json::object_t& binding);
 
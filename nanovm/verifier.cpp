@@ -0,0 +1,108 @@
+#include "verifier.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+#include "analysis.hpp"
+#include "isa.hpp"
+#include "utils.hpp"
+
+
+
+
+static uint8_t declared_ram_words(const NVMAObject& obj)
+{
+    size_t word_bytes = obj.width / 8;
+    size_t words = (obj.ram.data.size() + word_bytes - 1) / word_bytes;
+    return std::clamp<size_t>(words, 1, 32); // lr always exists
+}
+
+
+std::vector<VerifyError> verify_program(const NVMAObject& obj)
+{
+    std::vector<VerifyError> errors;
+    auto& text = obj.text.data;
+    if (text.size() > 256) {
+        errors.push_back({0, "text section is bigger than 256 bytes"});
+        return errors;
+    }
+
+    auto words = declared_ram_words(obj);
+    auto code_end = code_size(obj);
+    std::vector<uint8_t> entries;
+    for (auto& entry : entry_points(obj)) {
+        if (entry.pos >= code_end)
+            errors.push_back({entry.pos, "entry point " + entry.name + " is outside the code"});
+        entries.push_back(entry.pos);
+    }
+    auto cfg = build_cfg(text, 0xFFFFFFFF, entries);
+
+    std::map<uint8_t, const Instruction*> reachable;
+    for (auto& block : cfg.blocks) {
+        if (not block.reachable)
+            continue;
+        for (size_t i = 0; i < block.pcs.size(); i++)
+            reachable[block.pcs[i]] = &block.code[i];
+        if (block.unresolved_indirect)
+            errors.push_back({block.pcs.back(), "PC_SWP target is not known at load time"});
+    }
+
+    for (auto& [pc, inst] : reachable) {
+        std::string name = mnemonic_name(inst->op);
+        if (pc >= text.size()) {
+            // HALT of the padding, only the end of text may be reached
+            if (pc > text.size())
+                errors.push_back({pc, "reached outside text of " + std::to_string(text.size()) + " bytes"});
+            continue;
+        }
+        if (pc >= code_end) {
+            errors.push_back({pc, "executes .rodata, which starts at " + fhex(code_end, 2)});
+            continue;
+        }
+        if (inst->op == Mnemonic::Unknown) {
+            errors.push_back({pc, "unknown instruction 0x" + fhex(text[pc], 2)
+                                  + (size_t(pc) + 1 < text.size() ? " 0x" + fhex(text[pc + 1], 2) : std::string())});
+            continue;
+        }
+        if (size_t(pc) + inst->size > text.size())
+            errors.push_back({pc, name + " straddles the end of text"});
+        for (size_t p = size_t(pc) + 1; p < std::min<size_t>(size_t(pc) + inst->size, 256); p++)
+            if (reachable.count(p))
+                errors.push_back({(uint8_t)p, "reached inside " + name + " at " + fhex(pc, 2)});
+
+        // the index may move a ROM load anywhere in text, only the table is checked
+        if (is_rom_load(inst->op) and inst->imm >= text.size())
+            errors.push_back({pc, name + " reads table at " + fhex(inst->imm, 2) + " outside text of "
+                                  + std::to_string(text.size()) + " bytes"});
+
+        // LOAD_IND/STORE_IND take the word modulo 32 and need no check
+        auto regs = encoded_registers(*inst);
+        if (words < 32 and (regs >> words)) {
+            int word = 31 - __builtin_clz(regs);
+            errors.push_back({pc, name + " uses word " + std::to_string(word) + ", program RAM has "
+                                  + std::to_string(words) + " words"});
+        }
+    }
+
+    std::stable_sort(errors.begin(), errors.end(), [] (auto& a, auto& b) { return a.pc < b.pc; });
+    return errors;
+}
+
+
+VerifiedImage VerifiedImage::load(const NVMAObject& obj)
+{
+    auto errors = verify_program(obj);
+    if (errors.size()) {
+        std::string message = "Program rejected by verifier:";
+        for (auto& e : errors)
+            message += "\n  " + fhex(e.pc, 2) + ": " + e.message;
+        throw std::runtime_error(message);
+    }
+
+    VerifiedImage image;
+    image.code.fill(0xFF);
+    std::copy(obj.text.data.begin(), obj.text.data.end(), image.code.begin());
+    image.text_size = obj.text.data.size();
+    return image;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "runtime_compiler.hpp"
+
+
+
+
+/*
+Проверка программы при загрузке, после нее движок исполняет text без проверок pc.
+
+По всем достижимым с pc 0 и с точек входа собранной линкером программы (entry_points)
+инструкциям (граф потока управления из analysis, цели PC_SWP - через распространение
+констант) проверяется:
+```
+> команда известна: все заголовки заняты, отвергаются неизвестные подкоды PACK (0xFC),
+>   0xFD (есть только LOAD_IND/STORE_IND) и 0xFE (есть только LOAD_ROMB/H/W)
+> инструкция целиком лежит в text, pc = размер text допустим - это HALT дополнения
+> цели переходов не попадают внутрь другой достижимой инструкции
+> цель каждого PC_SWP известна
+> номера слов операндов (и lr) меньше объявленного размера ram программы
+> исполнение не доходит до .rodata, таблица LOAD_ROMB/H/W начинается внутри text
+> точки входа лежат в коде, а не в .rodata
+```
+Слово LOAD_IND/STORE_IND берется по модулю 32 и всегда лежит в ram из 32 слов,
+проверяется только слово указателя.
+Проверенный text копируется в выровненный буфер 256 + padding байт, дополненный
+HALT, так что чтения операндов не выходят за буфер при любом pc.
+*/
+
+
+struct VerifyError
+{
+    uint8_t pc;
+    std::string message;
+};
+
+
+// empty when the program passes
+std::vector<VerifyError> verify_program(const NVMAObject& obj);
+
+
+struct VerifiedImage
+{
+    static constexpr size_t padding = 4;
+
+    alignas(64) std::array<uint8_t, 256 + padding> code;
+    uint16_t text_size = 0;
+
+    // throws std::runtime_error with every diagnostic if the program is rejected
+    static VerifiedImage load(const NVMAObject& obj);
+};
@@ -2,15 +2,98 @@
 
 #include <stdint.h>
 
+#include <stdexcept>
+#include <string>
 
 
-void execute(uint32_t* ram,
+
+
+/*
+Движок параметризован типом слова ram: uint16_t, uint32_t или uint64_t.
+Кодировка команд от ширины не зависит, один и тот же text исполняется с
+любой шириной, меняется только арифметика: переполнение, сдвиги, сравнение
+JL, число полос упакованных операций. Ширина программы задается в объекте
+(NVMAObject::width), dispatch_width выбирает специализацию по ней.
+*/
+
+
+template <typename Word>
+struct VmWord
+{
+    static_assert(sizeof(Word) == 2 or sizeof(Word) == 4 or sizeof(Word) == 8,
+                  "word must be uint16_t, uint32_t or uint64_t");
+
+    static constexpr uint8_t bits = sizeof(Word) * 8;
+
+    // host procedure for CALL; the type is not deduced, so nullptr and lambdas can be passed
+    using Proc = Word (*)(Word proc_id, Word arg);
+};
+
+
+// calls fn(Word{}) with the word type of width bits
+template <typename Fn>
+decltype(auto) dispatch_width(unsigned width, Fn&& fn)
+{
+    switch (width)
+    {
+    case 16: return fn(uint16_t{});
+    case 32: return fn(uint32_t{});
+    case 64: return fn(uint64_t{});
+    }
+    throw std::runtime_error("Unsupported word width " + std::to_string(width));
+}
+
+
+
+template <typename Word>
+void execute(Word* ram,
              const void* text,
              uint8_t start,
-             uint32_t (*proc)(uint32_t, uint32_t),
+             typename VmWord<Word>::Proc proc,
              uint8_t* exec_flag);
 
-bool execute_one(uint32_t* ram,
+template <typename Word>
+bool execute_one(Word* ram,
                  const uint8_t* code,
                  uint8_t& pc,
-                 uint32_t (*proc)(uint32_t proc_id, uint32_t arg));
+                 typename VmWord<Word>::Proc proc);
+
+// Executes at most max_steps instructions, steps - how many were executed
+// (HALT is not counted). Returns false after HALT.
+template <typename Word>
+bool execute_bounded(Word* ram,
+                     const uint8_t* code,
+                     uint8_t& pc,
+                     typename VmWord<Word>::Proc proc,
+                     uint32_t max_steps,
+                     uint32_t& steps);
+
+
+
+enum class ExecStatus : uint8_t {
+    Halted,
+    Call,   // stopped after CALL, result must be written to ram[call.result]
+    Yield,  // max_steps instructions executed
+};
+
+template <typename Word>
+struct BasicPendingCall
+{
+    Word proc_id;
+    Word arg;
+    uint8_t result;
+};
+
+using PendingCall = BasicPendingCall<uint32_t>;
+
+// Runs until HALT or CALL, pc is left after the CALL so execution can be resumed
+// with the same function once ram[call.result] holds the result.
+template <typename Word>
+ExecStatus execute_until_call(Word* ram,
+                              const uint8_t* code,
+                              uint8_t& pc,
+                              BasicPendingCall<Word>& call,
+                              uint32_t max_steps);
+
+// all functions are instantiated in exec.cpp for uint16_t, uint32_t and uint64_t
+
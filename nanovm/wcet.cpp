@@ -0,0 +1,91 @@
+#include <cstring>
+#include <iostream>
+
+#include "bounds.hpp"
+#include "runtime_compiler.hpp"
+#include "utils.hpp"
+
+
+
+
+struct Arguments
+{
+    std::string source;
+    std::string binary;
+    std::string bindings;
+};
+
+
+Arguments parse_args(int argc, char* argv[])
+{
+    Arguments args;
+    auto proc = [&] (char opt, const std::string& value)
+    {
+        switch (opt) {
+        case 'i':
+            args.source = value;
+            break;
+
+        case 'b':
+            args.binary = value;
+            break;
+
+        case 'I':
+            args.bindings = value;
+            break;
+        }
+    };
+
+    parse_args("i:b:I:", argc, argv, proc);
+
+    return args;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try {
+        auto args = parse_args(argc, argv);
+
+        NVMAObject obj;
+        if (args.source.size())
+            obj = compile(load_file(args.source));
+        else if (args.binary.size())
+            obj = parse_nvma_object(load_file(args.binary));
+        else
+            throw std::runtime_error("Must be specified -i <source> or -b <binary>");
+
+        auto result = analyze_wcet(obj);
+
+        for (auto& loop : result.loops) {
+            std::cout << "loop " << fhex(loop.header, 2) << ": ";
+            if (loop.bounded)
+                std::cout << "iterations <= " << loop.iterations.str() << " (counter " << loop.counter << ")" << std::endl;
+            else
+                std::cout << "unbounded, " << loop.reason << std::endl;
+        }
+
+        if (not result.bounded) {
+            std::cout << "unbounded: " << result.reason << " (pc " << fhex(result.offending_pc, 2) << ")" << std::endl;
+            return 2;
+        }
+        std::cout << "instructions <= " << result.instructions.str() << std::endl;
+
+        if (args.bindings.size()) {
+            parse_sections_file(obj, load_file(args.bindings));
+            std::map<std::string, uint64_t> values;
+            for (auto& [word, name] : input_variables(obj)) {
+                uint32_t value = 0;
+                if ((word + 1) * 4 <= obj.ram.data.size())
+                    std::memcpy(&value, obj.ram.data.data() + word * 4, 4);
+                values[name] = value;
+            }
+            std::cout << "instructions <= " << result.instructions.evaluate(values) << " for " << args.bindings << std::endl;
+        }
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+}